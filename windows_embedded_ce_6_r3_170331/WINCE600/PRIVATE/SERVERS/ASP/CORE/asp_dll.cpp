@@ -58,18 +58,27 @@ BOOL WINAPI DllMain(HANDLE hInstance, DWORD dwReason, LPVOID /*lpReserved*/)
 		    	return FALSE;
 
 		    g_pScriptSite->AddRef();   
+
+			if (NULL == (g_pASPCache = new CASPCache())) {
+				g_pScriptSite->Release();
+				g_pScriptSite = NULL;
+				TlsFree(g_dwTlsSlot);
+				return FALSE;
+			}
     	}
     	break;
     	
     	case DLL_PROCESS_DETACH:
     	{
 			DEBUGMSG(ZONE_INIT,(L"ASP.dll:  Detaching from process\r\n"));
-    		if (g_pScriptSite)
-    			g_pScriptSite->Release();
+			if (g_pScriptSite)
+				g_pScriptSite->Release();
 
+			if (g_pASPCache)
+				delete g_pASPCache;
 
 			TlsFree(g_dwTlsSlot);
-    	    _Module.Term();
+			_Module.Term();
     	}
     	break;
     }
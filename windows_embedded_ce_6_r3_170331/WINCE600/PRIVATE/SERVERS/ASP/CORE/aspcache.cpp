@@ -0,0 +1,274 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+/*--
+Module Name: aspcache.cpp
+Abstract: Cache of converted ASP pages
+
+          Reading a page and its include files, handling the preproc
+          directives and converting it to script is done on every request
+          otherwise.  The cache keeps the result per physical file and
+          reuses it as long as the last write time and size of the page and
+          of every include file it was built from are unchanged.
+--*/
+
+#include "aspmain.h"
+
+CASPCache *g_pASPCache;
+
+
+CASPCacheEntry::CASPCacheEntry()
+{
+	ZEROMEM(this);
+	m_cRef = 1;
+}
+
+CASPCacheEntry::~CASPCacheEntry()
+{
+	int i;
+
+	DEBUGCHK(! m_fInCache);
+
+	if (m_pIncludes)
+	{
+		for (i = 0; i < m_nIncludes; i++)
+		{
+			MyFree(m_pIncludes[i].m_wszFileName);
+			MyFree(m_pIncludes[i].m_pszFileName);
+		}
+		MyFree(m_pIncludes);
+	}
+	MyFree(m_wszFileName);
+	MyFree(m_pszData);
+	MyFree(m_wszScript);
+}
+
+
+CASPCache::CASPCache()
+{
+	InitializeCriticalSection(&m_cs);
+	memset(m_rgHash, 0, sizeof(m_rgHash));
+	m_pNewest = m_pOldest = NULL;
+	m_cEntries = 0;
+	m_cbMem = 0;
+	m_cHits = m_cMisses = m_cEvictions = 0;
+}
+
+CASPCache::~CASPCache()
+{
+	Flush();
+	DeleteCriticalSection(&m_cs);
+}
+
+
+// File names are compared case insensitive, like the file system does.
+DWORD CASPCache::Hash(PCWSTR wszFileName)
+{
+	DWORD dwHash = 0;
+
+	while (*wszFileName)
+		dwHash = dwHash * 31 + towlower(*wszFileName++);
+
+	return dwHash;
+}
+
+
+//  Checks the page and its include files against the disk.
+BOOL CASPCache::IsCurrent(CASPCacheEntry *pEntry)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	int i;
+
+	if (! GetFileAttributesEx(pEntry->m_wszFileName, GetFileExInfoStandard, &fad) ||
+	    fad.nFileSizeLow != pEntry->m_dwFileSize ||
+	    0 != CompareFileTime(&fad.ftLastWriteTime, &pEntry->m_ftLastWrite))
+	{
+		return FALSE;
+	}
+
+	for (i = 0; i < pEntry->m_nIncludes; i++)
+	{
+		if (! GetFileAttributesEx(pEntry->m_pIncludes[i].m_wszFileName, GetFileExInfoStandard, &fad) ||
+		    fad.nFileSizeLow != pEntry->m_pIncludes[i].m_dwFileSize ||
+		    0 != CompareFileTime(&fad.ftLastWriteTime, &pEntry->m_pIncludes[i].m_ftLastWrite))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+
+//  Takes the entry out of the hash table and LRU list and drops the cache's
+//  reference.  Must be called with m_cs held.
+void CASPCache::Unlink(CASPCacheEntry *pEntry)
+{
+	CASPCacheEntry **ppTrav;
+
+	DEBUGCHK(pEntry->m_fInCache);
+
+	for (ppTrav = &m_rgHash[pEntry->m_dwHash % ASP_CACHE_HASH_SIZE]; *ppTrav != pEntry; ppTrav = &(*ppTrav)->m_pNextHash)
+		DEBUGCHK(*ppTrav);
+	*ppTrav = pEntry->m_pNextHash;
+
+	if (pEntry->m_pNewer)
+		pEntry->m_pNewer->m_pOlder = pEntry->m_pOlder;
+	else
+		m_pNewest = pEntry->m_pOlder;
+
+	if (pEntry->m_pOlder)
+		pEntry->m_pOlder->m_pNewer = pEntry->m_pNewer;
+	else
+		m_pOldest = pEntry->m_pNewer;
+
+	m_cEntries--;
+	m_cbMem -= pEntry->m_cbMem;
+	pEntry->m_fInCache = FALSE;
+	pEntry->Release();
+}
+
+
+//  Returns a referenced entry for the page if there is a current one, NULL
+//  otherwise.  The caller calls Release() when done with it.
+CASPCacheEntry *CASPCache::Lookup(PASP_CONTROL_BLOCK pACB)
+{
+	CASPCacheEntry *pEntry;
+	DWORD dwHash = Hash(pACB->wszFileName);
+
+	EnterCriticalSection(&m_cs);
+	for (pEntry = m_rgHash[dwHash % ASP_CACHE_HASH_SIZE]; pEntry; pEntry = pEntry->m_pNextHash)
+	{
+		if (pEntry->m_dwHash == dwHash &&
+		    pEntry->m_scriptLangDefault == pACB->scriptLang &&
+		    pEntry->m_lCodePageDefault == pACB->lCodePage &&
+		    pEntry->m_lcidDefault == pACB->lcid &&
+		    0 == _wcsicmp(pEntry->m_wszFileName, pACB->wszFileName))
+		{
+			pEntry->AddRef();
+			break;
+		}
+	}
+	LeaveCriticalSection(&m_cs);
+
+	if (NULL == pEntry)
+	{
+		InterlockedIncrement(&m_cMisses);
+		return NULL;
+	}
+
+	// Don't hold the lock across file system calls.
+	if (! IsCurrent(pEntry))
+	{
+		DEBUGMSG(ZONE_CACHE,(L"ASP: cached copy of %s is out of date\r\n",pACB->wszFileName));
+
+		EnterCriticalSection(&m_cs);
+		if (pEntry->m_fInCache)
+			Unlink(pEntry);
+		LeaveCriticalSection(&m_cs);
+
+		pEntry->Release();
+		InterlockedIncrement(&m_cMisses);
+		return NULL;
+	}
+
+	// Move to the newest end of the LRU list
+	EnterCriticalSection(&m_cs);
+	if (pEntry->m_fInCache && pEntry != m_pNewest)
+	{
+		pEntry->m_pNewer->m_pOlder = pEntry->m_pOlder;
+		if (pEntry->m_pOlder)
+			pEntry->m_pOlder->m_pNewer = pEntry->m_pNewer;
+		else
+			m_pOldest = pEntry->m_pNewer;
+
+		pEntry->m_pOlder = m_pNewest;
+		pEntry->m_pNewer = NULL;
+		m_pNewest->m_pNewer = pEntry;
+		m_pNewest = pEntry;
+	}
+	LeaveCriticalSection(&m_cs);
+
+	InterlockedIncrement(&m_cHits);
+	return pEntry;
+}
+
+
+//  Adds a newly converted page, replacing any older copy and evicting the
+//  least recently used pages to stay within the limits.  The cache takes
+//  over the caller's reference.
+void CASPCache::Insert(CASPCacheEntry *pEntry)
+{
+	CASPCacheEntry *pTrav;
+
+	if (pEntry->m_cbMem > ASP_CACHE_MAX_ENTRY_BYTES)
+	{
+		DEBUGMSG(ZONE_CACHE,(L"ASP: %s is too large to cache (%d bytes)\r\n",pEntry->m_wszFileName,pEntry->m_cbMem));
+		pEntry->Release();
+		return;
+	}
+
+	pEntry->m_dwHash = Hash(pEntry->m_wszFileName);
+
+	EnterCriticalSection(&m_cs);
+
+	for (pTrav = m_rgHash[pEntry->m_dwHash % ASP_CACHE_HASH_SIZE]; pTrav; pTrav = pTrav->m_pNextHash)
+	{
+		if (pTrav->m_dwHash == pEntry->m_dwHash &&
+		    pTrav->m_scriptLangDefault == pEntry->m_scriptLangDefault &&
+		    pTrav->m_lCodePageDefault == pEntry->m_lCodePageDefault &&
+		    pTrav->m_lcidDefault == pEntry->m_lcidDefault &&
+		    0 == _wcsicmp(pTrav->m_wszFileName, pEntry->m_wszFileName))
+		{
+			Unlink(pTrav);
+			break;
+		}
+	}
+
+	while (m_pOldest && (m_cEntries >= ASP_CACHE_MAX_ENTRIES ||
+	                     m_cbMem + pEntry->m_cbMem > ASP_CACHE_MAX_BYTES))
+	{
+		DEBUGMSG(ZONE_CACHE,(L"ASP: evicting %s from cache\r\n",m_pOldest->m_wszFileName));
+		Unlink(m_pOldest);
+		m_cEvictions++;
+	}
+
+	pEntry->m_pNextHash = m_rgHash[pEntry->m_dwHash % ASP_CACHE_HASH_SIZE];
+	m_rgHash[pEntry->m_dwHash % ASP_CACHE_HASH_SIZE] = pEntry;
+
+	pEntry->m_pOlder = m_pNewest;
+	pEntry->m_pNewer = NULL;
+	if (m_pNewest)
+		m_pNewest->m_pNewer = pEntry;
+	else
+		m_pOldest = pEntry;
+	m_pNewest = pEntry;
+
+	m_cEntries++;
+	m_cbMem += pEntry->m_cbMem;
+	pEntry->m_fInCache = TRUE;
+
+	LeaveCriticalSection(&m_cs);
+}
+
+
+void CASPCache::Flush()
+{
+	EnterCriticalSection(&m_cs);
+
+	DEBUGMSG(ZONE_CACHE,(L"ASP: flushing cache, %d entries, %d bytes, hits = %d, misses = %d, evictions = %d\r\n",
+	                     m_cEntries, m_cbMem, m_cHits, m_cMisses, m_cEvictions));
+
+	while (m_pOldest)
+		Unlink(m_pOldest);
+
+	LeaveCriticalSection(&m_cs);
+}
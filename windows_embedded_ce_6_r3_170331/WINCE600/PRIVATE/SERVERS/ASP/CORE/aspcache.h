@@ -0,0 +1,116 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+/*--
+Module Name: aspcache.h
+Abstract: Cache of converted ASP pages
+--*/
+
+#ifndef _ASPCACHE_H_
+#define _ASPCACHE_H_
+
+#define ASP_CACHE_HASH_SIZE         64
+#define ASP_CACHE_MAX_ENTRIES       64
+#define ASP_CACHE_MAX_BYTES         (1024*1024)   // all entries together
+#define ASP_CACHE_MAX_ENTRY_BYTES   (128*1024)    // larger pages aren't cached
+
+// An include file the page was built from, kept to check it hasn't changed
+// and to map script error lines back to it.
+typedef struct
+{
+	PWSTR    m_wszFileName;		// physical path
+	FILETIME m_ftLastWrite;
+	DWORD    m_dwFileSize;
+	PSTR     m_pszFileName;		// name as written in the #include
+	int      m_iStartLine;
+	int      m_cLines;
+} ASP_CACHE_INCLUDE;
+
+
+//  A converted page.  Entries are read only once they are in the cache and
+//  are reference counted, so a request can keep using one after it has been
+//  replaced or evicted.
+class CASPCacheEntry
+{
+friend class CASPCache;
+
+private:
+	CASPCacheEntry *m_pNextHash;
+	CASPCacheEntry *m_pNewer;		// LRU list
+	CASPCacheEntry *m_pOlder;
+	DWORD m_dwHash;
+	LONG  m_cRef;
+	BOOL  m_fInCache;
+
+public:
+	// Key.  The httpd defaults are part of it since a page without
+	// <%@ directives is converted with them.
+	PWSTR       m_wszFileName;
+	SCRIPT_LANG m_scriptLangDefault;
+	UINT        m_lCodePageDefault;
+	LCID        m_lcidDefault;
+
+	// Validation
+	FILETIME    m_ftLastWrite;
+	DWORD       m_dwFileSize;
+	int         m_nIncludes;
+	ASP_CACHE_INCLUDE *m_pIncludes;
+
+	// Conversion results
+	BOOL        m_fPlainText;		// no <% in page, m_pszData is the page
+	SCRIPT_LANG m_scriptLang;
+	UINT        m_lCodePage;
+	LCID        m_lcid;
+	PSTR        m_pszData;			// page text or converted script
+	int         m_cbData;
+	PWSTR       m_wszScript;		// script as handed to the script engine
+	UINT        m_cchScript;
+	DWORD       m_cbMem;			// charged against ASP_CACHE_MAX_BYTES
+
+	CASPCacheEntry();
+	~CASPCacheEntry();
+
+	void AddRef()   { InterlockedIncrement(&m_cRef); }
+	void Release()  { if (0 == InterlockedDecrement(&m_cRef)) delete this; }
+};
+
+
+class CASPCache
+{
+private:
+	CRITICAL_SECTION m_cs;
+	CASPCacheEntry *m_rgHash[ASP_CACHE_HASH_SIZE];
+	CASPCacheEntry *m_pNewest;
+	CASPCacheEntry *m_pOldest;
+	int   m_cEntries;
+	DWORD m_cbMem;
+
+	LONG  m_cHits;
+	LONG  m_cMisses;
+	LONG  m_cEvictions;
+
+	static DWORD Hash(PCWSTR wszFileName);
+	static BOOL  IsCurrent(CASPCacheEntry *pEntry);
+	void Unlink(CASPCacheEntry *pEntry);
+
+public:
+	CASPCache();
+	~CASPCache();
+
+	CASPCacheEntry *Lookup(PASP_CONTROL_BLOCK pACB);
+	void Insert(CASPCacheEntry *pEntry);
+	void Flush();
+};
+
+extern CASPCache *g_pASPCache;
+
+#endif
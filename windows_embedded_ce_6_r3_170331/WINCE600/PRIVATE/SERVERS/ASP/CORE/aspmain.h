@@ -122,6 +122,7 @@ int GetLineNumber(PSTR pszStart, PSTR pszEnd);
   #define ZONE_DICT     DEBUGZONE(6)
   #define ZONE_MEM      DEBUGZONE(7)
   #define ZONE_PARSER   DEBUGZONE(8)
+  #define ZONE_CACHE    DEBUGZONE(9)
 #endif
 
 
@@ -151,6 +152,7 @@ int GetLineNumber(PSTR pszStart, PSTR pszEnd);
 #include "scrsite.h"
 #include "asp.h"
 #include "script.h"
+#include "aspcache.h"
 #include "server.h"
 #include "response.h"
 #include "request.h"
@@ -44,7 +44,7 @@ const char cszKeepAliveText[]  = "keep-alive\r\nContent-Length: %d"; // called w
     TEXT("ASP"), {
     TEXT("Error"),TEXT("Init"),TEXT("Script"),TEXT("Server"),
     TEXT("Request"),TEXT("Response"),TEXT("RequestDict"),
-    TEXT("Mem"),TEXT(""),TEXT(""),TEXT(""),
+    TEXT("Mem"),TEXT(""),TEXT("Cache"),TEXT(""),
     TEXT(""),TEXT(""),TEXT(""),TEXT(""),TEXT("") },
     0x0001
   }; 
@@ -72,6 +72,9 @@ int g_dwPerfCounter;
 //  for ASP.
 void TerminateASP()
 {
+	if (g_pASPCache)
+		g_pASPCache->Flush();
+
 	DEBUGMSG(ZONE_INIT,(L"ASP:  Calling CoFreeUnusedLibraries()\r\n"));
 	CoInitializeEx(NULL,COINIT_MULTITHREADED);
 	CoFreeUnusedLibraries();
@@ -165,10 +168,16 @@ CASPState::~CASPState()
 	if (m_pIncludeInfo)
 	{
 		for (; m_pIncludeInfo[i].m_pszFileName != NULL && i < MAX_INCLUDE_FILES; i++)
+		{
 			MyFree(m_pIncludeInfo[i].m_pszFileName);
+			MyFree(m_pIncludeInfo[i].m_wszFileName);
+		}
 		MyFree(m_pIncludeInfo);
 	}
 
+	if (m_pCacheEntry)
+		m_pCacheEntry->Release();
+
 	//  Delete the objects used through the script
 	//  Later --> move empty string to global?
 	if (m_pEmptyString)
@@ -214,26 +223,49 @@ DWORD CASPState::Main()
 	DEBUG_CODE_INIT;
 	DWORD ret = HSE_STATUS_SUCCESS;		// we only return HSE_STATUS_ERROR if there's an Access Violation in ASP
 	DWORD dwFileSize = 0;
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	BOOL fCacheable = FALSE;
+	BOOL fPlainText;
 
-	if (! svsutil_OpenAndReadFile(m_pACB->wszFileName,(DWORD *) &m_cbFileData, &m_pszFileData))
-		myleave(11);
+	//  Use the converted page from an earlier request if the page and its
+	//  include files haven't changed since.
+	if (g_pASPCache && NULL != (m_pCacheEntry = g_pASPCache->Lookup(m_pACB)))
+	{
+		if (! LoadFromCache())
+			myleave(17);
 
-	//  Read include files and Preproc dirictives if extended parse component included
-	if (c_fUseExtendedParse)
+		fPlainText = m_pCacheEntry->m_fPlainText;
+	}
+	else
 	{
-		if (! ParseIncludes() )
-			myleave(12);
-			
-		if (! ParseProcDirectives() )
-			myleave(13);
+		// Get the timestamp before reading so a change made while we convert
+		// the page shows up as out of date on the next request.
+		fCacheable = (g_pASPCache && GetFileAttributesEx(m_pACB->wszFileName, GetFileExInfoStandard, &fad));
+
+		if (! svsutil_OpenAndReadFile(m_pACB->wszFileName,(DWORD *) &m_cbFileData, &m_pszFileData))
+			myleave(11);
+
+		//  Read include files and Preproc dirictives if extended parse component included
+		if (c_fUseExtendedParse)
+		{
+			if (! ParseIncludes() )
+				myleave(12);
+				
+			if (! ParseProcDirectives() )
+				myleave(13);
+		}
+
+		fPlainText = (NULL == MyStrStr(m_pszFileData,BEGIN_COMMAND));
 	}
 
 	// This is a plain old text file, no ASP commands
 	// Send it to client without further processing
 	// For ASP pages that have no script commands, this speeds up processing immensly.
-	if (NULL == MyStrStr(m_pszFileData,BEGIN_COMMAND))
+	if (fPlainText)
 	{
 		CHAR szBuf[256];
+		PSTR pszBody = m_pCacheEntry ? m_pCacheEntry->m_pszData : m_pszFileData;
+		DWORD cbBody = m_pCacheEntry ? m_pCacheEntry->m_cbData : m_cbFileData;
 
 		strcpy(szBuf,cszContentTextHTML);
 		int i = SVSUTIL_CONSTSTRLEN(cszContentTextHTML);
@@ -242,7 +274,7 @@ DWORD CASPState::Main()
 
 		if (m_fServerUsingKeepAlives)
 		{
-			i += sprintf(szBuf+i,cszKeepAlive,m_cbFileData);
+			i += sprintf(szBuf+i,cszKeepAlive,cbBody);
 			m_fKeepAlive = TRUE;
 		}
 
@@ -252,12 +284,21 @@ DWORD CASPState::Main()
 
 		m_fSentHeaders = TRUE;
 		m_pACB->ServerSupportFunction(m_pACB->ConnID,HSE_REQ_SEND_RESPONSE_HEADER, 0, 0, (DWORD*) szBuf);
-		m_pACB->WriteClient(m_pACB->ConnID,(LPVOID) m_pszFileData,(LPDWORD) &m_cbFileData, 0);
+		m_pACB->WriteClient(m_pACB->ConnID,(LPVOID) pszBody,&cbBody, 0);
+
+		if (fCacheable)
+			AddToCache(&fad, TRUE);
 		goto done;		// we're done processing
 	}
 
-	if (! ConvertToScript())
-		myleave(14);
+	if (NULL == m_pCacheEntry)
+	{
+		if (! ConvertToScript())
+			myleave(14);
+
+		if (fCacheable)
+			AddToCache(&fad, FALSE);
+	}
 
 	if (c_fUseCollections)
 	{
@@ -288,6 +329,157 @@ done:
 }
 
 
+//  Sets up the parse results from the cached conversion of the page.  The
+//  script text is copied since it belongs to this request (error reporting
+//  may write into it), a plain text page is sent straight from the entry.
+BOOL CASPState::LoadFromCache()
+{
+	DEBUG_CODE_INIT;
+	BOOL ret = FALSE;
+	CASPCacheEntry *pEntry = m_pCacheEntry;
+	int i;
+
+	m_scriptLang = pEntry->m_scriptLang;
+	m_lCodePage  = pEntry->m_lCodePage;
+	m_lcid       = pEntry->m_lcid;
+
+	if (pEntry->m_fPlainText)
+	{
+		ret = TRUE;
+		myleave(0);
+	}
+
+	// Include file line info, used to report script errors against the right file
+	if (pEntry->m_nIncludes)
+	{
+		if (NULL == (m_pIncludeInfo = MyRgAllocZ(INCLUDE_INFO, MAX_INCLUDE_FILES)))
+			myleave(80);
+
+		for (i = 0; i < pEntry->m_nIncludes; i++)
+		{
+			if (NULL == (m_pIncludeInfo[i].m_pszFileName = MySzDupA(pEntry->m_pIncludes[i].m_pszFileName)))
+				myleave(81);
+
+			m_pIncludeInfo[i].m_iStartLine = pEntry->m_pIncludes[i].m_iStartLine;
+			m_pIncludeInfo[i].m_cLines     = pEntry->m_pIncludes[i].m_cLines;
+		}
+	}
+
+	if (NULL == (m_pszScriptData = MySzDupA(pEntry->m_pszData, pEntry->m_cbData)))
+		myleave(82);
+	m_cbScriptData = pEntry->m_cbData;
+
+	if (NULL == (m_bstrScriptData = SysAllocStringLen(pEntry->m_wszScript, pEntry->m_cchScript)))
+		myleave(83);
+
+	ret = TRUE;
+done:
+	DEBUGMSG_ERR(ZONE_ERROR,(L"ASP: LoadFromCache failed, err = %d\r\n",err));
+
+	if (FALSE == ret)
+	{
+		m_aspErr = IDS_E_NOMEM;
+		ServerError();
+	}
+	return ret;
+}
+
+
+//  Saves the conversion of this page for later requests.  Not being able
+//  to cache it isn't an error, the request itself was handled already.
+void CASPState::AddToCache(WIN32_FILE_ATTRIBUTE_DATA *pfad, BOOL fPlainText)
+{
+	DEBUG_CODE_INIT;
+	BOOL ret = FALSE;
+	CASPCacheEntry *pEntry = NULL;
+	ASP_CACHE_INCLUDE *pInc;
+	int nIncludes = 0;
+	int i;
+
+	if (m_pIncludeInfo)
+	{
+		for (; nIncludes < MAX_INCLUDE_FILES && m_pIncludeInfo[nIncludes].m_pszFileName; nIncludes++)
+		{
+			// Without the physical path we can't tell later if it changed
+			if (NULL == m_pIncludeInfo[nIncludes].m_wszFileName)
+				myleave(90);
+		}
+	}
+
+	if (NULL == (pEntry = new CASPCacheEntry()))
+		myleave(91);
+
+	pEntry->m_scriptLangDefault = m_pACB->scriptLang;
+	pEntry->m_lCodePageDefault  = m_pACB->lCodePage;
+	pEntry->m_lcidDefault       = m_pACB->lcid;
+	pEntry->m_ftLastWrite       = pfad->ftLastWriteTime;
+	pEntry->m_dwFileSize        = pfad->nFileSizeLow;
+	pEntry->m_fPlainText        = fPlainText;
+	pEntry->m_scriptLang        = m_scriptLang;
+	pEntry->m_lCodePage         = m_lCodePage;
+	pEntry->m_lcid              = m_lcid;
+
+	if (NULL == (pEntry->m_wszFileName = MySzDupW(m_pACB->wszFileName)))
+		myleave(92);
+
+	if (fPlainText)
+	{
+		// The page has been sent, the entry can have the buffer
+		pEntry->m_pszData = m_pszFileData;
+		pEntry->m_cbData  = m_cbFileData;
+		m_pszFileData = NULL;
+	}
+	else
+	{
+		if (NULL == (pEntry->m_pszData = MySzDupA(m_pszScriptData, m_cbScriptData)))
+			myleave(93);
+		pEntry->m_cbData = m_cbScriptData;
+
+		pEntry->m_cchScript = SysStringLen(m_bstrScriptData);
+		if (NULL == (pEntry->m_wszScript = MySzDupW(m_bstrScriptData, pEntry->m_cchScript)))
+			myleave(94);
+	}
+
+	if (nIncludes)
+	{
+		if (NULL == (pEntry->m_pIncludes = MyRgAllocZ(ASP_CACHE_INCLUDE, nIncludes)))
+			myleave(95);
+		pEntry->m_nIncludes = nIncludes;
+
+		for (i = 0; i < nIncludes; i++)
+		{
+			pInc = &pEntry->m_pIncludes[i];
+
+			if (NULL == (pInc->m_wszFileName = MySzDupW(m_pIncludeInfo[i].m_wszFileName)) ||
+			    NULL == (pInc->m_pszFileName = MySzDupA(m_pIncludeInfo[i].m_pszFileName)))
+				myleave(96);
+
+			pInc->m_ftLastWrite = m_pIncludeInfo[i].m_ftLastWrite;
+			pInc->m_dwFileSize  = m_pIncludeInfo[i].m_dwFileSize;
+			pInc->m_iStartLine  = m_pIncludeInfo[i].m_iStartLine;
+			pInc->m_cLines      = m_pIncludeInfo[i].m_cLines;
+
+			pEntry->m_cbMem += sizeof(WCHAR) * (wcslen(pInc->m_wszFileName) + 1) +
+			                   strlen(pInc->m_pszFileName) + 1;
+		}
+	}
+
+	pEntry->m_cbMem += sizeof(CASPCacheEntry) + nIncludes * sizeof(ASP_CACHE_INCLUDE) +
+	                   sizeof(WCHAR) * (wcslen(pEntry->m_wszFileName) + 1) +
+	                   pEntry->m_cbData + 1 + sizeof(WCHAR) * pEntry->m_cchScript;
+
+	g_pASPCache->Insert(pEntry);
+	pEntry = NULL;
+
+	ret = TRUE;
+done:
+	DEBUGMSG_ERR(ZONE_CACHE,(L"ASP: AddToCache failed, err = %d\r\n",err));
+
+	if (pEntry)
+		pEntry->Release();
+}
+
+
 // Inits IActiveScript related libs/vars
 BOOL CASPState::InitScript()
 {
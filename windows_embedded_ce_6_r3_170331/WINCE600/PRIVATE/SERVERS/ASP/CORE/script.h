@@ -28,8 +28,12 @@ typedef struct
 	PSTR m_pszEnd;			// where --> ends, where to start copying data after it.
 	DWORD m_dwFileSize;
 	HANDLE m_hFile;			// Handle to file
+	PWSTR m_wszFileName;	// Physical path, for the page cache
+	FILETIME m_ftLastWrite;
 } INCLUDE_INFO, *PINCLUDE_INFO;
 
+class CASPCacheEntry;
+
 class CASPState 
 {
 friend class CRequest;
@@ -98,6 +102,7 @@ private:
 	int m_cbScriptData;				// Size of script 
 	PSTR m_pszScriptData;			// orig script data, kept around in case of error
 	PINCLUDE_INFO m_pIncludeInfo;	// Holds include file names, line # info.
+	CASPCacheEntry *m_pCacheEntry;	// Cached conversion of this page, if any
 
 	BOOL ParseProcDirectives();		// Handles <%@
 	BOOL ParseProcDirectiveLine(PSTR pszTrav, PSTR pszSubEnd);
@@ -114,6 +119,9 @@ private:
 	void CopyPlainText(PSTR &pszRead, PSTR &pszWrite, PSTR pszSubEnd);
 	void CopyScriptText(PSTR &pszRead, PSTR &pszWrite, PSTR pszSubEnd);
 
+	BOOL LoadFromCache();
+	void AddToCache(WIN32_FILE_ATTRIBUTE_DATA *pfad, BOOL fPlainText);
+
 	BOOL InitScript();
 	BOOL RunScript();
 };
@@ -239,6 +239,11 @@ BOOL CASPState::FindIncludeFiles(int *pnFiles, int *pnNewChars, DWORD *pdwMaxFil
 		if (dwFileSize > dwMaxFileSize)
 			dwMaxFileSize = dwFileSize;
 
+		// Remember the physical file and its timestamp so the page cache can
+		// tell when it changes.  If either fails the page just isn't cached.
+		if (GetFileTime(m_pIncludeInfo[nFiles].m_hFile, NULL, NULL, &m_pIncludeInfo[nFiles].m_ftLastWrite))
+			m_pIncludeInfo[nFiles].m_wszFileName = MySzDupW(wszFileName);
+
 		// Put original char back in place
 		*pszSubEnd = '\"';
 
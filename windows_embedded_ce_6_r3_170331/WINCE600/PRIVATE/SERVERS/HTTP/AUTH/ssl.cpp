@@ -162,6 +162,9 @@ void CGlobalVariables::InitSSL(CReg *pWebsite) {
     SchannelCred.cCreds = 1;
     SchannelCred.paCred = &pCertContext;
 
+    // Schannel keeps the session cache for abbreviated handshakes itself, 0 uses its default lifespan.
+    SchannelCred.dwSessionLifespan = reg.ValueDW(RV_SSL_SESSION_LIFESPAN,0);
+
     dwErr = m_SecurityInterface.AcquireCredentialsHandle(
                                     NULL,                 // Name of principal
                                     UNISP_NAME,           // Name of package
@@ -315,6 +318,8 @@ void CHttpRequest::CloseSSLSession() {
 done:
     if (m_SSLInfo.m_fHasCtxt)
         g_pVars->m_SecurityInterface.DeleteSecurityContext(&m_SSLInfo.m_hcred);
+
+    MyFree(m_SSLInfo.m_pszRecordBuf);
 }
 
 
@@ -633,6 +638,13 @@ BOOL CHttpRequest::HandleSSLHandShake(BOOL fRenegotiate, BYTE *pInitialData, DWO
             if (scRet != SEC_E_OK)
                 return FALSE;
 
+            // Sizes can change on renegotiate, so (re)allocate the record buffer here.
+            // If this fails SendEncryptedData encrypts each write as it comes.
+            DEBUGCHK(0 == m_SSLInfo.m_cbRecordData);
+            MyFree(m_SSLInfo.m_pszRecordBuf);
+            m_SSLInfo.m_pszRecordBuf = MyRgAllocNZ(CHAR,m_SSLInfo.m_Sizes.cbHeader + m_SSLInfo.m_Sizes.cbMaximumMessage + m_SSLInfo.m_Sizes.cbTrailer);
+            m_SSLInfo.m_cbRecordData = 0;
+
                 //
                 // retrieve CBT info 
                 //
@@ -985,6 +997,30 @@ BOOL CHttpRequest::SendEncryptedData(PSTR pszBuf, DWORD dwLen, BOOL fCopyBuffer)
 
     dwRemaining = dwLen;
 
+    // Gather the data into records in m_pszRecordBuf.  The caller's buffer is never
+    // encrypted in place this way, so fCopyBuffer doesn't matter here.
+    if (m_SSLInfo.m_pszRecordBuf) {
+        PSTR pszData = m_SSLInfo.m_pszRecordBuf + m_SSLInfo.m_Sizes.cbHeader;
+
+        while (dwRemaining) {
+            DWORD dwCopy = min(dwRemaining,m_SSLInfo.m_Sizes.cbMaximumMessage - m_SSLInfo.m_cbRecordData);
+
+            memcpy(pszData + m_SSLInfo.m_cbRecordData,pszBuf+dwOffset,dwCopy);
+            m_SSLInfo.m_cbRecordData += dwCopy;
+            dwOffset    += dwCopy;
+            dwRemaining -= dwCopy;
+
+            if (m_SSLInfo.m_cbRecordData == m_SSLInfo.m_Sizes.cbMaximumMessage && !SendEncryptedRecord())
+                myleave(1913);
+        }
+
+        if (!m_SSLInfo.m_fHoldRecord && !SendEncryptedRecord())
+            myleave(1914);
+
+        fRet = TRUE;
+        goto done;
+    }
+
     if (fCopyBuffer) {
         if (dwLen <= sizeof(szStaticBuf)) {
             pszSendBuf = szStaticBuf;
@@ -1032,6 +1068,68 @@ done:
     return fRet;
 }
 
+// Encrypts the data gathered in m_pszRecordBuf.  Header, data and trailer are
+// adjacent in the buffer, so the record is sent with a single send().
+BOOL CHttpRequest::SendEncryptedRecord(void) {
+    DEBUG_CODE_INIT;
+    BOOL            fRet = FALSE;
+    SecBuffer       Buffers[4];
+    SecBufferDesc   Message;
+    SECURITY_STATUS scRet;
+    PSTR            pszRecord = m_SSLInfo.m_pszRecordBuf;
+    DWORD           cbData    = m_SSLInfo.m_cbRecordData;
+    DWORD           cbRecord;
+
+    if (0 == cbData)
+        return TRUE;
+
+    m_SSLInfo.m_cbRecordData = 0;
+
+    Message.ulVersion = SECBUFFER_VERSION;
+    Message.cBuffers = 4;
+    Message.pBuffers = Buffers;
+
+    Buffers[0].pvBuffer   = pszRecord;
+    Buffers[0].cbBuffer   = m_SSLInfo.m_Sizes.cbHeader;
+    Buffers[0].BufferType = SECBUFFER_STREAM_HEADER;
+
+    Buffers[1].pvBuffer   = pszRecord + m_SSLInfo.m_Sizes.cbHeader;
+    Buffers[1].cbBuffer   = cbData;
+    Buffers[1].BufferType = SECBUFFER_DATA;
+
+    Buffers[2].pvBuffer   = pszRecord + m_SSLInfo.m_Sizes.cbHeader + cbData;
+    Buffers[2].cbBuffer   = m_SSLInfo.m_Sizes.cbTrailer;
+    Buffers[2].BufferType = SECBUFFER_STREAM_TRAILER;
+
+    Buffers[3].BufferType = SECBUFFER_EMPTY;
+
+    scRet = g_pVars->m_SecurityInterface.EncryptMessage(&m_SSLInfo.m_hcred,0,&Message,0);
+    if (scRet != SEC_E_OK && scRet != SEC_E_INCOMPLETE_MESSAGE)
+        myleave(1915);
+
+    // The trailer may come back shorter than cbTrailer, it's still right after the data.
+    DEBUGCHK(Buffers[0].cbBuffer == m_SSLInfo.m_Sizes.cbHeader);
+    cbRecord = Buffers[0].cbBuffer + Buffers[1].cbBuffer + Buffers[2].cbBuffer;
+
+    if (SOCKET_ERROR == send(m_socket,pszRecord,cbRecord,0))
+        myleave(1916);
+
+    fRet = TRUE;
+done:
+    DEBUGMSG_ERR(ZONE_RESPONSE | ZONE_SSL,(L"HTTPD: SendEncryptedRecord failed, err = %d, GLE=0x%08x\r\n",err,GetLastError()));
+    return fRet;
+}
+
+// While fHold is set, SendEncryptedData only sends full records and keeps the
+// rest for the next call.  Clearing it sends whatever is left.
+BOOL CHttpRequest::HoldSendData(BOOL fHold) {
+    if (!m_fIsSecurePort || !m_SSLInfo.m_pszRecordBuf)
+        return TRUE;
+
+    m_SSLInfo.m_fHoldRecord = fHold;
+    return fHold ? TRUE : SendEncryptedRecord();
+}
+
 //
 //  CSSLUsers implementation functions
 //
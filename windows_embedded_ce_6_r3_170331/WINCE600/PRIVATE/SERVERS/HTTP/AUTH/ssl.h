@@ -28,6 +28,12 @@ typedef struct _SSL_INFO  {
     DWORD                     m_cbSerialNumber;
     DWORD                     m_dwCertFlags;        // CRED_XXX flags queried by ISAPI extension on CERT_FLAGS.
 
+    // Outgoing record, header + cbMaximumMessage plaintext + trailer.  Data is gathered
+    // here and encrypted in place so a full record goes out with one send().
+    PSTR                      m_pszRecordBuf;
+    DWORD                     m_cbRecordData;       // plaintext bytes waiting in m_pszRecordBuf
+    BOOL                      m_fHoldRecord;        // more data coming, only send full records
+
     //
     // Channel Binding Token
     //
@@ -50,3 +50,4 @@
 #define IDS_HTTPD_BIND_ERROR          59
 #define IDS_HTTPD_AUTH_INIT_ERROR     60
 #define IDS_HTTPD_SSL_INIT_ERROR      61
+#define IDS_HTTPD_LOG_DROPPED         62
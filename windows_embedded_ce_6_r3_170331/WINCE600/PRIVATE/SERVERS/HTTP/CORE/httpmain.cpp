@@ -229,7 +229,7 @@ void CGlobalVariables::InitGlobals(CReg *pWebsite, const WCHAR *szSiteName)  {
                 return;
         }
 
-        m_pLog = new CLog(dwMaxLogSize,wszLogDir);
+        m_pLog = new CLog(dwMaxLogSize,wszLogDir,pWebsite->ValueDW(RV_LOGROLLINTERVAL),pWebsite->ValueDW(RV_LOGBLOCKWHENFULL));
         if (!m_pLog)
             return;
 
@@ -30,38 +30,64 @@ const char cszDateOutputFmt[]     = "%3s, %02d %3s %04d %02d:%02d:%02d ";
 #define PREVIOUS_LOG_NAME L"\\previous-httpd.log"
 #define LOG_EXTRA_BUFFER_LEN 100
 
-void CLog::WriteEvent(DWORD dwEvent,...) {
-	CHAR szOutput[MINBUFSIZE];
+// Formats an event into szOutput, which must be MINBUFSIZE long.  Returns length, 0 on failure.
+DWORD CLog::FormatEvent(PSTR szOutput, DWORD dwEvent, va_list ap) {
 	WCHAR wszFormat[512];
 	WCHAR wszOutput[512];
 	PSTR pszTrav = szOutput;
 	SYSTEMTIME st;
-	va_list ap;
 
 	if (!LoadString(g_hInst,dwEvent,wszFormat,ARRAYSIZEOF(wszFormat)))
-		return;
+		return 0;
 
-	va_start(ap,dwEvent);
 	wvsprintf(wszOutput,wszFormat,ap);
-	va_end (ap);
 
 	GetSystemTime(&st);
 	pszTrav = szOutput + sprintf(szOutput, cszDateOutputFmt, 
    	   rgWkday[st.wDayOfWeek], st.wDay, rgMonth[st.wMonth], st.wYear, st.wHour, st.wMinute, st.wSecond);
 
 	pszTrav += MyW2A(wszOutput,pszTrav,MINBUFSIZE - (pszTrav - szOutput)) - 1;
-	WriteData(szOutput,pszTrav - szOutput);	
+	return pszTrav - szOutput;
+}
+
+void CLog::WriteEvent(DWORD dwEvent,...) {
+	CHAR szOutput[MINBUFSIZE];
+	DWORD dwToWrite;
+	va_list ap;
+
+	va_start(ap,dwEvent);
+	dwToWrite = FormatEvent(szOutput,dwEvent,ap);
+	va_end (ap);
+
+	if (dwToWrite)
+		WriteData(szOutput,dwToWrite);	
 }
 
 CLog::~CLog() {
 	WriteEvent(IDS_HTTPD_SHUTDOWN_COMPLETE);
+
+	if (m_hWriterThread) {
+		// Writer empties the ring before it exits.
+		m_fShutdown = TRUE;
+		SetEvent(m_hWorkEvent);
+		WaitForSingleObject(m_hWriterThread,INFINITE);
+		CloseHandle(m_hWriterThread);
+	}
+
+	if (m_hWorkEvent)
+		CloseHandle(m_hWorkEvent);
+	if (m_hSpaceEvent)
+		CloseHandle(m_hSpaceEvent);
+	MyFree(m_pRing);
+	MyFree(m_pBatch);
+
 	MyCloseHandle(m_hLog);
 	DeleteCriticalSection(&m_CritSection);
 }
 
 #define MAX_LOG_OPEN_ATTEMPTS  15
 
-CLog::CLog(DWORD dwMaxFileLen, WCHAR * lpszLogDir) {
+CLog::CLog(DWORD dwMaxFileLen, WCHAR * lpszLogDir, DWORD dwRollMinutes, BOOL fBlockWhenFull) {
 	int i;
 	
 	memset(this, 0, sizeof(*this));
@@ -123,9 +149,49 @@ CLog::CLog(DWORD dwMaxFileLen, WCHAR * lpszLogDir) {
 			return;
 		}
 	}
+
+	m_dwRollInterval = dwRollMinutes * 60 * 1000;
+	m_dwLastRoll     = GetTickCount();
+	m_fBlockWhenFull = fBlockWhenFull;
+
+	// If this fails request threads write to the file themselves, as before.
+	if (! StartWriter()) {
+		DEBUGMSG(ZONE_ERROR | ZONE_INIT,(L"HTTPD: Unable to start log writer thread, logging synchronously, GLE=0x%08x\r\n",GetLastError()));
+	}
+
 	WriteEvent(IDS_HTTPD_STARTUP);	
 }
 
+BOOL CLog::StartWriter() {
+	int i;
+
+	if (NULL == (m_pRing = MyRgAllocZ(LOGSLOT,LOG_RING_SLOTS)) ||
+	    NULL == (m_pBatch = MyRgAllocNZ(CHAR,LOG_BATCH_SIZE)) ||
+	    NULL == (m_hWorkEvent = CreateEvent(NULL,FALSE,FALSE,NULL)) ||
+	    NULL == (m_hSpaceEvent = CreateEvent(NULL,FALSE,FALSE,NULL)))
+	{
+		goto fail;
+	}
+
+	for (i = 0; i < LOG_RING_SLOTS; i++)
+		m_pRing[i].lSeq = i;
+
+	if (NULL == (m_hWriterThread = MyCreateThread(WriterThread,this)))
+		goto fail;
+
+	return TRUE;
+
+fail:
+	if (m_hWorkEvent)
+		CloseHandle(m_hWorkEvent);
+	if (m_hSpaceEvent)
+		CloseHandle(m_hSpaceEvent);
+	m_hWorkEvent = m_hSpaceEvent = NULL;
+	MyFree(m_pRing);
+	MyFree(m_pBatch);
+	return FALSE;
+}
+
 //  The log written has the following format
 //  (DATE) (TIME) (IP of requester) (Method) (Request-URI) (Status returned)
 
@@ -163,26 +229,199 @@ void CLog::WriteLog(CHttpRequest* pRequest) {
 }
 
 void CLog::WriteData(PSTR szBuffer, DWORD dwToWrite) {
-	DWORD dwWritten = 0;
+	if (m_pRing) {
+		QueueData(szBuffer,dwToWrite);
+		return;
+	}
 
 	EnterCriticalSection(&m_CritSection);
-	{
-		m_dwFileSize += dwToWrite;
-		// roll over the logs once the maximum size has been reached.
-		if (m_dwFileSize > m_dwMaxFileSize) {
-			MyCloseHandle(m_hLog);
-			DeleteFile(lpszPrevLog);  
-			MoveFile(lpszCurrentLog,lpszPrevLog);
-			m_hLog = MyOpenAppendFile(lpszCurrentLog);
-			m_dwFileSize = dwToWrite;
+	WriteToFile(szBuffer,dwToWrite);
+	LeaveCriticalSection(&m_CritSection);
+}
+
+//  Puts a line on the log ring without taking a lock.  A thread claims the slot
+//  at m_lEnqueuePos by advancing it, fills it in, and then sets the slot's lSeq
+//  to position+1 to hand it to the writer.  The writer sets lSeq to
+//  position+LOG_RING_SLOTS once it has written it, so a slot whose lSeq is
+//  behind the position being claimed hasn't been written yet - the ring is full.
+void CLog::QueueData(PSTR szBuffer, DWORD dwToWrite) {
+	LOGSLOT *pSlot;
+	LONG lPos;
+	LONG lDiff;
+	PSTR pszCopy = NULL;
+
+	if (dwToWrite > LOG_SLOT_SIZE) {
+		if (NULL == (pszCopy = MySzDupA(szBuffer,dwToWrite))) {
+			InterlockedIncrement((LONG*)&m_lDropped);
+			return;
 		}
+	}
+
+	for (;;) {
+		lPos  = m_lEnqueuePos;
+		pSlot = &m_pRing[lPos & (LOG_RING_SLOTS-1)];
+		lDiff = pSlot->lSeq - lPos;
+
+		if (lDiff == 0) {
+			if (lPos == InterlockedCompareExchange((LONG*)&m_lEnqueuePos,lPos+1,lPos))
+				break;
+		}
+		else if (lDiff < 0) {
+			if (!m_fBlockWhenFull || m_fShutdown) {
+				InterlockedIncrement((LONG*)&m_lDropped);
+				MyFree(pszCopy);
+				return;
+			}
 
-		if (m_hLog != INVALID_HANDLE_VALUE) {
-			WriteFile(m_hLog,(LPCVOID) szBuffer,dwToWrite,&dwWritten,NULL);
-			DEBUGMSG(ZONE_REQUEST,(L"HTTPD: Wrote log out to file\r\n"));
+			InterlockedIncrement((LONG*)&m_lWaiters);
+			WaitForSingleObject(m_hSpaceEvent,LOG_FULL_WAIT);
+			InterlockedDecrement((LONG*)&m_lWaiters);
 		}
+		// Otherwise another thread claimed the slot first, try again.
 	}
-	LeaveCriticalSection(&m_CritSection);
+
+	pSlot->pszData = pszCopy;
+	pSlot->cbData  = dwToWrite;
+	if (!pszCopy)
+		memcpy(pSlot->szData,szBuffer,dwToWrite);
+
+	InterlockedExchange((LONG*)&pSlot->lSeq,lPos+1);
+
+	// Wake the writer if it's waiting for work.
+	if (InterlockedExchange((LONG*)&m_fWriterIdle,FALSE))
+		SetEvent(m_hWorkEvent);
+}
+
+DWORD WINAPI CLog::WriterThread(LPVOID lpv) {
+	((CLog*)lpv)->WriterLoop();
+	return 0;
+}
+
+//  Takes lines off the ring in order and collects them in m_pBatch, so a busy
+//  server writes the log in large pieces.  Whatever is collected is written
+//  once the ring is empty.  Rolling the log happens here too, so requests
+//  never wait on it.
+void CLog::WriterLoop() {
+	DWORD cbBatch = 0;
+	DWORD dwWait;
+	LONG  lDropped;
+	LOGSLOT *pSlot;
+
+	for (;;) {
+		pSlot = &m_pRing[m_lDequeuePos & (LOG_RING_SLOTS-1)];
+
+		if (pSlot->lSeq == m_lDequeuePos+1) {
+			PSTR  pszData = pSlot->pszData ? pSlot->pszData : pSlot->szData;
+			DWORD cbData  = pSlot->cbData;
+
+			if (cbBatch + cbData > LOG_BATCH_SIZE) {
+				WriteToFile(m_pBatch,cbBatch);
+				cbBatch = 0;
+			}
+
+			if (cbData > LOG_BATCH_SIZE)
+				WriteToFile(pszData,cbData);
+			else {
+				memcpy(m_pBatch+cbBatch,pszData,cbData);
+				cbBatch += cbData;
+			}
+
+			MyFree(pSlot->pszData);
+			InterlockedExchange((LONG*)&pSlot->lSeq,m_lDequeuePos+LOG_RING_SLOTS);
+			m_lDequeuePos++;
+
+			if (m_lWaiters)
+				SetEvent(m_hSpaceEvent);
+			continue;
+		}
+
+		// Nothing more to take for now, write out what we have.
+		if (cbBatch) {
+			WriteToFile(m_pBatch,cbBatch);
+			cbBatch = 0;
+		}
+
+		if (0 != (lDropped = InterlockedExchange((LONG*)&m_lDropped,0))) {
+			DEBUGMSG(ZONE_ERROR,(L"HTTPD: %d log lines were dropped, log ring was full\r\n",lDropped));
+			WriteEventToFile(IDS_HTTPD_LOG_DROPPED,lDropped);
+		}
+
+		if (IsRollDue())
+			RollLog();
+
+		// A thread may have claimed a slot but not filled it in yet, wait for it.
+		if (m_fShutdown && m_lEnqueuePos == m_lDequeuePos)
+			break;
+
+		// Say we're going idle before checking the ring one last time, so a line
+		// queued in between either is seen here or sets m_hWorkEvent.
+		InterlockedExchange((LONG*)&m_fWriterIdle,TRUE);
+		if (pSlot->lSeq == m_lDequeuePos+1 || m_fShutdown) {
+			InterlockedExchange((LONG*)&m_fWriterIdle,FALSE);
+			if (m_fShutdown)
+				Sleep(10);
+			continue;
+		}
+
+		// Only need a timeout if there's something to roll.
+		dwWait = INFINITE;
+		if (m_dwRollInterval && m_dwFileSize) {
+			DWORD dwElapsed = GetTickCount() - m_dwLastRoll;
+			dwWait = (dwElapsed < m_dwRollInterval) ? m_dwRollInterval - dwElapsed : 0;
+		}
+
+		WaitForSingleObject(m_hWorkEvent,dwWait);
+		InterlockedExchange((LONG*)&m_fWriterIdle,FALSE);
+	}
+}
+
+// Writes straight to the log file.  Called on the writer thread, or with
+// m_CritSection held when there isn't one.
+void CLog::WriteToFile(PSTR szBuffer, DWORD dwToWrite) {
+	DWORD dwWritten = 0;
+
+	if (IsRollDue())
+		RollLog();
+
+	m_dwFileSize += dwToWrite;
+	// roll over the logs once the maximum size has been reached.
+	if (m_dwFileSize > m_dwMaxFileSize) {
+		RollLog();
+		m_dwFileSize = dwToWrite;
+	}
+
+	if (m_hLog != INVALID_HANDLE_VALUE) {
+		WriteFile(m_hLog,(LPCVOID) szBuffer,dwToWrite,&dwWritten,NULL);
+		DEBUGMSG(ZONE_REQUEST,(L"HTTPD: Wrote log out to file\r\n"));
+	}
+}
+
+// The writer thread can't queue to itself, it formats events straight to the file.
+void CLog::WriteEventToFile(DWORD dwEvent,...) {
+	CHAR szOutput[MINBUFSIZE];
+	DWORD dwToWrite;
+	va_list ap;
+
+	va_start(ap,dwEvent);
+	dwToWrite = FormatEvent(szOutput,dwEvent,ap);
+	va_end (ap);
+
+	if (dwToWrite)
+		WriteToFile(szOutput,dwToWrite);
+}
+
+// Time based roll over, only once something has been written since the last one.
+BOOL CLog::IsRollDue() {
+	return (m_dwRollInterval && m_dwFileSize && (GetTickCount() - m_dwLastRoll >= m_dwRollInterval));
+}
+
+void CLog::RollLog() {
+	MyCloseHandle(m_hLog);
+	DeleteFile(lpszPrevLog);  
+	MoveFile(lpszCurrentLog,lpszPrevLog);
+	m_hLog = MyOpenAppendFile(lpszCurrentLog);
+	m_dwFileSize = 0;
+	m_dwLastRoll = GetTickCount();
 }
 
 // Returns the size of the buffer we'll need.
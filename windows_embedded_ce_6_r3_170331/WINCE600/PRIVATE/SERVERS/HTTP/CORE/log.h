@@ -23,6 +23,21 @@ Abstract: Logging functions
 class CHttpRequest;  // forward declaration
 
 
+// Request threads put log lines on a ring, a writer thread takes them off and
+// writes them out in batches.  Lines that fit are copied into the slot itself.
+#define LOG_RING_SLOTS        128      // Must be a power of 2
+#define LOG_SLOT_SIZE         256
+#define LOG_BATCH_SIZE        8192     // Most the writer collects for one WriteFile
+#define LOG_FULL_WAIT         100      // ms a request waits for room when LogBlockWhenFull is set
+
+typedef struct {
+	volatile LONG lSeq;                // Ring position slot is ready for, see CLog::QueueData
+	DWORD  cbData;
+	PSTR   pszData;                    // Allocated copy of lines longer than LOG_SLOT_SIZE, else NULL
+	CHAR   szData[LOG_SLOT_SIZE];
+} LOGSLOT;
+
+
 // Right now we assume only one object handles all requests.
 
 class CLog {
@@ -30,12 +45,38 @@ private:
 	HANDLE m_hLog;
 	DWORD m_dwMaxFileSize;				// Max log can grow before it's rolled over
 	DWORD m_dwFileSize;		   			// Current file length
-	CRITICAL_SECTION m_CritSection;
+	DWORD m_dwRollInterval;				// ms between time based roll overs, 0 if none
+	DWORD m_dwLastRoll;					// GetTickCount() of last roll over
+	CRITICAL_SECTION m_CritSection;		// Only used when there's no writer thread
 	WCHAR lpszCurrentLog[MAX_PATH+1];
 	WCHAR lpszPrevLog[MAX_PATH+1];
+
+	// Log ring, NULL if writer thread couldn't be started
+	LOGSLOT *m_pRing;
+	volatile LONG m_lEnqueuePos;		// Next position request threads will claim
+	LONG   m_lDequeuePos;				// Next position writer will take, writer thread only
+	volatile LONG m_lDropped;			// Lines thrown away since last reported
+	volatile LONG m_lWaiters;			// Request threads waiting for room on the ring
+	volatile LONG m_fWriterIdle;		// Writer is (about to be) waiting on m_hWorkEvent
+	BOOL   m_fBlockWhenFull;			// Wait for room rather than drop the line
+	BOOL   m_fShutdown;
+	PSTR   m_pBatch;					// Writer's output buffer, LOG_BATCH_SIZE
+	HANDLE m_hWorkEvent;				// Lines have been queued / shutdown
+	HANDLE m_hSpaceEvent;				// Writer has freed slots
+	HANDLE m_hWriterThread;
+
+	DWORD FormatEvent(PSTR szOutput, DWORD dwEvent, va_list ap);
+	BOOL StartWriter();
+	void QueueData(PSTR szBuffer, DWORD dwToWrite);
+	static DWORD WINAPI WriterThread(LPVOID lpv);
+	void WriterLoop();
+	void WriteToFile(PSTR szBuffer, DWORD dwToWrite);
+	void WriteEventToFile(DWORD dwEvent,...);
+	BOOL IsRollDue();
+	void RollLog();
 	
 public:
-	CLog(DWORD dwMaxFileLen, WCHAR * lpszLogDir);
+	CLog(DWORD dwMaxFileLen, WCHAR * lpszLogDir, DWORD dwRollMinutes=0, BOOL fBlockWhenFull=FALSE);
 	~CLog();
 
 	void WriteData(PSTR wszData, DWORD dwToWrite);
@@ -457,6 +457,8 @@ public:
 
     BOOL SendData(PSTR pszBuf, DWORD dwLen, BOOL fCopyBuffer=FALSE);
     BOOL SendEncryptedData(PSTR pszBuf, DWORD dwLen, BOOL fCopyBuffer);
+    BOOL SendEncryptedRecord(void);
+    BOOL HoldSendData(BOOL fHold);
 
     //  ISAPI Extension / ASP Specific
     friend BOOL WINAPI GetServerVariable(HCONN hConn, PSTR psz, PVOID pv, PDWORD pdw);
@@ -576,12 +578,15 @@ public:
         if (!fFromFilter && m_pRequest->FilterNoResponse())
             return; 
 
+        // On SSL, headers and file go out together in full size records.
+        m_pRequest->HoldSendData(TRUE);
+
         SendHeadersAndDefaultBodyIfAvailable(pszExtraHeaders,pszNewRespStatus);
-        if (VERB_HEAD == m_pRequest->m_idMethod)
-            return;
 
-        if(m_hFile)
+        if(m_hFile && (VERB_HEAD != m_pRequest->m_idMethod))
             SendFile(m_pRequest->m_socket, m_hFile, m_pRequest);
+
+        m_pRequest->HoldSendData(FALSE);
     }
 };
 
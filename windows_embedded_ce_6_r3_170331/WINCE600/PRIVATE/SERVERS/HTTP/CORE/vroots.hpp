@@ -49,11 +49,49 @@ typedef struct {
 }
 VROOTINFO, *PVROOTINFO;
 
+// Node of the prefix trie CVRoots builds over the vroot names.  Edges are labelled
+// with runs of lower cased characters, so a URL is matched against every vroot in
+// one pass over it rather than being compared against each vroot in turn.
+typedef struct _VROOTTRIENODE {
+	PCSTR	pszLabel;                   // Characters on the edge leading here, lower case
+	int		iLabelLen;
+	int		iVRoot;                     // Index of vroot whose name ends here, -1 if none
+	struct _VROOTTRIENODE *pChild;      // First child
+	struct _VROOTTRIENODE *pSibling;    // Next child of our parent
+}
+VROOTTRIENODE, *PVROOTTRIENODE;
+
+// Recently translated URLs.  A website gets a new CVRoots when the vroots are
+// refreshed, so the cache is never out of date with the table it belongs to.
+#define VROOT_CACHE_SIZE      64        // Must be a power of 2
+#define VROOT_CACHE_MAX_URL   256       // Longer URLs aren't cached
+
+typedef struct {
+	DWORD	dwHash;
+	PSTR	pszURL;                     // URL as passed to URLAtoPathW, NULL if slot is empty
+	int		iVRoot;
+	PWSTR	wszPath;                    // What URLAtoPathW returned for it
+}
+VROOTCACHEENTRY;
+
 
 inline BOOL IsSlash(CHAR c) {
 	return ((c == '/') || (c == '\\'));
 }
 
+// Vroot names are compared without regard to case, same as _memicmp does.
+inline CHAR LowerURLChar(CHAR c) {
+	return (c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c;
+}
+
+inline DWORD HashURL(PCSTR pszURL, int iLen) {
+	DWORD dwHash = 0;
+	for (int j = 0; j < iLen; j++)
+		dwHash = dwHash * 31 + (BYTE) pszURL[j];
+
+	return dwHash;
+}
+
 inline int CountSignificantSlashesInURL(PCSTR pszURL, int iURLLen) {
 	DWORD iSlashes = 0;
 	// Skip first char '/', and don't check last character for ending '/'.
@@ -115,13 +153,79 @@ class CVRoots {
 	PVROOTINFO m_pVRoots;
 	int m_nRefCnt;
 
+	PVROOTTRIENODE m_pTrieNodes;        // m_pTrieNodes[0] is the root, NULL if trie couldn't be built
+	int   m_nTrieNodes;
+	PSTR  m_pszTrieLabels;              // Lower cased vroot names, trie labels point into this
+	int   m_iCatchAllVRoot;             // Vroot that matches every URL, -1 if none
+
+	CRITICAL_SECTION m_csCache;
+	VROOTCACHEENTRY  m_rgCache[VROOT_CACHE_SIZE];
+
 	PVROOTINFO MatchVRoot(PCSTR pszInputURL, int iInputLen) {
-		int i;
+		PVROOTINFO pVRoot;
 
 		// If there was an error on setting up the vroots, m_pVRoots = NULL.
 		if (!m_pVRoots)
 			return NULL;
 
+		if (m_pTrieNodes) {
+			int iVRoot = MatchVRootTrie(pszInputURL,iInputLen);
+			pVRoot = (iVRoot == -1) ? NULL : &m_pVRoots[iVRoot];
+			DEBUGCHK(pVRoot == MatchVRootLinear(pszInputURL,iInputLen));
+		}
+		else
+			pVRoot = MatchVRootLinear(pszInputURL,iInputLen);
+
+		if (pVRoot) {
+			DEBUGMSG(ZONE_VROOTS, (L"HTTPD: URL %a matched VRoot %a (path %s, perm=%d, auth=%d)\r\n", 
+				pszInputURL, pVRoot->pszURL, pVRoot->wszPath, pVRoot->dwPermissions, pVRoot->AuthLevel));
+		}
+		else {
+			DEBUGMSG(ZONE_VROOTS, (L"HTTPD: URL %a did not matched any VRoot\r\n", pszInputURL));
+		}
+		return pVRoot;
+	}
+
+	// Walks the trie along the URL.  Of the vroots whose names end on a path segment
+	// boundary on the way, the one with the lowest index (longest name) wins, which
+	// is the one MatchVRootLinear would have found first.
+	int MatchVRootTrie(PCSTR pszInputURL, int iInputLen) {
+		PVROOTTRIENODE pNode = &m_pTrieNodes[0];
+		int iVRoot = iInputLen ? m_iCatchAllVRoot : -1;
+		int iPos = 0;
+		int k;
+
+		while (iPos < iInputLen) {
+			CHAR c = LowerURLChar(pszInputURL[iPos]);
+
+			for (pNode = pNode->pChild; pNode && pNode->pszLabel[0] != c; pNode = pNode->pSibling)
+				;
+
+			if (!pNode || pNode->iLabelLen > iInputLen - iPos)
+				break;
+
+			for (k = 1; k < pNode->iLabelLen && LowerURLChar(pszInputURL[iPos+k]) == pNode->pszLabel[k]; k++)
+				;
+
+			if (k < pNode->iLabelLen)
+				break;
+
+			iPos += k;
+
+			// A request for '/webAdmin.htm' must not match vroot '/webAdmin'.
+			if (pNode->iVRoot != -1 && (iPos == iInputLen || IsSlash(pszInputURL[iPos]))) {
+				if (iVRoot == -1 || pNode->iVRoot < iVRoot)
+					iVRoot = pNode->iVRoot;
+			}
+		}
+		return iVRoot;
+	}
+
+	// Original matcher, checks each vroot in turn.  Used if the trie couldn't be
+	// built, and in debug builds to verify what the trie finds.
+	PVROOTINFO MatchVRootLinear(PCSTR pszInputURL, int iInputLen) {
+		int i;
+
 		int iInputSlashes = CountSignificantSlashesInURL(pszInputURL,iInputLen);
 		PCSTR szFirstUrlSlashInit = GetNextSlash(pszInputURL+1);
 		if (NULL == szFirstUrlSlashInit)
@@ -143,11 +247,8 @@ class CVRoots {
 				continue;
 
 			// If it's path '/', always match.
-			if (iLen == 1) {
-				DEBUGMSG(ZONE_VROOTS, (L"HTTPD: URL %a matched VRoot %a (path %s, perm=%d, auth=%d)\r\n", 
-					pszInputURL, m_pVRoots[i].pszURL, m_pVRoots[i].wszPath, m_pVRoots[i].dwPermissions, m_pVRoots[i].AuthLevel));
+			if (iLen == 1)
 				return &(m_pVRoots[i]);
-			}
 
 			// It's possible for a virtual root name to have multiple slashes, i.e.
 			// '/a/b' could map to '\windows\www' whereas '/a' could be something else.
@@ -187,16 +288,153 @@ class CVRoots {
 						continue;
 				}
 				*/
-
-				DEBUGMSG(ZONE_VROOTS, (L"HTTPD: URL %a matched VRoot %a (path %s, perm=%d, auth=%d)\r\n", 
-					pszInputURL, m_pVRoots[i].pszURL, m_pVRoots[i].wszPath, m_pVRoots[i].dwPermissions, m_pVRoots[i].AuthLevel));
 				return &(m_pVRoots[i]);
 			}
 		}
-		DEBUGMSG(ZONE_VROOTS, (L"HTTPD: URL %a did not matched any VRoot\r\n", pszInputURL));
 		return NULL;
 	}
 
+	// Builds the trie MatchVRootTrie walks, from the sorted vroot table.  Only vroots
+	// that MatchVRootLinear can select go in, so both always agree.
+	BOOL BuildTrie() {
+		int i;
+		int cbLabels = 0;
+		PSTR pszLabel;
+
+		m_iCatchAllVRoot = -1;
+
+		for (i = 0; i < m_nVRoots; i++)
+			cbLabels += m_pVRoots[i].iURLLen;
+
+		// Each vroot adds at most a new leaf and one split node.
+		if (NULL == (m_pTrieNodes = MyRgAllocZ(VROOTTRIENODE, 2*m_nVRoots+1)) ||
+		    NULL == (m_pszTrieLabels = MyRgAllocNZ(CHAR, cbLabels+1)))
+			return FALSE;
+
+		m_pTrieNodes[0].iVRoot = -1;
+		m_nTrieNodes = 1;
+		pszLabel = m_pszTrieLabels;
+
+		for (i = 0; i < m_nVRoots; i++) {
+			PVROOTINFO pVRoot = &m_pVRoots[i];
+			int iLen = pVRoot->iURLLen;
+
+			if (!pVRoot->pszURL || !iLen)
+				continue;
+
+			if (pVRoot->fRootDir && iLen != 1)
+				iLen--;
+
+			// Like MatchVRootLinear, a vroot this short matches every URL.
+			if (iLen == 1) {
+				if (m_iCatchAllVRoot == -1)
+					m_iCatchAllVRoot = i;
+				continue;
+			}
+
+			// MatchVRootLinear compares a vroot with the URL up to the slash that ends
+			// iNumSlashes+1 path segments.  A name that ends in a slash, or that doesn't
+			// have iNumSlashes slashes (redirects don't set it), never matches that way.
+			if (IsSlash(pVRoot->pszURL[pVRoot->iURLLen-1]) ||
+			    pVRoot->iNumSlashes != CountSignificantSlashesInURL(pVRoot->pszURL,pVRoot->iURLLen))
+				continue;
+
+			for (int j = 0; j < pVRoot->iURLLen; j++)
+				pszLabel[j] = LowerURLChar(pVRoot->pszURL[j]);
+
+			InsertTrie(pszLabel,pVRoot->iURLLen,i);
+			pszLabel += pVRoot->iURLLen;
+		}
+		DEBUGCHK(m_nTrieNodes <= 2*m_nVRoots+1);
+		return TRUE;
+	}
+
+	void InsertTrie(PCSTR pszURL, int iLen, int iVRoot) {
+		PVROOTTRIENODE pNode = &m_pTrieNodes[0];
+		PVROOTTRIENODE pChild;
+		PVROOTTRIENODE *ppChild;
+		int k;
+
+		while (iLen) {
+			for (ppChild = &pNode->pChild; *ppChild && (*ppChild)->pszLabel[0] != pszURL[0]; ppChild = &(*ppChild)->pSibling)
+				;
+
+			if (NULL == (pChild = *ppChild)) {
+				pChild = &m_pTrieNodes[m_nTrieNodes++];
+				pChild->pszLabel  = pszURL;
+				pChild->iLabelLen = iLen;
+				pChild->iVRoot    = iVRoot;
+				*ppChild = pChild;
+				return;
+			}
+
+			for (k = 1; k < iLen && k < pChild->iLabelLen && pszURL[k] == pChild->pszLabel[k]; k++)
+				;
+
+			// Name ends or differs part way along the edge, split it there.
+			if (k < pChild->iLabelLen) {
+				PVROOTTRIENODE pSplit = &m_pTrieNodes[m_nTrieNodes++];
+				pSplit->pszLabel  = pChild->pszLabel;
+				pSplit->iLabelLen = k;
+				pSplit->iVRoot    = -1;
+				pSplit->pChild    = pChild;
+				pSplit->pSibling  = pChild->pSibling;
+
+				pChild->pszLabel  += k;
+				pChild->iLabelLen -= k;
+				pChild->pSibling  = NULL;
+
+				*ppChild = pChild = pSplit;
+			}
+
+			pNode   = pChild;
+			pszURL += k;
+			iLen   -= k;
+		}
+
+		// Same name twice (i.e. '/a' and '/a/'), the linear search finds the first.
+		if (pNode->iVRoot == -1)
+			pNode->iVRoot = iVRoot;
+	}
+
+	// On a hit, returns a copy of the path URLAtoPathW built for pszInputURL before.
+	PWSTR LookupCache(PCSTR pszInputURL, int iInputLen, PVROOTINFO *ppVRoot) {
+		DWORD dwHash = HashURL(pszInputURL,iInputLen);
+		VROOTCACHEENTRY *pEntry = &m_rgCache[dwHash & (VROOT_CACHE_SIZE-1)];
+		PWSTR wszPath = NULL;
+
+		EnterCriticalSection(&m_csCache);
+		if (pEntry->pszURL && pEntry->dwHash == dwHash && 0 == strcmp(pEntry->pszURL,pszInputURL)) {
+			if (NULL != (wszPath = MySzDupW(pEntry->wszPath)))
+				*ppVRoot = &m_pVRoots[pEntry->iVRoot];
+		}
+		LeaveCriticalSection(&m_csCache);
+
+		return wszPath;
+	}
+
+	void AddToCache(PCSTR pszInputURL, int iInputLen, PVROOTINFO pVRoot, PCWSTR wszPath) {
+		DWORD dwHash = HashURL(pszInputURL,iInputLen);
+		VROOTCACHEENTRY *pEntry = &m_rgCache[dwHash & (VROOT_CACHE_SIZE-1)];
+		PSTR  pszURLCopy  = MySzDupA(pszInputURL,iInputLen);
+		PWSTR wszPathCopy = MySzDupW(wszPath);
+
+		if (!pszURLCopy || !wszPathCopy) {
+			MyFree(pszURLCopy);
+			MyFree(wszPathCopy);
+			return;
+		}
+
+		EnterCriticalSection(&m_csCache);
+		MyFree(pEntry->pszURL);
+		MyFree(pEntry->wszPath);
+		pEntry->dwHash  = dwHash;
+		pEntry->pszURL  = pszURLCopy;
+		pEntry->iVRoot  = pVRoot - m_pVRoots;
+		pEntry->wszPath = wszPathCopy;
+		LeaveCriticalSection(&m_csCache);
+	}
+
 	BOOL Init(CReg *pWebsite, BOOL fDefaultDirBrowse, BOOL fDefaultBasic, BOOL fDefaultNTLM, BOOL fDefaultNegotiate) {
 		const WCHAR cszDLL[] = L".dll";
 		const WCHAR cszASP[] = L".asp";
@@ -382,6 +620,13 @@ class CVRoots {
 			}
 		} while(fChange);
 
+		if (! BuildTrie()) {
+			// Not fatal, MatchVRoot falls back to checking each vroot.
+			DEBUGMSG(ZONE_ERROR, (L"HTTPD: Unable to build vroot trie, GLE=%d\r\n",GetLastError()));
+			MyFree(m_pTrieNodes);
+			MyFree(m_pszTrieLabels);
+		}
+
 	done:
 		if(err) {
 			DEBUGMSG(ZONE_ERROR, (L"HTTPD: CVRoots::ctor FAILED due to err=%d GLE=%d (num=%d i=%d pVRoots=0x%08x url=%s path=%s)\r\n", 
@@ -393,9 +638,20 @@ class CVRoots {
 	}
 
 	void Cleanup() {
+		int i;
+
+		for (i=0; i<VROOT_CACHE_SIZE; i++) {
+			MyFree(m_rgCache[i].pszURL);
+			MyFree(m_rgCache[i].wszPath);
+		}
+		DeleteCriticalSection(&m_csCache);
+
+		MyFree(m_pTrieNodes);
+		MyFree(m_pszTrieLabels);
+
 		if(!m_pVRoots)
 			return;
-		for(int i=0; i<m_nVRoots; i++) {
+		for(i=0; i<m_nVRoots; i++) {
 			MyFree(m_pVRoots[i].pszURL);
 			MyFree(m_pVRoots[i].wszPath);
 			MyFree(m_pVRoots[i].wszUserList);
@@ -405,15 +661,7 @@ class CVRoots {
 		DEBUGCHK(m_nRefCnt == 0);
 	}
 
-public:
-	CVRoots(CReg *pWebsite, BOOL fDefaultDirBrowse, BOOL fDefaultBasic, BOOL fDefaultNTLM, BOOL fDefaultNegotiate)  { ZEROMEM(this); Init(pWebsite, fDefaultDirBrowse, fDefaultBasic, fDefaultNTLM, fDefaultNegotiate); }
-	~CVRoots() { Cleanup(); }
-	DWORD      Count()  { return m_nVRoots; }
-
-	
-	PWSTR URLAtoPathW(PSTR pszInputURL, PVROOTINFO *ppVRootInfo=NULL, PSTR *ppszPathInfo=0, BOOL fAcceptRedirect=FALSE)  {
-		WCHAR *wszTemp = NULL;
-		int iInputLen = strlen(pszInputURL);
+	PWSTR MapURLAtoPathW(PSTR pszInputURL, int iInputLen, PVROOTINFO *ppVRootInfo, PSTR *ppszPathInfo, BOOL fAcceptRedirect)  {
 		PVROOTINFO pVRoot = MatchVRoot(pszInputURL, iInputLen);
 		if(!pVRoot)
 			return NULL;
@@ -485,6 +733,51 @@ public:
 		return wszOutPath;
 	}
 
+public:
+	CVRoots(CReg *pWebsite, BOOL fDefaultDirBrowse, BOOL fDefaultBasic, BOOL fDefaultNTLM, BOOL fDefaultNegotiate)  { 
+		ZEROMEM(this); 
+		InitializeCriticalSection(&m_csCache);
+		Init(pWebsite, fDefaultDirBrowse, fDefaultBasic, fDefaultNTLM, fDefaultNegotiate); 
+	}
+	~CVRoots() { Cleanup(); }
+	DWORD      Count()  { return m_nVRoots; }
+
+	
+	PWSTR URLAtoPathW(PSTR pszInputURL, PVROOTINFO *ppVRootInfo=NULL, PSTR *ppszPathInfo=0, BOOL fAcceptRedirect=FALSE)  {
+		int iInputLen = strlen(pszInputURL);
+		PVROOTINFO pVRoot = NULL;
+		PWSTR wszOutPath;
+		CHAR szURL[VROOT_CACHE_MAX_URL+1];
+		BOOL fCacheable = (m_pVRoots && iInputLen <= VROOT_CACHE_MAX_URL);
+
+		if (fCacheable && (NULL != (wszOutPath = LookupCache(pszInputURL, iInputLen, &pVRoot)))) {
+			if (ppVRootInfo)
+				*ppVRootInfo = pVRoot;
+
+			// Script vroots still need the URL split from its path info. SetPathInfo
+			// also truncates pszInputURL, as MapURLAtoPathW does on a miss; the two
+			// paths must leave the caller's URL the same.
+			if (pVRoot->ScriptType != SCRIPT_TYPE_NONE && ppszPathInfo && pszInputURL[pVRoot->iURLLen] != 0)
+				SetPathInfo(ppszPathInfo,pszInputURL,pVRoot->iURLLen);
+
+			return wszOutPath;
+		}
+
+		// Mapping can truncate pszInputURL, keep what the cache is keyed on.
+		if (fCacheable)
+			memcpy(szURL, pszInputURL, iInputLen+1);
+
+		wszOutPath = MapURLAtoPathW(pszInputURL, iInputLen, &pVRoot, ppszPathInfo, fAcceptRedirect);
+
+		if (ppVRootInfo && pVRoot)
+			*ppVRootInfo = pVRoot;
+
+		if (fCacheable && wszOutPath)
+			AddToCache(szURL, iInputLen, pVRoot, wszOutPath);
+
+		return wszOutPath;
+	}
+
 	// Ref counting assumes that caller holds g_CritSect
 	void AddRef(void) { m_nRefCnt++; }
 	void DelRef(void) { 
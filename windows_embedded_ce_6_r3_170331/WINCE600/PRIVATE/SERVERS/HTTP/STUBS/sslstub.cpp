@@ -53,3 +53,8 @@ BOOL CHttpRequest::HandleSSLClientCertCheck(void) {
 	DEBUGCHK(FALSE);
 	return FALSE;
 }
+
+// Called for every response, not only SSL ones, so no DEBUGCHK here.
+BOOL CHttpRequest::HoldSendData(BOOL fHold) {
+	return TRUE;
+}
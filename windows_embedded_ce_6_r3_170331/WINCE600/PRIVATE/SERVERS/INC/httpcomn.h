@@ -52,6 +52,8 @@ Abstract: Registry settings and default values used by httpd.dll, the http
 #define RV_MAXLOGSIZE     L"MaxLogSize"
 #define RV_FILTER         L"Filter DLLs"
 #define RV_LOGDIR         L"LogFileDirectory"
+#define RV_LOGROLLINTERVAL  L"LogRollInterval"   // minutes, 0 = only roll on MaxLogSize
+#define RV_LOGBLOCKWHENFULL L"LogBlockWhenFull"  // wait rather than drop lines when log can't keep up
 #define RV_ADMINUSERS     L"AdminUsers"
 #define RV_ADMINGROUPS    L"AdminGroups"
 #define RV_ISENABLED      L"IsEnabled"
@@ -94,6 +96,7 @@ Abstract: Registry settings and default values used by httpd.dll, the http
 #define RV_SSL_PORT          L"Port"
 #define RV_SSL_ENABLE        L"IsEnabled"
 #define RV_SSL_CERT_SUBJECT  L"CertificateSubject"
+#define RV_SSL_SESSION_LIFESPAN L"SessionLifespan"   // ms Schannel keeps a session for resumption
 // SSL Client Cert fields
 #define RV_SSL_CERT_TRUST_OVERRIDE     L"CertTrustOverride"
 
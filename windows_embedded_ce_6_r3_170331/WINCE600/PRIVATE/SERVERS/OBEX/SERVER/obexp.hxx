@@ -51,6 +51,35 @@
 
 #define OBEX_INVALID_CID        0xffffffff
 
+#if ! defined (OBEX_MIN_PACKET_SIZE)
+#define OBEX_MIN_PACKET_SIZE    0xff
+#endif
+
+#if ! defined (OBEX_MAX_PACKET_SIZE)
+#define OBEX_MAX_PACKET_SIZE    0xffff
+#endif
+
+#define OBEX_MAXPACKET_DEFAULT    OBEX_MAX_PACKET_SIZE    // Largest packet offered in CONNECT responses
+
+//
+//    Single Response Mode (OBEX 1.5, GOEP 2.0)
+//
+#if ! defined (OBEX_HID_SRM)
+#define OBEX_HID_SRM            (0x17 | OBEX_TYPE_BYTE)
+#endif
+
+#if ! defined (OBEX_HID_SRMP)
+#define OBEX_HID_SRMP            (0x18 | OBEX_TYPE_BYTE)
+#endif
+
+#define OBEX_SRM_DISABLE        0x00
+#define OBEX_SRM_ENABLE            0x01
+#define OBEX_SRMP_WAIT            0x01
+
+#define OBEX_SRM_OFF            0            // Connection states
+#define OBEX_SRM_REQUESTED        1
+#define OBEX_SRM_ACTIVE            2
+
 int obutil_IsLocal        (WCHAR *szFileName);
 int obutil_GetGUID        (WCHAR *lpsz, GUID *pguid);
 int obutil_PollSocket    (SOCKET s);
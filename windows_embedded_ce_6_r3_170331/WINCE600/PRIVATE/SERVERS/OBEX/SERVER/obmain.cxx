@@ -98,6 +98,7 @@ public:
     unsigned int    uiOBEX_MAINT_PERIOD;
     unsigned int    uiOBEX_SERVER_TIMEOUT;
     unsigned int    uiOBEX_CONNECTION_TIMEOUT;
+    unsigned int    uiOBEX_MAX_PACKET;
 
     ISdpRecord      *pSdpRecord;
 
@@ -121,6 +122,7 @@ public:
         uiOBEX_CONNECTION_TIMEOUT = OBEX_CONNECTION_TIMEOUT;
         uiOBEX_SERVER_TIMEOUT = OBEX_SERVER_TIMEOUT;
         uiOBEX_MAINT_PERIOD = OBEX_MAINT_PERIOD;
+        uiOBEX_MAX_PACKET = OBEX_MAXPACKET_DEFAULT;
 
         pSdpRecord = NULL;
     }
@@ -144,6 +146,19 @@ public:
     void ServiceRequest (Connection *pConn);                                // +
 
     static DWORD WINAPI Compact (LPVOID pThis);                                // +
+
+    //    Packet buffers are recycled per connection; both start and return locked.
+    unsigned char *AllocPacket (Connection *pConn, int cSize);                // +
+    void FreePacket (Connection *pConn);                                    // +
+
+    //    Single Response Mode. These start and return locked.
+    void CheckSRM (Connection *pConn);                                        // +
+    int FilterResponse (Connection *pConn, int iResponse, int *pfAddSRM);    // +
+
+    //    this starts unlocked and returns unlocked.
+    void ContinueSRM (SOCKET s);                                            // +
+
+    static DWORD WINAPI PumpSRM (LPVOID pvSocket);                            // +
 };
 
 
@@ -224,9 +239,23 @@ public:
     unsigned char    *pBuffer;
     int                cFilled;
     int                cBufSize;
+    int                cBufAlloc;
+
+    unsigned char    *pSpare;            // Last packet buffer, kept for the next packet
+    int                cSpareAlloc;
 
     unsigned char   ucPeekBuff[3];
     int                cPeekFilled;
+
+    unsigned int    uiPeerMaxPacket;    // Largest packet the client accepts
+
+    int                iSRMState;            // OBEX_SRM_*
+    unsigned char    ucSRMOp;            // PUT or GET running in SRM
+    int                fSRMFinal;            // current request is the last one of the operation
+    int                fSRMWait;            // client asked us to wait (SRMP)
+    int                fSRMPump;            // the next GET request is implied
+    int                fSRMCid;
+    unsigned int    uiSRMCid;
 };
 
 class Association {
@@ -404,6 +433,12 @@ int GlobalData::Start (void) {
             (dwType == REG_DWORD) && (dwSize == sizeof(dw)) && (dw > OBEX_MAINT_PERIOD_MIN))
             uiOBEX_MAINT_PERIOD = dw;
 
+        //    0 leaves the packet size advertised by the service alone
+        dwSize = sizeof(dw);
+        if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"MaxPacketLength", 0, &dwType, (LPBYTE)&dw, &dwSize)) &&
+            (dwType == REG_DWORD) && (dwSize == sizeof(dw)) && ((dw == 0) || ((dw >= OBEX_MIN_PACKET_SIZE) && (dw <= OBEX_MAX_PACKET_SIZE))))
+            uiOBEX_MAX_PACKET = dw;
+
         WCHAR szProtocols[OBEX_SMALLBUFFER];
         dwSize = sizeof(szProtocols);
         if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"protocols", 0, &dwType, (LPBYTE)szProtocols, &dwSize)) &&
@@ -425,6 +460,7 @@ int GlobalData::Start (void) {
     IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_INIT, L"[OBEX] GlobalData::Start : uiOBEX_SERVER_TIMEOUT     = %d\n", uiOBEX_SERVER_TIMEOUT));
     IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_INIT, L"[OBEX] GlobalData::Start : uiOBEX_CONNECTION_TIMEOUT = %d\n", uiOBEX_CONNECTION_TIMEOUT));
     IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_INIT, L"[OBEX] GlobalData::Start : uiOBEX_MAINT_PERIOD       = %d\n", uiOBEX_MAINT_PERIOD));
+    IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_INIT, L"[OBEX] GlobalData::Start : uiOBEX_MAX_PACKET         = %d\n", uiOBEX_MAX_PACKET));
 
     pfmdServers = svsutil_AllocFixedMemDescr (sizeof (Server), OBEX_MEM_SCALE);
     pfmdAssociations = svsutil_AllocFixedMemDescr (sizeof(Association), OBEX_MEM_SCALE);
@@ -632,6 +668,17 @@ void GlobalData::ServiceRequest (Connection *pConn) {
         IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_PACKETS, L"[OBEX] GlobalData::ServiceRequest: packet 0x%08x OP = GET, CONTINUE\n", pConn->uiCurrentTransaction));
 #endif
 
+    //    CONNECT carries version, flags and the largest packet the client accepts
+    if ((p.Op () == OBEX_OP_CONNECT) && (pConn->cBufSize >= 7)) {
+        pConn->uiPeerMaxPacket = (pConn->pBuffer[5] << 8) | pConn->pBuffer[6];
+        if (pConn->uiPeerMaxPacket < OBEX_MIN_PACKET_SIZE)
+            pConn->uiPeerMaxPacket = OBEX_MIN_PACKET_SIZE;
+
+        IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_PACKETS, L"[OBEX] GlobalData::ServiceRequest: packet 0x%08x client max packet %d\n", pConn->uiCurrentTransaction, pConn->uiPeerMaxPacket));
+    }
+
+    CheckSRM (pConn);
+
     int fHaveConnectionId = FALSE;
 
     //if the packet has a connection ID quickly dispatch it
@@ -788,6 +835,17 @@ DWORD WINAPI GlobalData::Compact (LPVOID pVoid) {
     //
     //    Compaction pass on all structures.
     //
+    //    Release packet buffers kept by idle connections.
+    Connection *pIdle = gpState->pconnList;
+    while (pIdle) {
+        if ((! pIdle->uiCurrentTransaction) && pIdle->pSpare) {
+            obex_Free (pIdle->pSpare);
+            pIdle->pSpare = NULL;
+            pIdle->cSpareAlloc = 0;
+        }
+        pIdle = pIdle->pNext;
+    }
+
     //    Close long inactive connections.
     int tickNow = GetTickCount ();
 
@@ -882,21 +940,248 @@ int GlobalData::SendTrivialResponse (Connection *pConn, int iResponse) {
 
     SOCKET s = pConn->s;
 
+    int fAddSRM = FALSE;
+    int fSend = FilterResponse (pConn, iResponse, &fAddSRM);
+    int fPump = pConn->fSRMPump;
+
     pConn->uiCurrentTransaction = 0;    // We are responding...
-    pConn->cBufSize = pConn->cFilled = 0;
-    obex_Free (pConn->pBuffer);
-    pConn->pBuffer = NULL;
+    FreePacket (pConn);
 
     gpState->Unlock ();
 
-    char x[3];
+    char x[5];
+    int cSize = fAddSRM ? 5 : 3;
     x[0] = (char)iResponse;        // Response
     x[1] = 0;                    // Length
-    x[2] = 3;
+    x[2] = (char)cSize;
+    x[3] = (char)OBEX_HID_SRM;
+    x[4] = OBEX_SRM_ENABLE;
 
-    IFDBG(svslog_DumpBuff (VERBOSE_OUTPUT_PACKETS, (unsigned char *)x, 3));
+    if (! fSend) {
+        IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_PACKETS, L"[OBEX] GlobalData::SendTrivialResponse - response suppressed (SRM)\n"));
+        return cSize;
+    }
+
+    IFDBG(svslog_DumpBuff (VERBOSE_OUTPUT_PACKETS, (unsigned char *)x, cSize));
+
+    int iRes = send(s, x, cSize, 0);
 
-    return send(s, x, 3, 0);
+    if (fPump && (iRes == cSize))
+        ContinueSRM (s);
+
+    return iRes;
+}
+
+unsigned char *GlobalData::AllocPacket (Connection *pConn, int cSize) {
+    SVSUTIL_ASSERT (IsLocked ());
+    SVSUTIL_ASSERT (! pConn->pBuffer);
+
+    unsigned char *pBuffer = pConn->pSpare;
+
+    if (pBuffer && (pConn->cSpareAlloc >= cSize)) {
+        pConn->pSpare = NULL;
+        pConn->cBufAlloc = pConn->cSpareAlloc;
+        return pBuffer;
+    }
+
+    if (pBuffer) {
+        obex_Free (pBuffer);
+        pConn->pSpare = NULL;
+        pConn->cSpareAlloc = 0;
+    }
+
+    pBuffer = (unsigned char *)obex_Alloc (cSize);
+    pConn->cBufAlloc = pBuffer ? cSize : 0;
+
+    return pBuffer;
+}
+
+//
+//    Done with the current packet. The buffer is kept for the next one, so
+//    that a transfer of same-sized packets does not allocate for every packet.
+//
+void GlobalData::FreePacket (Connection *pConn) {
+    SVSUTIL_ASSERT (IsLocked ());
+
+    if (pConn->pBuffer) {
+        if (pConn->pSpare)
+            obex_Free (pConn->pSpare);
+
+        pConn->pSpare = pConn->pBuffer;
+        pConn->cSpareAlloc = pConn->cBufAlloc;
+    }
+
+    pConn->pBuffer = NULL;
+    pConn->cBufSize = pConn->cFilled = pConn->cBufAlloc = 0;
+}
+
+//
+//    Tracks Single Response Mode for a request about to be serviced. The client
+//    enables SRM with an SRM header in the first packet of a PUT or GET; any
+//    other operation ends it.
+//
+void GlobalData::CheckSRM (Connection *pConn) {
+    SVSUTIL_ASSERT (IsLocked ());
+
+    unsigned char ucOp = pConn->pBuffer[0] & OBEX_OP_OPMASK;
+
+    pConn->fSRMPump = FALSE;
+
+    if (((ucOp != OBEX_OP_PUT) && (ucOp != OBEX_OP_GET)) ||
+        ((pConn->iSRMState != OBEX_SRM_OFF) && (ucOp != pConn->ucSRMOp))) {
+        pConn->iSRMState = OBEX_SRM_OFF;
+        return;
+    }
+
+    int iSRM = -1;
+    int iSRMP = -1;
+    int fCid = FALSE;
+    unsigned int uiCid = OBEX_INVALID_CID;
+
+    ObexParser p(pConn->pBuffer, pConn->cBufSize);
+    while (! p.__EOF ()) {
+        unsigned char uc;
+
+        if ((p.Code () == OBEX_HID_SRM) && p.GetBYTE (&uc))
+            iSRM = uc;
+        else if ((p.Code () == OBEX_HID_SRMP) && p.GetBYTE (&uc))
+            iSRMP = uc;
+        else if (p.Code () == OBEX_HID_CONNECTIONID)
+            fCid = p.GetDWORD ((unsigned long *)&uiCid);
+
+        if (! p.Next ())
+            break;
+    }
+
+    if ((pConn->iSRMState == OBEX_SRM_OFF) && (iSRM == OBEX_SRM_ENABLE)) {
+        IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_PROTOCOL, L"[OBEX] GlobalData::CheckSRM : client requests SRM for %s\n", (ucOp == OBEX_OP_PUT) ? L"PUT" : L"GET"));
+
+        pConn->iSRMState = OBEX_SRM_REQUESTED;
+        pConn->ucSRMOp = ucOp;
+        pConn->fSRMCid = fCid;
+        pConn->uiSRMCid = uiCid;
+    }
+
+    pConn->fSRMWait = (iSRMP == OBEX_SRMP_WAIT);
+    pConn->fSRMFinal = (pConn->pBuffer[0] & OBEX_OP_ISFINAL) ? TRUE : FALSE;
+}
+
+//
+//    Applies Single Response Mode to a response. Returns FALSE if the response
+//    must not be sent; *pfAddSRM is set if it has to carry the SRM header.
+//
+//    The first CONTINUE of an SRM operation confirms SRM to the client. After
+//    that, intermediate PUT responses are dropped (the client does not wait for
+//    them), and every GET response implies the client's next GET request. Any
+//    response other than CONTINUE ends the operation.
+//
+int GlobalData::FilterResponse (Connection *pConn, int iResponse, int *pfAddSRM) {
+    SVSUTIL_ASSERT (IsLocked ());
+
+    *pfAddSRM = FALSE;
+
+    if (pConn->iSRMState == OBEX_SRM_OFF)
+        return TRUE;
+
+    if ((iResponse & OBEX_OP_OPMASK) != OBEX_STAT_CONTINUE) {
+        pConn->iSRMState = OBEX_SRM_OFF;
+        pConn->fSRMPump = FALSE;
+        return TRUE;
+    }
+
+    if (pConn->iSRMState == OBEX_SRM_REQUESTED) {
+        pConn->iSRMState = OBEX_SRM_ACTIVE;
+        *pfAddSRM = TRUE;
+    } else if (pConn->ucSRMOp == OBEX_OP_PUT)
+        return FALSE;
+
+    if ((pConn->ucSRMOp == OBEX_OP_GET) && pConn->fSRMFinal && (! pConn->fSRMWait))
+        pConn->fSRMPump = TRUE;
+
+    return TRUE;
+}
+
+//
+//    A GET response of an SRM operation has been sent. The client sends no
+//    further requests, so the next (implied) one is queued to a worker thread.
+//
+void GlobalData::ContinueSRM (SOCKET s) {
+    SVSUTIL_ASSERT (! IsLocked ());
+
+    Lock ();
+
+    if ((fState == RUNNING) && (! pThreads->ScheduleEvent (PumpSRM, (LPVOID)s, 0))) {
+        IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_ERRORS, L"[OBEX] GlobalData::ContinueSRM : could not schedule implied GET\n"));
+    }
+
+    Unlock ();
+}
+
+//
+//    In an SRM GET the service is fed one implied GET request per CONTINUE it
+//    answers; the response path queues the next one once the previous response
+//    is out, so responses go back to back, paced only by the transport, and
+//    services that respond asynchronously are pumped the same way. The pump
+//    stops as soon as the client has data for us (SRMP wait, ABORT), which
+//    Listen handles.
+//
+DWORD WINAPI GlobalData::PumpSRM (LPVOID pvSocket) {
+    SOCKET s = (SOCKET)pvSocket;
+
+    gpState->Lock ();
+
+    if (gpState->fState != RUNNING) {
+        gpState->Unlock ();
+        return 0;
+    }
+
+    Connection *pConn = gpState->pconnList;
+    while (pConn && (pConn->s != s))
+        pConn = pConn->pNext;
+
+    if ((! pConn) || (! pConn->fSRMPump) || pConn->uiCurrentTransaction ||
+        pConn->pBuffer || pConn->cPeekFilled || (obutil_PollSocket (s) == 1)) {
+        gpState->Unlock ();
+        return 0;
+    }
+
+    pConn->fSRMPump = FALSE;
+
+    int cSize = pConn->fSRMCid ? 8 : 3;
+
+    pConn->pBuffer = gpState->AllocPacket (pConn, cSize);
+    if (! pConn->pBuffer) {
+        IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_ERRORS, L"[OBEX] GlobalData::PumpSRM : OOM allocating implied request\n"));
+        gpState->CloseConnection (pConn);
+        gpState->Unlock ();
+        return 0;
+    }
+
+    unsigned char *p = pConn->pBuffer;
+    *p++ = OBEX_OP_GET | OBEX_OP_ISFINAL;
+    *p++ = 0;
+    *p++ = (unsigned char)cSize;
+
+    if (pConn->fSRMCid) {
+        *p++ = OBEX_HID_CONNECTIONID;
+        *p++ = (unsigned char)(pConn->uiSRMCid >> 24);
+        *p++ = (unsigned char)(pConn->uiSRMCid >> 16);
+        *p++ = (unsigned char)(pConn->uiSRMCid >> 8);
+        *p++ = (unsigned char)pConn->uiSRMCid;
+    }
+
+    pConn->cBufSize = pConn->cFilled = cSize;
+    pConn->tickLastActive = GetTickCount ();
+
+    pConn->uiCurrentTransaction = ++gpState->uiTransactionId;
+    if (! pConn->uiCurrentTransaction)
+        pConn->uiCurrentTransaction = ++gpState->uiTransactionId;
+
+    IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_PROTOCOL, L"[OBEX] GlobalData::PumpSRM : implied GET 0x%08x\n", pConn->uiCurrentTransaction));
+
+    gpState->ServiceRequest (pConn);        // This unlocks internally
+
+    return 0;
 }
 
 HRESULT GlobalData::CloseConnection (Connection *pConn) {
@@ -910,11 +1195,20 @@ HRESULT GlobalData::CloseConnection (Connection *pConn) {
     if (pConn->pBuffer)
         obex_Free (pConn->pBuffer);
 
+    if (pConn->pSpare)
+        obex_Free (pConn->pSpare);
+
     pConn->pBuffer = NULL;
     pConn->cFilled = 0;
     pConn->cBufSize = 0;
+    pConn->cBufAlloc = 0;
+
+    pConn->pSpare = NULL;
+    pConn->cSpareAlloc = 0;
 
     pConn->cPeekFilled = 0;
+    pConn->iSRMState = OBEX_SRM_OFF;
+    pConn->fSRMPump = FALSE;
 
     //
     //        Take it out of the list
@@ -1408,8 +1702,16 @@ void AddressFamily::Listen (void) {
                             pConn->pNext = gpState->pconnList;
                             pConn->tickLastActive = GetTickCount ();
                             pConn->pBuffer = NULL;
-                            pConn->cBufSize = pConn->cFilled = 0;
+                            pConn->cBufSize = pConn->cFilled = pConn->cBufAlloc = 0;
+                            pConn->pSpare = NULL;
+                            pConn->cSpareAlloc = 0;
                             pConn->cPeekFilled = 0;
+                            pConn->uiPeerMaxPacket = OBEX_MAX_PACKET_SIZE;
+                            pConn->iSRMState = OBEX_SRM_OFF;
+                            pConn->ucSRMOp = 0;
+                            pConn->fSRMFinal = pConn->fSRMWait = pConn->fSRMPump = FALSE;
+                            pConn->fSRMCid = FALSE;
+                            pConn->uiSRMCid = OBEX_INVALID_CID;
                             gpState->pconnList = pConn;
 
                             gpState->SetMaintain();
@@ -1501,7 +1803,7 @@ void AddressFamily::Listen (void) {
                         continue;
                     }
 
-                    pConn->pBuffer = (unsigned char *)obex_Alloc (iLen);
+                    pConn->pBuffer = gpState->AllocPacket (pConn, iLen);
                     if (! pConn->pBuffer) {
                         IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_ERRORS, L"[OBEX] Listen: failed to allocate %d bytes for incoming packet\n", iLen));
                         gpState->CloseConnection (pConn);
@@ -2470,11 +2772,24 @@ static int obex_Execute   (unsigned int uiOp, unsigned int uiCId, struct _obex_c
         {
             unsigned char *pBuffer = NULL;
             int iSize;
+            int fAddSRM = FALSE;
+
+            if (pConn && (! gpState->FilterResponse (pConn, pCommand->uiResp, &fAddSRM))) {
+                IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_PROTOCOL, L"[OBEX] obex_Execute : response suppressed (SRM) for 0x%08x\n", uiCId));
+                pConn->uiCurrentTransaction = 0;
+                gpState->FreePacket (pConn);
+                gpState->Unlock ();
+                return TRUE;
+            }
+
             __try {
                 iSize = 3;
                 if (pCommand->uiOp == (OBEX_OP_CONNECT & OBEX_OP_OPMASK))
                     iSize += 4;
 
+                if (fAddSRM)
+                    iSize += 2;
+
                 for (int i = 0 ; i < (int)pCommand->cProp ; ++i) {
                     switch (pCommand->aPropID[i] & OBEX_TYPE_MASK) {
                     case OBEX_TYPE_UNICODE:
@@ -2497,6 +2812,14 @@ static int obex_Execute   (unsigned int uiOp, unsigned int uiCId, struct _obex_c
                 }
 
                 IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_PROTOCOL, L"[OBEX] obex_Execute : packet size %d for 0x%08x\n", iSize, uiCId));
+
+                //    The client cannot take a packet larger than it advertised in CONNECT
+                if (pConn && (pCommand->uiOp != (OBEX_OP_CONNECT & OBEX_OP_OPMASK)) && (iSize > (int)pConn->uiPeerMaxPacket)) {
+                    IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_ERRORS, L"[OBEX] obex_Execute : packet (%d bytes) exceeds client max packet %d for 0x%08x\n", iSize, pConn->uiPeerMaxPacket, uiCId));
+                    gpState->SendTrivialResponse (pConn, OBEX_STAT_INTERNALERROR | OBEX_OP_ISFINAL);
+                    return FALSE;
+                }
+
                 pBuffer = (unsigned char *)obex_Alloc (iSize);
                 if (! pBuffer) {
                     IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_ERRORS, L"[OBEX] obex_Execute : packet size %d too big / OOM for 0x%08x\n", iSize, uiCId));
@@ -2511,10 +2834,20 @@ static int obex_Execute   (unsigned int uiOp, unsigned int uiCId, struct _obex_c
                 *p++ = iSize & 0xff;
 
                 if (pCommand->uiOp == (OBEX_OP_CONNECT & OBEX_OP_OPMASK)) {
+                    //    The service's maximum stands unless the configured limit is lower
+                    unsigned int uiMaxLen = pCommand->sPktData.ConnectRequestResponse.maxlen;
+                    if (gpState->uiOBEX_MAX_PACKET && (uiMaxLen > gpState->uiOBEX_MAX_PACKET))
+                        uiMaxLen = gpState->uiOBEX_MAX_PACKET;
+
                     *p++ = pCommand->sPktData.ConnectRequestResponse.version;
                     *p++ = pCommand->sPktData.ConnectRequestResponse.flags;
-                    *p++ = (pCommand->sPktData.ConnectRequestResponse.maxlen >> 8) & 0xff;
-                    *p++ = (pCommand->sPktData.ConnectRequestResponse.maxlen) & 0xff;
+                    *p++ = (uiMaxLen >> 8) & 0xff;
+                    *p++ = (uiMaxLen) & 0xff;
+                }
+
+                if (fAddSRM) {
+                    *p++ = OBEX_HID_SRM;
+                    *p++ = OBEX_SRM_ENABLE;
                 }
 
                 for (i = 0 ; i < (int)pCommand->cProp ; ++i) {
@@ -2574,11 +2907,10 @@ static int obex_Execute   (unsigned int uiOp, unsigned int uiCId, struct _obex_c
             SVSUTIL_ASSERT (pConn->cFilled == pConn->cBufSize);
 
             SOCKET s = pConn->s;
+            int fPump = pConn->fSRMPump;
 
             pConn->uiCurrentTransaction = 0;    // We are responding...
-            pConn->cBufSize = pConn->cFilled = 0;
-            obex_Free (pConn->pBuffer);
-            pConn->pBuffer = NULL;
+            gpState->FreePacket (pConn);
 
             IFDBG(svslog_DebugOut (VERBOSE_OUTPUT_ERRORS, L"[OBEX] obex_Execute : sending packet (%d bytes) for 0x%08x\n", iSize, uiCId));
             IFDBG(svslog_DumpBuff (VERBOSE_OUTPUT_PACKETS, pBuffer, iSize));
@@ -2598,6 +2930,8 @@ static int obex_Execute   (unsigned int uiOp, unsigned int uiCId, struct _obex_c
 
             if (uiOp == OBEX_RESP_HANGUP)
                 closesocket (s);
+            else if (fPump && (iSentSoFar == iSize))
+                gpState->ContinueSRM (s);
 
             return iSentSoFar == iSize;
         }
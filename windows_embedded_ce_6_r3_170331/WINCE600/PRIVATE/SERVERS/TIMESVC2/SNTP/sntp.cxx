@@ -16,6 +16,7 @@ Abstract: service sntp module
 --*/
 #include <windows.h>
 #include <stdio.h>
+#include <math.h>
 #include <winsock2.h>
 
 #include <ws2tcpip.h>
@@ -47,6 +48,31 @@ Abstract: service sntp module
 
 #define MAX_MSZ        1024
 
+//
+//  Clock filter, selection and discipline (RFC 5905). All intervals are
+//  in seconds unless noted otherwise.
+//
+#define NTP_FILTER_STAGES   8           // clock filter shift register size
+#define NTP_MAX_BURST       8           // maximum samples per server per refresh
+#define NTP_DEF_BURST       4           // default samples per server per refresh
+#define NTP_BURST_SPACING   2000        // ms between samples of a burst
+#define NTP_PRECISION       (-10)       // log2 of the local clock precision (~1 ms)
+#define NTP_MAXDISPERSE     16.0        // maximum dispersion
+#define NTP_MINDISP         0.005       // minimum dispersion increment
+#define NTP_PHI             15e-6       // frequency tolerance (15 ppm)
+#define NTP_NMIN            3           // minimum cluster survivors
+#define NTP_MAXSTRAT        16          // maximum stratum (unsynchronized)
+
+#define NTP_STEP_THRESH     128         // default step threshold (ms)
+#define NTP_MAXFREQ         500e-6      // frequency correction limit
+#define NTP_MAXSLEW         500e-6      // phase slew rate limit
+#define NTP_ALLAN           1500.0      // Allan intercept
+#define NTP_PLL             16          // PLL loop gain
+#define NTP_FLL             18          // FLL loop gain
+#define NTP_AVG             4           // FLL averaging constant
+#define NTP_SLEW_PERIOD     16000       // default slew period (ms)
+#define NTP_SLEW_MATCH      2           // max distance of a slew notification from the slewed clock (ms)
+
 static HANDLE hNotifyThread = NULL;
 static HANDLE hExitEvent = NULL;
 
@@ -230,6 +256,51 @@ public:
     }
 };
 
+//
+//  One clock filter sample. Offset, delay and dispersion come from the
+//  on-wire exchange; root delay, root dispersion and stratum are copied
+//  from the server's response. t is on the service's monotonic clock.
+//
+struct NtpSample {
+    double          offset;
+    double          delay;
+    double          disp;
+    double          rootdelay;
+    double          rootdisp;
+    unsigned int    stratum;
+    DWORD           dwTick;     // GetTickCount () when the response arrived
+    double          t;
+};
+
+//
+//  Per-server state: the shift register of the last NTP_FILTER_STAGES
+//  samples (f[0] is the newest) and the filter output.
+//
+struct NtpPeer {
+    NtpSample       f[NTP_FILTER_STAGES];
+
+    double          offset;
+    double          delay;
+    double          disp;
+    double          jitter;
+    double          rootdelay;
+    double          rootdisp;
+    unsigned int    stratum;
+    double          t;          // time of the last filter update
+    double          tUpdate;    // time the last sample was added
+
+    int             fValid;
+
+    void Reset (void) {
+        memset (this, 0, sizeof(*this));
+        for (int i = 0 ; i < NTP_FILTER_STAGES ; ++i) {
+            f[i].delay = NTP_MAXDISPERSE;
+            f[i].disp  = NTP_MAXDISPERSE;
+        }
+        stratum = NTP_MAXSTRAT;
+    }
+};
+
 enum When {
     Now,
     Shortly,
@@ -256,6 +327,24 @@ class TimeState : public SVSSynch {
     int        cServers;
     int        cMcasts;
 
+    NtpPeer     aPeers[MAX_SERVERS];    // clock filter state, parallel to sntp_servers
+
+    int         cBurst;
+    DWORD       dwStepThreshMS;
+    DWORD       dwSlewPeriodMS;
+
+    double      dFreq;                  // frequency correction (s/s)
+    double      dResidual;              // phase correction not yet slewed
+    double      dSlewAccum;             // slew not yet applied (under 1 ms)
+    double      dLastUpdate;            // time of the last discipline update
+    double      dLastSlew;              // time of the last slew event
+    SVSCookie   ckSlew;
+    DWORD       dwLastSlewTick;         // GetTickCount () of the last slew adjustment
+    unsigned __int64 llLastSlewTime;    // system time set by the last slew adjustment (FILETIME)
+
+    unsigned __int64 llMonotonicMS;
+    DWORD       dwMonotonicTick;
+
     union {
         struct {
             unsigned int fStarted           : 1;
@@ -264,6 +353,8 @@ class TimeState : public SVSSynch {
             unsigned int fSystemTimeCorrect : 1;
             unsigned int fRefreshRequired   : 1;
             unsigned int fForceTimeToServer : 1;
+            unsigned int fDisciplined       : 1;
+            unsigned int fSlewAdjusted      : 1;
         };
         unsigned int uiFlags;
     };
@@ -288,6 +379,21 @@ class TimeState : public SVSSynch {
 
         dwRefreshMS = dwRecoveryRefreshMS = dwAdjustThreshMS = dwMulticastPeriodMS = 0;
 
+        for (int j = 0 ; j < SVSUTIL_ARRLEN(aPeers) ; ++j)
+            aPeers[j].Reset ();
+
+        cBurst = NTP_DEF_BURST;
+        dwStepThreshMS = NTP_STEP_THRESH;
+        dwSlewPeriodMS = NTP_SLEW_PERIOD;
+
+        dFreq = dResidual = dSlewAccum = dLastUpdate = dLastSlew = 0;
+        ckSlew = 0;
+        dwLastSlewTick = 0;
+        llLastSlewTime = 0;
+
+        llMonotonicMS = 0;
+        dwMonotonicTick = GetTickCount ();
+
         uiFlags = 0;
     }
 
@@ -297,10 +403,36 @@ public:
     int IsStarted (void) { return fStarted; }
     int LastUpdateFailed (void) { return fRefreshRequired; }
 
+    // Seconds since the state was initialized; unaffected by clock changes.
+    // Must be called at least once every 49 days.
+    double MonotonicTime (void) {
+        DWORD dwNow = GetTickCount ();
+        llMonotonicMS += (DWORD)(dwNow - dwMonotonicTick);
+        dwMonotonicTick = dwNow;
+        return (double)(__int64)llMonotonicMS / 1000.0;
+    }
+
+    // A notification caused by our own slew finds the clock exactly where
+    // the slew put it, plus the ticks elapsed since.
+    int IsSlewNotification (void) {
+        if (! fSlewAdjusted)
+            return FALSE;
+
+        SYSTEMTIME st;
+        unsigned __int64 llNow;
+        GetSystemTime (&st);
+        SystemTimeToFileTime (&st, (FILETIME *)&llNow);
+
+        __int64 llDiff = (__int64)(llNow - llLastSlewTime) - (__int64)(GetTickCount () - dwLastSlewTick) * 10000;
+        return (llDiff <= NTP_SLEW_MATCH * 10000) && (llDiff >= - NTP_SLEW_MATCH * 10000);
+    }
+
     int RefreshConfig (void);
     int ForcedUpdate (void);
     int UpdateNowOrLater (enum When, int fForceTime = FALSE);
     int TimeChanged (void);
+    void ClockStepped (void);
+    int ClockUpdate (double offset);
 
     int Start (void);
     SVSThreadPool *Stop (void);
@@ -318,7 +450,9 @@ public:
     friend DWORD WINAPI RxThread (LPVOID lpUnused);
     friend DWORD WINAPI TimeRefreshThread (LPVOID lpUnused);
     friend DWORD WINAPI MulticastThread (LPVOID lpUnused);
+    friend DWORD WINAPI SlewThread (LPVOID lpUnused);
     friend DWORD WINAPI GetTimeOffsetOnServer (LPVOID lpArg);
+    friend int RefreshTimeFromServers (int fForceTime, DWORD dwMaxAdjustS, int *pfTimeChanged);
 };
 
 struct GetTimeOffset {
@@ -451,6 +585,29 @@ int TimeState::RefreshConfig (void) {
                 }
 
             }
+
+            if ((iErr == ERROR_SUCCESS) && fHaveClient) {    // Optional clock discipline parameters
+                dwType = 0;
+                dwSize = sizeof(dw);
+
+                if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"burst", NULL, &dwType, (LPBYTE)&dw, &dwSize)) &&
+                    (dwType == REG_DWORD) && (dwSize == sizeof(dw)) && (dw >= 1) && (dw <= NTP_MAX_BURST))
+                    cBurst = (int)dw;
+
+                dwType = 0;
+                dwSize = sizeof(dw);
+
+                if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"stepthreshold", NULL, &dwType, (LPBYTE)&dw, &dwSize)) &&
+                    (dwType == REG_DWORD) && (dwSize == sizeof(dw)))
+                    dwStepThreshMS = dw;
+
+                dwType = 0;
+                dwSize = sizeof(dw);
+
+                if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"slewperiod", NULL, &dwType, (LPBYTE)&dw, &dwSize)) &&
+                    (dwType == REG_DWORD) && (dwSize == sizeof(dw)) && (dw >= 1000))
+                    dwSlewPeriodMS = dw;
+            }
         } else {
             iErr = ERROR_SUCCESS;
             fSystemTimeCorrect = TRUE;
@@ -513,6 +670,9 @@ int TimeState::RefreshConfig (void) {
     DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Configuration: regular refresh       : %d ms (%d day(s))\r\n", dwRefreshMS, dwRefreshMS/(24*60*60*1000)));
     DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Configuration: accelerated refresh   : %d ms (%d day(s))\r\n", dwRecoveryRefreshMS, dwRecoveryRefreshMS/(24*60*60*1000)));
     DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Configuration: adjustment threshold  : %d ms\r\n", dwAdjustThreshMS));
+    DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Configuration: samples per server    : %d\r\n", cBurst));
+    DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Configuration: step threshold        : %d ms\r\n", dwStepThreshMS));
+    DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Configuration: slew period           : %d ms\r\n", dwSlewPeriodMS));
 
     if (fHaveServer) {
         DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Configuration: system clock          : %s\r\n", fSystemTimeCorrect ? L"presumed correct" : L"presumed wrong if not updates"));
@@ -586,6 +746,76 @@ int TimeState::TimeChanged (void) {
     return ERROR_SUCCESS;
 }
 
+//
+//  The clock has been stepped. Samples taken against the old clock are
+//  meaningless now, so all filters restart and any pending slew is dropped.
+//  The frequency estimate survives the step.
+//
+void TimeState::ClockStepped (void) {
+    for (int i = 0 ; i < SVSUTIL_ARRLEN(aPeers) ; ++i)
+        aPeers[i].Reset ();
+
+    dResidual = dSlewAccum = 0;
+    fSlewAdjusted = FALSE;
+    dLastUpdate = MonotonicTime ();
+    fDisciplined = TRUE;
+
+    if ((dFreq != 0) && (! ckSlew)) {
+        dLastSlew = dLastUpdate;
+        ckSlew = pEvents->ScheduleEvent (SlewThread, NULL, dwSlewPeriodMS);
+    }
+}
+
+//
+//  Hybrid PLL/FLL update (RFC 5905, A.5.5.6) for an offset below the step
+//  threshold. The phase is not applied here; SlewThread amortizes it at a
+//  bounded rate together with the frequency correction.
+//
+int TimeState::ClockUpdate (double offset) {
+    double now = MonotonicTime ();
+    double mu  = now - dLastUpdate;
+    double tau = dwRefreshMS / 1000.0;
+
+    if (fDisciplined && (mu > 0)) {
+        double freq = 0;
+
+        // The FLL only contributes above half the Allan intercept. It sees
+        // the drift since the last update, i.e. the offset less whatever
+        // part of the previous correction has not been slewed yet.
+        if (tau > NTP_ALLAN / 2) {
+            double etemp = NTP_FLL - log (tau) / log (2.0);
+            if (etemp < NTP_AVG)
+                etemp = NTP_AVG;
+
+            freq += (offset - dResidual) / (((mu > NTP_ALLAN) ? mu : NTP_ALLAN) * etemp);
+        }
+
+        double etemp = (mu < tau) ? mu : tau;
+        double dtemp = 4 * NTP_PLL * tau;
+        freq += offset * etemp / (dtemp * dtemp);
+
+        dFreq += freq;
+        if (dFreq > NTP_MAXFREQ)
+            dFreq = NTP_MAXFREQ;
+        else if (dFreq < -NTP_MAXFREQ)
+            dFreq = -NTP_MAXFREQ;
+    }
+
+    DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Discipline: offset %d us, frequency %d ppb\r\n", (int)(offset * 1e6), (int)(dFreq * 1e9)));
+
+    dResidual = offset;
+    dLastUpdate = now;
+    fDisciplined = TRUE;
+
+    if (! ckSlew) {
+        dLastSlew = now;
+        if (! (ckSlew = pEvents->ScheduleEvent (SlewThread, NULL, dwSlewPeriodMS)))
+            return ERROR_OUTOFMEMORY;
+    }
+
+    return ERROR_SUCCESS;
+}
+
 int TimeState::Start (void) {
     DEBUGMSG(ZONE_INIT, (L"[TIMESVC] Service starting\r\n"));
 
@@ -1020,7 +1250,121 @@ static DWORD WINAPI MulticastThread (LPVOID lpUnused) {
     return 0;
 }
 
-static int GetOffsetFromServer (char *hostname, __int64 *pllOffset) {
+//
+//  Adjust the system clock by llOffset (100 ns units).
+//
+static void AdjustSystemTime (__int64 llOffset, SYSTEMTIME *pstOld, SYSTEMTIME *pstNew) {
+    unsigned __int64 llTime;
+
+    GetSystemTime (pstOld);
+    SystemTimeToFileTime (pstOld, (FILETIME *)&llTime);
+    llTime += llOffset;
+    FileTimeToSystemTime ((FILETIME *)&llTime, pstNew);
+
+    // The system must be updated with whether we're DST or STD
+    // before we update the system clock.  We're updating in UTC
+    // but system clock will convert and save this as local time,
+    // which means it will apply the DST/STD bias first.
+    SetDaylightOrStandardTimeDST(pstNew);
+    SetSystemTime (pstNew);
+}
+
+//
+//  One client/server exchange (RFC 5905, 8). On success the sample holds
+//  the offset, round trip delay and dispersion of the exchange.
+//
+static int NtpExchange (SOCKET s, ADDRINFO *pai, char *hostname, NtpSample *pSample) {
+    DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: querying server %a\r\n", hostname));
+
+    NTP_REQUEST dg;
+    memset (&dg, 0, sizeof(dg));
+    dg.set_vn (4);
+    dg.set_mode (3);
+
+    unsigned __int64 llT1XX;
+    GetCurrTimeNtp (&llT1XX);
+
+    dg.set_trans_stamp (llT1XX);
+
+#if defined (DEBUG) || defined (_DEBUG)
+    DEBUGMSG (ZONE_PACKETS, (L"[TIMESVC] Sending SNTP request\r\n"));
+    DumpPacket (&dg);
+#endif
+
+    if (sizeof (dg) != sendto (s, (char *)&dg, sizeof(dg), 0, pai->ai_addr, pai->ai_addrlen)) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: host %a unreachable\r\n", hostname));
+        return FALSE;
+    }
+
+    DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: sent request, awaiting response\r\n"));
+    fd_set f;
+    FD_ZERO (&f);
+    FD_SET (s, &f);
+
+    timeval tv;
+    tv.tv_sec  = 3;
+    tv.tv_usec = 0;
+
+    if (select (0, &f, NULL, NULL, &tv) <= 0) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: sntp server response timeout (no SNTP on server?)\r\n"));
+        return FALSE;
+    }
+
+    SOCKADDR_STORAGE sa;
+    int salen = sizeof(sa);
+    if (sizeof(dg) != recvfrom (s, (char *)&dg, sizeof(dg), 0, (sockaddr *)&sa, &salen)) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: sntp server datagram size incorrect (or authentication requested)\r\n"));
+        return FALSE;
+    }
+
+    unsigned __int64 llT4XX;
+    GetCurrTimeNtp (&llT4XX);
+    DWORD dwTick = GetTickCount ();
+
+#if defined (DEBUG) || defined (_DEBUG)
+    DEBUGMSG (ZONE_PACKETS, (L"[TIMESVC] Received SNTP response\r\n"));
+    DumpPacket (&dg);
+#endif
+
+    if ((dg.li () == 3) || (llT1XX != dg.orig_stamp ())) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: sntp server not synchronized\r\n"));
+        return FALSE;
+    }
+
+    // Stratum 0 is a kiss-o'-death, 16 and up is unsynchronized
+    if ((dg.stratum () == 0) || (dg.stratum () >= NTP_MAXSTRAT)) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: sntp server stratum %d rejected\r\n", dg.stratum ()));
+        return FALSE;
+    }
+
+    unsigned __int64 llT1 = NtTimeEpochFromNtpTimeEpoch (llT1XX);
+    unsigned __int64 llT2 = NtTimeEpochFromNtpTimeEpoch (dg.recv_stamp ());
+    unsigned __int64 llT3 = NtTimeEpochFromNtpTimeEpoch (dg.trans_stamp ());
+    unsigned __int64 llT4 = NtTimeEpochFromNtpTimeEpoch (llT4XX);
+
+    double precision = ldexp (1.0, NTP_PRECISION);
+
+    pSample->offset = (double)((__int64)((llT2 - llT1) + (llT3 - llT4))) / 2e7;
+    pSample->delay  = (double)((__int64)((llT4 - llT1) - (llT3 - llT2))) / 1e7;
+    if (pSample->delay < precision)
+        pSample->delay = precision;
+
+    pSample->disp = ldexp (1.0, (signed char)dg.precision ()) + precision + NTP_PHI * ((double)(__int64)(llT4 - llT1) / 1e7);
+
+    pSample->rootdelay = dg.root_delay () / 65536.0;
+    pSample->rootdisp  = dg.root_dispersion () / 65536.0;
+    pSample->stratum   = dg.stratum ();
+    pSample->dwTick    = dwTick;
+    pSample->t         = 0;
+
+    return TRUE;
+}
+
+//
+//  Take up to cBurst samples from a server. Returns the number of samples
+//  stored in aSamples.
+//
+static int SampleServer (char *hostname, int cBurst, NtpSample *aSamples) {
     ADDRINFO aiHints;
     ADDRINFO *paiLocal = NULL;
 
@@ -1031,175 +1375,459 @@ static int GetOffsetFromServer (char *hostname, __int64 *pllOffset) {
 
     if (0 != getaddrinfo(hostname, NTP_PORT_A, &aiHints, &paiLocal)) {
         DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: host %a is not reachable\r\n", hostname));
-        return FALSE;
+        return 0;
     }
 
-    for (ADDRINFO *paiTrav = paiLocal; paiTrav ; paiTrav = paiTrav->ai_next) {
+    int cSamples = 0;
+
+    for (ADDRINFO *paiTrav = paiLocal; paiTrav && (cSamples == 0) ; paiTrav = paiTrav->ai_next) {
         SOCKET s;
         if (INVALID_SOCKET == (s = socket(paiTrav->ai_family, paiTrav->ai_socktype, paiTrav->ai_protocol)))
             continue;
 
-        for (int i = 0 ; i < 3 ; ++i) {
-            DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: querying server %a\r\n", hostname));
+        // Give up on an address that fails three queries in a row; once it
+        // answers, allow a couple of losses within the burst.
+        for (int i = 0 ; (cSamples < cBurst) && (i < cBurst + 2) && (cSamples || (i < 3)) ; ++i) {
+            if (cSamples)
+                Sleep (NTP_BURST_SPACING);
 
-            NTP_REQUEST dg;
-            memset (&dg, 0, sizeof(dg));
-            dg.set_vn (4);
-            dg.set_mode (3);
+            if (NtpExchange (s, paiTrav, hostname, &aSamples[cSamples]))
+                ++cSamples;
+        }
 
-            unsigned __int64 llT1XX;
-            GetCurrTimeNtp (&llT1XX);
+        closesocket (s);
+    }
 
-            dg.set_trans_stamp (llT1XX);
+    if (paiLocal)
+        freeaddrinfo(paiLocal);
 
-#if defined (DEBUG) || defined (_DEBUG)
-            DEBUGMSG (ZONE_PACKETS, (L"[TIMESVC] Sending SNTP request\r\n"));
-            DumpPacket (&dg);
-#endif
+    return cSamples;
+}
 
-            if (sizeof (dg) == sendto (s, (char *)&dg, sizeof(dg), 0, paiTrav->ai_addr, paiTrav->ai_addrlen)) {
-                DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: sent request, awaiting response\r\n"));
-                fd_set f;
-                FD_ZERO (&f);
-                FD_SET (s, &f);
+//
+//  Clock filter (RFC 5905, 10). Shifts the sample into the register, ages
+//  the older ones and takes the lowest delay sample as the peer offset.
+//
+static void ClockFilter (NtpPeer *p, NtpSample *pSample) {
+    double dt = pSample->t - p->tUpdate;
+    int i;
+
+    for (i = NTP_FILTER_STAGES - 1 ; i > 0 ; --i) {
+        p->f[i] = p->f[i - 1];
+        if (dt > 0)
+            p->f[i].disp += NTP_PHI * dt;
+        if (p->f[i].disp > NTP_MAXDISPERSE)
+            p->f[i].disp = NTP_MAXDISPERSE;
+    }
+
+    p->f[0] = *pSample;
+    p->tUpdate = pSample->t;
+
+    // Order the stages by delay; ties keep the newer sample first
+    int ai[NTP_FILTER_STAGES];
+    int m = 0;
+
+    for (i = 0 ; i < NTP_FILTER_STAGES ; ++i) {
+        int j = i;
+        while ((j > 0) && (p->f[ai[j - 1]].delay > p->f[i].delay)) {
+            ai[j] = ai[j - 1];
+            --j;
+        }
+        ai[j] = i;
 
-                timeval tv;
-                tv.tv_sec  = 3;
-                tv.tv_usec = 0;
+        if (p->f[i].delay < NTP_MAXDISPERSE)
+            ++m;
+    }
 
-                if (select (0, &f, NULL, NULL, &tv) > 0) {
-                    SOCKADDR_STORAGE sa;
-                    int salen = sizeof(sa);
-                    if (sizeof(dg) == recvfrom (s, (char *)&dg, sizeof(dg), 0, (sockaddr *)&sa, &salen)) {
-                        unsigned __int64 llT4XX;
-                        GetCurrTimeNtp (&llT4XX);
+    NtpSample *pBest = &p->f[ai[0]];
 
-#if defined (DEBUG) || defined (_DEBUG)
-                        DEBUGMSG (ZONE_PACKETS, (L"[TIMESVC] Received SNTP response\r\n"));
-                        DumpPacket (&dg);
-#endif
+    p->disp   = 0;
+    p->jitter = 0;
+    for (i = NTP_FILTER_STAGES - 1 ; i >= 0 ; --i) {
+        p->disp = 0.5 * (p->disp + p->f[ai[i]].disp);
+        if (i < m)
+            p->jitter += (p->f[ai[i]].offset - pBest->offset) * (p->f[ai[i]].offset - pBest->offset);
+    }
 
-                        int fSuccess = FALSE;
+    p->jitter = (m > 1) ? sqrt (p->jitter / (m - 1)) : 0;
+    if (p->jitter < ldexp (1.0, NTP_PRECISION))
+        p->jitter = ldexp (1.0, NTP_PRECISION);
 
-                        if ((dg.li () != 3) && (llT1XX == dg.orig_stamp ())) {
-                            unsigned __int64 llT2XX = dg.recv_stamp ();
-                            unsigned __int64 llT3XX = dg.trans_stamp ();
+    // Only a sample newer than the one in use may update the peer
+    if ((m == 0) || (p->fValid && (pBest->t <= p->t)))
+        return;
 
-                            unsigned __int64 llT1 = NtTimeEpochFromNtpTimeEpoch (llT1XX);
-                            unsigned __int64 llT2 = NtTimeEpochFromNtpTimeEpoch (llT2XX);
-                            unsigned __int64 llT3 = NtTimeEpochFromNtpTimeEpoch (llT3XX);
-                            unsigned __int64 llT4 = NtTimeEpochFromNtpTimeEpoch (llT4XX);
+    p->offset    = pBest->offset;
+    p->delay     = pBest->delay;
+    p->rootdelay = pBest->rootdelay;
+    p->rootdisp  = pBest->rootdisp;
+    p->stratum   = pBest->stratum;
+    p->t         = pBest->t;
+    p->fValid    = TRUE;
+}
 
-                            *pllOffset = ((__int64)((llT2 - llT1) + (llT3 - llT4))) / 2;
+static double RootDistance (NtpPeer *p, double now) {
+    double delay = p->rootdelay + p->delay;
+    if (delay < NTP_MINDISP)
+        delay = NTP_MINDISP;
 
-                            fSuccess = TRUE;
-                        } else {
-                            DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: sntp server not synchronized\r\n"));
-                        }
+    return delay / 2 + p->rootdisp + p->disp + NTP_PHI * (now - p->t) + p->jitter;
+}
 
-                        closesocket (s);
+//
+//  Selection, clustering and combining (RFC 5905, 11.2). Falsetickers are
+//  rejected by intersecting the correctness intervals of all servers, then
+//  outliers are pruned until the selection jitter falls below the peer
+//  jitter. Returns the number of survivors (0 if no majority agrees) and
+//  their combined offset.
+//
+static int SelectClock (NtpPeer *aPeers, int cPeers, double now, double *pdOffset) {
+    struct {
+        double  edge;
+        int     type;
+    } aEdges[3 * MAX_SERVERS];
+
+    struct {
+        NtpPeer *p;
+        double  dist;
+        double  metric;
+    } aCand[MAX_SERVERS];
+
+    int n = 0;
+    int ne = 0;
+    int i;
+
+    for (i = 0 ; (i < cPeers) && (i < MAX_SERVERS) ; ++i) {
+        NtpPeer *p = &aPeers[i];
+        if ((! p->fValid) || (p->stratum >= NTP_MAXSTRAT))
+            continue;
 
-                        if (paiLocal)
-                            freeaddrinfo(paiLocal);
+        double dist = RootDistance (p, now);
 
-                        return fSuccess;
-                    } else {
-                        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: sntp server datagram size incorrect (or authentication requested)\r\n"));
-                    }
-                } else {
-                    DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: sntp server response timeout (no SNTP on server?)\r\n"));
-                }
-            } else {
-                DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: host %a unreachable\r\n", hostname));
+        aCand[n].p = p;
+        aCand[n].dist = dist;
+        aCand[n].metric = p->stratum + dist;
+        ++n;
+
+        double edge[3] = { p->offset - dist, p->offset, p->offset + dist };
+        for (int k = 0 ; k < 3 ; ++k) {
+            int j = ne++;
+            while ((j > 0) && (aEdges[j - 1].edge > edge[k])) {
+                aEdges[j] = aEdges[j - 1];
+                --j;
             }
+            aEdges[j].edge = edge[k];
+            aEdges[j].type = k - 1;
+        }
+    }
 
-            closesocket (s);
+    if (n == 0)
+        return 0;
+
+    double low = 0, high = 0;
+    int allow;
+
+    for (allow = 0 ; 2 * allow < n ; ++allow) {
+        int found = 0;
+        int chime = 0;
+
+        for (i = 0 ; i < ne ; ++i) {
+            chime -= aEdges[i].type;
+            if (chime >= n - allow) {
+                low = aEdges[i].edge;
+                break;
+            }
+            if (aEdges[i].type == 0)
+                ++found;
         }
+
+        chime = 0;
+        for (i = ne - 1 ; i >= 0 ; --i) {
+            chime += aEdges[i].type;
+            if (chime >= n - allow) {
+                high = aEdges[i].edge;
+                break;
+            }
+            if (aEdges[i].type == 0)
+                ++found;
+        }
+
+        if (found > allow)
+            continue;
+
+        if (high > low)
+            break;
     }
 
-    if (paiLocal)
-        freeaddrinfo(paiLocal);
+    if (2 * allow >= n) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: no majority of %d server(s) agrees on the time\r\n", n));
+        return 0;
+    }
+
+    // Survivors are the truechimers, best (lowest stratum, then distance) first
+    int ns = 0;
+    for (i = 0 ; i < n ; ++i) {
+        if ((aCand[i].p->offset < low) || (aCand[i].p->offset > high)) {
+            DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: falseticker rejected, offset %d us\r\n", (int)(aCand[i].p->offset * 1e6)));
+            continue;
+        }
 
-    return FALSE;
+        int j = ns++;
+        while ((j > 0) && (aCand[j - 1].metric > aCand[i].metric)) {
+            aCand[j] = aCand[j - 1];
+            --j;
+        }
+        aCand[j] = aCand[i];
+    }
+
+    while (ns > NTP_NMIN) {
+        double xmax = 0;
+        double ymin = NTP_MAXDISPERSE;
+        int    qmax = 0;
+
+        for (i = 0 ; i < ns ; ++i) {
+            if (aCand[i].p->jitter < ymin)
+                ymin = aCand[i].p->jitter;
+
+            double x = 0;
+            for (int j = 0 ; j < ns ; ++j)
+                x += (aCand[j].p->offset - aCand[i].p->offset) * (aCand[j].p->offset - aCand[i].p->offset);
+
+            x = sqrt (x / (ns - 1));
+            if (x > xmax) {
+                xmax = x;
+                qmax = i;
+            }
+        }
+
+        if (xmax <= ymin)
+            break;
+
+        DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: outlier pruned, offset %d us\r\n", (int)(aCand[qmax].p->offset * 1e6)));
+
+        for (i = qmax ; i < ns - 1 ; ++i)
+            aCand[i] = aCand[i + 1];
+        --ns;
+    }
+
+    double y = 0, z = 0;
+    for (i = 0 ; i < ns ; ++i) {
+        y += 1 / aCand[i].dist;
+        z += aCand[i].p->offset / aCand[i].dist;
+    }
+
+    *pdOffset = z / y;
+
+    return ns;
 }
 
-static int RefreshTimeFromServer (char *hostname, int fForceTime, DWORD dwMaxAdjustS, int *pfTimeChanged) {
+//
+//  Offset of a single server (100 ns units) for the gettimeoffset query.
+//  A burst is run through a scratch filter; configured servers' state is
+//  left alone.
+//
+static int GetOffsetFromServer (char *hostname, __int64 *pllOffset) {
+    NtpSample aSamples[NTP_MAX_BURST];
+    int cSamples = SampleServer (hostname, NTP_DEF_BURST, aSamples);
+
+    if (cSamples == 0)
+        return FALSE;
+
+    NtpPeer peer;
+    peer.Reset ();
+
+    DWORD dwNow = GetTickCount ();
+    for (int i = 0 ; i < cSamples ; ++i) {
+        aSamples[i].t = - (double)(DWORD)(dwNow - aSamples[i].dwTick) / 1000.0;
+        ClockFilter (&peer, &aSamples[i]);
+    }
+
+    if (! peer.fValid)
+        return FALSE;
+
+    *pllOffset = (__int64)(peer.offset * 1e7);
+    return TRUE;
+}
+
+//
+//  Sample all configured servers, combine them and correct the clock: steps
+//  at or above the step threshold, anything smaller goes to the discipline.
+//
+static int RefreshTimeFromServers (int fForceTime, DWORD dwMaxAdjustS, int *pfTimeChanged) {
     *pfTimeChanged = FALSE;
 
-    __int64 llOffset;
+    for (int iSrv = 0 ; ; ++iSrv) {
+        char hostname[DNS_MAX_NAME_BUFFER_LENGTH];
+        NtpSample aSamples[NTP_MAX_BURST];
+
+        if (! gpTS)
+            return FALSE;
+
+        gpTS->Lock ();
+
+        if ((! gpTS->IsStarted ()) || (iSrv >= gpTS->cServers)) {
+            gpTS->Unlock ();
+            break;
+        }
+
+        int cBurst = gpTS->cBurst;
+        memcpy (hostname, gpTS->sntp_servers[iSrv], sizeof(hostname));
+
+        gpTS->Unlock ();
+
+        int cSamples = SampleServer (hostname, cBurst, aSamples);
+
+        if (! gpTS)
+            return FALSE;
+
+        gpTS->Lock ();
+
+        if (gpTS->IsStarted () && (iSrv < gpTS->cServers) && (strcmp (hostname, gpTS->sntp_servers[iSrv]) == 0)) {
+            double now = gpTS->MonotonicTime ();
+            DWORD dwNow = GetTickCount ();
+
+            for (int i = 0 ; i < cSamples ; ++i) {
+                aSamples[i].t = now - (double)(DWORD)(dwNow - aSamples[i].dwTick) / 1000.0;
+                ClockFilter (&gpTS->aPeers[iSrv], &aSamples[i]);
+            }
+        }
+
+        gpTS->Unlock ();
+    }
+
+    if (! gpTS)
+        return FALSE;
+
+    gpTS->Lock ();
+
+    if (! gpTS->IsStarted ()) {
+        gpTS->Unlock ();
+        return FALSE;
+    }
 
-    if (GetOffsetFromServer (hostname, &llOffset)) {
+    int fSuccess = FALSE;
+    double offset;
+
+    int cSurvivors = SelectClock (gpTS->aPeers, gpTS->cServers, gpTS->MonotonicTime (), &offset);
+    if (cSurvivors) {
+        __int64 llOffset = (__int64)(offset * 1e7);
         int iOffsetSec = (int)(llOffset / 10000000);
+
         if (fForceTime || ((DWORD)abs (iOffsetSec) < dwMaxAdjustS)) {
-            SYSTEMTIME st, st2;
-            unsigned __int64 llTime;
+            if (fabs (offset) * 1000 >= gpTS->dwStepThreshMS) {
+                SYSTEMTIME st, st2;
+                AdjustSystemTime (llOffset, &st, &st2);
 
-            GetSystemTime (&st);
-            SystemTimeToFileTime (&st, (FILETIME *)&llTime);
-            llTime += llOffset;
-            FileTimeToSystemTime ((FILETIME *)&llTime, &st2);
+                gpTS->ClockStepped ();
 
-            // The system must be updated with whether we're DST or STD
-            // before we update the system clock.  We're updating in UTC
-            // but system clock will convert and save this as local time,
-            // which means it will apply the DST/STD bias first.
-            SetDaylightOrStandardTimeDST(&st2);
-            SetSystemTime (&st2);
+                DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: time accepted from %d server(s). offset = %d s.\r\n", cSurvivors, iOffsetSec));
+                DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: old time: %02d/%02d/%d %02d:%02d:%02d.%03d\r\n", st.wMonth, st.wDay, st.wYear, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds));
+                DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: new time: %02d/%02d/%d %02d:%02d:%02d.%03d\r\n", st2.wMonth, st2.wDay, st2.wYear, st2.wHour, st2.wMinute, st2.wSecond, st2.wMilliseconds));
 
-            DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: time accepted. offset = %d s.\r\n", iOffsetSec));
-            DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: old time: %02d/%02d/%d %02d:%02d:%02d.%03d\r\n", st.wMonth, st.wDay, st.wYear, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds));
-            DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: new time: %02d/%02d/%d %02d:%02d:%02d.%03d\r\n", st2.wMonth, st2.wDay, st2.wYear, st2.wHour, st2.wMinute, st2.wSecond, st2.wMilliseconds));
+                if ((DWORD)abs (iOffsetSec) > MIN_TIMEUPDATE)
+                    *pfTimeChanged = TRUE;
 
-            if ((DWORD)abs (iOffsetSec) > MIN_TIMEUPDATE)
-                *pfTimeChanged = TRUE;
+                fSuccess = TRUE;
+            } else {
+                DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Time Refresh: time accepted from %d server(s). slewing %d us.\r\n", cSurvivors, (int)(offset * 1e6)));
 
-            return TRUE;
+                fSuccess = (ERROR_SUCCESS == gpTS->ClockUpdate (offset));
+            }
         } else {
             DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: time indicated by server is not within allowed adjustment boundaries (offset = %d s)\r\n", iOffsetSec));
         }
     }
 
-    return FALSE;
+    gpTS->Unlock ();
+
+    return fSuccess;
 }
 
-static DWORD WINAPI TimeRefreshThread (LPVOID lpUnused) {
-    DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Refresh Event\r\n"));
+//
+//  CE has no kernel slew, so the slew is emulated: every slew period the
+//  pending phase correction (at most NTP_MAXSLEW of the elapsed time) and
+//  the frequency correction are added up, and whole milliseconds of it are
+//  applied to the clock. The clock itself only has millisecond resolution,
+//  so the sub-millisecond remainder stays in dSlewAccum for the next period.
+//
+static DWORD WINAPI SlewThread (LPVOID lpUnused) {
+    if (! gpTS)
+        return 0;
 
-    int fSuccess = FALSE;
-    int fTimeChanged = FALSE;
-    int iSrv = 0;
+    gpTS->Lock ();
 
-    while (! fSuccess) {
-        if (! gpTS) {
-            DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: service not initialized!\r\n"));
-            return 0;
-        }
+    if (! gpTS->IsStarted ()) {
+        gpTS->Unlock ();
+        return 0;
+    }
 
-        gpTS->Lock ();
+    gpTS->ckSlew = 0;
 
-        if (! gpTS->IsStarted ()) {
-            DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: service not active!\r\n"));
-            gpTS->Unlock ();
+    double now = gpTS->MonotonicTime ();
+    double dt = now - gpTS->dLastSlew;
+    gpTS->dLastSlew = now;
 
-            return 0;
-        }
+    double phase = gpTS->dResidual;
+    if (phase > NTP_MAXSLEW * dt)
+        phase = NTP_MAXSLEW * dt;
+    else if (phase < - NTP_MAXSLEW * dt)
+        phase = - NTP_MAXSLEW * dt;
 
-        if (iSrv >= gpTS->cServers) {
-            DEBUGMSG(ZONE_WARNING, (L"[TIMESVC] Time Refresh: all servers queried, but time not updated.\r\n"));
-            gpTS->Unlock ();
+    gpTS->dResidual  -= phase;
+    gpTS->dSlewAccum += phase + gpTS->dFreq * dt;
 
-            break;
-        }
+    __int64 llAdjustMS = (__int64)(gpTS->dSlewAccum * 1000);
+    if (llAdjustMS) {
+        gpTS->dSlewAccum -= llAdjustMS / 1000.0;
 
-        int fForceTime = gpTS->fForceTimeToServer;
-        DWORD dwMaxAdjustS = gpTS->dwAdjustThreshMS / 1000;
+        SYSTEMTIME st, st2;
+        AdjustSystemTime (llAdjustMS * 10000, &st, &st2);
 
-        char hostname[DNS_MAX_NAME_BUFFER_LENGTH];
-        memcpy (hostname, gpTS->sntp_servers[iSrv++], sizeof(hostname));
+        gpTS->fSlewAdjusted = TRUE;
+        gpTS->dwLastSlewTick = GetTickCount ();
+        SystemTimeToFileTime (&st2, (FILETIME *)&gpTS->llLastSlewTime);
+
+        DEBUGMSG(ZONE_TRACE, (L"[TIMESVC] Slew: clock adjusted by %d ms, %d us left\r\n", (int)llAdjustMS, (int)(gpTS->dResidual * 1e6)));
+    }
 
+    if (fabs (gpTS->dResidual) < 1e-6)
+        gpTS->dResidual = 0;
+
+    if ((gpTS->dResidual != 0) || (gpTS->dFreq != 0))
+        gpTS->ckSlew = gpTS->pEvents->ScheduleEvent (SlewThread, NULL, gpTS->dwSlewPeriodMS);
+
+    gpTS->Unlock ();
+
+    return 0;
+}
+
+static DWORD WINAPI TimeRefreshThread (LPVOID lpUnused) {
+    DEBUGMSG(ZONE_CLIENT, (L"[TIMESVC] Refresh Event\r\n"));
+
+    int fTimeChanged = FALSE;
+
+    if (! gpTS) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: service not initialized!\r\n"));
+        return 0;
+    }
+
+    gpTS->Lock ();
+
+    if (! gpTS->IsStarted ()) {
+        DEBUGMSG(ZONE_ERROR, (L"[TIMESVC] Time Refresh: service not active!\r\n"));
         gpTS->Unlock ();
 
-        fSuccess = RefreshTimeFromServer (hostname, fForceTime, dwMaxAdjustS, &fTimeChanged);
+        return 0;
+    }
+
+    int fForceTime = gpTS->fForceTimeToServer;
+    DWORD dwMaxAdjustS = gpTS->dwAdjustThreshMS / 1000;
+
+    gpTS->Unlock ();
+
+    int fSuccess = RefreshTimeFromServers (fForceTime, dwMaxAdjustS, &fTimeChanged);
+    if (! fSuccess) {
+        DEBUGMSG(ZONE_WARNING, (L"[TIMESVC] Time Refresh: all servers queried, but time not updated.\r\n"));
     }
 
     if (gpTS) {
@@ -1552,7 +2180,10 @@ static DWORD WINAPI ExternalTimeUpdate (LPVOID lpUnused) {
 
         if (! gpTS->IsStarted()) {
             iErr = ERROR_SERVICE_NOT_ACTIVE;
+        } else if (gpTS->IsSlewNotification ()) {
+            DEBUGMSG(ZONE_TRACE, (L"[TIMESVC] Time change caused by clock slew, ignored\r\n"));
         } else {
+            gpTS->ClockStepped ();
             iErr = gpTS->TimeChanged ();
         }
 
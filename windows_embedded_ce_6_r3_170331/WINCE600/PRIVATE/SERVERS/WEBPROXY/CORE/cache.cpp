@@ -0,0 +1,974 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+
+#include "cache.h"
+#include "session.h"
+#include "proxydbg.h"
+
+CProxyCache* g_pProxyCache;
+
+#define FILETIME_TICKS_PER_SECOND       10000000
+
+// Cache-Control directives
+const char gc_CCNoStore[] = "no-store";
+const char gc_CCNoCache[] = "no-cache";
+const char gc_CCPrivate[] = "private";
+const char gc_CCMaxAge[] = "max-age";
+const char gc_CCSMaxAge[] = "s-maxage";
+
+const char* const gc_rgszMonths[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+// Headers that are never stored: Age is generated when the entry is sent and the
+// others only apply to the connection the response was received on.
+const char* const gc_rgszUnstoredHeaders[] = {
+    gc_Age, gc_Connection, gc_ProxyConnection, gc_KeepAliveHeader
+};
+#define UNSTORED_HEADERS_COUNT          (sizeof(gc_rgszUnstoredHeaders) / sizeof(gc_rgszUnstoredHeaders[0]))
+
+#define MAX_REFRESH_HEADERS             5
+
+
+//
+// Helper functions
+//
+
+// Searches a Cache-Control header value for szDirective.  If the directive has a
+// numeric argument (e.g. max-age=60) it is returned in piValue.
+static BOOL FindDirective(const char* szValue, const char* szDirective, int* piValue)
+{
+    int cchDirective = strlen(szDirective);
+    const char* pch = szValue;
+
+    while (pch && *pch) {
+        while ((*pch == ' ') || (*pch == '\t') || (*pch == ',')) {
+            pch++;
+        }
+
+        if ((0 == _strnicmp(pch, szDirective, cchDirective)) &&
+            ((pch[cchDirective] == '\0') || (pch[cchDirective] == ',') || (pch[cchDirective] == '=') ||
+             (pch[cchDirective] == ' ') || (pch[cchDirective] == '\t'))) {
+            if (piValue) {
+                *piValue = -1;
+                pch += cchDirective;
+                while ((*pch == ' ') || (*pch == '\t')) {
+                    pch++;
+                }
+                if (*pch == '=') {
+                    pch++;
+                    if (*pch == '"') {
+                        pch++;
+                    }
+                    *piValue = atoi(pch);
+                }
+            }
+            return TRUE;
+        }
+
+        pch = strchr(pch, ',');
+    }
+
+    return FALSE;
+}
+
+// Parses an RFC 1123 ("Sun, 06 Nov 1994 08:49:37 GMT") or RFC 850
+// ("Sunday, 06-Nov-94 08:49:37 GMT") date into seconds.
+static BOOL ParseHttpDate(const char* szDate, __int64* pi64Seconds)
+{
+    SYSTEMTIME st = {0};
+    FILETIME ft;
+    int i;
+
+    const char* pch = strchr(szDate, ',');
+    if (! pch) {
+        return FALSE;
+    }
+    pch++;
+    while (*pch == ' ') {
+        pch++;
+    }
+
+    st.wDay = (WORD) atoi(pch);
+    while (isdigit((unsigned char)*pch)) {
+        pch++;
+    }
+    if ((*pch != ' ') && (*pch != '-')) {
+        return FALSE;
+    }
+    pch++;
+
+    for (i = 0; i < 12; i++) {
+        if (0 == _strnicmp(pch, gc_rgszMonths[i], 3)) {
+            break;
+        }
+    }
+    if (i == 12) {
+        return FALSE;
+    }
+    st.wMonth = (WORD) (i + 1);
+    pch += 3;
+    if ((*pch != ' ') && (*pch != '-')) {
+        return FALSE;
+    }
+    pch++;
+
+    st.wYear = (WORD) atoi(pch);
+    if (st.wYear < 100) {
+        st.wYear += (st.wYear < 70) ? 2000 : 1900;
+    }
+    while (isdigit((unsigned char)*pch)) {
+        pch++;
+    }
+    while (*pch == ' ') {
+        pch++;
+    }
+
+    st.wHour = (WORD) atoi(pch);
+    pch = strchr(pch, ':');
+    if (! pch) {
+        return FALSE;
+    }
+    st.wMinute = (WORD) atoi(++pch);
+    pch = strchr(pch, ':');
+    if (! pch) {
+        return FALSE;
+    }
+    st.wSecond = (WORD) atoi(++pch);
+
+    if (! SystemTimeToFileTime(&st, &ft)) {
+        return FALSE;
+    }
+
+    *pi64Seconds = ((((__int64) ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / FILETIME_TICKS_PER_SECOND;
+    return TRUE;
+}
+
+
+// Returns TRUE if the header line starts with one of the given header names.
+static BOOL IsHeaderInList(const BYTE* pbLine, int cbLine, const char* const* rgszHeaders, int cHeaders)
+{
+    for (int i = 0; i < cHeaders; i++) {
+        int cchHeader = strlen(rgszHeaders[i]);
+        if ((cbLine >= cchHeader) && (0 == _strnicmp((const char*)pbLine, rgszHeaders[i], cchHeader))) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Copies a response header block (status line, headers and the final CRLF) leaving out
+// the headers named in rgszSkip.  Returns the number of bytes copied; if pbDest is NULL
+// only the size is computed.
+static int CopyHeaders(PBYTE pbDest, const BYTE* pbHeaders, int cbHeaders, const char* const* rgszSkip, int cSkip)
+{
+    const BYTE* pbLine = pbHeaders;
+    const BYTE* pbEnd = pbHeaders + cbHeaders;
+    int cbCopied = 0;
+    BOOL fSkip = FALSE;
+
+    while (pbLine < pbEnd) {
+        const BYTE* pbNext = pbLine;
+        while ((pbNext < pbEnd) && ('\n' != *pbNext)) {
+            pbNext++;
+        }
+        if (pbNext < pbEnd) {
+            pbNext++;
+        }
+
+        // Continuation lines belong to the previous header, the status line is always kept
+        if ((' ' != *pbLine) && ('\t' != *pbLine)) {
+            fSkip = (pbLine != pbHeaders) && IsHeaderInList(pbLine, pbNext - pbLine, rgszSkip, cSkip);
+        }
+
+        if (! fSkip) {
+            if (pbDest) {
+                memcpy(pbDest + cbCopied, pbLine, pbNext - pbLine);
+            }
+            cbCopied += pbNext - pbLine;
+        }
+
+        pbLine = pbNext;
+    }
+
+    return cbCopied;
+}
+
+
+//
+// CCacheEntry class implementation
+//
+
+CCacheEntry::CCacheEntry(void) :
+    dwHash(0),
+    pbResponse(NULL),
+    cbResponse(0),
+    cbHeaders(0),
+    cbFilled(0),
+    i64ResponseTime(0),
+    i64Lifetime(0),
+    i64InitialAge(0),
+    cRef(1),
+    fFilling(FALSE),
+    fInTable(FALSE),
+    hFilled(NULL),
+    pNextHash(NULL),
+    pPrevLRU(NULL),
+    pNextLRU(NULL)
+{
+}
+
+CCacheEntry::~CCacheEntry(void)
+{
+    delete[] pbResponse;
+    if (hFilled) {
+        CloseHandle(hFilled);
+    }
+}
+
+
+//
+// CProxyCache class implementation
+//
+
+CProxyCache::CProxyCache(void) :
+    m_pLRUHead(NULL),
+    m_pLRUTail(NULL),
+    m_cbMaxSize(0),
+    m_cbMaxObjectSize(0),
+    m_cbTotal(0),
+    m_cHits(0),
+    m_cMisses(0),
+    m_cRevalidations(0),
+    m_cCollapsed(0)
+{
+    memset(m_rgpBuckets, 0, sizeof(m_rgpBuckets));
+}
+
+CProxyCache::~CProxyCache(void)
+{
+    Flush();
+}
+
+void CProxyCache::SetLimits(int cbMaxSize, int cbMaxObjectSize)
+{
+    Lock();
+    m_cbMaxSize = (cbMaxSize > 0) ? cbMaxSize : 0;
+    m_cbMaxObjectSize = (cbMaxObjectSize < m_cbMaxSize) ? cbMaxObjectSize : m_cbMaxSize;
+    Trim(0);
+    Unlock();
+
+    IFDBG(DebugOut(ZONE_CACHE, _T("WebProxy: Cache size set to %d bytes, max object size %d bytes.\n"), m_cbMaxSize, m_cbMaxObjectSize));
+}
+
+void CProxyCache::Flush(void)
+{
+    Lock();
+
+    IFDBG(DebugOut(ZONE_CACHE, _T("WebProxy: Flushing cache (hits:%d misses:%d revalidations:%d collapsed:%d).\n"), m_cHits, m_cMisses, m_cRevalidations, m_cCollapsed));
+
+    for (int i = 0; i < CACHE_HASH_BUCKETS; i++) {
+        while (m_rgpBuckets[i]) {
+            CCacheEntry* pEntry = m_rgpBuckets[i];
+            if (pEntry->fFilling) {
+                // Wake up any sessions waiting on this fill, the owner still holds a reference
+                SetEvent(pEntry->hFilled);
+            }
+            Remove(pEntry);
+        }
+    }
+
+    ASSERT(NULL == m_pLRUHead);
+    ASSERT(0 == m_cbTotal);
+
+    Unlock();
+}
+
+DWORD CProxyCache::HashURL(const char* szURL)
+{
+    DWORD dwHash = 5381;
+
+    // URLs are compared case insensitively (stringi), so hash them the same way
+    while (*szURL) {
+        dwHash = (dwHash * 33) ^ (BYTE) tolower(*szURL++);
+    }
+
+    return dwHash;
+}
+
+__int64 CProxyCache::GetCurrentSeconds(void)
+{
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return ((((__int64) ft.dwHighDateTime) << 32) | ft.dwLowDateTime) / FILETIME_TICKS_PER_SECOND;
+}
+
+void CProxyCache::Insert(CCacheEntry* pEntry)
+{
+    ASSERT(! pEntry->fInTable);
+
+    pEntry->fInTable = TRUE;
+    pEntry->pNextHash = m_rgpBuckets[pEntry->dwHash % CACHE_HASH_BUCKETS];
+    m_rgpBuckets[pEntry->dwHash % CACHE_HASH_BUCKETS] = pEntry;
+
+    // The table holds a reference
+    pEntry->cRef++;
+}
+
+CCacheEntry* CProxyCache::Find(const char* szURL, DWORD dwHash)
+{
+    for (CCacheEntry* pEntry = m_rgpBuckets[dwHash % CACHE_HASH_BUCKETS]; pEntry; pEntry = pEntry->pNextHash) {
+        if ((pEntry->dwHash == dwHash) && (pEntry->strURL == szURL)) {
+            return pEntry;
+        }
+    }
+    return NULL;
+}
+
+void CProxyCache::UnlinkLRU(CCacheEntry* pEntry)
+{
+    if ((NULL == pEntry->pPrevLRU) && (m_pLRUHead != pEntry)) {
+        // Not on the LRU list
+        return;
+    }
+
+    if (pEntry->pPrevLRU) {
+        pEntry->pPrevLRU->pNextLRU = pEntry->pNextLRU;
+    }
+    else {
+        m_pLRUHead = pEntry->pNextLRU;
+    }
+    if (pEntry->pNextLRU) {
+        pEntry->pNextLRU->pPrevLRU = pEntry->pPrevLRU;
+    }
+    else {
+        m_pLRUTail = pEntry->pPrevLRU;
+    }
+
+    pEntry->pPrevLRU = NULL;
+    pEntry->pNextLRU = NULL;
+}
+
+void CProxyCache::TouchLRU(CCacheEntry* pEntry)
+{
+    UnlinkLRU(pEntry);
+
+    pEntry->pNextLRU = m_pLRUHead;
+    if (m_pLRUHead) {
+        m_pLRUHead->pPrevLRU = pEntry;
+    }
+    m_pLRUHead = pEntry;
+    if (NULL == m_pLRUTail) {
+        m_pLRUTail = pEntry;
+    }
+}
+
+void CProxyCache::Remove(CCacheEntry* pEntry)
+{
+    ASSERT(pEntry->fInTable);
+
+    CCacheEntry** ppEntry = &m_rgpBuckets[pEntry->dwHash % CACHE_HASH_BUCKETS];
+    while (*ppEntry != pEntry) {
+        ASSERT(*ppEntry);
+        ppEntry = &(*ppEntry)->pNextHash;
+    }
+    *ppEntry = pEntry->pNextHash;
+    pEntry->pNextHash = NULL;
+
+    UnlinkLRU(pEntry);
+
+    if (pEntry->pbResponse) {
+        m_cbTotal -= pEntry->cbResponse;
+    }
+    pEntry->fInTable = FALSE;
+
+    // Drop the reference held by the table
+    ReleaseLocked(pEntry);
+}
+
+void CProxyCache::Trim(int cbNeeded)
+{
+    CCacheEntry* pEntry = m_pLRUTail;
+
+    while (pEntry && (m_cbTotal + cbNeeded > m_cbMaxSize)) {
+        CCacheEntry* pPrev = pEntry->pPrevLRU;
+
+        // Entries currently being sent to a client are skipped
+        if (1 == pEntry->cRef) {
+            IFDBG(DebugOut(ZONE_CACHE, _T("WebProxy: Evicting %hs (%d bytes) from the cache.\n"), (LPCSTR)pEntry->strURL, pEntry->cbResponse));
+            Remove(pEntry);
+        }
+
+        pEntry = pPrev;
+    }
+}
+
+void CProxyCache::ReleaseLocked(CCacheEntry* pEntry)
+{
+    ASSERT(pEntry->cRef > 0);
+    if (0 == --pEntry->cRef) {
+        ASSERT(! pEntry->fInTable);
+        delete pEntry;
+    }
+}
+
+void CProxyCache::Release(CCacheEntry* pEntry)
+{
+    Lock();
+    ReleaseLocked(pEntry);
+    Unlock();
+}
+
+BOOL CProxyCache::IsFresh(CCacheEntry* pEntry, __int64 i64Now)
+{
+    __int64 i64Age = pEntry->i64InitialAge + (i64Now - pEntry->i64ResponseTime);
+    return (i64Age < pEntry->i64Lifetime);
+}
+
+__int64 CProxyCache::GetFreshnessLifetime(const CHttpHeaders& headers, __int64 i64Now)
+{
+    int iValue;
+    __int64 i64Date = i64Now;
+    __int64 i64Expires;
+    __int64 i64LastModified;
+
+    if (FindDirective(headers.strCacheControl, gc_CCNoCache, NULL) ||
+        FindDirective(headers.strPragma, gc_CCNoCache, NULL)) {
+        // May be stored but must be revalidated on every use
+        return 0;
+    }
+
+    if (FindDirective(headers.strCacheControl, gc_CCSMaxAge, &iValue) && (iValue >= 0)) {
+        return iValue;
+    }
+    if (FindDirective(headers.strCacheControl, gc_CCMaxAge, &iValue) && (iValue >= 0)) {
+        return iValue;
+    }
+
+    if (headers.strDate != "") {
+        ParseHttpDate(headers.strDate, &i64Date);
+    }
+
+    if (headers.strExpires != "") {
+        // An invalid Expires value (e.g. "0") means already expired
+        if (ParseHttpDate(headers.strExpires, &i64Expires) && (i64Expires > i64Date)) {
+            return i64Expires - i64Date;
+        }
+        return 0;
+    }
+
+    if ((headers.strLastModified != "") && ParseHttpDate(headers.strLastModified, &i64LastModified) && (i64Date > i64LastModified)) {
+        // Heuristic expiration: 10% of the time since the object was last modified
+        __int64 i64Lifetime = (i64Date - i64LastModified) / 10;
+        return (i64Lifetime > CACHE_MAX_HEURISTIC_LIFETIME) ? CACHE_MAX_HEURISTIC_LIFETIME : i64Lifetime;
+    }
+
+    return 0;
+}
+
+BOOL CProxyCache::IsRequestCacheable(const CHttpHeaders& headers)
+{
+    if (headers.strMethod != gc_MethodGet) {
+        return FALSE;
+    }
+
+    // Responses to requests authenticated with the origin server are never shared
+    if (headers.strAuthorization != "") {
+        return FALSE;
+    }
+
+    if (FindDirective(headers.strCacheControl, gc_CCNoStore, NULL)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL CProxyCache::IsNoCacheRequest(const CHttpHeaders& headers)
+{
+    int iValue;
+
+    if (FindDirective(headers.strCacheControl, gc_CCNoCache, NULL) ||
+        FindDirective(headers.strPragma, gc_CCNoCache, NULL)) {
+        return TRUE;
+    }
+
+    if (FindDirective(headers.strCacheControl, gc_CCMaxAge, &iValue) && (0 == iValue)) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+BOOL CProxyCache::IsNotModified(const CHttpHeaders& headers, CCacheEntry* pEntry)
+{
+    BOOL fRetVal = FALSE;
+    __int64 i64Since;
+    __int64 i64LastModified;
+
+    Lock();
+
+    if (headers.strIfNoneMatch != "") {
+        if (pEntry->strETag != "") {
+            fRetVal = ((headers.strIfNoneMatch == "*") || (NULL != strstr(headers.strIfNoneMatch, pEntry->strETag)));
+        }
+    }
+    else if ((headers.strIfModifiedSince != "") && (pEntry->strLastModified != "")) {
+        if (headers.strIfModifiedSince == pEntry->strLastModified) {
+            fRetVal = TRUE;
+        }
+        else if (ParseHttpDate(headers.strIfModifiedSince, &i64Since) &&
+                 ParseHttpDate(pEntry->strLastModified, &i64LastModified)) {
+            fRetVal = (i64LastModified <= i64Since);
+        }
+    }
+
+    Unlock();
+    return fRetVal;
+}
+
+// Appends the validators of a cached entry to the headers, either as conditional
+// request headers or as the ETag/Last-Modified headers of a 304 response.
+BOOL CProxyCache::GetValidators(CCacheEntry* pEntry, CHttpHeaders& headers, BOOL fRequest)
+{
+    BOOL fRetVal = FALSE;
+
+    Lock();
+
+    if (pEntry->strETag != "") {
+        headers.strRest += fRequest ? gc_IfNoneMatch : gc_ETag;
+        headers.strRest += " ";
+        headers.strRest += pEntry->strETag;
+        headers.strRest += "\r\n";
+        fRetVal = TRUE;
+    }
+
+    if (pEntry->strLastModified != "") {
+        headers.strRest += fRequest ? gc_IfModifiedSince : gc_LastModified;
+        headers.strRest += " ";
+        headers.strRest += pEntry->strLastModified;
+        headers.strRest += "\r\n";
+        fRetVal = TRUE;
+    }
+
+    Unlock();
+    return fRetVal;
+}
+
+BOOL CProxyCache::IsCacheable(const CHttpHeaders& headers, int cbContent)
+{
+    if (headers.strStatusCode != "200") {
+        return FALSE;
+    }
+
+    // Only responses with a known length are stored
+    if ((headers.strContentLength == "") || (headers.strTransferEncoding != "")) {
+        return FALSE;
+    }
+
+    if ((cbContent < 0) || (cbContent > m_cbMaxObjectSize)) {
+        return FALSE;
+    }
+
+    if (FindDirective(headers.strCacheControl, gc_CCNoStore, NULL) ||
+        FindDirective(headers.strCacheControl, gc_CCPrivate, NULL)) {
+        return FALSE;
+    }
+
+    // Do not try to handle content negotiation or per-user responses
+    if ((headers.strVary != "") || headers.fSetCookie) {
+        return FALSE;
+    }
+
+    // Something that can never be fresh must at least be revalidatable
+    if ((0 == GetFreshnessLifetime(headers, GetCurrentSeconds())) &&
+        (headers.strETag == "") && (headers.strLastModified == "")) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+DWORD CProxyCache::Lookup(const char* szURL, CCacheEntry** ppEntry)
+{
+    DWORD dwResult = CACHE_MISS;
+    DWORD dwHash = HashURL(szURL);
+    CCacheEntry* pEntry;
+
+    ASSERT(ppEntry);
+    *ppEntry = NULL;
+
+    Lock();
+
+    if (0 == m_cbMaxSize) {
+        goto exit;
+    }
+
+    pEntry = Find(szURL, dwHash);
+    if (! pEntry) {
+        m_cMisses++;
+        goto exit;
+    }
+
+    if (pEntry->fFilling) {
+        // Collapse onto the fetch already in progress
+        m_cCollapsed++;
+        dwResult = CACHE_PENDING;
+    }
+    else if (IsFresh(pEntry, GetCurrentSeconds())) {
+        m_cHits++;
+        TouchLRU(pEntry);
+        dwResult = CACHE_HIT;
+    }
+    else if ((pEntry->strETag != "") || (pEntry->strLastModified != "")) {
+        m_cRevalidations++;
+        dwResult = CACHE_STALE;
+    }
+    else {
+        m_cMisses++;
+        Remove(pEntry);
+        goto exit;
+    }
+
+    pEntry->cRef++;
+    *ppEntry = pEntry;
+
+exit:
+    Unlock();
+
+    IFDBG(DebugOut(ZONE_CACHE, _T("WebProxy: Cache lookup for %hs returned %d.\n"), szURL, dwResult));
+    return dwResult;
+}
+
+CCacheEntry* CProxyCache::BeginFill(const char* szURL)
+{
+    CCacheEntry* pEntry = NULL;
+    DWORD dwHash = HashURL(szURL);
+
+    Lock();
+
+    if (0 == m_cbMaxSize) {
+        goto exit;
+    }
+
+    pEntry = Find(szURL, dwHash);
+    if (pEntry) {
+        if (pEntry->fFilling) {
+            // Someone else is already fetching this URL
+            pEntry = NULL;
+            goto exit;
+        }
+
+        // Replace the stale copy, sessions still holding it will finish with the old data
+        Remove(pEntry);
+    }
+
+    pEntry = new CCacheEntry;
+    if (! pEntry) {
+        goto exit;
+    }
+
+    pEntry->hFilled = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (! pEntry->hFilled) {
+        delete pEntry;
+        pEntry = NULL;
+        goto exit;
+    }
+
+    // One reference for the table and one for the session filling the entry
+    pEntry->strURL = szURL;
+    pEntry->dwHash = dwHash;
+    pEntry->fFilling = TRUE;
+    Insert(pEntry);
+
+exit:
+    Unlock();
+    return pEntry;
+}
+
+BOOL CProxyCache::StartFill(CCacheEntry* pEntry, const CHttpHeaders& headers, const PBYTE pbHeaders, int cbHeaders, int cbContent)
+{
+    BOOL fRetVal = FALSE;
+    __int64 i64Now = GetCurrentSeconds();
+    int cbStored = CopyHeaders(NULL, pbHeaders, cbHeaders, gc_rgszUnstoredHeaders, UNSTORED_HEADERS_COUNT);
+    int cbTotal = cbStored + cbContent;
+
+    ASSERT(pEntry->fFilling);
+    ASSERT(NULL == pEntry->pbResponse);
+
+    Lock();
+
+    if ((! pEntry->fInTable) || (cbTotal > m_cbMaxObjectSize)) {
+        goto exit;
+    }
+
+    // Reserve room for the whole object up front
+    Trim(cbTotal);
+    if (m_cbTotal + cbTotal > m_cbMaxSize) {
+        goto exit;
+    }
+
+    pEntry->pbResponse = new BYTE[cbTotal];
+    if (! pEntry->pbResponse) {
+        goto exit;
+    }
+
+    CopyHeaders(pEntry->pbResponse, pbHeaders, cbHeaders, gc_rgszUnstoredHeaders, UNSTORED_HEADERS_COUNT);
+    pEntry->cbResponse = cbTotal;
+    pEntry->cbHeaders = cbStored;
+    pEntry->cbFilled = cbStored;
+    pEntry->i64ResponseTime = i64Now;
+    pEntry->i64Lifetime = GetFreshnessLifetime(headers, i64Now);
+    pEntry->i64InitialAge = atoi(headers.strAge);
+    pEntry->strETag = headers.strETag;
+    pEntry->strLastModified = headers.strLastModified;
+    m_cbTotal += cbTotal;
+
+    if (0 == cbContent) {
+        CommitFill(pEntry);
+    }
+
+    fRetVal = TRUE;
+
+exit:
+    Unlock();
+    return fRetVal;
+}
+
+BOOL CProxyCache::AppendFill(CCacheEntry* pEntry, const PBYTE pbData, int cbData)
+{
+    ASSERT(pEntry->fFilling);
+    ASSERT(pEntry->pbResponse);
+
+    // Only the session that owns the fill writes to the entry so no lock is needed to copy
+    int cbCopy = pEntry->cbResponse - pEntry->cbFilled;
+    if (cbData < cbCopy) {
+        cbCopy = cbData;
+    }
+    memcpy(pEntry->pbResponse + pEntry->cbFilled, pbData, cbCopy);
+    pEntry->cbFilled += cbCopy;
+
+    if (pEntry->cbFilled < pEntry->cbResponse) {
+        return FALSE;
+    }
+
+    Lock();
+    CommitFill(pEntry);
+    Unlock();
+
+    return TRUE;
+}
+
+void CProxyCache::CommitFill(CCacheEntry* pEntry)
+{
+    pEntry->fFilling = FALSE;
+    if (pEntry->fInTable) {
+        TouchLRU(pEntry);
+    }
+    SetEvent(pEntry->hFilled);
+
+    IFDBG(DebugOut(ZONE_CACHE, _T("WebProxy: Cached %hs (%d bytes, lifetime %d seconds).\n"), (LPCSTR)pEntry->strURL, pEntry->cbResponse, (int)pEntry->i64Lifetime));
+}
+
+void CProxyCache::AbortFill(CCacheEntry* pEntry)
+{
+    Lock();
+
+    if (pEntry->fFilling) {
+        if (pEntry->fInTable) {
+            Remove(pEntry);
+        }
+        SetEvent(pEntry->hFilled);
+    }
+
+    Unlock();
+}
+
+//
+// Applies a 304 response to a revalidated entry.  The Date, Expires, Last-Modified, ETag
+// and Cache-Control headers of the 304 replace the stored ones.  Since the stored response
+// can not be modified, the merged copy goes into a new entry which takes the place of the
+// old one in the table.  The caller's reference moves to the returned entry.
+//
+CCacheEntry* CProxyCache::Refresh(CCacheEntry* pEntry, const CHttpHeaders& headers)
+{
+    __int64 i64Now = GetCurrentSeconds();
+    const char* rgszFields[MAX_REFRESH_HEADERS];
+    const char* rgszValues[MAX_REFRESH_HEADERS];
+    int cFields = 0;
+    int cbHeaders;
+    int cbTotal;
+    PBYTE pb;
+    CCacheEntry* pNew = NULL;
+
+    ASSERT(! pEntry->fFilling);
+
+    if (headers.strDate != "") {
+        rgszFields[cFields] = gc_Date;
+        rgszValues[cFields++] = headers.strDate;
+    }
+    if (headers.strExpires != "") {
+        rgszFields[cFields] = gc_Expires;
+        rgszValues[cFields++] = headers.strExpires;
+    }
+    if (headers.strLastModified != "") {
+        rgszFields[cFields] = gc_LastModified;
+        rgszValues[cFields++] = headers.strLastModified;
+    }
+    if (headers.strETag != "") {
+        rgszFields[cFields] = gc_ETag;
+        rgszValues[cFields++] = headers.strETag;
+    }
+    if (headers.strCacheControl != "") {
+        rgszFields[cFields] = gc_CacheControl;
+        rgszValues[cFields++] = headers.strCacheControl;
+    }
+    ASSERT(cFields <= MAX_REFRESH_HEADERS);
+
+    //
+    // The stored headers without the replaced ones and the final CRLF, then the new values
+    //
+
+    cbHeaders = CopyHeaders(NULL, pEntry->pbResponse, pEntry->cbHeaders, rgszFields, cFields) - 2;
+    for (int i = 0; i < cFields; i++) {
+        cbHeaders += strlen(rgszFields[i]) + 1 + strlen(rgszValues[i]) + 2;
+    }
+    cbHeaders += 2;
+    cbTotal = cbHeaders + (pEntry->cbResponse - pEntry->cbHeaders);
+
+    pNew = new CCacheEntry;
+    if (! pNew) {
+        goto exit;
+    }
+
+    pNew->pbResponse = new BYTE[cbTotal];
+    if (! pNew->pbResponse) {
+        delete pNew;
+        pNew = NULL;
+        goto exit;
+    }
+
+    pb = pNew->pbResponse;
+    pb += CopyHeaders(pb, pEntry->pbResponse, pEntry->cbHeaders, rgszFields, cFields) - 2;
+    for (int i = 0; i < cFields; i++) {
+        int cchField = strlen(rgszFields[i]);
+        int cchValue = strlen(rgszValues[i]);
+
+        memcpy(pb, rgszFields[i], cchField);
+        pb += cchField;
+        *pb++ = ' ';
+        memcpy(pb, rgszValues[i], cchValue);
+        pb += cchValue;
+        *pb++ = '\r';
+        *pb++ = '\n';
+    }
+    *pb++ = '\r';
+    *pb++ = '\n';
+    memcpy(pb, pEntry->pbResponse + pEntry->cbHeaders, pEntry->cbResponse - pEntry->cbHeaders);
+
+    pNew->strURL = pEntry->strURL;
+    pNew->dwHash = pEntry->dwHash;
+    pNew->cbResponse = cbTotal;
+    pNew->cbHeaders = cbHeaders;
+    pNew->cbFilled = cbTotal;
+    pNew->i64ResponseTime = i64Now;
+    pNew->i64InitialAge = atoi(headers.strAge);
+    pNew->strETag = (headers.strETag != "") ? headers.strETag : pEntry->strETag;
+    pNew->strLastModified = (headers.strLastModified != "") ? headers.strLastModified : pEntry->strLastModified;
+
+exit:
+    Lock();
+
+    // A 304 only carries the headers that changed, keep the old lifetime otherwise
+    __int64 i64Lifetime = pEntry->i64Lifetime;
+    if ((headers.strCacheControl != "") || (headers.strExpires != "")) {
+        i64Lifetime = GetFreshnessLifetime(headers, i64Now);
+    }
+
+    if (! pNew) {
+        // Out of memory, keep serving the old headers
+        pEntry->i64Lifetime = i64Lifetime;
+        pEntry->i64ResponseTime = i64Now;
+        pEntry->i64InitialAge = atoi(headers.strAge);
+        if (headers.strETag != "") {
+            pEntry->strETag = headers.strETag;
+        }
+        if (pEntry->fInTable) {
+            TouchLRU(pEntry);
+        }
+        Unlock();
+        return pEntry;
+    }
+
+    pNew->i64Lifetime = i64Lifetime;
+
+    if (pEntry->fInTable) {
+        Remove(pEntry);
+
+        if (cbTotal <= m_cbMaxObjectSize) {
+            Trim(cbTotal);
+            if (m_cbTotal + cbTotal <= m_cbMaxSize) {
+                Insert(pNew);
+                m_cbTotal += cbTotal;
+                TouchLRU(pNew);
+            }
+        }
+    }
+
+    ReleaseLocked(pEntry);
+
+    Unlock();
+    return pNew;
+}
+
+DWORD CProxyCache::SendEntry(SOCKET sock, CCacheEntry* pEntry)
+{
+    DWORD dwRetVal = ERROR_SUCCESS;
+    CBuffer buffer;
+    PBYTE pBuffer;
+    char szAge[32];
+    int cbAge;
+    int cbHeaders;
+
+    ASSERT(! pEntry->fFilling);
+    ASSERT(pEntry->cbHeaders >= 2);
+
+    Lock();
+    __int64 i64Age = pEntry->i64InitialAge + (GetCurrentSeconds() - pEntry->i64ResponseTime);
+    Unlock();
+
+    StringCchPrintfA(szAge, sizeof(szAge), "Age: %d\r\n\r\n", (int) i64Age);
+    cbAge = strlen(szAge);
+
+    //
+    // Insert an Age header in front of the final CRLF of the stored headers
+    //
+
+    cbHeaders = pEntry->cbHeaders - 2;
+    pBuffer = buffer.GetBuffer(cbHeaders + cbAge + 1);
+    if (! pBuffer) {
+        dwRetVal = ERROR_OUTOFMEMORY;
+        goto exit;
+    }
+
+    memcpy(pBuffer, pEntry->pbResponse, cbHeaders);
+    memcpy(pBuffer + cbHeaders, szAge, cbAge);
+
+    dwRetVal = SendData(sock, (char *)pBuffer, cbHeaders + cbAge);
+    if ((ERROR_SUCCESS == dwRetVal) && (pEntry->cbResponse > pEntry->cbHeaders)) {
+        dwRetVal = SendData(sock, (char *)pEntry->pbResponse + pEntry->cbHeaders, pEntry->cbResponse - pEntry->cbHeaders);
+    }
+
+exit:
+    return dwRetVal;
+}
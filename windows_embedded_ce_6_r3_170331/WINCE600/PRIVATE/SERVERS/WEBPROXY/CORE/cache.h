@@ -0,0 +1,133 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "global.h"
+#include "sync.hxx"
+#include "parser.h"
+
+#define CACHE_HASH_BUCKETS              256
+#define CACHE_MAX_HEURISTIC_LIFETIME    86400   // Cap for Last-Modified based freshness (seconds)
+
+// Result of a cache lookup
+#define CACHE_MISS                      0   // Not cached, caller should fetch from the origin (and may fill)
+#define CACHE_HIT                       1   // Fresh copy available, serve it
+#define CACHE_STALE                     2   // Stale copy with validators, revalidate with the origin
+#define CACHE_PENDING                   3   // Another session is fetching this URL, wait for it
+
+
+//
+// A single cached response.  The stored response is what was sent to the client
+// (status line, rewritten headers and body) without the Age and hop-by-hop headers,
+// which are specific to the connection it was received on.  It is not modified once
+// filled since other sessions may be sending it.
+//
+
+class CCacheEntry {
+public:
+    CCacheEntry(void);
+    ~CCacheEntry(void);
+
+    stringi strURL;
+    DWORD dwHash;
+
+    PBYTE pbResponse;
+    int cbResponse;         // Total size of the response once filled
+    int cbHeaders;          // Size of the headers including the terminating CRLF
+    int cbFilled;           // Number of bytes filled so far
+
+    __int64 i64ResponseTime;    // Time the response was received (seconds)
+    __int64 i64Lifetime;        // Freshness lifetime (seconds)
+    __int64 i64InitialAge;      // Age reported by upstream caches (seconds)
+
+    string strETag;
+    stringi strLastModified;
+
+    LONG cRef;
+    BOOL fFilling;
+    BOOL fInTable;
+    HANDLE hFilled;         // Signalled when the fill completes or is aborted
+
+    CCacheEntry* pNextHash;
+    CCacheEntry* pPrevLRU;
+    CCacheEntry* pNextLRU;
+};
+
+
+class CProxyCache {
+public:
+    CProxyCache(void);
+    ~CProxyCache(void);
+
+    void SetLimits(int cbMaxSize, int cbMaxObjectSize);
+    void Flush(void);
+    BOOL IsEnabled(void) { return (m_cbMaxSize > 0); }
+
+    // Request side
+    DWORD Lookup(const char* szURL, CCacheEntry** ppEntry);
+    CCacheEntry* BeginFill(const char* szURL);
+    void Release(CCacheEntry* pEntry);
+
+    // Response side
+    BOOL IsCacheable(const CHttpHeaders& headers, int cbContent);
+    BOOL StartFill(CCacheEntry* pEntry, const CHttpHeaders& headers, const PBYTE pbHeaders, int cbHeaders, int cbContent);
+    BOOL AppendFill(CCacheEntry* pEntry, const PBYTE pbData, int cbData);
+    void AbortFill(CCacheEntry* pEntry);
+    CCacheEntry* Refresh(CCacheEntry* pEntry, const CHttpHeaders& headers);
+
+    BOOL GetValidators(CCacheEntry* pEntry, CHttpHeaders& headers, BOOL fRequest);
+    BOOL IsNotModified(const CHttpHeaders& headers, CCacheEntry* pEntry);
+
+    DWORD SendEntry(SOCKET sock, CCacheEntry* pEntry);
+
+    static BOOL IsRequestCacheable(const CHttpHeaders& headers);
+    static BOOL IsNoCacheRequest(const CHttpHeaders& headers);
+
+private:
+    void Lock(void) { m_csCache.lock(); }
+    void Unlock(void) { m_csCache.unlock(); }
+
+    CCacheEntry* Find(const char* szURL, DWORD dwHash);
+    void Insert(CCacheEntry* pEntry);
+    void Remove(CCacheEntry* pEntry);
+    void CommitFill(CCacheEntry* pEntry);
+    void TouchLRU(CCacheEntry* pEntry);
+    void UnlinkLRU(CCacheEntry* pEntry);
+    void Trim(int cbNeeded);
+    void ReleaseLocked(CCacheEntry* pEntry);
+    BOOL IsFresh(CCacheEntry* pEntry, __int64 i64Now);
+    __int64 GetFreshnessLifetime(const CHttpHeaders& headers, __int64 i64Now);
+
+    static DWORD HashURL(const char* szURL);
+    static __int64 GetCurrentSeconds(void);
+
+    ce::critical_section m_csCache;
+    CCacheEntry* m_rgpBuckets[CACHE_HASH_BUCKETS];
+    CCacheEntry* m_pLRUHead;    // Most recently used
+    CCacheEntry* m_pLRUTail;    // Least recently used
+    int m_cbMaxSize;
+    int m_cbMaxObjectSize;
+    int m_cbTotal;
+
+    // Statistics
+    DWORD m_cHits;
+    DWORD m_cMisses;
+    DWORD m_cRevalidations;
+    DWORD m_cCollapsed;
+};
+
+extern CProxyCache* g_pProxyCache;
+
+#endif // __CACHE_H__
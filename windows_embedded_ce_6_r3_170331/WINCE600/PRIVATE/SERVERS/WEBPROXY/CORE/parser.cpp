@@ -401,6 +401,7 @@ DWORD CHttpParser::ParseGenericHeaders(INET_PARSER& parser, CHttpHeaders& header
         else {
             // If it is an unknown header then append headers in 
             // the form: "header: value\r\n"
+            ParseCacheHeader(strField, parser.QueryLine(), headers);
             
             headers.strRest += strField;
             headers.strRest += " ";
@@ -414,6 +415,50 @@ DWORD CHttpParser::ParseGenericHeaders(INET_PARSER& parser, CHttpHeaders& header
     return dwRetVal;
 }
 
+void CHttpParser::ParseCacheHeader(const stringi& strField, const char* szValue, CHttpHeaders& headers)
+{
+    if (strField == gc_CacheControl) {
+        // Cache-Control header can be replicated several times in request or response packet
+        if (headers.strCacheControl != "") {
+            headers.strCacheControl += ", ";
+        }
+        headers.strCacheControl += szValue;
+    }
+    else if (strField == gc_Pragma) {
+        headers.strPragma = szValue;
+    }
+    else if (strField == gc_Expires) {
+        headers.strExpires = szValue;
+    }
+    else if (strField == gc_Date) {
+        headers.strDate = szValue;
+    }
+    else if (strField == gc_Age) {
+        headers.strAge = szValue;
+    }
+    else if (strField == gc_LastModified) {
+        headers.strLastModified = szValue;
+    }
+    else if (strField == gc_ETag) {
+        headers.strETag = szValue;
+    }
+    else if (strField == gc_Vary) {
+        headers.strVary = szValue;
+    }
+    else if (strField == gc_SetCookie) {
+        headers.fSetCookie = TRUE;
+    }
+    else if (strField == gc_IfNoneMatch) {
+        headers.strIfNoneMatch = szValue;
+    }
+    else if (strField == gc_IfModifiedSince) {
+        headers.strIfModifiedSince = szValue;
+    }
+    else if (strField == gc_WWWAuthorization) {
+        headers.strAuthorization = szValue;
+    }
+}
+
 void CHttpParser::ParseAuthorization(CHttpHeaders& headers, DWORD* pdwAuthType)
 {
     ASSERT(pdwAuthType);
@@ -32,6 +32,21 @@ const char gc_TransferEncoding[] = "Transfer-Encoding:";
 const char gc_Location[] = "Location:";
 const char gc_MaxForwards[] = "Max-Forwards:";
 
+// HTTP header names used by the response cache
+const char gc_CacheControl[] = "Cache-Control:";
+const char gc_Pragma[] = "Pragma:";
+const char gc_ETag[] = "ETag:";
+const char gc_LastModified[] = "Last-Modified:";
+const char gc_Expires[] = "Expires:";
+const char gc_Date[] = "Date:";
+const char gc_Age[] = "Age:";
+const char gc_KeepAliveHeader[] = "Keep-Alive:";
+const char gc_Vary[] = "Vary:";
+const char gc_SetCookie[] = "Set-Cookie:";
+const char gc_IfNoneMatch[] = "If-None-Match:";
+const char gc_IfModifiedSince[] = "If-Modified-Since:";
+const char gc_WWWAuthorization[] = "Authorization:";
+
 // HTTP header values
 const char gc_ConnKeepAlive[] = "Keep-Alive";
 const char gc_ConnClose[] = "close";
@@ -41,12 +56,14 @@ const char gc_HTTP10[] = "HTTP/1.0";
 const char gc_HTTP11[] = "HTTP/1.1";
 const char gc_SessionBasedAuth[] = "Session-Based-Authentication";
 const char gc_MethodPost[] = "POST";
+const char gc_MethodGet[] = "GET";
 const char gc_MethodConnect[] = "CONNECT";
 const char gc_MethodOptions[] = "OPTIONS";
 const char gc_TEChunked[] = "chunked";
 const char gc_Reason200[] = "OK";
 const char gc_Reason200Conn[] = "Connection established";
 const char gc_Reason302[] = "Found";
+const char gc_Reason304[] = "Not Modified";
 const char gc_Reason400[] = "Bad Request";
 const char gc_Reason403[] = "Forbidden";
 const char gc_Reason407[] = "Proxy Authentication Required";
@@ -55,7 +72,8 @@ const char gc_Reason502[] = "Bad Gateway";
 
 class CHttpHeaders {
 public:
-    CHttpHeaders(void)
+    CHttpHeaders(void) :
+        fSetCookie(FALSE)
     {
     }
     
@@ -86,6 +104,21 @@ public:
 
     stringi strRest;
 
+    // Caching headers.  These are only recorded for the response cache, the
+    // headers themselves are forwarded unmodified as part of strRest.
+    stringi strCacheControl;
+    stringi strPragma;
+    stringi strExpires;
+    stringi strDate;
+    stringi strAge;
+    stringi strLastModified;
+    stringi strVary;
+    stringi strIfModifiedSince;
+    string strETag;
+    string strIfNoneMatch;
+    string strAuthorization;
+    BOOL fSetCookie;
+
     int GetBufferSize(void);
     void GetRequestBuffer(PBYTE pBuffer);
     void GetResponseBuffer(PBYTE pBuffer);
@@ -108,6 +141,7 @@ public:
 
 private:
     DWORD ParseGenericHeaders(INET_PARSER& parser, CHttpHeaders& headers);
+    void ParseCacheHeader(const stringi& strField, const char* szValue, CHttpHeaders& headers);
 };
 
 extern CHttpParser* g_pParser;
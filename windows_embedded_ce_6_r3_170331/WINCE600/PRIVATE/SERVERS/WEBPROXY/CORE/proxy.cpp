@@ -20,6 +20,7 @@
 #include "resource.h"
 #include "parser.h"
 #include "filter.h"
+#include "cache.h"
 
 ProxySettings* g_pSettings;
 ProxyErrors* g_pErrors;
@@ -81,6 +82,13 @@ DWORD CHttpProxy::Init(void)
         goto exit;
     }
 
+    g_pProxyCache = new CProxyCache;
+    if (! g_pProxyCache) {
+        dwRetVal = ERROR_OUTOFMEMORY;
+        IFDBG(DebugOut(ZONE_ERROR, _T("WebProxy: Out of memory.\n")));
+        goto exit;
+    }
+
     dwRetVal = InitStrings();
     if (ERROR_SUCCESS != dwRetVal) {
         IFDBG(DebugOut(ZONE_ERROR, _T("WebProxy: Error initializing proxy strings.\n")));
@@ -92,6 +100,10 @@ DWORD CHttpProxy::Init(void)
 
 exit:
     if (ERROR_SUCCESS != dwRetVal) {
+        if (g_pProxyCache) {
+            delete g_pProxyCache;
+            g_pProxyCache = NULL;
+        }
         if (g_pProxyFilter) {
             delete g_pProxyFilter;
             g_pProxyFilter = NULL;
@@ -113,6 +125,8 @@ DWORD CHttpProxy::Deinit(void)
 {    
     DeinitStrings();
     
+    delete g_pProxyCache;
+    g_pProxyCache = NULL;
     delete g_pProxyFilter;
     g_pProxyFilter = NULL;
     delete g_pSessionMgr;
@@ -157,6 +171,9 @@ DWORD CHttpProxy::InitSettings(void)
         g_pSettings->iSessionTimeout = regWebProxy.ValueDW(RV_SESSION_TIMEOUT, DEFAULT_SESSION_TIMEOUT);
         g_pSettings->iMaxBufferSize = regWebProxy.ValueDW(RV_MAXHEADERSSIZE, DEFAULT_MAX_BUFFER_SIZE);
         g_pSettings->iSecondProxyPort = regWebProxy.ValueDW(RV_SECOND_PROXY_PORT, DEFAULT_HTTP_PORT);
+        g_pSettings->iCacheSize = regWebProxy.ValueDW(RV_CACHE_SIZE, DEFAULT_CACHE_SIZE);
+        g_pSettings->iCacheMaxObjectSize = regWebProxy.ValueDW(RV_CACHE_MAX_OBJECT_SIZE, DEFAULT_CACHE_MAX_OBJECT_SIZE);
+        g_pSettings->iCacheCollapseWait = regWebProxy.ValueDW(RV_CACHE_COLLAPSE_WAIT, DEFAULT_CACHE_COLLAPSE_WAIT);
 
         cSessionThreads = regWebProxy.ValueDW(RV_SESSION_THREADS, g_pSettings->iMaxConnections);
   
@@ -184,6 +201,9 @@ DWORD CHttpProxy::InitSettings(void)
     }
 
     g_pProxyFilter->LoadFilters();
+
+    // A cache size of zero disables the response cache
+    g_pProxyCache->SetLimits(g_pSettings->iCacheSize, g_pSettings->iCacheMaxObjectSize);
     
     if (g_pSettings->fNTLMAuth) {
         dwRetVal = InitNTLMSecurityLib();
@@ -222,6 +242,7 @@ DWORD CHttpProxy::DeinitSettings(void)
     }
 
     g_pProxyFilter->RemoveAllFilters();
+    g_pProxyCache->Flush();
 
     delete g_pThreadPool;
     g_pThreadPool = NULL;
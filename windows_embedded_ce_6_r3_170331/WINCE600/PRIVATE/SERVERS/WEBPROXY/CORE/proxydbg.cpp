@@ -31,7 +31,7 @@ DBGPARAM dpCurSettings =
   TEXT("Service"),
   TEXT("Session"),
   TEXT("Filter"),
-  TEXT("Undefined"),
+  TEXT("Cache"),
   TEXT("Undefined"),
   TEXT("Undefined"),
   TEXT("Undefined"),
@@ -48,12 +48,16 @@ CHttpSession::CHttpSession(void) :
     m_fChunked(FALSE),
     m_dwSessionId(0),
     m_cbResponseRemain(0),
-    m_cbRequestRemain(0)
+    m_cbRequestRemain(0),
+    m_pCacheFill(NULL),
+    m_pCacheRevalidate(NULL),
+    m_cPendingResponses(0)
 {
 }
 
 CHttpSession::~CHttpSession(void)
 {
+    CacheCleanup();
 }
 
 void CHttpSession::SetId(DWORD dwSessionId)
@@ -265,6 +269,9 @@ void CHttpSession::Run(void)
         Shutdown();
     }
 
+    // Any partially received response can not be cached
+    CacheCleanup();
+
     SessionUnlock();
 
     dwErr = g_pSessionMgr->RemoveSession(m_dwSessionId);
@@ -592,6 +599,26 @@ DWORD CHttpSession::HandleClientMessage(CBuffer& buffer, int* pcchBuffer, int cc
             }            
         }
 
+        //
+        // Try to satisfy the request from the response cache.  This is only done when no
+        // other response is outstanding on this connection so that responses stay in order.
+        //
+
+        if (g_pProxyCache->IsEnabled() && (0 == m_cPendingResponses) && (0 == m_cbResponseRemain) &&
+            (0 == cbTotalContent) && (! m_fChunked) && CProxyCache::IsRequestCacheable(headers)) {
+            BOOL fServed = FALSE;
+            
+            dwRetVal = HandleCacheRequest(headers, &fServed);
+            if (ERROR_SUCCESS != dwRetVal) {
+                goto exit;
+            }
+
+            if (fServed) {
+                *pcchSent = cchHeaders;
+                goto exit;
+            }
+        }
+
         //
         // Check if server socket has been opened yet.  If not, open it.  If it has been
         // opened then verify that we are connected to the correct server for this request.
@@ -658,6 +685,8 @@ DWORD CHttpSession::HandleClientMessage(CBuffer& buffer, int* pcchBuffer, int cc
         if (cbContent) {
             memcpy(&pBuffer[cbNewHeaders], pContent, cbContent);
         }
+
+        m_cPendingResponses++;
     }
         
     //
@@ -674,6 +703,7 @@ DWORD CHttpSession::HandleServerMessage(CBuffer& buffer, int* pcchBuffer, int cc
 {
     DWORD dwRetVal = ERROR_SUCCESS;
     CHttpHeaders headers;
+    BOOL fServeCached = FALSE;
 
     ASSERT(pcchBuffer);
     ASSERT(pfCloseConnection);
@@ -699,6 +729,12 @@ DWORD CHttpSession::HandleServerMessage(CBuffer& buffer, int* pcchBuffer, int cc
 
         if (m_cbResponseRemain >= 0) {
             m_cbResponseRemain -= *pcchBuffer;
+
+            if (m_pCacheFill && g_pProxyCache->AppendFill(m_pCacheFill, pBuffer, *pcchBuffer)) {
+                // The whole response is now in the cache
+                g_pProxyCache->Release(m_pCacheFill);
+                m_pCacheFill = NULL;
+            }
         }
         else {
             *pfCloseConnection = TRUE;
@@ -758,6 +794,11 @@ DWORD CHttpSession::HandleServerMessage(CBuffer& buffer, int* pcchBuffer, int cc
         m_fAuthInProgress = (headers.strStatusCode == "401");
         cbContent = *pcchBuffer - cchHeaders;
 
+        // Informational responses are followed by the real response
+        if (strncmp(headers.strStatusCode, "1", 1) && (m_cPendingResponses > 0)) {
+            m_cPendingResponses--;
+        }
+
         if (m_fSSLTunnelThruSecondProxy) {
             // We need to set up tunnel after response from secondary proxy
             if (headers.strStatusCode == "200") {
@@ -847,13 +888,25 @@ DWORD CHttpSession::HandleServerMessage(CBuffer& buffer, int* pcchBuffer, int cc
         if (cbContent) {
             memcpy(&pBuffer[cbNewHeaders], pContent, cbContent);
         }
+
+        if (m_pCacheFill || m_pCacheRevalidate) {
+            HandleCacheResponse(headers, pBuffer, cbNewHeaders, cbContent, cbTotalContent, &fServeCached);
+        }
     }
 
     //
-    // Send the data along to the client
+    // Send the data along to the client.  If a stale cache entry was just revalidated
+    // then the cached copy is sent instead of the 304 from the server.
     //
 
-    dwRetVal = SendData(m_sockClient, (char *)pBuffer, *pcchSent);
+    if (fServeCached) {
+        dwRetVal = g_pProxyCache->SendEntry(m_sockClient, m_pCacheRevalidate);
+        g_pProxyCache->Release(m_pCacheRevalidate);
+        m_pCacheRevalidate = NULL;
+    }
+    else {
+        dwRetVal = SendData(m_sockClient, (char *)pBuffer, *pcchSent);
+    }
 
 exit:
     if (ERROR_SUCCESS != dwRetVal) {
@@ -926,6 +979,12 @@ DWORD CHttpSession::ConnectServer(const char* szHost, int iPort)
 
     IFDBG(DebugOut(ZONE_CONNECT, _T("WebProxy: Trying to connect to host %S on port %d in session %d.\n"), szHost, iPort, m_dwSessionId));
 
+    // Responses still outstanding on the old connection will never arrive
+    if ((0 != m_cPendingResponses) || (0 != m_cbResponseRemain)) {
+        CacheCleanup();
+    }
+    m_cPendingResponses = 0;
+
     sprintf(szPort, "%d", iPort);
     dwRetVal = getaddrinfo(szHost, szPort, NULL, &pAI);
     if (ERROR_SUCCESS != dwRetVal) {
@@ -1492,6 +1551,151 @@ exit:
     return dwRetVal;
 }
 
+DWORD CHttpSession::HandleCacheRequest(CHttpHeaders& headers, BOOL* pfServed)
+{
+    DWORD dwRetVal = ERROR_SUCCESS;
+    CCacheEntry* pEntry = NULL;
+    DWORD dwResult;
+
+    ASSERT(pfServed);
+    *pfServed = FALSE;
+
+    // Anything left over from a previous response can no longer be completed
+    CacheCleanup();
+
+    dwResult = g_pProxyCache->Lookup(headers.strURL, &pEntry);
+    if (CACHE_PENDING == dwResult) {
+        //
+        // Another session is already fetching this URL.  Wait for it to finish rather than
+        // sending a second request to the server.
+        //
+        
+        HANDLE hFilled = pEntry->hFilled;
+
+        IFDBG(DebugOut(ZONE_CACHE, _T("WebProxy: Session %d is waiting for another session to fetch %hs.\n"), m_dwSessionId, (LPCSTR)headers.strURL));
+
+        SessionUnlock();
+        WaitForSingleObject(hFilled, g_pSettings->iCacheCollapseWait);
+        SessionLock();
+
+        g_pProxyCache->Release(pEntry);
+        pEntry = NULL;
+
+        // Check if session was closed while waiting
+        if (! m_fRunning) {
+            dwRetVal = ERROR_CANCELLED;
+            goto exit;
+        }
+
+        dwResult = g_pProxyCache->Lookup(headers.strURL, &pEntry);
+        if (CACHE_PENDING == dwResult) {
+            // Took too long, just fetch it without caching
+            goto exit;
+        }
+    }
+
+    if ((CACHE_HIT == dwResult) && (! CProxyCache::IsNoCacheRequest(headers))) {
+        if (g_pProxyCache->IsNotModified(headers, pEntry)) {
+            CHttpHeaders response;
+            
+            response.strStatusCode = "304";
+            response.strReason = gc_Reason304;
+            g_pProxyCache->GetValidators(pEntry, response, FALSE);
+            response.UpdateResponse();
+            
+            dwRetVal = SendCustomPacket(m_sockClient, response);
+        }
+        else {
+            dwRetVal = g_pProxyCache->SendEntry(m_sockClient, pEntry);
+        }
+        
+        IFDBG(DebugOut(ZONE_CACHE, _T("WebProxy: Served %hs from the cache in session %d.\n"), (LPCSTR)headers.strURL, m_dwSessionId));
+        *pfServed = TRUE;
+        goto exit;
+    }
+
+    //
+    // If there is a copy which can be revalidated then make the request conditional, unless the
+    // client made it conditional itself.  Otherwise the response will fill a new entry.
+    //
+
+    if (pEntry && (headers.strIfNoneMatch == "") && (headers.strIfModifiedSince == "") &&
+        g_pProxyCache->GetValidators(pEntry, headers, TRUE)) {
+        m_pCacheRevalidate = pEntry;
+        pEntry = NULL;
+    }
+    else {
+        m_pCacheFill = g_pProxyCache->BeginFill(headers.strURL);
+    }
+
+exit:
+    if (pEntry) {
+        g_pProxyCache->Release(pEntry);
+    }
+    
+    return dwRetVal;
+}
+
+void CHttpSession::HandleCacheResponse(const CHttpHeaders& headers, PBYTE pBuffer, int cbHeaders, int cbContent, int cbTotalContent, BOOL* pfServeCached)
+{
+    ASSERT(pfServeCached);
+    *pfServeCached = FALSE;
+
+    // Wait for the final response
+    if (0 == strncmp(headers.strStatusCode, "1", 1)) {
+        return;
+    }
+
+    if (m_pCacheRevalidate) {
+        if (headers.strStatusCode == "304") {
+            // Our copy is still good, the caller sends it instead of the 304
+            m_pCacheRevalidate = g_pProxyCache->Refresh(m_pCacheRevalidate, headers);
+            *pfServeCached = TRUE;
+            return;
+        }
+
+        // The object changed, the response replaces the stale copy
+        m_pCacheFill = g_pProxyCache->BeginFill(m_pCacheRevalidate->strURL);
+        g_pProxyCache->Release(m_pCacheRevalidate);
+        m_pCacheRevalidate = NULL;
+    }
+
+    if (m_pCacheFill) {
+        if (cbContent > cbTotalContent) {
+            // Anything past the content belongs to the next response
+            cbContent = cbTotalContent;
+        }
+
+        if (! (g_pProxyCache->IsCacheable(headers, cbTotalContent) &&
+               g_pProxyCache->StartFill(m_pCacheFill, headers, pBuffer, cbHeaders, cbTotalContent))) {
+            g_pProxyCache->AbortFill(m_pCacheFill);
+            g_pProxyCache->Release(m_pCacheFill);
+            m_pCacheFill = NULL;
+        }
+        else if ((0 == cbTotalContent) || g_pProxyCache->AppendFill(m_pCacheFill, pBuffer + cbHeaders, cbContent)) {
+            // The whole response is now in the cache
+            g_pProxyCache->Release(m_pCacheFill);
+            m_pCacheFill = NULL;
+        }
+
+        // Otherwise the remaining content is appended as it arrives
+    }
+}
+
+void CHttpSession::CacheCleanup(void)
+{
+    if (m_pCacheFill) {
+        g_pProxyCache->AbortFill(m_pCacheFill);
+        g_pProxyCache->Release(m_pCacheFill);
+        m_pCacheFill = NULL;
+    }
+
+    if (m_pCacheRevalidate) {
+        g_pProxyCache->Release(m_pCacheRevalidate);
+        m_pCacheRevalidate = NULL;
+    }
+}
+
 
 
 //
@@ -22,6 +22,7 @@
 #include "parser.h"
 #include "utils.h"
 #include "auth.h"
+#include "cache.h"
 
 typedef ce::auto_xxx<SOCKET, int (__stdcall *)(SOCKET), closesocket, INVALID_SOCKET, ce::ref_counting>        auto_socket;
 
@@ -74,6 +75,9 @@ protected:
     DWORD HandleProxyPacRequest(void);
     DWORD HandleChunked(CBuffer& buffer, int* pcchBuffer, int* pcchSent, BOOL fRequest);
     DWORD ReadChunkSize(SOCKET recvSock, CBuffer& buffer, int* pcbRecved, DWORD* pdwChunkSize, DWORD* pdwChunkHeaderSize);
+    DWORD HandleCacheRequest(CHttpHeaders& headers, BOOL* pfServed);
+    void HandleCacheResponse(const CHttpHeaders& headers, PBYTE pBuffer, int cbHeaders, int cbContent, int cbTotalContent, BOOL* pfServeCached);
+    void CacheCleanup(void);
     
     void SessionLock(void) { m_csSession.lock(); }
     void SessionUnlock(void) { m_csSession.unlock(); }
@@ -99,6 +103,10 @@ protected:
     
     string m_strCurrMethod;
     stringi m_strUser;
+
+    CCacheEntry* m_pCacheFill;          // Cache entry being filled by the current response
+    CCacheEntry* m_pCacheRevalidate;    // Stale cache entry being revalidated by the current response
+    int m_cPendingResponses;            // Requests forwarded to the server that have not been answered yet
 };
 
 class CSessionMgr {
@@ -35,6 +35,9 @@
 #define RV_PROXYSTRINGSIZE              L"ProxyErrorStringSize"
 #define RV_SECOND_PROXY_HOST            L"SecondProxyHost"
 #define RV_SECOND_PROXY_PORT            L"SecondProxyPort"
+#define RV_CACHE_SIZE                   L"CacheSize"
+#define RV_CACHE_MAX_OBJECT_SIZE        L"CacheMaxObjectSize"
+#define RV_CACHE_COLLAPSE_WAIT          L"CacheCollapseWait"
 #define RK_ICS                          L"Comm\\ConnectionSharing"
 #define RV_PUBLIC_INTF                  L"PublicInterface"
 #define RV_PRIVATE_INTF                 L"PrivateInterface"
@@ -62,6 +65,9 @@
 #define FREE_LIST_SIZE                  20
 #define MAX_ADDRESS_SIZE                256
 #define MAX_SOCKET_LIST                 64
+#define DEFAULT_CACHE_SIZE              1048576
+#define DEFAULT_CACHE_MAX_OBJECT_SIZE   131072
+#define DEFAULT_CACHE_COLLAPSE_WAIT     1000
 
 class ProxySettings {
 public:
@@ -85,6 +91,9 @@ public:
         fNTLMAuth = DEFAULT_AUTH_NTLM;
         fBasicAuth = DEFAULT_AUTH_BASIC;
         iSessionTimeout = DEFAULT_SESSION_TIMEOUT;
+        iCacheSize = DEFAULT_CACHE_SIZE;
+        iCacheMaxObjectSize = DEFAULT_CACHE_MAX_OBJECT_SIZE;
+        iCacheCollapseWait = DEFAULT_CACHE_COLLAPSE_WAIT;
     }
 
     void Lock(void) {
@@ -108,6 +117,9 @@ public:
     BOOL fNTLMAuth;
     BOOL fBasicAuth;
     int iSessionTimeout;
+    int iCacheSize;
+    int iCacheMaxObjectSize;
+    int iCacheCollapseWait;     // How long to wait for another session's fetch of the same URL (ms)
 };
 
 
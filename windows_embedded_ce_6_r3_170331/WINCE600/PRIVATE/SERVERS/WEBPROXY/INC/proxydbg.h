@@ -28,6 +28,7 @@
 #define ZONE_SERVICE        DEBUGZONE(7)
 #define ZONE_SESSION        DEBUGZONE(8)
 #define ZONE_FILTER         DEBUGZONE(9)
+#define ZONE_CACHE          DEBUGZONE(10)
 #define ZONE_WARN            DEBUGZONE(14)
 #define ZONE_ERROR            DEBUGZONE(15)
 
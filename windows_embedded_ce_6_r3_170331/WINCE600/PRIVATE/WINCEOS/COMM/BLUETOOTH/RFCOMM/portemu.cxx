@@ -271,6 +271,7 @@ public:
     int                 iDefaultMTUMax;         // Default MTU Max
     int                 iDefaultSendQuota;      // Default Send Quota
     int                 iDefaultRecvQuota;      // Default Recv Quota
+    int                 iInitialCredits;        // Credits granted to the peer in parameter negotiation
 
     HANDLE              hSDP;                   // SDP handle
     SDP_INTERFACE       sdp_if;                 // sdp interface table
@@ -285,6 +286,7 @@ public:
 
         iDefaultMTUMin = iDefaultMTUMax = 0;
         iDefaultSendQuota = iDefaultRecvQuota = 0;
+        iInitialCredits = 0;
 
         hSDP = NULL;
         memset(&sdp_if, 0, sizeof(sdp_if));
@@ -1748,7 +1750,7 @@ static int portemu_pnreq_ind (void *pUserContext, HANDLE hConnection, unsigned c
 
         pContext->credit_fc     = TRUE;
         pContext->iHaveCredits  = initial_credits;
-        pContext->iGaveCredits  = RFCOMM_PN_CREDIT_MAX;
+        pContext->iGaveCredits  = gpPORTEMU->iInitialCredits;
     } else {
         IFDBG(DebugOut (DEBUG_RFCOMM_TRACE, L"[PORTEMU] portemu_pnreq_ind 0x%08x CREDIT-based Flow OFF\n", pUserContext));
 
@@ -1759,6 +1761,7 @@ static int portemu_pnreq_ind (void *pUserContext, HANDLE hConnection, unsigned c
 
     HANDLE h = pContext->hRFCOMM;
     RFCOMM_PNRSP_In pCallback = pContext->rfcomm_if.rfcomm_PNRSP_In;
+    int iCredits = pContext->iGaveCredits;
 
     gpPORTEMU->Unlock ();
 
@@ -1766,7 +1769,7 @@ static int portemu_pnreq_ind (void *pUserContext, HANDLE hConnection, unsigned c
     __try {
         iRes = pCallback (h, NULL, hConnection, priority, n1,
                                     (use_credit_fc == RFCOMM_PN_CREDIT_IN) ? RFCOMM_PN_CREDIT_OUT : 0,
-                                    (use_credit_fc == RFCOMM_PN_CREDIT_IN) ? RFCOMM_PN_CREDIT_MAX : 0);
+                                    iCredits);
     } __except (1) {
         IFDBG(DebugOut (DEBUG_ERROR, L"[PORTEMU] portemu_pnreq_ind Exception in rfcomm_PNRSP_In\n"));
     }
@@ -2231,7 +2234,7 @@ static int portemu_pnreq_out (void *pCallContext, int iError, unsigned char prio
 
         pContext->credit_fc    = TRUE;
         pContext->iHaveCredits = initial_credits;
-        pContext->iGaveCredits = RFCOMM_PN_CREDIT_MAX;
+        pContext->iGaveCredits = gpPORTEMU->iInitialCredits;
     } else {
         IFDBG(DebugOut (DEBUG_RFCOMM_TRACE, L"[PORTEMU] portemu_pnreq_ind 0x%08x CREDIT-based Flow OFF\n", pContext));
 
@@ -2803,9 +2806,10 @@ extern "C" DWORD COM_Open (DWORD dwData, DWORD dwAccess, DWORD dwShareMode) {
             RFCOMM_PNREQ_In pCallback = pContext->rfcomm_if.rfcomm_PNREQ_In;
             iRes = ERROR_INTERNAL_ERROR;
             int n1 = pContext->iMTU;
+            int iCredits = gpPORTEMU->iInitialCredits;
             gpPORTEMU->Unlock ();
             __try {
-                iRes = pCallback (h, (LPVOID)hContext, hConnect, PORTEMU_PRI, n1, RFCOMM_PN_CREDIT_IN, RFCOMM_PN_CREDIT_MAX);
+                iRes = pCallback (h, (LPVOID)hContext, hConnect, PORTEMU_PRI, n1, RFCOMM_PN_CREDIT_IN, iCredits);
             } __except (1) {
                 IFDBG(DebugOut (DEBUG_ERROR, L"[PORTEMU] COM_Open: exception in rfcomm_PNREQ_In\n"));
             }
@@ -4090,6 +4094,7 @@ int portemu_InitializeOnce (void) {
     gpPORTEMU->iDefaultMTUMin = PORTEMU_MTUMIN;
     gpPORTEMU->iDefaultRecvQuota = PORTEMU_RECVMAX;
     gpPORTEMU->iDefaultSendQuota = PORTEMU_SENDMAX;
+    gpPORTEMU->iInitialCredits = RFCOMM_PN_CREDIT_MAX;
 
     return ERROR_SUCCESS;
 }
@@ -4156,6 +4161,19 @@ int portemu_CreateDriverInstance (void) {
 
     SVSUTIL_ASSERT(gpPORTEMU->hSDP);
 
+    HKEY hk;
+    if (ERROR_SUCCESS == RegOpenKeyEx (HKEY_BASE, L"software\\Microsoft\\bluetooth\\rfcomm", 0, KEY_READ, &hk)) {
+        DWORD dwVal = 0;
+        DWORD dwType = REG_DWORD;
+        DWORD dwSize = sizeof(dwVal);
+
+        if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"InitialCredits", NULL, &dwType, (LPBYTE) &dwVal, &dwSize)) && (dwType == REG_DWORD) &&
+            (dwVal > 0) && (dwVal <= RFCOMM_PN_CREDIT_MAX))
+            gpPORTEMU->iInitialCredits = (int) dwVal;
+
+        RegCloseKey (hk);
+    }
+
     gpPORTEMU->fInitialized = TRUE;
     IFDBG(DebugOut (DEBUG_RFCOMM_INIT, L"[PORTEMU] portemu_CreateDriverInstance ERROR_SUCCESS\n"));
     gpPORTEMU->Unlock ();
@@ -51,6 +51,8 @@
 
 #define RFCOMM_SCALE    10
 
+#define RFCOMM_DATA_WINDOW  8       // User data frames outstanding in L2CAP per session
+
 //    link stages (phys & log)
 #define    DORMANT          0x00
 #define CONNECTING          0x01
@@ -302,6 +304,8 @@ struct DLCI {
     unsigned int    fStage     : 8;     // Lifestage of a channel
     unsigned int    fFCA       : 1;     // 1 = sent FC signal already
 
+    int             iDeficit;           // Bytes this channel may still send in the current round
+
     DLCI (Session *a_pSess, unsigned char a_ch, int a_fLocal, RFCOMM_CONTEXT *a_pOwner) {
         memset (this, 0, sizeof(*this));
 
@@ -327,7 +331,8 @@ struct Task {
     unsigned int    fLocal              : 1;    // Channel is local
     unsigned int    fPF                 : 1;    // Does this block the line?
     unsigned int    fData               : 1;    // Is this data or signal
-    unsigned int    fUnused             : 2;    // pad
+    unsigned int    fInWindow           : 1;    // Counted in the session's cDataOut
+    unsigned int    fUnused             : 1;    // pad
     unsigned int    eType               : 6;    // Signal type
 
     unsigned char   signal_length       : 4;    // Signal packet waiting for session to open
@@ -337,6 +342,8 @@ struct Task {
 
     Session         *pPhysLink;
 
+    BD_BUFFER       *pBuffer;       // User data frame waiting for the session send window
+
     Task (int a_fWhat, RFCOMM_CONTEXT *a_pOwner, Session *a_pSess) {
         memset (this, 0, sizeof(*this));
 
@@ -385,6 +392,10 @@ struct Session {
 
     int             iErr;           // Number of physical errors
 
+    int             cDataOut;       // User data frames outstanding in L2CAP
+    int             cDataQueued;    // User data frames waiting for the send window
+    DLCI            *pSchedChann;   // Channel currently served by the scheduler
+
     Session (BD_ADDR *pba) {
         memset (this, 0, sizeof(*this));
 
@@ -453,6 +464,8 @@ public:
     DWORD           dwDiscT1;       // T1 timeout for DISC command
     DWORD           dwSabmT1;       // T1 timeout for SABM command
 
+    int             cDataWindow;    // User data frames outstanding per session, 0 = unlimited
+
     BOOL            fAllowMultipleDisconnectMsgs; //Allow Multiple Disconnect Messages to the PEER
 
     unsigned int    fRunning : 1;   // Running?
@@ -477,6 +490,8 @@ public:
         dwDiscT1 = RFCOMM_T1;
         dwSabmT1 = RFCOMM_T1;
 
+        cDataWindow = RFCOMM_DATA_WINDOW;
+
         fAllowMultipleDisconnectMsgs = FALSE;
 
         fRunning = FALSE;
@@ -706,6 +721,18 @@ static void DeleteCall (Task *pTask) {
             btutil_CloseHandle (pTask->hCallContext);
             pTask->hCallContext = SVSUTIL_HANDLE_INVALID;
         }
+
+        if (pTask->fWhat == CALL_RFCOMM_USERDATA) {
+            Session *pSess = VerifyLink (pTask->pPhysLink);
+            if (pTask->pBuffer) {
+                if (pSess)
+                    --pSess->cDataQueued;
+
+                pTask->pBuffer->pFree (pTask->pBuffer);
+                pTask->pBuffer = NULL;
+            } else if (pTask->fInWindow && pSess)
+                --pSess->cDataOut;
+        }
         
         delete pTask;
     }
@@ -779,6 +806,120 @@ static int SendFrame (Task *pTask, unsigned short cid, BD_BUFFER *pb) {
     return iRes;
 }
 
+//
+//    User data goes down through a window of frames outstanding in L2CAP per session.
+//    When the window is full, frames wait on their tasks and are released by deficit
+//    round robin across the channels of the session, so that a bulk transfer on one
+//    channel does not starve interactive traffic on the others.
+//
+static Task *GetQueuedData (Session *pSess, DLCI *pChann) {
+    Task *pTask = gpRFCOMM->pCalls;
+    while (pTask && ((pTask->pPhysLink != pSess) || (! pTask->pBuffer) ||
+            (pTask->channel != pChann->channel) || (pTask->fLocal != pChann->fLocal)))
+        pTask = pTask->pNext;
+
+    return pTask;
+}
+
+static Task *GetOrphanedData (Session *pSess) {
+    Task *pTask = gpRFCOMM->pCalls;
+    while (pTask) {
+        if ((pTask->pPhysLink == pSess) && pTask->pBuffer) {
+            DLCI *pChann = pSess->pLogLinks;
+            while (pChann && ((pChann->channel != pTask->channel) || (pChann->fLocal != pTask->fLocal)))
+                pChann = pChann->pNext;
+
+            if (! pChann)
+                break;
+        }
+
+        pTask = pTask->pNext;
+    }
+
+    return pTask;
+}
+
+static Task *ScheduleQueuedData (Session *pSess) {
+    int cChannels = 0;
+    DLCI *pChann = pSess->pLogLinks;
+    while (pChann) {
+        ++cChannels;
+        pChann = pChann->pNext;
+    }
+
+    pChann = pSess->pSchedChann ? VerifyChannel (pSess, pSess->pSchedChann) : NULL;
+    if (! pChann)
+        pChann = pSess->pLogLinks;
+
+    // Every channel with data is topped up on its first visit, so two rounds are enough
+    for (int i = 0 ; pChann && (i <= 2 * cChannels) ; ++i) {
+        Task *pTask = GetQueuedData (pSess, pChann);
+        if (pTask) {
+            int cBytes = BufferTotal (pTask->pBuffer);
+            if (pChann->iDeficit >= cBytes) {
+                pChann->iDeficit -= cBytes;
+                pSess->pSchedChann = pChann;
+                return pTask;
+            }
+
+            pChann->iDeficit += (cBytes > pSess->outMTU) ? cBytes : pSess->outMTU;
+        } else
+            pChann->iDeficit = 0;
+
+        pChann = pChann->pNext ? pChann->pNext : pSess->pLogLinks;
+    }
+
+    return NULL;
+}
+
+static void SendQueuedData (Session *pSess) {
+    while (gpRFCOMM->fConnected && VerifyLink (pSess) && pSess->cDataQueued) {
+        Task *pTask = GetOrphanedData (pSess);
+        if (pTask) {
+            IFDBG(DebugOut (DEBUG_WARN, L"SendQueuedData : dropping data for closed channel %d\n", pTask->channel));
+            CancelCall (pTask, ERROR_CONNECTION_ABORTED, NULL);
+            continue;
+        }
+
+        if (gpRFCOMM->cDataWindow && (pSess->cDataOut >= gpRFCOMM->cDataWindow))
+            break;
+
+        pTask = ScheduleQueuedData (pSess);
+        if (! pTask) {
+            SVSUTIL_ASSERT (0);
+            break;
+        }
+
+        BD_BUFFER *pBuffer = pTask->pBuffer;
+        pTask->pBuffer = NULL;
+
+        --pSess->cDataQueued;
+        ++pSess->cDataOut;
+        pTask->fInWindow = TRUE;
+
+        int iRes = SendFrame (pTask, pSess->cid, pBuffer);
+        if (iRes != ERROR_SUCCESS) {
+            pBuffer->pFree (pBuffer);
+
+            //
+            //    The frame never reached L2CAP, so its window slot is released here.
+            //    If the task went away while we were unlocked, DeleteCall already did it.
+            //
+            if (VerifyCall (pTask)) {
+                if (pTask->fInWindow && VerifyLink (pSess))
+                    --pSess->cDataOut;
+
+                pTask->fInWindow = FALSE;
+
+                if (gpRFCOMM->fRunning)
+                    CancelCall (pTask, iRes, NULL);
+            }
+
+            break;
+        }
+    }
+}
+
 static int SendFrame (Task *pTask, unsigned short cid, int fIncoming, int cBytes, unsigned char *pBytes) {
 #if defined (DEBUG) || defined (_DEBUG)
     WCHAR *szCMD = L"UNKN";
@@ -1215,6 +1356,9 @@ static void DeleteChannel (Session *pSess, DLCI *pChan, int iSignal, int iError,
 
     if (gpRFCOMM->fRunning)
         delete pChan;
+
+    // Drop any data still queued for the channel
+    SendQueuedData (pSess);
 }
 
 static void CloseSession (Session *pSess, int iError, BOOL fCancelCalls) {
@@ -3177,6 +3321,7 @@ static int rfcomm_data_down_out (void *pCallContext, unsigned short result) {
     if (pCall->fWhat == CALL_RFCOMM_USERDATA) {
         RFCOMM_CONTEXT *pOwner = pCall->pOwner;
         void *pContext = pCall->pContext;
+        Session *pSess = pCall->pPhysLink;
 
         DeleteCall (pCall);
 
@@ -3196,6 +3341,8 @@ static int rfcomm_data_down_out (void *pCallContext, unsigned short result) {
         pOwner->DelRef ();
 
         IFDBG(DebugOut (DEBUG_RFCOMM_CALLBACK, L"rfcomm_data_down_out : came out of rfcomm_DataDown_Out\n"));
+
+        SendQueuedData (pSess);
     } else
         IFDBG(DebugOut (DEBUG_RFCOMM_CALLBACK, L"rfcomm_data_down_out : Signal data forwarded; deferring processing until response...\n"));
 
@@ -3522,11 +3669,16 @@ static int rfcomm_abort_call (HANDLE hDeviceContext, void *pCallContext) {
         pTask = pTask->pNext;
 
     if (pTask) {
-        if (pTask->fPF && pTask->pPhysLink)
-            pTask->pPhysLink->fWaitAck = TRUE;
+        Session *pSess = pTask->pPhysLink;
+
+        if (pTask->fPF && pSess)
+            pSess->fWaitAck = TRUE;
 
         DeleteCall (pTask);
         iRes = ERROR_SUCCESS;
+
+        if (pSess)
+            SendQueuedData (pSess);
     }
 
     IFDBG(DebugOut (DEBUG_RFCOMM_TRACE, L"rfcomm_abort_call: returned %d\n", iRes));
@@ -3778,6 +3930,8 @@ static int rfcomm_data_down_in (HANDLE hDeviceContext, void *pCallContext, HANDL
         Task *pCall = NewTask (CALL_RFCOMM_USERDATA, pOwner, pDLCI->pSess);
         if (pCall) {
             pCall->pContext = pCallContext;
+            pCall->channel  = pDLCI->channel;
+            pCall->fLocal   = pDLCI->fLocal;
 
             AddTask (pCall);
 
@@ -3811,10 +3965,23 @@ static int rfcomm_data_down_in (HANDLE hDeviceContext, void *pCallContext, HANDL
 
             pBuffer->pBuffer[pBuffer->cEnd++] = FCSCompute (pBuffer->pBuffer + pBuffer->cStart, 2);
 
-            iRes = SendFrame (pCall, pDLCI->pSess->cid, pBuffer);
+            Session *pSess = pDLCI->pSess;
 
-            if ((iRes != ERROR_SUCCESS) && gpRFCOMM->fRunning)
-                DeleteCall (pCall);
+            if (gpRFCOMM->cDataWindow && (pSess->cDataQueued || (pSess->cDataOut >= gpRFCOMM->cDataWindow))) {
+                pCall->pBuffer = pBuffer;
+                ++pSess->cDataQueued;
+
+                SendQueuedData (pSess);
+                iRes = ERROR_SUCCESS;
+            } else {
+                ++pSess->cDataOut;
+                pCall->fInWindow = TRUE;
+
+                iRes = SendFrame (pCall, pSess->cid, pBuffer);
+
+                if ((iRes != ERROR_SUCCESS) && gpRFCOMM->fRunning)
+                    DeleteCall (pCall);
+            }
         } else
             iRes = ERROR_OUTOFMEMORY;
     }
@@ -4402,6 +4569,10 @@ int rfcomm_CreateDriverInstance (void) {
         if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"AllowMultipleDisconnectMsgs", NULL, &dwType, (LPBYTE) &dwVal, &dwSize)) && (dwType == REG_DWORD))
             gpRFCOMM->fAllowMultipleDisconnectMsgs = (BOOL) dwVal;
 
+        dwSize = sizeof(dwVal);
+        if ((ERROR_SUCCESS == RegQueryValueEx (hk, L"DataWindow", NULL, &dwType, (LPBYTE) &dwVal, &dwSize)) && (dwType == REG_DWORD))
+            gpRFCOMM->cDataWindow = (int) dwVal;
+
         RegCloseKey (hk);
     }
 
@@ -4926,6 +5097,8 @@ int rfcomm_ProcessConsoleCommand (WCHAR *pszCommand) {
                 DebugOut (DEBUG_OUTPUT, L"outMTU                      %d\n", pPhysLink->outMTU);
                 DebugOut (DEBUG_OUTPUT, L"Timeout cookie              0x%08x\n", pPhysLink->kTimeoutCookie);
                 DebugOut (DEBUG_OUTPUT, L"Hardware failures           %d\n", pPhysLink->iErr);
+                DebugOut (DEBUG_OUTPUT, L"Data frames outstanding     %d\n", pPhysLink->cDataOut);
+                DebugOut (DEBUG_OUTPUT, L"Data frames queued          %d\n", pPhysLink->cDataQueued);
 
                 int iCount = 0;
                 DLCI *pLogLink = pPhysLink->pLogLinks;
@@ -154,12 +154,23 @@ SdpDatabase::ServiceRecord::ServiceRecord() : handle(INVALID_ID), streamSize(0),
 #if defined (UNDER_CE)
     hCallerProc = GetCallerProcess();
 #endif
+
+#if defined (UNDER_CE) || defined (WINCE_EMULATION)
+    pUuids = NULL;
+    numUuids = 0;
+    pAttribs = NULL;
+    numAttribs = 0;
+#endif
 }
 
 
 
 SdpDatabase::ServiceRecord::~ServiceRecord()
 {
+#if defined (UNDER_CE) || defined (WINCE_EMULATION)
+    FreeIndex();
+#endif
+
     if (pStream) {
 #if ! (defined (UNDER_CE) || defined (WINCE_EMULATION))
         delete[] pStream;
@@ -170,6 +181,217 @@ SdpDatabase::ServiceRecord::~ServiceRecord()
     pStream = NULL;
 }
 
+#if defined (UNDER_CE) || defined (WINCE_EMULATION)
+//
+// Collects the UUIDs and top level attribute offsets of a record.  The record
+// is walked twice, once to size the tables (counting == TRUE) and once to fill
+// them in.
+//
+struct SdpIndexBuilder {
+    SdpIndexBuilder(PUCHAR pRecordStream, BOOLEAN fCount)
+    {
+        RtlZeroMemory(this, sizeof(*this));
+        pBase = pRecordStream;
+        counting = fCount;
+        isAttribId = TRUE;
+    }
+
+    void AddUuid(GUID *pUuid);
+    void AddAttribute(PUCHAR pElement, ULONG size);
+
+    static NTSTATUS IndexRecordStreamWalk(SdpIndexBuilder *pBuilder,
+                                          UCHAR DataType,
+                                          ULONG DataSize,
+                                          PUCHAR Data,
+                                          ULONG DataStorageSize);
+
+    PUCHAR pBase;
+
+    GUID *pUuids;
+    ULONG maxUuids;
+    ULONG numUuids;
+
+    SdpAttribIndex *pAttribs;
+    ULONG maxAttribs;
+    ULONG numAttribs;
+
+    ULONG depth;
+    USHORT attribute;
+    BOOLEAN isAttribId;
+    BOOLEAN counting;
+};
+
+void SdpIndexBuilder::AddUuid(GUID *pUuid)
+{
+    if (counting) {
+        //
+        // Duplicates are only weeded out on the second pass, so this is an
+        // upper bound
+        //
+        numUuids++;
+        return;
+    }
+
+    for (ULONG i = 0; i < numUuids; i++) {
+        if (IsEqualUuid(&pUuids[i], pUuid)) {
+            return;
+        }
+    }
+
+    ASSERT(numUuids < maxUuids);
+    RtlCopyMemory(&pUuids[numUuids], pUuid, sizeof(GUID));
+    numUuids++;
+}
+
+void SdpIndexBuilder::AddAttribute(PUCHAR pElement, ULONG size)
+{
+    if (! counting) {
+        ASSERT(numAttribs < maxAttribs);
+        pAttribs[numAttribs].attribute = attribute;
+        pAttribs[numAttribs].offset = (ULONG) (pElement - pBase);
+        pAttribs[numAttribs].size = size;
+    }
+
+    numAttribs++;
+}
+
+NTSTATUS
+SdpIndexBuilder::IndexRecordStreamWalk(
+    SdpIndexBuilder *pBuilder,
+    UCHAR DataType,
+    ULONG DataSize,
+    PUCHAR Data,
+    ULONG DataStorageSize
+    )
+{
+    if (Data == NULL) {
+        //
+        // end of a sequence or alternative
+        //
+        ASSERT(pBuilder->depth > 0);
+        pBuilder->depth--;
+        return STATUS_SUCCESS;
+    }
+
+    if (DataType == SDP_TYPE_UUID) {
+        GUID uuid;
+
+        SdpRetrieveUuidFromStream(Data, DataSize, &uuid, TRUE);
+        pBuilder->AddUuid(&uuid);
+    }
+
+    if (pBuilder->depth == 1) {
+        //
+        // Direct children of the record sequence alternate between the
+        // attribute ID and its value
+        //
+        if (pBuilder->isAttribId) {
+            if (DataType != SDP_TYPE_UINT || DataSize != sizeof(USHORT)) {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            RtlRetrieveUshort(&pBuilder->attribute, Data);
+            pBuilder->attribute = RtlUshortByteSwap(pBuilder->attribute);
+        }
+        else {
+            //
+            // Data points past the element header and the size storage (if
+            // any), back up to the start of the element
+            //
+            pBuilder->AddAttribute(Data - DataStorageSize - 1,
+                                   DataSize + DataStorageSize + 1);
+        }
+
+        pBuilder->isAttribId = !pBuilder->isAttribId;
+    }
+
+    if (DataType == SDP_TYPE_SEQUENCE || DataType == SDP_TYPE_ALTERNATIVE) {
+        pBuilder->depth++;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS SdpDatabase::ServiceRecord::BuildIndex()
+{
+    NTSTATUS status;
+
+    FreeIndex();
+
+    if (pStream == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    SdpIndexBuilder count(pStream, TRUE);
+
+    status = SdpWalkStream(pStream,
+                           streamSize,
+                           (PSDP_STREAM_WALK_FUNC) SdpIndexBuilder::IndexRecordStreamWalk,
+                           (PVOID) &count);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    if (count.numAttribs == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    SdpIndexBuilder fill(pStream, FALSE);
+
+    fill.maxAttribs = count.numAttribs;
+    fill.pAttribs = (SdpAttribIndex *) SdpAllocatePool(count.numAttribs * sizeof(SdpAttribIndex));
+
+    if (count.numUuids) {
+        fill.maxUuids = count.numUuids;
+        fill.pUuids = (GUID *) SdpAllocatePool(count.numUuids * sizeof(GUID));
+    }
+
+    if (fill.pAttribs == NULL || (count.numUuids && fill.pUuids == NULL)) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else {
+        status = SdpWalkStream(pStream,
+                               streamSize,
+                               (PSDP_STREAM_WALK_FUNC) SdpIndexBuilder::IndexRecordStreamWalk,
+                               (PVOID) &fill);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        if (fill.pAttribs) {
+            SdpFreePool(fill.pAttribs);
+        }
+        if (fill.pUuids) {
+            SdpFreePool(fill.pUuids);
+        }
+        return status;
+    }
+
+    ASSERT(fill.numAttribs == count.numAttribs);
+
+    pUuids = fill.pUuids;
+    numUuids = fill.numUuids;
+    pAttribs = fill.pAttribs;
+    numAttribs = fill.numAttribs;
+
+    return STATUS_SUCCESS;
+}
+
+void SdpDatabase::ServiceRecord::FreeIndex()
+{
+    if (pUuids) {
+        SdpFreePool(pUuids);
+        pUuids = NULL;
+    }
+    numUuids = 0;
+
+    if (pAttribs) {
+        SdpFreePool(pAttribs);
+        pAttribs = NULL;
+    }
+    numAttribs = 0;
+}
+#endif // UNDER_CE
+
 SdpDatabase::ServiceRecord * SdpDatabase::GetServiceRecord(HANDLE handle)
 {
     ServiceRecord *pRecord;
@@ -279,6 +501,15 @@ NTSTATUS SdpDatabase::Init()
     m_pSdpRecord->streamSize = g_ServiceStreamSize;
     RtlCopyMemory(m_pSdpRecord->pStream, g_ServiceStream, g_ServiceStreamSize);
     m_pSdpRecord->recordHandle = 0x0;
+
+#if defined (UNDER_CE) || defined (WINCE_EMULATION)
+    //
+    // AlterDatabaseState rewrites the state value in place, so the index stays
+    // valid for the lifetime of the record.  If it can't be built, searches
+    // fall back to walking the stream.
+    //
+    m_pSdpRecord->BuildIndex();
+#endif
     
     m_ServiceRecordList.AddHead(m_pSdpRecord);
 
@@ -807,6 +1038,11 @@ NTSTATUS SdpDatabase::AddRecord(PUCHAR pStream, ULONG streamSize, PHANDLE pHandl
         pRecord->pStream = pNewStream;
         pRecord->psmList.count = 0;
 
+        //
+        // Not fatal, searches walk the stream if the record has no index
+        //
+        pRecord->BuildIndex();
+
         AlterDatabaseState();
 
         if (!pRecordOriginal)
@@ -79,6 +79,8 @@ struct SdpUuidSearch {
 
     BOOLEAN SearchStream(PUCHAR pStream, ULONG streamSize);
 
+    BOOLEAN SearchIndex(GUID *pUuids, ULONG numUuids);
+
     void SetUuids(SdpQueryUuid *pUuid, UCHAR maxUuid);
 
     static NTSTATUS FindUuidsInSearchStreamWalk(SdpUuidSearch * pUuidSrch,
@@ -132,6 +134,35 @@ BOOLEAN SdpUuidSearch::SearchStream(PUCHAR pStream, ULONG streamSize)
     return TRUE;
 }
 
+//
+// Same as SearchStream, but matches against the UUIDs pre-parsed out of the
+// record when it was added to the database
+//
+BOOLEAN SdpUuidSearch::SearchIndex(GUID *pUuids, ULONG numUuids)
+{
+    PAGED_CODE();
+
+    ULONG i, j;
+
+    for (i = 0; i < max; i++) {
+        for (j = 0; j < numUuids; j++) {
+            if (IsEqualUuid(&queryData[i].uuid, &pUuids[j])) {
+                break;
+            }
+        }
+
+        if (j == numUuids) {
+            SdpPrint(SDP_DBG_UUID_INFO | SDP_DBG_UUID_WARNING,
+                     ("did not find UUID #%d in index\n", i));
+            return FALSE;
+        }
+    }
+
+    SdpPrint(SDP_DBG_UUID_INFO, ("found all UUIDs in the index\n"));
+
+    return TRUE;
+}
+
 void
 SdpUuidSearch::SetUuids(
     SdpQueryUuid *pUuid,
@@ -227,6 +258,21 @@ SdpUuidSearch::FindUuidsInRecordStreamWalk(
     return STATUS_SUCCESS;
 }
 
+BOOLEAN
+SdpDatabase::SearchRecord(
+    SdpUuidSearch *pUuidSearch,
+    ServiceRecord *pRecord
+    )
+{
+#if defined (UNDER_CE) || defined (WINCE_EMULATION)
+    if (pRecord->pAttribs) {
+        return pUuidSearch->SearchIndex(pRecord->pUuids, pRecord->numUuids);
+    }
+#endif
+
+    return pUuidSearch->SearchStream(pRecord->pStream, pRecord->streamSize);
+}
+
 NTSTATUS
 SdpDatabase::ServiceSearchRequestResponseRemote(
     UCHAR *pStream,
@@ -336,7 +382,7 @@ SdpDatabase::ServiceSearchRequestResponse(
         }
 #endif
 
-        if (pUuidSearch->SearchStream(pRecord->pStream, pRecord->streamSize)) {
+        if (SearchRecord(pUuidSearch, pRecord)) {
             SdpPrint(SDP_DBG_UUID_INFO,
                      ("uuid search, FOUND match in record 0x%x\n",
                       pRecord->recordHandle));
@@ -626,6 +672,11 @@ struct SdpAttribSearch {
 
     NTSTATUS RetrieveAttributes(PUCHAR pStream, ULONG streamSize);
 
+    NTSTATUS FindIndexedElements(PUCHAR pStream,
+                                 SdpAttribIndex *pAttribs,
+                                 ULONG numAttribs,
+                                 PSDP_STREAM_ENTRY *ppEntry);
+
     NTSTATUS FindElements(PUCHAR pStream,
                           ULONG streamSize,
                           PSDP_STREAM_ENTRY *ppEntry,
@@ -665,6 +716,69 @@ struct SdpAttribSearch {
     BOOLEAN ownRange;
 };
 
+//
+// Builds the same reply as SdpFindAttributeSequenceInStream (a sequence of
+// attribute ID / value pairs, NULL if nothing matched) straight from the
+// record's attribute index, without validating and walking the record.
+//
+NTSTATUS
+SdpAttribSearch::FindIndexedElements(
+    PUCHAR pStream,
+    SdpAttribIndex *pAttribs,
+    ULONG numAttribs,
+    PSDP_STREAM_ENTRY *ppEntry
+    )
+{
+    PAGED_CODE();
+
+    ULONG i, sequenceSize, totalSize;
+    PUCHAR stream;
+    USHORT usVal;
+
+    *ppEntry = NULL;
+
+    sequenceSize = 0;
+    for (i = 0; i < numAttribs; i++) {
+        if (SdpIsAttributeInRange(pRange, numAttributes, pAttribs[i].attribute)) {
+            sequenceSize += sizeof(UCHAR)  +    // element header
+                            sizeof(USHORT) +    // attribute ID
+                            pAttribs[i].size;   // attribute value (includes header)
+        }
+    }
+
+    if (sequenceSize == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    totalSize = GetContainerHeaderSize(sequenceSize) + sequenceSize;
+    *ppEntry = (PSDP_STREAM_ENTRY) SdpAllocatePool(sizeof(SDP_STREAM_ENTRY) + totalSize - 1);
+    if (*ppEntry == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    InitializeListHead(&(*ppEntry)->link);
+    (*ppEntry)->streamSize = totalSize;
+
+    stream = WriteVariableSizeToStream(SDP_TYPE_SEQUENCE, sequenceSize, (*ppEntry)->stream);
+
+    for (i = 0; i < numAttribs; i++) {
+        if (SdpIsAttributeInRange(pRange, numAttributes, pAttribs[i].attribute)) {
+            *stream++ = FMT_TYPE(SDP_TYPE_UINT) | FMT_SIZE_INDEX_FROM_ST(SDP_ST_UINT16);
+
+            usVal = RtlUshortByteSwap(pAttribs[i].attribute);
+            memcpy(stream, &usVal, sizeof(USHORT));
+            stream += sizeof(USHORT);
+
+            memcpy(stream, pStream + pAttribs[i].offset, pAttribs[i].size);
+            stream += pAttribs[i].size;
+        }
+    }
+
+    ASSERT((ULONG) (stream - (*ppEntry)->stream) == totalSize);
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS SdpAttribSearch::RetrieveAttributes(PUCHAR pStream, ULONG streamSize)
 {
     PAGED_CODE();
@@ -821,6 +935,29 @@ SdpAttribSearch::RetrieveAttributesInSearchStreamWalk(
 }
 
 
+NTSTATUS
+SdpDatabase::FindRecordElements(
+    SdpAttribSearch *pAttribSearch,
+    ServiceRecord *pRecord,
+    PSDP_STREAM_ENTRY *ppEntry,
+    PSDP_ERROR pSdpError
+    )
+{
+#if defined (UNDER_CE) || defined (WINCE_EMULATION)
+    if (pRecord->pAttribs) {
+        return pAttribSearch->FindIndexedElements(pRecord->pStream,
+                                                  pRecord->pAttribs,
+                                                  pRecord->numAttribs,
+                                                  ppEntry);
+    }
+#endif
+
+    return pAttribSearch->FindElements(pRecord->pStream,
+                                       pRecord->streamSize,
+                                       ppEntry,
+                                       pSdpError);
+}
+
 NTSTATUS 
 SdpDatabase::ServiceAttributeRequestResponseRemote(
     IN ULONG serviceHandle,
@@ -905,11 +1042,10 @@ SdpDatabase::ServiceAttributeRequestResponse(
 
             foundRecord = TRUE;
 
-            status = pAttribSearch->FindElements(
-                pRecord->pStream,
-                pRecord->streamSize,
-                &pStreamEntry,
-                pSdpError);
+            status = FindRecordElements(pAttribSearch,
+                                        pRecord,
+                                        &pStreamEntry,
+                                        pSdpError);
 
             //
             // FindElements will return success even if there was no match.  If
@@ -1092,14 +1228,13 @@ SdpDatabase::ServiceSearchAttributeResponse(
         }
 #endif
 
-        if (pUuidSearch->SearchStream(pRecord->pStream, pRecord->streamSize)) {
+        if (SearchRecord(pUuidSearch, pRecord)) {
             pStreamEntry = NULL;
 
-            status = pAttribSearch->FindElements(
-                pRecord->pStream,
-                pRecord->streamSize,
-                &pStreamEntry,
-                pSdpError);
+            status = FindRecordElements(pAttribSearch,
+                                        pRecord,
+                                        &pStreamEntry,
+                                        pSdpError);
 
             if (NT_SUCCESS(status)) {
                 if (pStreamEntry != NULL) {
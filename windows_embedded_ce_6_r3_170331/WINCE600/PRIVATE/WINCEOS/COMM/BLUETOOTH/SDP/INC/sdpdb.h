@@ -51,6 +51,16 @@ struct HandleEntry {
 
 typedef CList<HandleEntry, FIELD_OFFSET(HandleEntry, link)> HandleList;
 
+//
+// Location of a top level attribute value inside a record stream.  offset and
+// size cover the whole value element, including its header.
+//
+struct SdpAttribIndex {
+    USHORT attribute;
+    ULONG offset;
+    ULONG size;
+};
+
 struct SdpAttribSearch;
 struct SdpUuidSearch;
 
@@ -132,6 +142,20 @@ protected:
         PSM_LIST    psmList;
 
         HANDLE      hCallerProc;     // Process that created this record, used when deleting the record on shutdown.
+
+        //
+        // Search index, rebuilt whenever pStream changes.  pUuids holds every
+        // UUID in the record (normalized to 128 bits, network byte order) and
+        // pAttribs the top level attributes in stream order.  pAttribs is NULL
+        // if the index could not be built, searches then walk pStream.
+        //
+        GUID            *pUuids;
+        ULONG           numUuids;
+        SdpAttribIndex  *pAttribs;
+        ULONG           numAttribs;
+
+        NTSTATUS BuildIndex();
+        void FreeIndex();
     };
 
 public:
@@ -322,6 +346,13 @@ protected:
     ServiceRecord* GetServiceRecord(HANDLE handle);
     ULONG GetNextRecordHandle();
 
+    // Assumes that the services list is locked
+    BOOLEAN SearchRecord(SdpUuidSearch *pUuidSearch, ServiceRecord *pRecord);
+    NTSTATUS FindRecordElements(SdpAttribSearch *pAttribSearch,
+                                ServiceRecord *pRecord,
+                                PSDP_STREAM_ENTRY *ppEntry,
+                                PSDP_ERROR pSdpError);
+
     ////////////////////////////////////////////////////////////////////////////
     // LIst of outside drivers that want to validate records
     ////////////////////////////////////////////////////////////////////////////
@@ -129,6 +129,10 @@ NTSTATUS SdpFindAttributeSequenceInStream(PUCHAR Stream,
                                           PSDP_STREAM_ENTRY *ppEntry,
                                           PSDP_ERROR SdpError);
 
+BOOLEAN SdpIsAttributeInRange(SdpAttributeRange *AttributeRange,
+                              ULONG AttributeRangeCount,
+                              USHORT Attribute);
+
 SDP_ERROR MapNtStatusToSdpError(NTSTATUS Status);
 
 NTSTATUS  SdpStreamFromTree(PSDP_NODE Root, PUCHAR *Stream, PULONG Size);
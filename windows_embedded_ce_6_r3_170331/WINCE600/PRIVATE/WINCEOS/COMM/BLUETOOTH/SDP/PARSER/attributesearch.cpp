@@ -91,6 +91,15 @@ struct FindStreamInfo {
 };
 
 ULONG FindStreamInfo::IsAttributeInRange(USHORT Attribute)
+{
+    return SdpIsAttributeInRange(AttributeRange, AttributeRangeCount, Attribute);
+}
+
+BOOLEAN SdpIsAttributeInRange(
+    SdpAttributeRange *AttributeRange,
+    ULONG AttributeRangeCount,
+    USHORT Attribute
+    )
 {
     ULONG i;
 
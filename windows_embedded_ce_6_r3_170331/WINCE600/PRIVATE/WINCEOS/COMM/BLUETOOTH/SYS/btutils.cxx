@@ -93,16 +93,130 @@ int StatusToError (unsigned char status, int iGeneric) {
     return iGeneric;
 }
 
+//
+//  Every HCI, L2CAP and RFCOMM packet is allocated and freed through BufferAlloc
+//  and BufferFree, so a few recently freed buffers of each size class are kept
+//  around instead of going back to the heap for every ACL fragment. Each buffer
+//  is preceded by a small header recording its class; requests larger than the
+//  biggest class bypass the pools.
+//
+#define BUFFER_POOL_CLASSES     3
+#define BUFFER_POOL_NONE        0xffffffff
+
+struct BufferPoolHeader {
+    BufferPoolHeader    *pNext;         // Next free buffer while cached
+    unsigned int        iClass;         // Size class, or BUFFER_POOL_NONE
+};
+
+struct BufferPool {
+    int                 cbData;         // Data bytes available in a buffer of this class
+    int                 cMaxFree;       // Maximum number of free buffers cached
+    int                 cFree;
+    BufferPoolHeader    *pFreeList;
+};
+
+static CRITICAL_SECTION g_csBufferPool;
+static BOOL             g_fBufferPool;
+static BufferPool       g_aBufferPool[BUFFER_POOL_CLASSES] = {
+    {128,  32, 0, NULL},    // HCI commands and events, signaling packets
+    {768,  32, 0, NULL},    // ACL fragments and packets up to the default L2CAP MTU
+    {1536, 16, 0, NULL}     // Large ACL fragments and RFCOMM frames
+};
+
+static void BufferPoolDrain (void) {
+    BufferPoolHeader *pList = NULL;
+
+    EnterCriticalSection (&g_csBufferPool);
+
+    for (int i = 0 ; i < BUFFER_POOL_CLASSES ; ++i) {
+        BufferPool *pPool = &g_aBufferPool[i];
+        while (pPool->pFreeList) {
+            BufferPoolHeader *pHdr = pPool->pFreeList;
+            pPool->pFreeList = pHdr->pNext;
+            pHdr->pNext = pList;
+            pList = pHdr;
+        }
+
+        pPool->cFree = 0;
+    }
+
+    LeaveCriticalSection (&g_csBufferPool);
+
+    while (pList) {
+        BufferPoolHeader *pNext = pList->pNext;
+        g_funcFree (pList, g_pvFreeData);
+        pList = pNext;
+    }
+}
+
 void BufferFree (BD_BUFFER *pBuf) {
-    if (! pBuf->fMustCopy)
-        g_funcFree (pBuf, g_pvFreeData);
+    if (pBuf->fMustCopy)
+        return;
+
+    BufferPoolHeader *pHdr = ((BufferPoolHeader *)pBuf) - 1;
+
+    if ((pHdr->iClass < BUFFER_POOL_CLASSES) && g_fBufferPool) {
+        BufferPool *pPool = &g_aBufferPool[pHdr->iClass];
+        BOOL fCached = FALSE;
+
+        EnterCriticalSection (&g_csBufferPool);
+
+        if (pPool->cFree < pPool->cMaxFree) {
+            pHdr->pNext = pPool->pFreeList;
+            pPool->pFreeList = pHdr;
+            ++pPool->cFree;
+            fCached = TRUE;
+        }
+
+        LeaveCriticalSection (&g_csBufferPool);
+
+        if (fCached)
+            return;
+    }
+
+    g_funcFree (pHdr, g_pvFreeData);
 }
 
 BD_BUFFER *BufferAlloc (int cSize) {
     SVSUTIL_ASSERT (cSize > 0);
 
-    BD_BUFFER *pRes = (BD_BUFFER *)g_funcAlloc (cSize + sizeof (BD_BUFFER), g_pvAllocData);
-    if (pRes) {
+    BufferPoolHeader *pHdr = NULL;
+    unsigned int iClass = BUFFER_POOL_NONE;
+    int cbData = cSize;
+
+    if (g_fBufferPool) {
+        for (unsigned int i = 0 ; i < BUFFER_POOL_CLASSES ; ++i) {
+            if (cSize <= g_aBufferPool[i].cbData) {
+                iClass = i;
+                cbData = g_aBufferPool[i].cbData;
+                break;
+            }
+        }
+    }
+
+    if (iClass != BUFFER_POOL_NONE) {
+        BufferPool *pPool = &g_aBufferPool[iClass];
+
+        EnterCriticalSection (&g_csBufferPool);
+
+        pHdr = pPool->pFreeList;
+        if (pHdr) {
+            pPool->pFreeList = pHdr->pNext;
+            --pPool->cFree;
+        }
+
+        LeaveCriticalSection (&g_csBufferPool);
+    }
+
+    if (! pHdr)
+        pHdr = (BufferPoolHeader *)g_funcAlloc (sizeof (BufferPoolHeader) + sizeof (BD_BUFFER) + cbData, g_pvAllocData);
+
+    BD_BUFFER *pRes = NULL;
+    if (pHdr) {
+        pHdr->pNext = NULL;
+        pHdr->iClass = iClass;
+
+        pRes = (BD_BUFFER *)(pHdr + 1);
         pRes->cSize = cSize;
 
         pRes->cEnd = pRes->cSize;
@@ -389,6 +503,9 @@ int btutil_InitializeOnce (void) {
 
     InitializeCriticalSection (&g_csLongTerm);
 
+    InitializeCriticalSection (&g_csBufferPool);
+    g_fBufferPool = TRUE;
+
     return ERROR_SUCCESS;
 }
 
@@ -404,6 +521,10 @@ int btutil_UninitializeOnce (void) {
 
     DeleteCriticalSection (&g_csLongTerm);
 
+    g_fBufferPool = FALSE;
+    BufferPoolDrain ();
+    DeleteCriticalSection (&g_csBufferPool);
+
     return ERROR_SUCCESS;
 }
 
@@ -423,6 +544,8 @@ int btutil_CloseDriverInstance (void) {
     
     handleSys->eStage = STOPPED;
 
+    BufferPoolDrain ();
+
     return ERROR_SUCCESS;
 }
 
@@ -47,6 +47,7 @@ extern BOOL PingDhcp(DWORD dwIPAddr);
 
 DhcpInfo * FindLockRefDhcp(DhcpInfo *pDhcp, PTSTR pName);
 void StartDhcpDialogThread(DWORD dwMsg);
+void ComputeLeaseRelativeFILETIME(DhcpInfo *pDhcp, int End, FILETIME * EndTime);
 void DhcpEventWorker(CTEEvent * Event, void * Context);
 void EventObtainLease(DhcpEvent * pEvent);
 
@@ -767,10 +768,132 @@ OpenDHCPKey(
     return hKey;
 }
 
+//
+// The cached lease is stored as a set of independent registry values, so a
+// power loss in the middle of SetDhcpConfig can leave a mix of old and new
+// values behind.  A check value computed over the lease fields is written
+// last and verified before the cached lease is used for INIT-REBOOT.
+//
+#define DHCP_LEASE_CHECK_VERSION    1
+
+DWORD
+LeaseCheckBytes(
+    DWORD   Check,
+    const BYTE * pData,
+    DWORD   cbData
+    )
+{
+    while (cbData--) {
+        Check ^= *pData++;
+        Check *= 16777619;      // FNV-1a prime
+    }
+    return Check;
+}
+
+DWORD
+ComputeLeaseCheck(
+    DhcpInfo * pDhcp
+    )
+{
+    DWORD Check = 2166136261 ^ DHCP_LEASE_CHECK_VERSION;
+
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->IPAddr, sizeof(pDhcp->IPAddr));
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->SubnetMask, sizeof(pDhcp->SubnetMask));
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->DhcpServer, sizeof(pDhcp->DhcpServer));
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->Gateway, sizeof(pDhcp->Gateway));
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->LeaseObtained, sizeof(pDhcp->LeaseObtained));
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->Lease, sizeof(pDhcp->Lease));
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->T1, sizeof(pDhcp->T1));
+    Check = LeaseCheckBytes(Check, (BYTE *)&pDhcp->T2, sizeof(pDhcp->T2));
+
+    // A lease obtained under a different client identifier is not ours
+    Check = LeaseCheckBytes(Check, pDhcp->ClientID, min(pDhcp->ClientIDLen, CHADDR_LEN));
+
+    return Check;
+}
+
+//
+// Decide whether the lease read from the registry can be used for INIT-REBOOT.
+// A lease that fails here is discarded so that we go straight to DISCOVER
+// instead of spending the INIT-REBOOT retries on an address we cannot keep.
+//
+BOOL
+IsCachedLeaseValid(
+    DhcpInfo * pDhcp,
+    BOOL    fHaveCheck,
+    DWORD   Check
+    )
+{
+    uint        Addr = net_long(pDhcp->IPAddr);
+    uint        HostMask = ~net_long(pDhcp->SubnetMask);
+    uint        Net = Addr >> 24;
+    FILETIME    CurTime, EndTime;
+
+    if (!fHaveCheck || (Check != ComputeLeaseCheck(pDhcp))) {
+        DEBUGMSG(ZONE_WARN, (TEXT("DHCP:IsCachedLeaseValid(%s): lease check mismatch\r\n"),
+            pDhcp->Name));
+        return FALSE;
+    }
+
+    //
+    // The mask must be contiguous and the address a unicast host address on it.
+    //
+    if ((HostMask == 0xffffffff) || (HostMask & (HostMask + 1)) ||
+        (Net == 0) || (Net == 127) || (Net >= 224) ||
+        ((HostMask > 1) && (((Addr & HostMask) == 0) || ((Addr & HostMask) == HostMask)))) {
+        DEBUGMSG(ZONE_WARN, (TEXT("DHCP:IsCachedLeaseValid(%s): bad address %X mask %X\r\n"),
+            pDhcp->Name, pDhcp->IPAddr, pDhcp->SubnetMask));
+        return FALSE;
+    }
+
+    //
+    // An infinite lease is stored as 0xffffffff with T1 and T2 derived from it,
+    // so comparing unsigned keeps it consistent.
+    //
+    if ((0 == pDhcp->Lease) ||
+        ((uint)pDhcp->T1 > (uint)pDhcp->T2) ||
+        ((uint)pDhcp->T2 > (uint)pDhcp->Lease)) {
+        DEBUGMSG(ZONE_WARN, (TEXT("DHCP:IsCachedLeaseValid(%s): bad lease times T1 %x T2 %x Lease %x\r\n"),
+            pDhcp->Name, pDhcp->T1, pDhcp->T2, pDhcp->Lease));
+        return FALSE;
+    }
+
+    ComputeLeaseRelativeFILETIME(pDhcp, pDhcp->Lease, &EndTime);
+    GetCurrentFT(&CurTime);
+    if (CompareFileTime(&CurTime, &EndTime) >= 0) {
+        DEBUGMSG(ZONE_WARN, (TEXT("DHCP:IsCachedLeaseValid(%s): lease expired\r\n"),
+            pDhcp->Name));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+//
+// Forget the lease read from the registry
+//
+void
+DiscardCachedLease(
+    DhcpInfo * pDhcp
+    )
+{
+    pDhcp->IPAddr = 0;
+    pDhcp->SubnetMask = 0;
+    pDhcp->DhcpServer = 0;
+    pDhcp->Gateway = 0;
+    memset(pDhcp->DNS, 0, sizeof(pDhcp->DNS));
+    memset(pDhcp->WinsServer, 0, sizeof(pDhcp->WinsServer));
+    pDhcp->LeaseObtained.dwLowDateTime = 0;
+    pDhcp->LeaseObtained.dwHighDateTime = 0;
+    pDhcp->Lease = pDhcp->T1 = pDhcp->T2 = 0;
+}
+
 STATUS GetDhcpConfig(DhcpInfo *pDhcp) {
     HKEY    hKey;
     BOOL    fStatus;
     uint    fDhcpEnabled, cSize;
+    BOOL    fHaveCheck = FALSE;
+    DWORD   LeaseCheck = 0;
 
     DEBUGMSG (ZONE_INIT, (TEXT("+DHCP:GetDhcpConfig(%s):\r\n"), pDhcp->Name));
 
@@ -820,6 +943,8 @@ STATUS GetDhcpConfig(DhcpInfo *pDhcp) {
                 // Get T1 & T2
                 GetRegDWORDValue(hKey, TEXT("T1"), &pDhcp->T1);
                 GetRegDWORDValue(hKey, TEXT("T2"), &pDhcp->T2);
+
+                fHaveCheck = GetRegDWORDValue(hKey, TEXT("DhcpLeaseCheck"), &LeaseCheck);
             }
         }
 
@@ -862,6 +987,15 @@ STATUS GetDhcpConfig(DhcpInfo *pDhcp) {
             RegDeleteValue(hKey, TEXT("DhcpEnableImmediateAutoIP"));
         }
 
+        //
+        // An auto IP address has no server lease behind it, so only a
+        // DHCP assigned address is checked here.
+        //
+        if (pDhcp->IPAddr && !(pDhcp->SFlags & DHCPSTATE_AUTO_CFG_IP) &&
+            !IsCachedLeaseValid(pDhcp, fHaveCheck, LeaseCheck)) {
+            DiscardCachedLease(pDhcp);
+        }
+
         RegCloseKey(hKey);
     }
 
@@ -913,6 +1047,9 @@ STATUS SetDhcpConfig(DhcpInfo *pDhcp) {
             // Store the list of params requested from server so we can tell
             // if it has changed after a reboot.
             SetRegBinaryValue(hKey,TEXT("PrevReqOptions"),pDhcp->ReqOptions,pDhcp->ReqOptions[0]+1);
+
+            // Written last so a partially saved lease fails the check on the next boot
+            SetRegDWORDValue(hKey, TEXT("DhcpLeaseCheck"), ComputeLeaseCheck(pDhcp));
         }
 
         // Save auto IP config state
@@ -1805,11 +1942,20 @@ STATUS GetDhcpLease(DhcpInfo *pDhcp) {
                     if (fDiscover) {
                         Flags |= SID_PKT_FL;
                         fDiscover = FALSE;
+                        BuildDhcpPkt(pDhcp, &Pkt, DHCPREQUEST, Flags, pDhcp->ReqOptions, &cPkt);
+                        Status = SendDhcpPkt(pDhcp, &Pkt, cPkt, DHCPACK, BCAST_FL | DFT_LOOP_FL);
                     } else {
+                        //
+                        // INIT-REBOOT with the cached lease. A server that knows
+                        // the client answers with an ACK or NAK, but one with no
+                        // record of it must stay silent (RFC 2131 4.3.2). So a
+                        // short retransmit sequence is enough before falling back
+                        // to the cached lease or a DISCOVER.
+                        //
                         Flags |= NEW_PKT_FL;
+                        BuildDhcpPkt(pDhcp, &Pkt, DHCPREQUEST, Flags, pDhcp->ReqOptions, &cPkt);
+                        Status = SendDhcpPkt(pDhcp, &Pkt, cPkt, DHCPACK, BCAST_FL | INIT_REBOOT_LOOP_FL);
                     }
-                    BuildDhcpPkt(pDhcp, &Pkt, DHCPREQUEST, Flags, pDhcp->ReqOptions, &cPkt);
-                    Status = SendDhcpPkt(pDhcp, &Pkt, cPkt, DHCPACK, BCAST_FL | DFT_LOOP_FL);
                 }
 
                 if (DHCP_DELETED == Status) {
@@ -75,6 +75,7 @@ typedef struct DhcpPkt {
 // first byte is number of times to loop...
 #define LOOP_MASK_FL		0x00ff
 #define ONCE_FL				0x0001
+#define INIT_REBOOT_LOOP_FL	0x0002
 #define DFT_LOOP_FL			0x0004
 #define BCAST_FL			0x0100
 
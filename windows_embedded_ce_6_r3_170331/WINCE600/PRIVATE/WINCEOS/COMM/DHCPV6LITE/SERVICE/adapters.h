@@ -95,10 +95,9 @@ typedef struct _DHCPV6_ADAPT {
     //
     // Timer Events
     //
-    BOOL bTimerCreated;
     BOOL bEventTimerQueued;
     BOOL bEventTimerCancelled;
-    HANDLE hEventTimer;
+    DHCPV6_TIMER_ENTRY EventTimer;
 
     //
     // Timer Variables
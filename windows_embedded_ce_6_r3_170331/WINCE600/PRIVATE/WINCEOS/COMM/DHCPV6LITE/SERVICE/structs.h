@@ -48,6 +48,18 @@ typedef struct _INI_INTERFACE_HANDLE {
 } INI_INTERFACE_HANDLE, * PINI_INTERFACE_HANDLE;
 
 
+//
+// Timer wheel entry, one per adapter. Owned by the timer module while bLinked.
+//
+typedef struct _DHCPV6_TIMER_ENTRY {
+    LIST_ENTRY Link;
+    BOOL bLinked;
+    ULONG uExpires;                     // absolute expiry, in wheel ticks
+    WAITORTIMERCALLBACK CallbackRoutine;
+    PVOID pvCallbackContext;
+} DHCPV6_TIMER_ENTRY, * PDHCPV6_TIMER_ENTRY;
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,17 +36,379 @@ Revision History:
 --*/
 
 #include "dhcpv6p.h"
-#include "wcetim.h"
 //#include "precomp.h"
 //#include "timer.tmh"
 
 
+#define DHCPV6_TIMER_REGKEY             TEXT("Comm\\DHCPv6L")
+#define DHCPV6_TIMER_REGVAL_TICK        TEXT("TimerTick")
+#define DHCPV6_TIMER_REGVAL_SLACK       TEXT("TimerSlack")
+
+//
+// uWakeTick value used while the service thread waits with no timers armed;
+// any expiry compares earlier than this.
+//
+#define DHCPV6_TIMER_NO_WAKE(pModule)   ((pModule)->uTick + 0x7fffffff)
+
+
+static
+VOID
+DhcpV6TimerReadRegistry(
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule
+    )
+{
+    HKEY hKey;
+    DWORD dwType;
+    DWORD dwVal;
+    DWORD dwValSize;
+
+
+    pDhcpV6TimerModule->dwTickMs = DHCPV6_TIMER_DEFAULT_TICK;
+    pDhcpV6TimerModule->dwSlackMs = DHCPV6_TIMER_DEFAULT_SLACK;
+
+    if (ERROR_SUCCESS != RegOpenKeyEx(HKEY_LOCAL_MACHINE, DHCPV6_TIMER_REGKEY,
+                                      0, 0, &hKey)) {
+        return;
+    }
+
+    dwValSize = sizeof(dwVal);
+    if (ERROR_SUCCESS == RegQueryValueEx(hKey, DHCPV6_TIMER_REGVAL_TICK, NULL,
+                                         &dwType, (LPBYTE)&dwVal, &dwValSize)
+        && dwType == REG_DWORD
+        && dwVal >= DHCPV6_TIMER_MIN_TICK
+        && dwVal <= DHCPV6_TIMER_MAX_TICK) {
+        pDhcpV6TimerModule->dwTickMs = dwVal;
+    }
+
+    dwValSize = sizeof(dwVal);
+    if (ERROR_SUCCESS == RegQueryValueEx(hKey, DHCPV6_TIMER_REGVAL_SLACK, NULL,
+                                         &dwType, (LPBYTE)&dwVal, &dwValSize)
+        && dwType == REG_DWORD) {
+        pDhcpV6TimerModule->dwSlackMs = dwVal;
+    }
+
+    RegCloseKey(hKey);
+}
+
+
+//
+// Put an entry in the slot matching its expiry
+// Lock: Wheel
+//
+static
+VOID
+DhcpV6TimerLink(
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule,
+    PDHCPV6_TIMER_ENTRY pEntry
+    )
+{
+    ULONG uDelta = pEntry->uExpires - pDhcpV6TimerModule->uTick;
+    ULONG uShift = DHCPV6_TIMER_ROOT_BITS;
+    PLIST_ENTRY pSlot = NULL;
+    ULONG i;
+
+
+    if ((LONG)uDelta < 0) {
+        //
+        // Already due, process it with the current tick
+        //
+        pEntry->uExpires = pDhcpV6TimerModule->uTick;
+        uDelta = 0;
+    }
+
+    if (uDelta < DHCPV6_TIMER_ROOT_SIZE) {
+        pSlot = &pDhcpV6TimerModule->Root[pEntry->uExpires & DHCPV6_TIMER_ROOT_MASK];
+    } else {
+        for (i = 0; i < DHCPV6_TIMER_LEVELS - 1; i++, uShift += DHCPV6_TIMER_LEVEL_BITS) {
+            if (i == DHCPV6_TIMER_LEVELS - 2 &&
+                uDelta >= (1UL << (uShift + DHCPV6_TIMER_LEVEL_BITS))) {
+                //
+                // Beyond the range of the wheel, clamp to the last slot
+                //
+                uDelta = (1UL << (uShift + DHCPV6_TIMER_LEVEL_BITS)) - 1;
+                pEntry->uExpires = pDhcpV6TimerModule->uTick + uDelta;
+            }
+
+            if (uDelta < (1UL << (uShift + DHCPV6_TIMER_LEVEL_BITS))) {
+                pSlot = &pDhcpV6TimerModule->Level[i][(pEntry->uExpires >> uShift) & DHCPV6_TIMER_LEVEL_MASK];
+                break;
+            }
+        }
+    }
+
+    ASSERT(pSlot);
+    InsertTailList(pSlot, &pEntry->Link);
+    pEntry->bLinked = TRUE;
+    pDhcpV6TimerModule->uTimers++;
+}
+
+
+//
+// Lock: Wheel
+//
+static
+VOID
+DhcpV6TimerUnlink(
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule,
+    PDHCPV6_TIMER_ENTRY pEntry
+    )
+{
+    ASSERT(pEntry->bLinked);
+    ASSERT(pDhcpV6TimerModule->uTimers);
+
+    RemoveEntryList(&pEntry->Link);
+    pEntry->bLinked = FALSE;
+    pDhcpV6TimerModule->uTimers--;
+}
+
+
+//
+// (Re)arm an entry to fire dwDueTime ms from now. Expiries are rounded up to
+// a tick, so a timer never fires early, and then deferred within the slack
+// to the tick with the most trailing zero bits so that timers close to each
+// other fire together.
+// Lock: Wheel
+//
+static
+VOID
+DhcpV6TimerArm(
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule,
+    PDHCPV6_TIMER_ENTRY pEntry,
+    DWORD dwDueTime
+    )
+{
+    DWORD dwNow = GetTickCount();
+    DWORD dwLead;
+    ULONG uTicks;
+    ULONG uSlack;
+    ULONG uLimit;
+    ULONG uMask;
+    ULONG uBit;
+
+
+    if (pEntry->bLinked) {
+        DhcpV6TimerUnlink(pDhcpV6TimerModule, pEntry);
+    }
+
+    if (dwDueTime > DHCPV6_TIMER_INFINITE_INTERVAL) {
+        dwDueTime = DHCPV6_TIMER_INFINITE_INTERVAL;
+    }
+
+    //
+    // Ticks are counted from dwTickTime, the time at which uTick is due
+    //
+    if ((LONG)(dwNow - pDhcpV6TimerModule->dwTickTime) < 0) {
+        dwLead = pDhcpV6TimerModule->dwTickTime - dwNow;
+        dwDueTime = (dwDueTime > dwLead) ? (dwDueTime - dwLead) : 0;
+    } else {
+        dwDueTime += dwNow - pDhcpV6TimerModule->dwTickTime;
+    }
+
+    uTicks = (dwDueTime + pDhcpV6TimerModule->dwTickMs - 1) / pDhcpV6TimerModule->dwTickMs;
+    pEntry->uExpires = pDhcpV6TimerModule->uTick + uTicks;
+
+    uSlack = pDhcpV6TimerModule->dwSlackMs / pDhcpV6TimerModule->dwTickMs;
+    if (uSlack > uTicks / 16) {
+        uSlack = uTicks / 16;
+    }
+
+    if (uSlack) {
+        uLimit = pEntry->uExpires + uSlack;
+        uMask = pEntry->uExpires ^ uLimit;
+
+        for (uBit = 0; (uMask >> uBit) > 1; uBit++);
+
+        pEntry->uExpires = uLimit & ~((1UL << uBit) - 1);
+    }
+
+    DhcpV6TimerLink(pDhcpV6TimerModule, pEntry);
+
+    if ((LONG)(pEntry->uExpires - pDhcpV6TimerModule->uWakeTick) < 0) {
+        pDhcpV6TimerModule->uWakeTick = pEntry->uExpires;
+        SetEvent(pDhcpV6TimerModule->hWakeEvent);
+    }
+}
+
+
+//
+// Move the entries of a higher level slot down the wheel
+// Lock: Wheel
+//
+static
+ULONG
+DhcpV6TimerCascade(
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule,
+    ULONG uLevel
+    )
+{
+    ULONG uIndex = (pDhcpV6TimerModule->uTick >> (DHCPV6_TIMER_ROOT_BITS + uLevel * DHCPV6_TIMER_LEVEL_BITS)) & DHCPV6_TIMER_LEVEL_MASK;
+    PLIST_ENTRY pSlot = &pDhcpV6TimerModule->Level[uLevel][uIndex];
+    LIST_ENTRY List;
+    PDHCPV6_TIMER_ENTRY pEntry;
+
+
+    if (IsListEmpty(pSlot)) {
+        return uIndex;
+    }
+
+    //
+    // Splice the slot onto a local list head, then relink in order
+    //
+    List.Flink = pSlot->Flink;
+    List.Blink = pSlot->Blink;
+    List.Flink->Blink = &List;
+    List.Blink->Flink = &List;
+    InitializeListHead(pSlot);
+
+    while (!IsListEmpty(&List)) {
+        pEntry = CONTAINING_RECORD(List.Flink, DHCPV6_TIMER_ENTRY, Link);
+        RemoveEntryList(&pEntry->Link);
+        pDhcpV6TimerModule->uTimers--;
+        DhcpV6TimerLink(pDhcpV6TimerModule, pEntry);
+    }
+
+    return uIndex;
+}
+
+
+//
+// Fire everything due up to now. Callbacks run without the wheel lock so they
+// can take the adapter lock and rearm.
+// Lock: Wheel
+//
+static
+VOID
+DhcpV6TimerRunWheel(
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule
+    )
+{
+    PDHCPV6_TIMER_ENTRY pEntry;
+    PLIST_ENTRY pSlot;
+    WAITORTIMERCALLBACK CallbackRoutine;
+    PVOID pvCallbackContext;
+    DWORD dwBehind;
+    ULONG uIndex;
+    ULONG i;
+
+
+    while (!pDhcpV6TimerModule->bDeInitializing &&
+           (LONG)(GetTickCount() - pDhcpV6TimerModule->dwTickTime) >= 0) {
+
+        if (pDhcpV6TimerModule->uTimers == 0) {
+            //
+            // Nothing armed, skip straight past the current time
+            //
+            dwBehind = GetTickCount() - pDhcpV6TimerModule->dwTickTime;
+            pDhcpV6TimerModule->uTick += dwBehind / pDhcpV6TimerModule->dwTickMs + 1;
+            pDhcpV6TimerModule->dwTickTime += (dwBehind / pDhcpV6TimerModule->dwTickMs + 1) * pDhcpV6TimerModule->dwTickMs;
+            break;
+        }
+
+        uIndex = pDhcpV6TimerModule->uTick & DHCPV6_TIMER_ROOT_MASK;
+        if (uIndex == 0) {
+            for (i = 0; i < DHCPV6_TIMER_LEVELS - 1; i++) {
+                if (DhcpV6TimerCascade(pDhcpV6TimerModule, i) != 0) {
+                    break;
+                }
+            }
+        }
+
+        pSlot = &pDhcpV6TimerModule->Root[uIndex];
+        while (!IsListEmpty(pSlot) && !pDhcpV6TimerModule->bDeInitializing) {
+            pEntry = CONTAINING_RECORD(pSlot->Flink, DHCPV6_TIMER_ENTRY, Link);
+            ASSERT(pEntry->uExpires == pDhcpV6TimerModule->uTick);
+
+            DhcpV6TimerUnlink(pDhcpV6TimerModule, pEntry);
+            CallbackRoutine = pEntry->CallbackRoutine;
+            pvCallbackContext = pEntry->pvCallbackContext;
+
+            LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
+            CallbackRoutine(pvCallbackContext, TRUE);
+            EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
+        }
+
+        pDhcpV6TimerModule->uTick++;
+        pDhcpV6TimerModule->dwTickTime += pDhcpV6TimerModule->dwTickMs;
+    }
+}
+
+
+//
+// How long the service thread may sleep: until the next non empty root slot,
+// or until the root wraps and the next level has to be cascaded.
+// Lock: Wheel
+//
+static
+DWORD
+DhcpV6TimerNextTimeout(
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule
+    )
+{
+    ULONG uTicks;
+    LONG lWait;
+
+
+    if (pDhcpV6TimerModule->uTimers == 0) {
+        pDhcpV6TimerModule->uWakeTick = DHCPV6_TIMER_NO_WAKE(pDhcpV6TimerModule);
+        return INFINITE;
+    }
+
+    for (uTicks = 0;
+         uTicks < DHCPV6_TIMER_ROOT_SIZE - (pDhcpV6TimerModule->uTick & DHCPV6_TIMER_ROOT_MASK);
+         uTicks++) {
+        if (!IsListEmpty(&pDhcpV6TimerModule->Root[(pDhcpV6TimerModule->uTick + uTicks) & DHCPV6_TIMER_ROOT_MASK])) {
+            break;
+        }
+    }
+
+    pDhcpV6TimerModule->uWakeTick = pDhcpV6TimerModule->uTick + uTicks;
+
+    lWait = (LONG)(pDhcpV6TimerModule->dwTickTime + uTicks * pDhcpV6TimerModule->dwTickMs - GetTickCount());
+
+    return (lWait > 0) ? (DWORD)lWait : 0;
+}
+
+
+static
+DWORD
+WINAPI
+DhcpV6TimerThread(
+    LPVOID pvContext
+    )
+{
+    PDHCPV6_TIMER_MODULE pDhcpV6TimerModule = (PDHCPV6_TIMER_MODULE)pvContext;
+    DWORD dwTimeout;
+
+
+    DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("Begin Timer Thread"));
+
+    EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
+
+    while (!pDhcpV6TimerModule->bDeInitializing) {
+        DhcpV6TimerRunWheel(pDhcpV6TimerModule);
+        dwTimeout = DhcpV6TimerNextTimeout(pDhcpV6TimerModule);
+
+        LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
+        WaitForSingleObject(pDhcpV6TimerModule->hWakeEvent, dwTimeout);
+        EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
+    }
+
+    LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
+
+    DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("End Timer Thread"));
+
+    return 0;
+}
+
+
 DWORD
 InitDhcpV6TimerModule(
     PDHCPV6_TIMER_MODULE pDhcpV6TimerModule
     )
 {
     DWORD dwError = 0;
+    BOOL bRWLock = FALSE;
+    ULONG i, j;
 
 
     DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("Begin Initializing Timer"));
@@ -55,18 +417,68 @@ InitDhcpV6TimerModule(
 
     dwError = InitializeRWLock(&pDhcpV6TimerModule->RWLock);
     BAIL_ON_WIN32_ERROR(dwError);
+    bRWLock = TRUE;
+
+    __try {
+        InitializeCriticalSection(&pDhcpV6TimerModule->csWheel);
+        pDhcpV6TimerModule->bWheelSection = TRUE;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        dwError = GetExceptionCode();
+        BAIL_ON_WIN32_ERROR(dwError);
+    }
+
+    for (i = 0; i < DHCPV6_TIMER_ROOT_SIZE; i++) {
+        InitializeListHead(&pDhcpV6TimerModule->Root[i]);
+    }
+    for (i = 0; i < DHCPV6_TIMER_LEVELS - 1; i++) {
+        for (j = 0; j < DHCPV6_TIMER_LEVEL_SIZE; j++) {
+            InitializeListHead(&pDhcpV6TimerModule->Level[i][j]);
+        }
+    }
+
+    DhcpV6TimerReadRegistry(pDhcpV6TimerModule);
 
-    pDhcpV6TimerModule->hTimerQueue = CreateTimerQueue();
-    if(pDhcpV6TimerModule->hTimerQueue == NULL) {
+    pDhcpV6TimerModule->uTick = 0;
+    pDhcpV6TimerModule->dwTickTime = GetTickCount();
+    pDhcpV6TimerModule->uWakeTick = DHCPV6_TIMER_NO_WAKE(pDhcpV6TimerModule);
+
+    pDhcpV6TimerModule->hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (pDhcpV6TimerModule->hWakeEvent == NULL) {
         dwError = GetLastError();
-        DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_FATAL, ("FAILED CreateTimerQueue with Error: %!status!", dwError));
+        DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_FATAL, ("FAILED CreateEvent with Error: %!status!", dwError));
+        BAIL_ON_WIN32_ERROR(dwError);
+    }
+
+    pDhcpV6TimerModule->hThread = CreateThread(NULL, 0, DhcpV6TimerThread, pDhcpV6TimerModule, 0, NULL);
+    if (pDhcpV6TimerModule->hThread == NULL) {
+        dwError = GetLastError();
+        DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_FATAL, ("FAILED CreateThread with Error: %!status!", dwError));
         ASSERT(0);
         BAIL_ON_WIN32_ERROR(dwError);
     }
 
+    DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("End Initializing Timer, tick %d ms, slack %d ms", pDhcpV6TimerModule->dwTickMs, pDhcpV6TimerModule->dwSlackMs));
+
+    return dwError;
+
 error:
 
-    DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("End Initializing Timer"));
+    if (pDhcpV6TimerModule->hWakeEvent) {
+        CloseHandle(pDhcpV6TimerModule->hWakeEvent);
+        pDhcpV6TimerModule->hWakeEvent = NULL;
+    }
+
+    if (pDhcpV6TimerModule->bWheelSection) {
+        DeleteCriticalSection(&pDhcpV6TimerModule->csWheel);
+        pDhcpV6TimerModule->bWheelSection = FALSE;
+    }
+
+    if (bRWLock) {
+        DestroyRWLock(&pDhcpV6TimerModule->RWLock);
+    }
+
+    DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("End Initializing Timer with Error: %!status!", dwError));
 
     return dwError;
 }
@@ -78,7 +490,8 @@ DeInitDhcpV6TimerModule(
     )
 {
     DWORD dwError = 0;
-    BOOL bDeleted = FALSE;
+    PDHCPV6_TIMER_ENTRY pEntry;
+    ULONG i, j;
 
 
     DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("Begin DeInitializing Timer"));
@@ -93,13 +506,39 @@ DeInitDhcpV6TimerModule(
     pDhcpV6TimerModule->bDeInitializing = TRUE;
     ReleaseExclusiveLock(&pDhcpV6TimerModule->RWLock);
 
-    bDeleted = DeleteTimerQueueEx(pDhcpV6TimerModule->hTimerQueue, INVALID_HANDLE_VALUE);
-    if (bDeleted == FALSE) {
-        dwError = GetLastError();
-        DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_FATAL, ("FAILED DeleteTimerQueueEx with Error: %!status!", dwError));
-        ASSERT(0);
-        BAIL_ON_WIN32_ERROR(dwError);
+    //
+    // Wait for the service thread, and with it any callback in progress
+    //
+    SetEvent(pDhcpV6TimerModule->hWakeEvent);
+    WaitForSingleObject(pDhcpV6TimerModule->hThread, INFINITE);
+    CloseHandle(pDhcpV6TimerModule->hThread);
+    pDhcpV6TimerModule->hThread = NULL;
+
+    //
+    // Timers still armed are dropped without firing
+    //
+    EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
+    for (i = 0; i < DHCPV6_TIMER_ROOT_SIZE; i++) {
+        while (!IsListEmpty(&pDhcpV6TimerModule->Root[i])) {
+            pEntry = CONTAINING_RECORD(pDhcpV6TimerModule->Root[i].Flink, DHCPV6_TIMER_ENTRY, Link);
+            DhcpV6TimerUnlink(pDhcpV6TimerModule, pEntry);
+        }
+    }
+    for (i = 0; i < DHCPV6_TIMER_LEVELS - 1; i++) {
+        for (j = 0; j < DHCPV6_TIMER_LEVEL_SIZE; j++) {
+            while (!IsListEmpty(&pDhcpV6TimerModule->Level[i][j])) {
+                pEntry = CONTAINING_RECORD(pDhcpV6TimerModule->Level[i][j].Flink, DHCPV6_TIMER_ENTRY, Link);
+                DhcpV6TimerUnlink(pDhcpV6TimerModule, pEntry);
+            }
+        }
     }
+    LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
+
+    CloseHandle(pDhcpV6TimerModule->hWakeEvent);
+    pDhcpV6TimerModule->hWakeEvent = NULL;
+
+    DeleteCriticalSection(&pDhcpV6TimerModule->csWheel);
+    pDhcpV6TimerModule->bWheelSection = FALSE;
 
     DestroyRWLock(&pDhcpV6TimerModule->RWLock);
 
@@ -112,7 +551,7 @@ error:
 
 
 //
-// Add timer to timer queue
+// Add timer to timer wheel
 // Lock: Adapter: Exclusive
 //
 DWORD
@@ -129,48 +568,27 @@ DhcpV6TimerSetTimer(
 
     DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("Set Timer on Adapt: %d with RefCount: %d, due in: %d", pDhcpV6Adapt->dwIPv6IfIndex, pDhcpV6Adapt->uRefCount, dwDueTime));
 
-    if (pDhcpV6Adapt->bTimerCreated == FALSE) {
-
-        pDhcpV6Adapt->bTimerCreated = CreateTimerQueueTimer(
-                                        &pDhcpV6Adapt->hEventTimer,
-                                        pDhcpV6TimerModule->hTimerQueue,
-                                        CallbackRoutine,
-                                        pvCallbackContext,
-                                        dwDueTime,
-                                        DHCPV6_TIMER_INFINITE_INTERVAL,
-                                        0
-                                        );
-        if (pDhcpV6Adapt->bTimerCreated == FALSE) {
-            dwError = GetLastError();
-            DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_ERROR, ("FAILED Create Timer on Adapt: %d with Error: %!status!", pDhcpV6Adapt->dwIPv6IfIndex, dwError));
-            ASSERT(0);
-            BAIL_ON_WIN32_ERROR(dwError);
-        }
-
-    } else {
-        BOOL bTimerChanged = FALSE;
+    if (pDhcpV6Adapt->bEventTimerQueued &&
+        ! pDhcpV6Adapt->bEventTimerCancelled) {
+        dwError = ERROR_ALREADY_EXISTS;
+        DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_WARN, ("WARN Timer Already Queued on Adapt: %d", pDhcpV6Adapt->dwIPv6IfIndex));
+        BAIL_ON_WIN32_ERROR(dwError);
+    }
 
-        if (pDhcpV6Adapt->bEventTimerQueued &&
-            ! pDhcpV6Adapt->bEventTimerCancelled) {
-            dwError = ERROR_ALREADY_EXISTS;
-            DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_WARN, ("WARN Timer Already Queued on Adapt: %d", pDhcpV6Adapt->dwIPv6IfIndex));
-            BAIL_ON_WIN32_ERROR(dwError);
-        }
+    EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
 
-        bTimerChanged = ChangeTimerQueueTimer(
-                            pDhcpV6TimerModule->hTimerQueue,
-                            pDhcpV6Adapt->hEventTimer,
-                            dwDueTime, // Will not immediately fire when set to 0
-                            DHCPV6_TIMER_INFINITE_INTERVAL
-                            );
-        if (!bTimerChanged) {
-            dwError = GetLastError();
-            DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_ERROR, ("FAILED Change Timer on Adapt: %d with Error: %!status!", pDhcpV6Adapt->dwIPv6IfIndex, dwError));
-            ASSERT(0);
-            BAIL_ON_WIN32_ERROR(dwError);
-        }
+    if (pDhcpV6TimerModule->bDeInitializing) {
+        LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
+        dwError = ERROR_DELETE_PENDING;
+        BAIL_ON_WIN32_ERROR(dwError);
     }
 
+    pDhcpV6Adapt->EventTimer.CallbackRoutine = CallbackRoutine;
+    pDhcpV6Adapt->EventTimer.pvCallbackContext = pvCallbackContext;
+    DhcpV6TimerArm(pDhcpV6TimerModule, &pDhcpV6Adapt->EventTimer, dwDueTime);
+
+    LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
+
     pDhcpV6Adapt->bEventTimerQueued = TRUE;
     pDhcpV6Adapt->bEventTimerCancelled = FALSE;
 
@@ -183,7 +601,8 @@ error:
 
 
 //
-// Cancel Adapters timer event
+// Cancel Adapters timer event. The callback still runs (promptly) so that it
+// can drop the reference held for the queued timer.
 // Lock: Adapter: Exclusive
 //
 DWORD
@@ -193,33 +612,20 @@ DhcpV6TimerCancel(
     )
 {
     DWORD dwError = 0;
-    BOOL bTimerChanged = FALSE;
 
 
     DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("Cancel Timer on Adapt: %d with RefCount: %d", pDhcpV6Adapt->dwIPv6IfIndex, pDhcpV6Adapt->uRefCount));
 
-    if (pDhcpV6Adapt->bTimerCreated == FALSE) {
-        return dwError;
-    }
-
     if (pDhcpV6Adapt->bEventTimerQueued == TRUE){
         pDhcpV6Adapt->bEventTimerCancelled = TRUE;
-        bTimerChanged = ChangeTimerQueueTimer(
-                            pDhcpV6TimerModule->hTimerQueue,
-                            pDhcpV6Adapt->hEventTimer,
-                            100, // Will not immediately fire when set to 0
-                            DHCPV6_TIMER_INFINITE_INTERVAL
-                            );
-        if (!bTimerChanged) {
-            dwError = GetLastError();
-            DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_ERROR, ("FAILED Change Timer on Adapt: %d with Error: %!status!", pDhcpV6Adapt->dwIPv6IfIndex, dwError));
-            ASSERT(0);
-            BAIL_ON_WIN32_ERROR(dwError);
+
+        EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
+        if (pDhcpV6Adapt->EventTimer.bLinked) {
+            DhcpV6TimerArm(pDhcpV6TimerModule, &pDhcpV6Adapt->EventTimer, 0);
         }
+        LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
     }
 
-error:
-
     return dwError;
 }
 
@@ -235,32 +641,18 @@ DhcpV6TimerFireNow(
     )
 {
     DWORD dwError = 0;
-    BOOL bTimerChanged = FALSE;
 
 
     DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("Fire Timer on Adapt: %d with RefCount: %d", pDhcpV6Adapt->dwIPv6IfIndex, pDhcpV6Adapt->uRefCount));
 
-    if (pDhcpV6Adapt->bTimerCreated == FALSE) {
-        return dwError;
-    }
-
     if (pDhcpV6Adapt->bEventTimerQueued == TRUE){
-        bTimerChanged = ChangeTimerQueueTimer(
-                            pDhcpV6TimerModule->hTimerQueue,
-                            pDhcpV6Adapt->hEventTimer,
-                            100, // Will not immediately fire when set to 0
-                            DHCPV6_TIMER_INFINITE_INTERVAL
-                            );
-        if (!bTimerChanged) {
-            dwError = GetLastError();
-            DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_ERROR, ("FAILED Fire Timer on Adapt: %d with Error: %!status!", pDhcpV6Adapt->dwIPv6IfIndex, dwError));
-            ASSERT(0);
-            BAIL_ON_WIN32_ERROR(dwError);
+        EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
+        if (pDhcpV6Adapt->EventTimer.bLinked) {
+            DhcpV6TimerArm(pDhcpV6TimerModule, &pDhcpV6Adapt->EventTimer, 0);
         }
+        LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
     }
 
-error:
-
     return dwError;
 }
 
@@ -271,32 +663,17 @@ DhcpV6TimerDelete(
     )
 {
     DWORD dwError = 0;
-    BOOL bTimerDeleted = FALSE;
 
 
     DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_TRACE, ("Delete Timer on Adapt: %d with RefCount: %d", pDhcpV6Adapt->dwIPv6IfIndex, pDhcpV6Adapt->uRefCount));
 
-    if (pDhcpV6Adapt->bTimerCreated == TRUE) {
-        pDhcpV6Adapt->bEventTimerCancelled = TRUE;
-        bTimerDeleted = DeleteTimerQueueTimer(
-                            pDhcpV6TimerModule->hTimerQueue,
-                            pDhcpV6Adapt->hEventTimer,
-                            NULL
-                            );
-        if (!bTimerDeleted) {
-            dwError = GetLastError();
-            if (dwError != ERROR_IO_PENDING) {
-                DhcpV6Trace(DHCPV6_TIMER, DHCPV6_LOG_LEVEL_ERROR, ("FAILED Delete Timer on Adapt: %d with Error: %!status!", pDhcpV6Adapt->dwIPv6IfIndex, dwError));
-                ASSERT(0);
-                BAIL_ON_WIN32_ERROR(dwError);
-            }
-            dwError = 0;
-        }
+    pDhcpV6Adapt->bEventTimerCancelled = TRUE;
 
-        pDhcpV6Adapt->bTimerCreated = FALSE;
+    EnterCriticalSection(&pDhcpV6TimerModule->csWheel);
+    if (pDhcpV6Adapt->EventTimer.bLinked) {
+        DhcpV6TimerUnlink(pDhcpV6TimerModule, &pDhcpV6Adapt->EventTimer);
     }
-
-error:
+    LeaveCriticalSection(&pDhcpV6TimerModule->csWheel);
 
     return dwError;
 }
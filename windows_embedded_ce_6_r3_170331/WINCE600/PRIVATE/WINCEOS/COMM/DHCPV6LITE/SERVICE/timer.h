@@ -30,12 +30,57 @@
 
 #define DHCPV6_TIMER_INFINITE_INTERVAL   0x7fffffff
 
+//
+// Adapter timers live on a hierarchical timer wheel run by a single service
+// thread. Level 0 has one slot per tick, every higher level has one slot per
+// full revolution of the level below it. 8 + 3 * 6 = 26 bits of ticks covers
+// DHCPV6_TIMER_INFINITE_INTERVAL even at the smallest tick.
+//
+#define DHCPV6_TIMER_ROOT_BITS          8
+#define DHCPV6_TIMER_LEVEL_BITS         6
+#define DHCPV6_TIMER_LEVELS             4
+
+#define DHCPV6_TIMER_ROOT_SIZE          (1 << DHCPV6_TIMER_ROOT_BITS)
+#define DHCPV6_TIMER_ROOT_MASK          (DHCPV6_TIMER_ROOT_SIZE - 1)
+#define DHCPV6_TIMER_LEVEL_SIZE         (1 << DHCPV6_TIMER_LEVEL_BITS)
+#define DHCPV6_TIMER_LEVEL_MASK         (DHCPV6_TIMER_LEVEL_SIZE - 1)
+
+#define DHCPV6_TIMER_DEFAULT_TICK       100     // ms
+#define DHCPV6_TIMER_MIN_TICK           50      // ms
+#define DHCPV6_TIMER_MAX_TICK           1000    // ms
+
+//
+// Timers may be deferred by up to this much (and never by more than 1/16 of
+// their due time) so that expiries close to each other share a tick.
+//
+#define DHCPV6_TIMER_DEFAULT_SLACK      1000    // ms
+
 
 typedef struct _DHCPV6_TIMER_MODULE {
     DHCPV6_RW_LOCK RWLock;
     BOOL bDeInitializing;
 
-    HANDLE hTimerQueue;
+    CRITICAL_SECTION csWheel;
+    BOOL bWheelSection;
+
+    HANDLE hWakeEvent;
+    HANDLE hThread;
+
+    DWORD dwTickMs;
+    DWORD dwSlackMs;
+
+    //
+    // uTick is the next tick to be processed, dwTickTime the GetTickCount()
+    // value it corresponds to. uWakeTick is when the service thread will look
+    // at the wheel next.
+    //
+    ULONG uTick;
+    DWORD dwTickTime;
+    ULONG uWakeTick;
+    ULONG uTimers;
+
+    LIST_ENTRY Root[DHCPV6_TIMER_ROOT_SIZE];
+    LIST_ENTRY Level[DHCPV6_TIMER_LEVELS - 1][DHCPV6_TIMER_LEVEL_SIZE];
 } DHCPV6_TIMER_MODULE, * PDHCPV6_TIMER_MODULE;
 
 
@@ -0,0 +1,99 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+/**********************************************************************/
+/**                        Microsoft Windows                         **/
+/**********************************************************************/
+
+/*
+    wspoll.h
+
+    include file for the poll set API in the Windows Sockets implementation.
+
+    A poll set keeps the sockets and network events (FD_READ, FD_WRITE, ...)
+    an application is interested in across calls, so that waiting costs
+    time in proportion to the sockets that are ready rather than to the
+    sockets that are registered, and the number of sockets is not bounded
+    by FD_SETSIZE.
+
+    Notification follows WSAEventSelect: an event is reported once, and is
+    reported again after the matching re-enabling call (recv for FD_READ,
+    send for FD_WRITE, accept for FD_ACCEPT). Registering a socket makes it
+    non-blocking.
+
+    closesocket removes the socket from every poll set it is registered
+    in, so WSAPOLLSET_DEL is not needed before closing it. Adding a socket
+    that is already in the set fails with WSAEINVAL.
+*/
+
+
+#ifndef _WSPOLL_H_
+#define _WSPOLL_H_
+
+
+//
+//  WSAPollSetCtl operations.
+//
+
+#define WSAPOLLSET_ADD          1
+#define WSAPOLLSET_MOD          2
+#define WSAPOLLSET_DEL          3
+
+
+//
+//  Readiness reported by WSAWaitPollSet.
+//
+
+typedef struct _WSAPOLLSET_EVENT {
+    SOCKET              s;
+    DWORD               dwContext;      // as passed to WSAPollSetCtl
+    WSANETWORKEVENTS    NetworkEvents;
+} WSAPOLLSET_EVENT, FAR * LPWSAPOLLSET_EVENT;
+
+
+//
+//  Function prototypes.
+//
+
+HANDLE
+WSAAPI
+WSACreatePollSet(
+    IN DWORD    dwFlags
+    );
+
+int
+WSAAPI
+WSAPollSetCtl(
+    IN HANDLE   hPollSet,
+    IN int      iOp,
+    IN SOCKET   s,
+    IN long     lNetworkEvents,
+    IN DWORD    dwContext
+    );
+
+int
+WSAAPI
+WSAWaitPollSet(
+    IN HANDLE               hPollSet,
+    OUT LPWSAPOLLSET_EVENT  lpEvents,
+    IN int                  cEvents,
+    IN DWORD                dwTimeout
+    );
+
+int
+WSAAPI
+WSAClosePollSet(
+    IN HANDLE   hPollSet
+    );
+
+
+#endif  // _WSPOLL_H_
@@ -222,6 +222,8 @@ STATIC VOID InsertRxWinAndForward(PIRLAP_CB, PIRDA_MSG, UINT, BOOLEAN *);
 STATIC VOID ResendRejects(PIRLAP_CB, UINT);
 STATIC VOID ConfirmAckedTxMsgs(PIRLAP_CB, UINT);
 STATIC VOID MissingRxFrames(PIRLAP_CB);
+STATIC VOID TxWinAcked(PIRLAP_CB);
+STATIC VOID TxWinRetransmitted(PIRLAP_CB, UINT);
 STATIC VOID IFrameOtherStates(PIRLAP_CB, int, int);
 STATIC UINT NegotiateQosParms(PIRLAP_CB, IRDA_QOS_PARMS *);
 STATIC VOID ApplyQosParms(PIRLAP_CB);
@@ -372,6 +374,8 @@ IrlapOpenLink(OUT PNTSTATUS           Status,
     pIrlapCb->RemoteDataSize    = IRLAP_CONTENTION_DATA_SIZE;
     pIrlapCb->RemoteWinSize     = IRLAP_CONTENTION_WIN_SIZE; 
     pIrlapCb->RemoteNumBOFS     = IRLAP_CONTENTION_BOFS;
+    pIrlapCb->TxWinSize         = IRLAP_CONTENTION_WIN_SIZE;
+    pIrlapCb->FastPollTime      = IRLAP_FAST_POLL_TIME;
 
     pIrlapCb->ConnAddr = IRLAP_BROADCAST_CONN_ADDR;
 
@@ -1070,8 +1074,8 @@ XmitTxMsgList(PIRLAP_CB pIrlapCb, BOOLEAN AlwaysTurnLink,
                (DequeMsgList(&pIrlapCb->TxMsgList, &pMsg) == SUCCESS))
         {
             pIrlapCb->FastPollCount = IRLAP_FAST_POLL_COUNT;
-            pIrlapCb->PollTimer.Timeout = IRLAP_FAST_POLL_TIME > 
-                pIrlapCb->RemoteMaxTAT ? pIrlapCb->RemoteMaxTAT : IRLAP_FAST_POLL_TIME;
+            pIrlapCb->PollTimer.Timeout = pIrlapCb->FastPollTime > 
+                pIrlapCb->RemoteMaxTAT ? pIrlapCb->RemoteMaxTAT : pIrlapCb->FastPollTime;
 
             if (pMsg->Prim == IRLAP_DATA_REQ)
             {
@@ -1079,11 +1083,14 @@ XmitTxMsgList(PIRLAP_CB pIrlapCb, BOOLEAN AlwaysTurnLink,
                 pIrlapCb->TxWin.pMsg[pIrlapCb->Vs] = pMsg;
 
                 pMsg->IRDA_MSG_SendRefCnt = 1;
+                pIrlapCb->TxFrameCnt++;
 
                 // Send message. If full window or there are no
                 // more data requests, send with PF Set (turns link).
-                if ((pIrlapCb->Vs == (pIrlapCb->TxWin.Start +
-                      pIrlapCb->RemoteWinSize-1) % IRLAP_MOD) ||
+                // The window is the adaptive TxWinSize, which may have
+                // shrunk below the frames already outstanding.
+                if (((pIrlapCb->Vs + IRLAP_MOD - pIrlapCb->TxWin.Start) %
+                      IRLAP_MOD + 1 >= (UINT) pIrlapCb->TxWinSize) ||
                       (0 == pIrlapCb->TxMsgList.Len /*AlwaysTurnLink*/))
                 {
                     SendIFrame(pIrlapCb,
@@ -2438,6 +2445,40 @@ NegotiateQosParms(PIRLAP_CB         pIrlapCb,
                           LINE_CAPACITY(pIrlapCb)));
     }
 
+    // If many I-frames had to be retransmitted on the last connection,
+    // have LMP segment into smaller frames on this one. Only our transmit
+    // size changes; RemoteDataSize still sizes the receive buffers.
+    // Too few frames to judge the link means no reduction, so a rate
+    // measured against an earlier peer does not carry over.
+    if (pIrlapCb->TxFrameCnt >= IRLAP_ERR_RATE_MIN_FRAMES)
+    {
+        pIrlapCb->TxErrorRate = pIrlapCb->RetransFrameCnt * 100 /
+                                pIrlapCb->TxFrameCnt;
+    }
+    else
+    {
+        pIrlapCb->TxErrorRate = 0;
+    }
+    pIrlapCb->TxFrameCnt = 0;
+    pIrlapCb->RetransFrameCnt = 0;
+
+    DataSizeBit = pIrlapCb->NegotiatedQos.bfDataSize;
+    if (pIrlapCb->TxErrorRate >= IRLAP_ERR_RATE_HIGH && DataSizeBit > 1)
+    {
+        DataSizeBit >>= 1;
+        if (pIrlapCb->TxErrorRate >= IRLAP_ERR_RATE_VERY_HIGH &&
+            DataSizeBit > 1)
+        {
+            DataSizeBit >>= 1;
+        }
+        pIrlapCb->NegotiatedQos.bfDataSize = DataSizeBit;
+
+        IRLAP_LOG_ACTION((pIrlapCb,
+                   TEXT("error rate %d%%, tx data size reduced to %d"),
+                          pIrlapCb->TxErrorRate,
+                          IrlapGetQosParmVal(vDataSizeTable, DataSizeBit, NULL)));
+    }
+
     return SUCCESS;
 }
 /*****************************************************************************
@@ -2452,6 +2493,22 @@ ApplyQosParms(PIRLAP_CB pIrlapCb)
     pIrlapCb->PollTimer.Timeout     = pIrlapCb->RemoteMaxTAT;
     pIrlapCb->FinalTimer.Timeout    = pIrlapCb->LocalMaxTAT;
 
+    // Start with the full negotiated window, it shrinks on retransmission
+    pIrlapCb->TxWinSize             = pIrlapCb->RemoteWinSize;
+    pIrlapCb->TxWinCleanCnt         = 0;
+
+    // The fast poll time is tuned for SIR. Scale it down with the baud
+    // rate so MIR/FIR links are not left idle for several frame times.
+    pIrlapCb->FastPollTime = IRLAP_FAST_POLL_TIME;
+    if (pIrlapCb->Baud > 115200)
+    {
+        pIrlapCb->FastPollTime = IRLAP_FAST_POLL_TIME * 115200 / pIrlapCb->Baud;
+        if (pIrlapCb->FastPollTime < IRLAP_MIN_FAST_POLL_TIME)
+        {
+            pIrlapCb->FastPollTime = IRLAP_MIN_FAST_POLL_TIME;
+        }
+    }
+
     if (pIrlapCb->Baud <= 115200)
     {
         pIrlapCb->FinalTimer.Timeout += 150; // fudge factor for SIR
@@ -3001,6 +3058,7 @@ ProcessREJ_SREJ(PIRLAP_CB   pIrlapCb,
                     SendIFrame(pIrlapCb,
                                pIrlapCb->TxWin.pMsg[Nr],
                                Nr, IRLAP_PFBIT_SET);
+                    TxWinRetransmitted(pIrlapCb, 1);
                 }
             }
         }
@@ -3608,6 +3666,9 @@ ResendRejects(PIRLAP_CB pIrlapCb, UINT Nr)
 {
     if (!pIrlapCb->RemoteBusy)
     {
+        TxWinRetransmitted(pIrlapCb,
+            (pIrlapCb->TxWin.End + IRLAP_MOD - Nr) % IRLAP_MOD);
+
         // Set Vs back
 
         for (pIrlapCb->Vs=Nr; pIrlapCb->Vs !=
@@ -3662,15 +3723,61 @@ ConfirmAckedTxMsgs(PIRLAP_CB pIrlapCb,
         }
         i = (i + 1) % IRLAP_MOD;
     }
+
+    // Whole outstanding window acknowledged
+    if (i != pIrlapCb->TxWin.Start && i == pIrlapCb->Vs)
+    {
+        TxWinAcked(pIrlapCb);
+    }
     pIrlapCb->TxWin.Start = i;
 }
 /*****************************************************************************
 *
+*   TxWinAcked - a window went through, after enough of them in a row
+*   open the send window back up by one frame
+*/
+VOID
+TxWinAcked(PIRLAP_CB pIrlapCb)
+{
+    if (++pIrlapCb->TxWinCleanCnt >= IRLAP_WIN_GROW_COUNT &&
+        pIrlapCb->TxWinSize < pIrlapCb->RemoteWinSize)
+    {
+        pIrlapCb->TxWinSize++;
+        pIrlapCb->TxWinCleanCnt = 0;
+        IRLAP_LOG_ACTION((pIrlapCb, TEXT("Tx window opened to %d"),
+                          pIrlapCb->TxWinSize));
+    }
+}
+/*****************************************************************************
+*
+*   TxWinRetransmitted - shrink the send window. A single selectively
+*   rejected frame takes one frame off, a go back N halves the window.
+*/
+VOID
+TxWinRetransmitted(PIRLAP_CB pIrlapCb, UINT FrameCnt)
+{
+    pIrlapCb->RetransFrameCnt += FrameCnt;
+    pIrlapCb->TxWinCleanCnt = 0;
+
+    if (FrameCnt > 1)
+    {
+        pIrlapCb->TxWinSize = (pIrlapCb->TxWinSize + 1) / 2;
+    }
+    else if (pIrlapCb->TxWinSize > 1)
+    {
+        pIrlapCb->TxWinSize--;
+    }
+    IRLAP_LOG_ACTION((pIrlapCb, TEXT("Tx window closed to %d"),
+                      pIrlapCb->TxWinSize));
+}
+/*****************************************************************************
+*
 */
 VOID
 MissingRxFrames(PIRLAP_CB pIrlapCb)
 {
     int MissingFrameCnt = 0;
+    int HeldFrameCnt = 1; // RxWin.End-1 is always held
     int MissingFrame = -1;
     UINT i;
 
@@ -3689,11 +3796,18 @@ MissingRxFrames(PIRLAP_CB pIrlapCb)
                 MissingFrame = i;
             }
         }
+        else
+        {
+            HeldFrameCnt++;
+        }
     }
 
-    // if there are missing frames send SREJ (1) or RR (more than 1)
-    // and turn link around
-    if (MissingFrameCnt == 1 && !pIrlapCb->LocalBusy)
+    // If there are missing frames send SREJ for the first one as long as
+    // fewer are missing than a go back N would resend needlessly, the
+    // next gap is rejected when the retransmission comes in. Otherwise
+    // send RR. Either way turn the link around.
+    if (MissingFrameCnt != 0 && MissingFrameCnt <= HeldFrameCnt &&
+        !pIrlapCb->LocalBusy)
     {
         // we don't want to send the SREJ when local is busy because
         // peer *MAY* interpret it as a clearing of the local busy condition
@@ -3884,6 +3998,8 @@ ApplyDefaultParms(PIRLAP_CB pIrlapCb)
     pIrlapCb->RemoteDataSize    = IRLAP_CONTENTION_DATA_SIZE;
     pIrlapCb->RemoteWinSize     = IRLAP_CONTENTION_WIN_SIZE;
     pIrlapCb->RemoteNumBOFS     = IRLAP_CONTENTION_BOFS;
+    pIrlapCb->TxWinSize         = IRLAP_CONTENTION_WIN_SIZE;
+    pIrlapCb->FastPollTime      = IRLAP_FAST_POLL_TIME;
     pIrlapCb->ConnAddr          = IRLAP_BROADCAST_CONN_ADDR;
 
     IMsg.Prim               = MAC_CONTROL_REQ;
@@ -27,6 +27,13 @@
 #define IRLAP_DSCV_SENSE_TIME           80
 #define IRLAP_FAST_POLL_TIME            10
 #define IRLAP_FAST_POLL_COUNT           10
+#define IRLAP_MIN_FAST_POLL_TIME        1
+
+// Adaptive send window and data size
+#define IRLAP_WIN_GROW_COUNT            4   // clean windows before growing
+#define IRLAP_ERR_RATE_MIN_FRAMES       32  // I-frames needed for a rate
+#define IRLAP_ERR_RATE_HIGH             10  // % retransmitted, 1 size down
+#define IRLAP_ERR_RATE_VERY_HIGH        25  // % retransmitted, 2 sizes down
 
 // XID Format
 #define IRLAP_XID_DSCV_FORMAT_ID     0x01
@@ -287,6 +294,12 @@ typedef struct IrlapControlBlock
   int               N2;            // const# retries before disconnecting
   int               N3;            // const# of connection retries
   int               FastPollCount;
+  int               FastPollTime;  // Poll timeout while data is flowing
+  int               TxWinSize;     // Frames sent per turn, <= RemoteWinSize
+  int               TxWinCleanCnt; // Windows acked without retransmission
+  UINT              TxFrameCnt;    // I-frames sent on this connection
+  UINT              RetransFrameCnt;// I-frames retransmitted
+  int               TxErrorRate;   // % retransmitted on last connection
   IRDA_TIMER        SlotTimer;
   IRDA_TIMER        QueryTimer;
   IRDA_TIMER        PollTimer;
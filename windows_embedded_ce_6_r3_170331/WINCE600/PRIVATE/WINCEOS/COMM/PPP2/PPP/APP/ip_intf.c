@@ -52,6 +52,7 @@
 #include "ipcp.h"
 #include "ipv6cp.h"
 #include "ncp.h"
+#include "ccp.h"
 #include "mac.h"
 #include "ip_intf.h"
 #include "crypt.h"
@@ -193,6 +194,7 @@ PppSendIPvXLocked(
 	USHORT                Offset   = pSendPacketInfo->Offset;
 	USHORT		          ipProto  = pSendPacketInfo->ipProto;
 	PVOID				  pMac     = pSession->macCntxt;
+	DWORD				  cbPacket;
 
 	ASSERT(ipProto == 4 || ipProto == 6);
 
@@ -206,14 +208,38 @@ PppSendIPvXLocked(
 	pWanPacket->CurrentBuffer += 8;
 	pWanPacket->CurrentLength -= 8;
 
+	//
+	// When MPPC is compressing the packet into a new WAN packet anyway, only copy
+	// the first PPP_TX_HEAD_SIZE bytes (enough for the IP/TCP headers needed by VJ
+	// compression and PPTP). The compressor reads the rest straight from the buffer
+	// chain, and pppMacSndData copies it if it ends up being sent uncompressed.
+	//
+	cbPacket = NdisBufferChainLength(pNdisBuf, Offset);
+	if (cbPacket > pWanPacket->CurrentLength)
+	{
+		DEBUGMSG(ZONE_WARN, (TEXT("PPP: WARNING - TX Packet too long, >%u bytes\n"), pWanPacket->CurrentLength));
+		NdisWanFreePacket (pMac, pWanPacket);
+		Status = NDIS_STATUS_INVALID_PACKET;
+	}
+	else if (cbPacket > PPP_TX_HEAD_SIZE
+	&&       pSession->Mode == PPPMODE_PPP
+	&&       pppCcp_IsTxCompressing(pSession))
+	{
+		DWORD dwOffset = Offset;
+
+		pWanPacket->CurrentLength = NdisBufferChainCopy(&pNdisBuf, &dwOffset, pWanPacket->CurrentBuffer, PPP_TX_HEAD_SIZE);
+		pppTxSetTail(pWanPacket, pNdisBuf, dwOffset);
+	}
 	// Copy the packet data to the WAN packet
-	if (!CopyNdisBufferChainToFlatBuffer(pNdisBuf, Offset, pWanPacket->CurrentBuffer, &pWanPacket->CurrentLength))
+	else if (!CopyNdisBufferChainToFlatBuffer(pNdisBuf, Offset, pWanPacket->CurrentBuffer, &pWanPacket->CurrentLength))
 	{
 		DEBUGMSG(ZONE_WARN, (TEXT("PPP: WARNING - TX Packet too long, >%u bytes\n"), pWanPacket->CurrentLength));
 		NdisWanFreePacket (pMac, pWanPacket);
 		Status = NDIS_STATUS_INVALID_PACKET;
 	}
-	else switch( pSession->Mode )
+
+	if (NDIS_STATUS_SUCCESS == Status)
+	switch( pSession->Mode )
 	{
 	case PPPMODE_PPP:
 		// Route to IP Data Transmit
@@ -1878,6 +1878,35 @@ pppStartTimer( pppSession_t  *s_p,
 	}
 }
 
+/*****************************************************************************
+*
+*   @func   DWORD | pppBatchTimerDelay | round up a timer delay to a batch boundary
+*
+*   @parm   DWORD | delay | Requested delay in milliseconds
+*
+*   @rdesc  Returns the delay, extended so that the timer expires on a
+*           PPP_TIMER_BATCH_MS boundary of the tick count.
+*
+*   @comm   Used for the periodic LCP echo/idle and NCP idle timers that
+*           every session runs, so that with many sessions their expirations
+*           coincide and the timer thread wakes once per batch rather than
+*           once per session.  Short delays are not extended.
+*/
+
+DWORD
+pppBatchTimerDelay( DWORD delay )
+{
+	DWORD	expiry;
+
+	if (delay >= PPP_TIMER_BATCH_MS)
+	{
+		expiry = GetTickCount() + delay;
+		delay += (PPP_TIMER_BATCH_MS - (expiry & (PPP_TIMER_BATCH_MS - 1))) & (PPP_TIMER_BATCH_MS - 1);
+	}
+
+	return delay;
+}
+
 /*****************************************************************************
 *
 *   @func   void | pppStopTimer | stop a timer with reference count processing
@@ -627,11 +627,42 @@ ChPrint(UCHAR b)
 //
 //  Returns:    Nothing
 //
+//
+USHORT
+compress (UCHAR *CurrentBuffer, UCHAR *CompOutBuffer, ULONG *CurrentLength, SendContext *context)
+{
+    CompressSegment segment;
+
+    segment.pData  = CurrentBuffer;
+    segment.cbData = *CurrentLength;
+
+    return compressv (&segment, 1, CompOutBuffer, CurrentLength, context);
+}
+
+
+//* compressv()
+//
+//  Function:   Compress data gathered from several buffers, as one packet.
+//
+//  Parameters:
+//      IN  pSegments -> the pieces of the packet, in order
+//      IN  cSegments -> number of pieces
+//      OUT CompOutBuffer -> points to NDIS_WAN_PACKET to compress data to
+//      IN  CurrentLength -> points to total length of the pieces
+//      IN  context -> connection compress context
+//
+//  Returns:    Nothing
+//
+//  A match never spans two pieces, so bytes near a piece boundary may go
+//  out as literals where a flat buffer would have matched. The output is
+//  then not byte-identical to compress() of the same packet, but it is a
+//  valid MPPC stream and decompresses to the same data.
+//
 //  WARNING:    CODE IS HIGHLY OPTIMIZED FOR TIME ON 386
 //
 //
 USHORT
-compress (UCHAR *CurrentBuffer, UCHAR *CompOutBuffer, ULONG *CurrentLength, SendContext *context)
+compressv (const CompressSegment *pSegments, int cSegments, UCHAR *CompOutBuffer, ULONG *CurrentLength, SendContext *context)
 {
     int     bit;
     int     byte;
@@ -677,12 +708,17 @@ compress (UCHAR *CurrentBuffer, UCHAR *CompOutBuffer, ULONG *CurrentLength, Send
 
     historyptr = context->History + context->CurrentIndex ;
 
+  for ( ; cSegments > 0 ; cSegments--, pSegments++) {
+
+    if (pSegments->cbData == 0)
+        continue;
+
 	//
 	// Setup the compress data source pointer.
 	//
-    currentptr = CurrentBuffer;
+    currentptr = pSegments->pData;
 
-    endptr = currentptr + *CurrentLength - 1;
+    endptr = currentptr + pSegments->cbData - 1;
 
     while (currentptr < (endptr-2)) {
 
@@ -882,6 +918,8 @@ compress (UCHAR *CurrentBuffer, UCHAR *CompOutBuffer, ULONG *CurrentLength, Send
         *historyptr++ = *currentptr++ ;
     }
 
+  }  // for each segment
+
 
     bitptr_end() ;
 
@@ -381,6 +381,34 @@ CcpProcessRxPacket(
 	PppFsmProcessRxPacket(pContext->pFsm, pMsg->data, pMsg->len);
 }
 
+/*****************************************************************************
+* 
+*   @func   BOOL | pppCcp_IsTxCompressing | Check for MPPC tx compression
+*   
+*   @parm   pppSession_t * | session | PPP session context.
+*               
+*   @comm   Return TRUE if packets sent now will be MPPC compressed into a new
+*			WAN packet by pppCcp_Compress, so the sender does not need to copy
+*			all the packet data into the original WAN packet.
+*
+*/
+
+BOOL
+pppCcp_IsTxCompressing(
+	IN      pppSession_t     *pSession)
+{
+	ncpCntxt_t         *ncp_p    = (ncpCntxt_t *)pSession->ncpCntxt;
+	PCCPContext         pContext;
+
+	if (ncp_p == NULL || !ncp_p->protocol[ NCP_CCP ].enabled)
+		return FALSE;
+
+	pContext = (PCCPContext)ncp_p->protocol[ NCP_CCP ].context;
+
+	return pContext->pFsm->state == PFS_Opened
+		&& (pContext->peer.SupportedBits & MCCP_COMPRESSION);
+}
+
 /*****************************************************************************
 * 
 *   @func   void | pppCcp_Compress | CCP Datagram compression
@@ -413,6 +441,11 @@ pppCcp_Compress(
 	PNDIS_WAN_PACKET	pCompressedPacket;
 	PNDIS_WAN_PACKET	pPacket;
 	USHORT				coherencyHeader;
+	CompressSegment		Segments[PPP_TX_MAX_SEGMENTS];
+	int					cSegments;
+	ULONG				cbData;
+	PNDIS_BUFFER		pNdisBuffer;
+	DWORD				dwOffset;
 
 	DEBUGMSG(ZONE_FUNCTION, (TEXT( "PPP: +pppCcp_Compress( 0x%X, 0x%X, 0x%X)\r\n" ), pSession, ppPacket, pwProtocol ));
     DEBUGMSG(ZONE_NCP && (pContext->peer.SupportedBits == 0), (TEXT("PPP: CCP called to send packet but TX COMPRESSION/ENCRYPTION OFF\n")));
@@ -512,26 +545,54 @@ pppCcp_Compress(
 			pCompressedPacket->CurrentBuffer += 6;
 			pCompressedPacket->CurrentLength -= 6;
 
+			//
+			// The packet data is the data in pPacket followed by the tail still in
+			// the sender's buffer chain, if any. Compress it in place from there.
+			// If the chain is too fragmented, just copy the tail into pPacket.
+			//
+			Segments[0].pData  = pPacket->CurrentBuffer;
+			Segments[0].cbData = pPacket->CurrentLength;
+			cbData = pPacket->CurrentLength;
+			cSegments = 1;
+
+			pNdisBuffer = PPP_TX_TAIL_BUFFER(pPacket);
+			dwOffset    = PPP_TX_TAIL_OFFSET(pPacket);
+			while (cSegments < PPP_TX_MAX_SEGMENTS
+			&&     NdisBufferChainNextSegment(&pNdisBuffer, &dwOffset, (PBYTE *)&Segments[cSegments].pData, (PDWORD)&Segments[cSegments].cbData))
+			{
+				cbData += Segments[cSegments].cbData;
+				cSegments++;
+			}
+			if (pNdisBuffer)
+			{
+				pppTxFlattenTail(pPacket);
+				Segments[0].cbData = cbData = pPacket->CurrentLength;
+				cSegments = 1;
+			}
+
 #ifdef DEBUG
 			if (ZONE_TRACE) {
-				DEBUGMSG (1, (TEXT("pppCcp_Compress: About to compress packet (%d):\n"),
-							  pPacket->CurrentLength));
-				DumpMem (pPacket->CurrentBuffer, pPacket->CurrentLength);
+				int i;
+
+				DEBUGMSG (1, (TEXT("pppCcp_Compress: About to compress packet (%d):\n"), cbData));
+				for (i = 0; i < cSegments; i++)
+					DumpMem (Segments[i].pData, Segments[i].cbData);
 			}
 #endif
 
-			// Compress the packet data in pPacket into pCompressedPacket
+			// Compress the packet data into pCompressedPacket
 			// Set the "FLUSHED" and "COMPRESSED" bits in the coherency header. 
 
-			pCompressedPacket->CurrentLength = pPacket->CurrentLength;
-			coherencyHeader |= compress( pPacket->CurrentBuffer,
-										 pCompressedPacket->CurrentBuffer,
-										&pCompressedPacket->CurrentLength,
-										&pContext->mppcSndCntxt );
+			pCompressedPacket->CurrentLength = cbData;
+			coherencyHeader |= compressv( Segments,
+										  cSegments,
+										  pCompressedPacket->CurrentBuffer,
+										 &pCompressedPacket->CurrentLength,
+										 &pContext->mppcSndCntxt );
 		
 			DEBUGMSG( ZONE_NCP, ( TEXT( "ccp:tx:compress %hs- Len: orig=%d comp=%d\n" ),
 				(coherencyHeader & (PACKET_FLUSHED << 8)) ? "FAILED" : "OK",
-				pPacket->CurrentLength, pCompressedPacket->CurrentLength));
+				cbData, pCompressedPacket->CurrentLength));
 
 			// If compression failed, free pCompressedPacket.
 			// Otherwise, switch to use pCompressedPacket instead of the original, uncompressed packet.
@@ -558,6 +619,11 @@ pppCcp_Compress(
 		}
 	}
 
+	//
+	// Sending the original packet, it needs the rest of the data now if it is to be encrypted.
+	//
+	pppTxFlattenTail(pPacket);
+
 	//
 	// Encrypt the data if encryption is enabled
 	//
@@ -174,6 +174,7 @@ void    pppCcp_LowerLayerDown(IN	PVOID	context);
 void    CcpProcessRxPacket( void *context, pppMsg_t *msg_p );
 void    CpktProcessRxPacket( void *context, pppMsg_t *msg_p );
 BOOL	pppCcp_Compress( pppSession_t *, PNDIS_WAN_PACKET *ppPacket, USHORT *pwProtocol );
+BOOL	pppCcp_IsTxCompressing( pppSession_t * );
 DWORD   CcpOpen(IN	PVOID	context );
 DWORD   CcpClose(IN	PVOID	context );
 DWORD   CcpRenegotiate(IN	PVOID	context );
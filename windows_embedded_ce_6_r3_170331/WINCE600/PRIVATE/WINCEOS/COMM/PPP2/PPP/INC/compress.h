@@ -74,6 +74,15 @@ struct RecvContext
 typedef struct RecvContext RecvContext;
 
 
+// A piece of a packet to compress
+
+typedef struct CompressSegment
+{
+    UCHAR   *pData;
+    ULONG   cbData;
+} CompressSegment;
+
+
 // Function Prototypes
 
 USHORT
@@ -82,6 +91,13 @@ compress( UCHAR         *CurrentBuffer,
           ULONG         *CurrentLength,
           SendContext   *context );
 
+USHORT
+compressv( const CompressSegment *pSegments,
+           int           cSegments,
+           UCHAR         *CompOutBuffer,
+           ULONG         *CurrentLength,
+           SendContext   *context );
+
 
 int
 decompress ( UCHAR 	 	 *inbuf,
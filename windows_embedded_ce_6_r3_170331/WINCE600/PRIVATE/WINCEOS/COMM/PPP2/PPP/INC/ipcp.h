@@ -105,6 +105,11 @@ typedef struct  ipcp_context
 
 	slcompress_t	vjcomp;						// compression control rec.
 
+	// Connection states for vjcomp, sized for the negotiated number of slots
+
+	cstate_t        *pVJStates;
+	DWORD           cVJStates;
+
 	// VJ decompression requires MAX_HDR (128) bytes of header space,
 	// so we maintain a decompression buffer to handle
 	// received packets.
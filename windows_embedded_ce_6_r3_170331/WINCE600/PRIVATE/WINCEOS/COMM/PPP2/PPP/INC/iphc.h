@@ -0,0 +1,119 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+/*****************************************************************************
+* 
+*
+*   @doc
+*   @module iphc.h | IP Header Compression (IPHC) for IPv6
+*
+*   See RFC 2507 "IP Header Compression" and RFC 2509 "IP Header
+*   Compression over PPP".
+*
+*/
+
+#pragma once
+
+//
+//	IPv6-Compression-Protocol option data for IPHC:
+//		2 bytes compression protocol (00 61)
+//		2 bytes TCP_SPACE
+//		2 bytes NON_TCP_SPACE
+//		2 bytes F_MAX_PERIOD
+//		2 bytes F_MAX_TIME
+//		2 bytes MAX_HEADER
+//		suboptions
+//
+#define IPHC_OPTION_LENGTH          12
+
+#define IPHC_DEFAULT_TCP_SPACE      15
+#define IPHC_DEFAULT_NON_TCP_SPACE  15
+#define IPHC_DEFAULT_F_MAX_PERIOD   256
+#define IPHC_DEFAULT_F_MAX_TIME     5       // seconds
+#define IPHC_DEFAULT_MAX_HEADER     168
+
+#define IPHC_MAX_CONTEXTS           256     // Only 8 bit CIDs are used
+#define IPHC_HASH_SIZE              64      // Context hash buckets, power of 2
+#define IPHC_MAX_HDR                48      // IPv6 header + UDP header
+
+#define IPHC_GENERATION_MASK        0x3F
+#define IPHC_INFINITE_PERIOD        0x40000000  // F_MAX_PERIOD 0
+
+//
+//	Compression state of one non-TCP packet stream (context).
+//
+typedef struct iphc_cstate
+{
+	struct iphc_cstate *cs_next;            // next most recently used
+	struct iphc_cstate *cs_prev;            // next least recently used
+	struct iphc_cstate *cs_hnext;           // next context in the same hash bucket
+
+	BYTE                cs_cid;             // context identifier
+	BYTE                cs_flags;
+#define ICSF_HASHED     (1<<0)              // context is in bucket cs_hash of the hash table
+
+	BYTE                cs_hash;
+	BYTE                cs_generation;
+	BYTE                cs_hlen;            // size of the compressed headers
+	BYTE                cs_hdr[IPHC_MAX_HDR];
+
+	// Compression slow-start, RFC 2507 section 3.3.1
+
+	DWORD               cs_period;          // compressed headers to send between full headers
+	DWORD               cs_sincefull;       // compressed headers sent since the last full header
+	DWORD               cs_tickfull;        // time the last full header was sent
+
+	// Per context statistics, reset when the context is reused
+
+	DWORD               cs_compressed;      // packets sent with a compressed header
+	DWORD               cs_full;            // packets sent with a full header
+}
+iphc_cstate_t;
+
+//
+//	Compression state for sending on one link.
+//
+typedef struct iphc
+{
+	iphc_cstate_t       *last_cs;           // least recently used, last_cs->cs_next is the most recent
+	iphc_cstate_t       *hash[IPHC_HASH_SIZE];
+
+	// Negotiated parameters
+
+	USHORT              cContexts;          // NON_TCP_SPACE + 1, at most IPHC_MAX_CONTEXTS
+	DWORD               MaxPeriod;          // F_MAX_PERIOD
+	USHORT              MaxTime;            // F_MAX_TIME, 0 for no time limit
+	USHORT              MaxHeader;          // MAX_HEADER
+
+	// Statistics
+
+	DWORD               packets;            // outbound IPv6 packets
+	DWORD               compressed;         // outbound compressed packets
+	DWORD               full;               // outbound full header packets
+	DWORD               searches;           // searches for a context
+	DWORD               misses;             // times couldn't find a context
+}
+iphc_t;
+
+USHORT
+iphc_compress(
+	IN OUT PNDIS_WAN_PACKET pPacket,
+	IN OUT iphc_t          *comp);
+
+void
+iphc_compress_init(
+	OUT	iphc_t          *comp,
+	IN  iphc_cstate_t   *pStates,
+	IN  USHORT           cContexts,
+	IN  USHORT           MaxPeriod,
+	IN  USHORT           MaxTime,
+	IN  USHORT           MaxHeader);
@@ -20,6 +20,7 @@
 #define IPV6CP_H
 
 #include "layerfsm.h"
+#include "iphc.h"
 
 
 // IPCP Option Values
@@ -57,6 +58,24 @@ typedef struct  IPV6Context
 	BYTE			LocalCompressionProtocol[2];
 	BYTE			PeerCompressionProtocol[2];
 
+	//
+	// IP Header Compression (IPHC) of packets sent to the peer, if the peer
+	// requested it. Parameters are from the peer's IPv6-Compression-Protocol
+	// option.
+	//
+	BOOL			bPeerIPHC;
+	USHORT			PeerIPHCNonTcpSpace;
+	USHORT			PeerIPHCMaxPeriod;
+	USHORT			PeerIPHCMaxTime;
+	USHORT			PeerIPHCMaxHeader;
+
+	iphc_t			iphc;
+	iphc_cstate_t	*pIPHCStates;
+	DWORD			cIPHCStates;
+
+	// Scratch buffer used for NAKing an IPv6-Compression-Protocol option
+	BYTE			optDataIPHC[IPHC_OPTION_LENGTH];
+
 	DWORD           dwOptionFlags;
 #define OPTION_DISABLE_REGISTRY_IFID		(1<<METHOD_IFID_REGISTRY)
 #define OPTION_DISABLE_PERSISTENT_RANDOM	(1<<METHOD_IFID_PERSISTENT_RANDOM)
@@ -494,6 +494,11 @@ pppStartTimer( pppSession_t     *s_p,
 DWORD
 pppStopTimer( pppSession_t *s_p, CTETimer *tmr_p );
 
+#define PPP_TIMER_BATCH_MS	256		// Must be a power of 2
+
+DWORD
+pppBatchTimerDelay( DWORD delay );
+
 DWORD
 PPPSessionRegisterProtocol(
     IN OUT pppSession_t    *pSession,
@@ -530,6 +535,54 @@ CopyNdisBufferChainToFlatBuffer(
 	IN     PBYTE            pFlatBuffer,
 	IN OUT PDWORD           pcbFlatBuffer);
 
+DWORD
+NdisBufferChainLength(
+	IN     PNDIS_BUFFER		pNdisBuffer,
+	IN     DWORD            dwOffset);
+
+DWORD
+NdisBufferChainCopy(
+	IN OUT PNDIS_BUFFER		*ppNdisBuffer,
+	IN OUT PDWORD           pdwOffset,
+	IN     PBYTE            pFlatBuffer,
+	IN     DWORD            cbCopy);
+
+BOOLEAN
+NdisBufferChainNextSegment(
+	IN OUT PNDIS_BUFFER		*ppNdisBuffer,
+	IN OUT PDWORD           pdwOffset,
+	   OUT PBYTE            *ppData,
+	   OUT PDWORD           pcbData);
+
+//
+//	A WAN packet being sent may hold only the start of the packet data, the
+//	rest (the "tail") still being in the sender's NDIS buffer chain. Stages that
+//	can read the chain directly (CCP compression) do so, and pppMacSndData copies
+//	the tail into the WAN packet if it is still there.
+//
+//	ProtocolReserved3 is the first buffer of the tail and ProtocolReserved4 the
+//	offset of the tail into it.
+//
+#define PPP_TX_HEAD_SIZE				128
+#define PPP_TX_MAX_SEGMENTS				8
+
+#define PPP_TX_TAIL_BUFFER(pPacket)		((PNDIS_BUFFER)(pPacket)->ProtocolReserved3)
+#define PPP_TX_TAIL_OFFSET(pPacket)		((DWORD)(pPacket)->ProtocolReserved4)
+
+void
+pppTxSetTail(
+	IN     PNDIS_WAN_PACKET	pPacket,
+	IN     PNDIS_BUFFER		pNdisBuffer,
+	IN     DWORD            dwOffset);
+
+DWORD
+pppTxTailLength(
+	IN     PNDIS_WAN_PACKET	pPacket);
+
+BOOLEAN
+pppTxFlattenTail(
+	IN     PNDIS_WAN_PACKET	pPacket);
+
 BYTE *
 StrToUpper( BYTE *string );
 
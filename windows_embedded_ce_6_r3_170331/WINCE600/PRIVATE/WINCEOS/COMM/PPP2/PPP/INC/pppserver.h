@@ -23,7 +23,7 @@
 
 #define COUNTOF(array) sizeof(array)/sizeof(array[0])
 
-typedef struct
+typedef struct PPPServerIPAddrInfo
 {
 	DWORD	IPAddr;
 	DWORD	IPMask;
@@ -52,6 +52,13 @@ typedef struct
 
 	DWORD   dwDhcpCollisionCount;
 
+	//
+	// Server lookup table links, see PPPServerConfiguration_t
+	//
+	struct PPPServerIPAddrInfo        *pNextByIPAddr;
+	struct PPPServerIPAddrInfo        *pNextByIndex;
+	struct PPPServerLineConfiguration *pLine;	// Line owning this info
+
 } PPPServerIPAddrInfo;
 
 //
@@ -96,6 +103,12 @@ typedef struct PPPServerLineConfiguration
 	BYTE        IPV6NetPrefix[16];
 	DWORD       IPV6NetPrefixBitLength;
 
+	//
+	// Server lookup table links, see PPPServerConfiguration_t
+	//
+	struct PPPServerLineConfiguration *pNextByName;
+	struct PPPServerLineConfiguration *pNextBySession;
+
 } PPPServerLineConfiguration_t;
 
 
@@ -114,6 +127,45 @@ typedef struct PPPServerUserCredentials
 	RASCNTL_SERVERUSERCREDENTIALS	info;
 } PPPServerUserCredentials_t;
 
+//
+//	The static IP address pool keeps its free addresses on a doubly linked
+//	list of pool indices, so that allocating, releasing and reserving a
+//	specific address (one obtained some other way, e.g. AutoIP or DHCP,
+//	which happens to fall in the pool range) are all O(1).
+//
+//	Addresses are allocated from the head and released to the tail, so a
+//	released address is the last to be reused.
+//
+typedef struct
+{
+	DWORD	dwStart;				// First address in the pool
+	DWORD	dwCount;				// Number of addresses in the pool
+	PDWORD	pNext;					// pNext[i] is the free index after i, IPPOOL_IN_USE if i is allocated
+	PDWORD	pPrev;					// pPrev[i] is the free index before i
+	DWORD	dwHead;					// Next index to allocate
+	DWORD	dwTail;					// Most recently released index
+	DWORD	dwFree;					// Number of free addresses
+} PPPServerIPPool_t;
+
+#define IPPOOL_NIL		((DWORD)-1)
+#define IPPOOL_IN_USE	((DWORD)-2)
+#define IPPOOL_MAX_COUNT	65536		// Larger pools are searched rather than indexed
+
+//
+//	Lines, and the server/client IP address info of each line, are hashed so
+//	that the per-session and per-event lookups do not have to walk the line
+//	list.  The hash chains, the static IP pool and the IPAddr, Index and
+//	pSession fields of each line are protected by PPPServerTableCritSec.
+//	That lock is only held for short periods and never across calls out of
+//	this module, so PPP sessions querying their line do not contend with
+//	configuration requests holding PPPServerCritSec.
+//
+#define PPPSRV_HASH_SIZE				64	// Must be a power of 2
+
+#define PPPSRV_HASH_IPADDR(a)			(((a) ^ ((a) >> 8) ^ ((a) >> 16)) & (PPPSRV_HASH_SIZE - 1))
+#define PPPSRV_HASH_INDEX(i)			((i) & (PPPSRV_HASH_SIZE - 1))
+#define PPPSRV_HASH_SESSION(s)			((((DWORD)(s)) >> 4) & (PPPSRV_HASH_SIZE - 1))
+
 //
 //	The PPPServerConfiguration_t describes PPP server configuration settings.
 //
@@ -146,6 +198,14 @@ typedef struct
 	DWORD       IPV6NetPrefixBitLength;
 	DWORD       IPV6NetCount;
 
+	// Lookup tables
+	PPPServerLineConfiguration_t *LineByName[PPPSRV_HASH_SIZE];
+	PPPServerLineConfiguration_t *LineBySession[PPPSRV_HASH_SIZE];
+	PPPServerIPAddrInfo          *IPAddrInfoByIPAddr[PPPSRV_HASH_SIZE];
+	PPPServerIPAddrInfo          *IPAddrInfoByIndex[PPPSRV_HASH_SIZE];
+
+	PPPServerIPPool_t            StaticIpPool;
+
 } PPPServerConfiguration_t;
 
 //
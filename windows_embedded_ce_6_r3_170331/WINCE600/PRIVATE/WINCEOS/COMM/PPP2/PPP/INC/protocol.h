@@ -48,6 +48,8 @@
 #define PPP_PROTOCOL_IPV6               0x0057 // Internet Protocol Version 6 (IPv6)
 #define PPP_PROTOCOL_COMPRESSED_TCP     0x002D // Van Jacobson Compressed TCP
 #define PPP_PROTOCOL_UNCOMPRESSED_TCP   0x002F // Van Jacobson Uncompressed TCP
+#define PPP_PROTOCOL_IPHC_FULL_HEADER   0x0061 // IP Header Compression (RFC 2509) full header
+#define PPP_PROTOCOL_IPHC_COMPRESSED_NON_TCP 0x0065 // IPHC compressed non-TCP header
 
 // Compressed Packet
 
@@ -34,9 +34,13 @@
 
 // Definitions and State Data
 
-#define MAX_STATES              (16)        // must be >2 and <255
+#define MAX_STATES              (256)       // slot IDs are one octet
+#define DEFAULT_STATES          (16)        // RFC 1332 default Max-Slot-Id + 1
 #define MAX_HDR                 (128)       // max TCP+IP hdr length 
 
+#define VJ_HASH_SIZE            (64)        // tx connection hash buckets, power of 2
+#define VJ_NO_STATE             (0xFFFF)    // last_recv/last_xmit before any packet
+
 // Active TCP Conversation State Data
 //
 // This is a copy of the entire IP/TCP header from the last packet 
@@ -46,9 +50,19 @@
 typedef struct  cstate 
 {
     struct cstate   *cs_next;           // next most recently used (tx only) 
+    struct cstate   *cs_prev;           // next least recently used (tx only)
+    struct cstate   *cs_hnext;          // next state in the same hash bucket (tx only)
     USHORT          cs_hlen;            // size of hdr (receive only) 
     BYTE            cs_id;              // state's connection # 
-    BYTE            cs_filler;
+    BYTE            cs_flags;
+#define CSF_HASHED      (1<<0)          // state is in bucket cs_hash of the hash table
+
+    BYTE            cs_hash;            // hash bucket of the connection (tx only)
+
+    // Per connection statistics (tx only), reset when the state is reused
+
+    DWORD           cs_compressed;      // packets sent with a compressed header
+    DWORD           cs_uncompressed;    // packets sent with a full header
 
     union 
     {
@@ -73,21 +87,42 @@ cstate_t;
 
 typedef struct slcompress 
 {
-    cstate_t    *last_cs;               // most recently used tstate 
-    BYTE        last_recv;              // last rcvd conn. id 
-    BYTE        last_xmit;              // last sent conn. id 
+    cstate_t    *last_cs;               // least recently used tstate, last_cs->cs_next is the most recent
+    USHORT      last_recv;              // last rcvd conn. id 
+    USHORT      last_xmit;              // last sent conn. id 
 	BYTE        LastRxFrameBad;         // last received frame had errors
     BYTE        flags;
 #define SLF_ENABLE_SLOTID_COMPRESSION_TX  (1<<1)
 #define SLF_ENABLE_SLOTID_COMPRESSION_RX  (1<<2)
 
-    BYTE        MaxStatesTx;            // Max states to use when sending
-    BYTE        MaxStatesRx;            // Max states to use receiving
-    cstate_t    tstate[ MAX_STATES ];   // xmit connection states 
-    cstate_t    rstate[ MAX_STATES ];   // receive connection states 
+    USHORT      MaxStatesTx;            // Max states to use when sending
+    USHORT      MaxStatesRx;            // Max states to use receiving
+    USHORT      cRStates;               // Number of receive states allocated (>= MaxStatesRx)
+    cstate_t    *tstate;                // xmit connection states [MaxStatesTx]
+    cstate_t    *rstate;                // receive connection states [cRStates]
+
+    cstate_t    *hash[ VJ_HASH_SIZE ];  // xmit connection states by address/port hash
+
+    // Statistics
+
+    DWORD       sls_packets;            // outbound TCP packets
+    DWORD       sls_compressed;         // outbound compressed packets
+    DWORD       sls_searches;           // searches for connection state
+    DWORD       sls_misses;             // times couldn't find conn. state
+    DWORD       sls_uncompressedin;     // inbound uncompressed packets
+    DWORD       sls_compressedin;       // inbound compressed packets
+    DWORD       sls_errorin;            // inbound unknown type packets
+    DWORD       sls_tossed;             // inbound packets tossed because of error
 }
 slcompress_t;
 
+//
+//  Memory needed for the connection states of a line with the given
+//  number of transmit and receive states.
+//
+#define SL_STATES_COUNT(MaxStatesRx, MaxStatesTx) \
+	((MaxStatesTx) + ((MaxStatesRx) > DEFAULT_STATES ? (MaxStatesRx) : DEFAULT_STATES))
+
 
 // Function Prototypes
 
@@ -106,8 +141,9 @@ sl_uncompress_tcp( BYTE *bufp, DWORD *len, slcompress_t *comp );
 void
 sl_compress_init(
 	OUT	slcompress_t *comp,
-	IN  BYTE          MaxStatesRx,
-	IN  BYTE          MaxStatesTx,
+	IN  cstate_t     *pStates,
+	IN  USHORT        MaxStatesRx,
+	IN  USHORT        MaxStatesTx,
 	IN  BOOL          CompressSlotIdsRx,
 	IN  BOOL          CompressSlotIdsTx);
 
@@ -112,7 +112,8 @@ ipcpUp(
 	pppSession_t    *pSession = (pppSession_t *)(pContext->session);
 	USHORT          MRU;
 	DWORD           cbMRU,
-		            cbMaxRxBuf;
+		            cbMaxRxBuf,
+		            cStates;
 
     if (pContext->local.VJCompressionEnabled || pContext->peer.VJCompressionEnabled )
     {
@@ -136,12 +137,35 @@ ipcpUp(
 			}
 		}
 
-        sl_compress_init(
-			&pContext->vjcomp,
-			pContext->local.MaxSlotId + 1,
-			pContext->peer.MaxSlotId + 1,
-			pContext->local.CompSlotId,
-			pContext->peer.CompSlotId && pContext->VJEnableSlotIdCompressionTx); // only enable if both we AND peer want it
+		//
+		// Allocate new VJ connection states if the number of slots has changed.
+		//
+		cStates = SL_STATES_COUNT(pContext->local.MaxSlotId + 1, pContext->peer.MaxSlotId + 1);
+		if (cStates != pContext->cVJStates)
+		{
+			DEBUGMSG(ZONE_IPCP, (TEXT("PPP: Allocating %u VJ connection states\n"), cStates));
+			pppFree(pSession, pContext->pVJStates);
+			pContext->cVJStates = cStates;
+			pContext->pVJStates = pppAlloc(pSession, cStates * sizeof(cstate_t));
+			if (pContext->pVJStates == NULL)
+			{
+				// Disable compression and decompression
+				pContext->local.VJCompressionEnabled = FALSE;
+				pContext->peer.VJCompressionEnabled = FALSE;
+				pContext->cVJStates = 0;
+			}
+		}
+
+		if (pContext->pVJStates)
+		{
+			sl_compress_init(
+				&pContext->vjcomp,
+				pContext->pVJStates,
+				pContext->local.MaxSlotId + 1,
+				pContext->peer.MaxSlotId + 1,
+				pContext->local.CompSlotId,
+				pContext->peer.CompSlotId && pContext->VJEnableSlotIdCompressionTx); // only enable if both we AND peer want it
+		}
     }
 
 	// Bring up the link
@@ -167,6 +191,10 @@ ipcpDown(
 
 	PppDhcpStop(pSession);
 
+	DEBUGMSG(ZONE_STATS && pContext->pVJStates, (L"PPP: VJ TX %u packets, %u compressed, %u searches, %u misses; RX %u uncompressed, %u compressed, %u errors, %u tossed\n",
+		pContext->vjcomp.sls_packets, pContext->vjcomp.sls_compressed, pContext->vjcomp.sls_searches, pContext->vjcomp.sls_misses,
+		pContext->vjcomp.sls_uncompressedin, pContext->vjcomp.sls_compressedin, pContext->vjcomp.sls_errorin, pContext->vjcomp.sls_tossed));
+
     // Take the TCP/IP interface down
     PPPVEMIPV4InterfaceDown(pSession);
 
@@ -389,9 +417,9 @@ pppIpcp_InstanceCreate(
         // XP compatibility...
         pContext->pFsm->idTxCR = 1;
 
-		// Default max VJ slot ID is 15
-		pContext->VJMaxSlotIdTx = MAX_STATES - 1;
-		pContext->VJMaxSlotIdRx = MAX_STATES - 1;
+		// Default max VJ slot ID is 15, up to MAX_STATES - 1 may be configured
+		pContext->VJMaxSlotIdTx = DEFAULT_STATES - 1;
+		pContext->VJMaxSlotIdRx = DEFAULT_STATES - 1;
 
 		 // Disable slot ID compression because we don't get link errors
 		pContext->VJEnableSlotIdCompressionTx = FALSE;
@@ -405,6 +433,12 @@ pppIpcp_InstanceCreate(
 						L"VJEnableSlotIdCompressionRx", REG_DWORD, 0,  &pContext->VJEnableSlotIdCompressionRx,   sizeof(DWORD),
 						NULL);
 
+		// Slot IDs are one octet
+		if (pContext->VJMaxSlotIdTx > MAX_STATES - 1)
+			pContext->VJMaxSlotIdTx = MAX_STATES - 1;
+		if (pContext->VJMaxSlotIdRx > MAX_STATES - 1)
+			pContext->VJMaxSlotIdRx = MAX_STATES - 1;
+
 		// Configure option values
 		ipcpOptionInit(pContext);
 
@@ -440,6 +474,7 @@ pppIpcp_InstanceDelete(
 	{
 		PppFsmDelete(pContext->pFsm);
 		pppFree(pContext->session, pContext->pVJRxBuf);
+		pppFree(pContext->session, pContext->pVJStates);
 		pppFree(pContext->session, pContext);
 	}
 }
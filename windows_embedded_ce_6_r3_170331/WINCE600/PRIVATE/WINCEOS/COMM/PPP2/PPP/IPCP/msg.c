@@ -73,7 +73,7 @@ pppIpcpSndData(
 			break;
         }
 
-		dwFlatLen = pWanPacket->CurrentLength;	// Save for later
+		dwFlatLen = pWanPacket->CurrentLength + pppTxTailLength(pWanPacket);	// Save for later
 		pContext->session->Stats.BytesSent += dwFlatLen;
 		pContext->session->Stats.FramesSent++;
 
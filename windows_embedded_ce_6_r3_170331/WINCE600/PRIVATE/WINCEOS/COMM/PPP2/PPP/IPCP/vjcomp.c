@@ -240,6 +240,79 @@ TcpHdrLen( struct TCPHeader *arg )
 	return bHeaderLength;
 }
 
+static BYTE
+VJHash(
+	IN  struct IPHeader  *ip,
+	IN  struct TCPHeader *tcp)
+//
+//	Return the tx hash bucket for the connection of a TCP/IP header.
+//
+{
+	ULONG	hash;
+
+	hash = ip->iph_src ^ ip->iph_dest ^ (((ULONG)tcp->tcp_src << 16) | tcp->tcp_dest);
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return (BYTE)(hash & (VJ_HASH_SIZE - 1));
+}
+
+static void
+VJHashRemove(
+	IN OUT slcompress_t *comp,
+	IN     cstate_t     *cs)
+//
+//	Remove a tx state from its hash bucket, if it is in one.
+//
+{
+	cstate_t **pcs;
+
+	if (cs->cs_flags & CSF_HASHED)
+	{
+		for (pcs = &comp->hash[cs->cs_hash]; *pcs; pcs = &(*pcs)->cs_hnext)
+		{
+			if (*pcs == cs)
+			{
+				*pcs = cs->cs_hnext;
+				break;
+			}
+		}
+		cs->cs_hnext = NULL;
+		cs->cs_flags &= ~CSF_HASHED;
+	}
+}
+
+static void
+VJMoveToFront(
+	IN OUT slcompress_t *comp,
+	IN     cstate_t     *cs)
+//
+//	Make a tx state the most recently used.
+//
+{
+	cstate_t *lastcs = comp->last_cs;
+
+	if (lastcs->cs_next == cs)
+	{
+		// Already at the front
+	}
+	else if (lastcs == cs)
+	{
+		// The list is circular, so the oldest becomes the newest by backing up last_cs
+		comp->last_cs = cs->cs_prev;
+	}
+	else
+	{
+		cs->cs_prev->cs_next = cs->cs_next;
+		cs->cs_next->cs_prev = cs->cs_prev;
+
+		cs->cs_next = lastcs->cs_next;
+		cs->cs_prev = lastcs;
+		lastcs->cs_next->cs_prev = cs;
+		lastcs->cs_next = cs;
+	}
+}
+
 //   A.2  Compression
 //
 //   This routine looks daunting but isn't really.  The code splits into four
@@ -355,32 +428,32 @@ sl_compress_tcp(
     // used again & we don't have to do any reordering if it's used.
     // Compare the ip/tcp src and dest fields.
 
+    comp->sls_packets++;
+
     cs = comp->last_cs->cs_next;                // access compression state
 
-    if ((ip->iph_src   != cs->cs_ip.iph_src   ) ||
+    if ((cs->cs_flags & CSF_HASHED) == 0        ||
+        (ip->iph_src   != cs->cs_ip.iph_src   ) ||
         (ip->iph_dest  != cs->cs_ip.iph_dest  ) ||
         (tcp->tcp_src  != cs->cs_tcp->tcp_src ) ||
         (tcp->tcp_dest != cs->cs_tcp->tcp_dest) )
     {
-        // Wasn't the first -- search for it.
+        // Wasn't the first -- look it up.
         //
-        // States are kept in a circularly linked list with last_cs
+        // States are kept in a circular, doubly linked list with last_cs
         // pointing to the end of the list.  The list is kept in lru
         // order by moving a state to the head of the list whenever
-        // it is referenced.  Since the list is short and,
-        // empirically, the connection we want is almost always near
-        // the front, we locate states via linear search.  If we
-        // don't find a state for the datagram, the oldest state is
-        // (re-)used.
-             
-        cstate_t *lcs;
-        cstate_t *lastcs = comp->last_cs;
-
-        do 
-        {
-            lcs = cs;
-            cs = cs->cs_next;
+        // it is referenced.  With up to 256 states a linear search of
+        // the list is too slow, so the states in use are also hashed
+        // on the connection addresses and ports.  If we don't find a
+        // state for the datagram, the oldest state is (re-)used.
+
+        BYTE iHash = VJHash(ip, tcp);
+
+        comp->sls_searches++;
 
+        for (cs = comp->hash[iHash]; cs; cs = cs->cs_hnext)
+        {
             // Compare connection data
 
             if ((ip->iph_src   == cs->cs_ip.iph_src   ) && 
@@ -388,37 +461,40 @@ sl_compress_tcp(
                 (tcp->tcp_src  == cs->cs_tcp->tcp_src ) &&
                 (tcp->tcp_dest == cs->cs_tcp->tcp_dest) )
             {
-
-                goto found;
+                break;
             }
+        }
 
-        } 
-        while(cs != lastcs);
-
-        // Didn't find it -- re-use oldest cstate_t. Send an uncompressed 
-        // packet that tells the other side what connection number we're 
-        // using for this conversation. Note that since the state list is 
-        // circular, the oldest state points to the newest and we only need 
-        // to set last_cs to update the lru linkage.
-              
-        comp->last_cs = lcs;
-		DEBUGMSG(ZONE_VJ, (L"PPP: TX VJ slot %x No previous cstate, uncompressed\n", cs->cs_id));
-        goto uncompressed;
-
+        if (cs == NULL)
+        {
+            // Didn't find it -- re-use oldest cstate_t. Send an uncompressed 
+            // packet that tells the other side what connection number we're 
+            // using for this conversation. Note that since the state list is 
+            // circular, the oldest state points to the newest and we only need 
+            // to set last_cs to update the lru linkage.
+
+            cs = comp->last_cs;
+            comp->last_cs = cs->cs_prev;
+            comp->sls_misses++;
+
+            DEBUGMSG(ZONE_VJ && (cs->cs_flags & CSF_HASHED), (L"PPP: TX VJ slot %x reused, previous connection sent %u compressed/%u uncompressed\n",
+                cs->cs_id, cs->cs_compressed, cs->cs_uncompressed));
+
+            VJHashRemove(comp, cs);
+            cs->cs_hash = iHash;
+            cs->cs_hnext = comp->hash[iHash];
+            comp->hash[iHash] = cs;
+            cs->cs_flags |= CSF_HASHED;
+            cs->cs_compressed = 0;
+            cs->cs_uncompressed = 0;
+
+            DEBUGMSG(ZONE_VJ, (L"PPP: TX VJ slot %x No previous cstate, uncompressed\n", cs->cs_id));
+            goto uncompressed;
+        }
 
-found:  //----------------------------------------------------------------------
         // Found State -- move to the front on the connection list. 
 
-        if (lastcs == cs)
-        {
-            comp->last_cs = lcs;
-        }
-        else 
-        {
-            lcs->cs_next    = cs->cs_next;
-            cs->cs_next     = lastcs->cs_next;
-            lastcs->cs_next = cs;
-        }
+        VJMoveToFront(comp, cs);
     }
 
     // Make sure that only what we expect to change changed. 
@@ -625,6 +701,9 @@ found:  //----------------------------------------------------------------------
     pPacket->CurrentLength -= totalLen;
     (BYTE *)pPacket->CurrentBuffer += totalLen;
 
+    cs->cs_compressed++;
+    comp->sls_compressed++;
+
     return PPP_PROTOCOL_COMPRESSED_TCP;              // packet is compressed
 
 
@@ -649,6 +728,8 @@ uncompressed: //---------------------------------------------------------------
 
     comp->last_xmit = cs->cs_id;
 
+    cs->cs_uncompressed++;
+
     return PPP_PROTOCOL_UNCOMPRESSED_TCP;
 }
 
@@ -707,7 +788,7 @@ sl_update_tcp(
 		return FALSE;
 
 	iState = ip->iph_protocol;
-    if (iState >= MAX_STATES) 
+    if (iState >= comp->cRStates) 
         return FALSE;
 
 	if (iState >= comp->MaxStatesRx)
@@ -721,6 +802,7 @@ sl_update_tcp(
     cs = &comp->rstate[ iState ];
 
     comp->LastRxFrameBad = FALSE;
+    comp->sls_uncompressedin++;
 
     // Restore the IP protocol field then save a copy of this packet 
     // header. The checksum is zeroed in the copy so we don't have to 
@@ -784,15 +866,15 @@ sl_uncompress_tcp(
         // Make sure the state index is in range, then grab the state. 
         // If we have a good state index, clear the 'discard' flag.
 
-        if (iState >= MAX_STATES)
+        if (iState >= comp->cRStates)
 		{
-			DEBUGMSG(ZONE_WARN, (L"PPP: WARNING - Peer sent VJ compressed packet slot=%u >= MAX_STATES(%u)\n", iState, MAX_STATES));
+			DEBUGMSG(ZONE_WARN, (L"PPP: WARNING - Peer sent VJ compressed packet slot=%u >= allocated states(%u)\n", iState, comp->cRStates));
             goto bad;
 		}
 
         if (iState >= comp->MaxStatesRx)
 		{
-			// Since we allocated MAX_STATES slots, we can handle this slotID. However, the peer
+			// Since we allocated at least DEFAULT_STATES slots, we can handle this slotID. However, the peer
 			// is technically in violation of the negotiated value so log a debug message.
 			DEBUGMSG(ZONE_WARN, (L"PPP: WARNING - Peer sent VJ compressed packet slot=%u >= negotiated max=%u\n", iState, comp->MaxStatesRx));
 		}
@@ -811,21 +893,23 @@ sl_uncompress_tcp(
         if (comp->LastRxFrameBad)
 		{
 			DEBUGMSG(ZONE_VJ, (L"PPP: RX VJ implicit state index but no prior state, toss\n"));
+			comp->sls_tossed++;
             return NULL;
 		}
 
-		iState = comp->last_recv;
+		iState = (BYTE)comp->last_recv;
 
 		//
 		// If no previous packet was received to initialize the last_recv
-		// state index, then it will be 255 and this packet is invalid. However,
+		// state index, then it will be VJ_NO_STATE and this packet is invalid. However,
 		// the LastRxFrameBad flag which was checked above should have been set at
 		// init time, so we shouldn't get here.
 		//
-		ASSERT(iState < comp->MaxStatesRx);
+		ASSERT(iState < comp->cRStates);
     }
 
 	DEBUGMSG(ZONE_VJ, (L"PPP: RX VJ slot %x %c%c%c%c%c%c\n", iState, DEBUG_OUTPUT_CHANGES(changes)));
+	comp->sls_compressedin++;
 
     // Find the state then fill in the TCP checksum and PUSH bit.
 
@@ -967,6 +1051,7 @@ bad://--------------------------------------------------------------------------
     // Bad Packet
 
     comp->LastRxFrameBad = TRUE;
+    comp->sls_errorin++;
     return NULL;
 }
 
@@ -975,17 +1060,21 @@ bad://--------------------------------------------------------------------------
 // This routine initializes the state structure for both the transmit and
 // receive halves of some serial line.  It must be called each time the
 // line is brought up.
+//
+// pStates must have room for SL_STATES_COUNT(MaxStatesRx, MaxStatesTx)
+// connection states.
 
 void
 sl_compress_init(
 	OUT	slcompress_t *comp,
-	IN  BYTE          MaxStatesRx,
-	IN  BYTE          MaxStatesTx,
+	IN  cstate_t     *pStates,
+	IN  USHORT        MaxStatesRx,
+	IN  USHORT        MaxStatesTx,
 	IN  BOOL          CompressSlotIdsRx,
 	IN  BOOL          CompressSlotIdsTx)
 {
     u_int i;
-    cstate_t *tstate = comp->tstate;
+    cstate_t *tstate;
 
     // Reset the compression record 
 
@@ -997,23 +1086,32 @@ sl_compress_init(
 	if (MaxStatesTx > MAX_STATES)
 		MaxStatesTx = MAX_STATES;
 
+	CTEMemSet((char *) pStates, 0, SL_STATES_COUNT(MaxStatesRx, MaxStatesTx) * sizeof(cstate_t));
+
+	// The receive states follow the transmit states. At least DEFAULT_STATES
+	// are kept so that peers which send slot IDs a little beyond the
+	// negotiated maximum still work.
+
+	comp->tstate   = tstate = pStates;
+	comp->rstate   = pStates + MaxStatesTx;
+	comp->cRStates = SL_STATES_COUNT(MaxStatesRx, MaxStatesTx) - MaxStatesTx;
+
     // Link the transmit states into a circular list.
+    // None of them is in the hash table until used for a connection.
 
-    for(i = MaxStatesTx - 1; i > 0; --i) 
+    for(i = 0; i < MaxStatesTx; i++) 
     {
-         tstate[i].cs_id   = i;
-         tstate[i].cs_next = &tstate[ i-1 ];
+         tstate[i].cs_id   = (BYTE)i;
+         tstate[i].cs_next = &tstate[ i > 0 ? i-1 : MaxStatesTx - 1 ];
+         tstate[i].cs_prev = &tstate[ i < MaxStatesTx - 1U ? i+1 : 0 ];
     }
 
-    tstate[0].cs_next = &tstate[ MaxStatesTx - 1 ];
-    tstate[0].cs_id   = 0;
     comp->last_cs     = &tstate[ 0 ];
 
     // Make sure we don't accidentally do CID compression
-    // (assumes MAX_STATES < 255).
          
-    comp->last_recv = 255;
-    comp->last_xmit = 255;
+    comp->last_recv = VJ_NO_STATE;
+    comp->last_xmit = VJ_NO_STATE;
 
 	comp->LastRxFrameBad = TRUE;
 	if (CompressSlotIdsRx)
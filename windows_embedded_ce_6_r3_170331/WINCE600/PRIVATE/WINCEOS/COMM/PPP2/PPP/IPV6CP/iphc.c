@@ -0,0 +1,399 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+/*****************************************************************************
+* 
+*
+*   @doc
+*   @module iphc.c | IP Header Compression (IPHC) for IPv6
+*
+*   @comm   Compression of the headers of IPv6 packets that are not TCP (UDP,
+*           ICMPv6, ...) as described in RFC 2507, for sending over PPP as
+*           described in RFC 2509.
+*
+*           Only the FULL_HEADER and COMPRESSED_NON_TCP packet types with
+*           8 bit context identifiers (CIDs) are sent. TCP and packets with
+*           extension headers are sent as regular IPv6 packets, which the
+*           RFC allows.
+*
+*/
+
+//  Include Files
+
+#include "windows.h"
+#include "cclib.h"
+#include "memory.h"
+#include "cxport.h"
+
+#include "ndis.h"
+#include "ndiswan.h"
+
+// PPP Include Files
+
+#include "protocol.h"
+#include "ppp.h"
+#include "iphc.h"
+
+#define IPV6_HEADER_LENGTH      40
+#define UDP_HEADER_LENGTH       8
+
+// IPv6 header fields
+
+#define IPV6_OFFSET_PAYLOAD_LENGTH  4
+#define IPV6_OFFSET_NEXT_HEADER     6
+#define IPV6_OFFSET_HOP_LIMIT       7
+#define IPV6_OFFSET_SOURCE          8   // Source and destination addresses, 32 bytes
+
+// UDP header fields, relative to the start of the IPv6 header
+
+#define UDP_OFFSET_PORTS            (IPV6_HEADER_LENGTH + 0)
+#define UDP_OFFSET_LENGTH           (IPV6_HEADER_LENGTH + 4)
+#define UDP_OFFSET_CHECKSUM         (IPV6_HEADER_LENGTH + 6)
+
+// Next header values
+
+#define NH_HOP_BY_HOP               0
+#define NH_TCP                      6
+#define NH_UDP                      17
+#define NH_ROUTING                  43
+#define NH_FRAGMENT                 44
+#define NH_ESP                      50
+#define NH_AH                       51
+#define NH_DESTINATION_OPTIONS      60
+
+// Bits in the first octet of the length field of a full header
+
+#define FULL_HEADER_NON_TCP         0x80
+
+static BYTE
+IphcHash(
+	IN  PBYTE pHeader,
+	IN  BYTE  cbHeader)
+//
+//	Return the hash bucket for the packet stream of a header: the addresses,
+//	next header and, for UDP, the ports.
+//
+{
+	ULONG	hash = pHeader[IPV6_OFFSET_NEXT_HEADER];
+	DWORD	i;
+
+	for (i = IPV6_OFFSET_SOURCE; i < IPV6_HEADER_LENGTH; i++)
+		hash = (hash << 5) + hash + pHeader[i];
+
+	if (cbHeader > IPV6_HEADER_LENGTH)
+	{
+		for (i = UDP_OFFSET_PORTS; i < UDP_OFFSET_LENGTH; i++)
+			hash = (hash << 5) + hash + pHeader[i];
+	}
+
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return (BYTE)(hash & (IPHC_HASH_SIZE - 1));
+}
+
+static BOOL
+IphcSameStream(
+	IN  iphc_cstate_t *cs,
+	IN  PBYTE          pHeader,
+	IN  BYTE           cbHeader)
+//
+//	Return TRUE if the header belongs to the packet stream of the context.
+//
+{
+	return cs->cs_hlen == cbHeader
+		&& cs->cs_hdr[IPV6_OFFSET_NEXT_HEADER] == pHeader[IPV6_OFFSET_NEXT_HEADER]
+		&& memcmp(&cs->cs_hdr[IPV6_OFFSET_SOURCE], &pHeader[IPV6_OFFSET_SOURCE], IPV6_HEADER_LENGTH - IPV6_OFFSET_SOURCE) == 0
+		&& (cbHeader == IPV6_HEADER_LENGTH
+		 || memcmp(&cs->cs_hdr[UDP_OFFSET_PORTS], &pHeader[UDP_OFFSET_PORTS], 4) == 0);
+}
+
+static void
+IphcHashRemove(
+	IN OUT iphc_t        *comp,
+	IN     iphc_cstate_t *cs)
+{
+	iphc_cstate_t **pcs;
+
+	if (cs->cs_flags & ICSF_HASHED)
+	{
+		for (pcs = &comp->hash[cs->cs_hash]; *pcs; pcs = &(*pcs)->cs_hnext)
+		{
+			if (*pcs == cs)
+			{
+				*pcs = cs->cs_hnext;
+				break;
+			}
+		}
+		cs->cs_hnext = NULL;
+		cs->cs_flags &= ~ICSF_HASHED;
+	}
+}
+
+static void
+IphcMoveToFront(
+	IN OUT iphc_t        *comp,
+	IN     iphc_cstate_t *cs)
+//
+//	Make a context the most recently used.
+//
+{
+	iphc_cstate_t *lastcs = comp->last_cs;
+
+	if (lastcs->cs_next == cs)
+	{
+		// Already at the front
+	}
+	else if (lastcs == cs)
+	{
+		// The list is circular, so the oldest becomes the newest by backing up last_cs
+		comp->last_cs = cs->cs_prev;
+	}
+	else
+	{
+		cs->cs_prev->cs_next = cs->cs_next;
+		cs->cs_next->cs_prev = cs->cs_prev;
+
+		cs->cs_next = lastcs->cs_next;
+		cs->cs_prev = lastcs;
+		lastcs->cs_next->cs_prev = cs;
+		lastcs->cs_next = cs;
+	}
+}
+
+USHORT
+iphc_compress(
+	IN OUT PNDIS_WAN_PACKET pPacket,
+	IN OUT iphc_t          *comp)
+//
+//	Compress the headers of the IPv6 packet in pPacket in place, if possible.
+//
+//	Return the PPP protocol to send the packet with: PPP_PROTOCOL_IPV6 if
+//	the packet was not changed, PPP_PROTOCOL_IPHC_FULL_HEADER if the CID
+//	and generation were put in the packet, or PPP_PROTOCOL_IPHC_COMPRESSED_NON_TCP
+//	if the headers were replaced by a compressed header.
+//
+{
+	PBYTE			pHeader = pPacket->CurrentBuffer;
+	iphc_cstate_t	*cs;
+	BYTE			cbHeader;
+	BYTE			cbCompressed;
+	BYTE			iHash;
+	BYTE			xsum[2];
+	PBYTE			cp;
+	DWORD			dwNow;
+	BOOL			bSendFull = FALSE;
+
+	if (pPacket->CurrentLength < IPV6_HEADER_LENGTH
+	||  (pHeader[0] >> 4) != 6)
+	{
+		return PPP_PROTOCOL_IPV6;
+	}
+
+	switch (pHeader[IPV6_OFFSET_NEXT_HEADER])
+	{
+	case NH_TCP:
+	case NH_HOP_BY_HOP:
+	case NH_ROUTING:
+	case NH_FRAGMENT:
+	case NH_ESP:
+	case NH_AH:
+	case NH_DESTINATION_OPTIONS:
+		// TCP compression and extension headers are not supported
+		return PPP_PROTOCOL_IPV6;
+
+	case NH_UDP:
+		cbHeader = IPV6_HEADER_LENGTH + UDP_HEADER_LENGTH;
+
+		//
+		// The UDP length is inferred from the packet length by the decompressor,
+		// so it must match the IPv6 payload length.
+		//
+		if (pPacket->CurrentLength < cbHeader
+		||  memcmp(&pHeader[UDP_OFFSET_LENGTH], &pHeader[IPV6_OFFSET_PAYLOAD_LENGTH], 2) != 0)
+		{
+			return PPP_PROTOCOL_IPV6;
+		}
+		break;
+
+	default:
+		// The next header is sent as data
+		cbHeader = IPV6_HEADER_LENGTH;
+		break;
+	}
+
+	if (cbHeader > comp->MaxHeader)
+		return PPP_PROTOCOL_IPV6;
+
+	comp->packets++;
+
+	//
+	// Find the context for the packet stream. Most often it is the most
+	// recently used one, otherwise look it up in the hash table. If there
+	// is none, reuse the least recently used context.
+	//
+	cs = comp->last_cs->cs_next;
+	if ((cs->cs_flags & ICSF_HASHED) == 0
+	||  !IphcSameStream(cs, pHeader, cbHeader))
+	{
+		iHash = IphcHash(pHeader, cbHeader);
+
+		comp->searches++;
+
+		for (cs = comp->hash[iHash]; cs; cs = cs->cs_hnext)
+		{
+			if (IphcSameStream(cs, pHeader, cbHeader))
+				break;
+		}
+
+		if (cs == NULL)
+		{
+			cs = comp->last_cs;
+			comp->last_cs = cs->cs_prev;
+			comp->misses++;
+
+			DEBUGMSG(ZONE_VJ && (cs->cs_flags & ICSF_HASHED), (L"PPP: TX IPHC CID %u reused, previous stream sent %u compressed/%u full\n",
+				cs->cs_cid, cs->cs_compressed, cs->cs_full));
+
+			IphcHashRemove(comp, cs);
+			cs->cs_hash = iHash;
+			cs->cs_hnext = comp->hash[iHash];
+			comp->hash[iHash] = cs;
+			cs->cs_flags |= ICSF_HASHED;
+			cs->cs_compressed = 0;
+			cs->cs_full = 0;
+
+			// Invalidate the fields of the previous stream held by the decompressor
+			cs->cs_hlen = 0;
+		}
+		else
+		{
+			IphcMoveToFront(comp, cs);
+		}
+	}
+
+	//
+	// If any field other than the lengths and the UDP checksum changed (or
+	// this is a new stream) then the decompressor needs a new full header,
+	// with a new generation so that it discards compressed headers for the
+	// old one.
+	//
+	dwNow = GetTickCount();
+	if (cs->cs_hlen != cbHeader
+	||  memcmp(&cs->cs_hdr[0], &pHeader[0], IPV6_OFFSET_PAYLOAD_LENGTH) != 0
+	||  cs->cs_hdr[IPV6_OFFSET_HOP_LIMIT] != pHeader[IPV6_OFFSET_HOP_LIMIT])
+	{
+		DEBUGMSG(ZONE_VJ, (L"PPP: TX IPHC CID %u context changed, full header\n", cs->cs_cid));
+
+		memcpy(&cs->cs_hdr[0], pHeader, cbHeader);
+		cs->cs_hlen = cbHeader;
+		cs->cs_generation = (cs->cs_generation + 1) & IPHC_GENERATION_MASK;
+		cs->cs_period = 1;
+		bSendFull = TRUE;
+	}
+	else if (cs->cs_sincefull >= cs->cs_period
+	||       (comp->MaxTime && dwNow - cs->cs_tickfull >= (DWORD)comp->MaxTime * 1000))
+	{
+		//
+		// Compression slow-start: refresh the context with a full header after
+		// 1, 2, 4, ... F_MAX_PERIOD compressed headers, and at least every F_MAX_TIME
+		// seconds, so that a decompressor that lost a full header recovers.
+		// A parameter value of 0 means infinity.
+		//
+		cs->cs_period *= 2;
+		if (cs->cs_period > comp->MaxPeriod)
+			cs->cs_period = comp->MaxPeriod;
+		bSendFull = TRUE;
+	}
+
+	if (bSendFull)
+	{
+		cs->cs_sincefull = 0;
+		cs->cs_tickfull = dwNow;
+		cs->cs_full++;
+		comp->full++;
+
+		// The CID and generation replace the IPv6 payload length
+		pHeader[IPV6_OFFSET_PAYLOAD_LENGTH]     = FULL_HEADER_NON_TCP | cs->cs_generation;
+		pHeader[IPV6_OFFSET_PAYLOAD_LENGTH + 1] = cs->cs_cid;
+
+		return PPP_PROTOCOL_IPHC_FULL_HEADER;
+	}
+
+	//
+	// Replace the headers by the compressed header:
+	//		CID
+	//		0 D Generation  (D = 0, no data field)
+	//		UDP checksum, if UDP
+	//
+	cbCompressed = 2;
+	if (cbHeader > IPV6_HEADER_LENGTH)
+	{
+		memcpy(xsum, &pHeader[UDP_OFFSET_CHECKSUM], 2);
+		cbCompressed += 2;
+	}
+
+	cp = pHeader + cbHeader - cbCompressed;
+	cp[0] = cs->cs_cid;
+	cp[1] = cs->cs_generation;
+	if (cbCompressed > 2)
+		memcpy(&cp[2], xsum, 2);
+
+	pPacket->CurrentBuffer = cp;
+	pPacket->CurrentLength -= cbHeader - cbCompressed;
+
+	cs->cs_sincefull++;
+	cs->cs_compressed++;
+	comp->compressed++;
+
+	return PPP_PROTOCOL_IPHC_COMPRESSED_NON_TCP;
+}
+
+void
+iphc_compress_init(
+	OUT	iphc_t          *comp,
+	IN  iphc_cstate_t   *pStates,
+	IN  USHORT           cContexts,
+	IN  USHORT           MaxPeriod,
+	IN  USHORT           MaxTime,
+	IN  USHORT           MaxHeader)
+//
+//	Initialize the compression state when the link comes up.
+//	pStates must have room for cContexts contexts.
+//
+{
+	USHORT	i;
+
+	memset(comp, 0, sizeof(*comp));
+
+	if (cContexts == 0)
+		cContexts = 1;
+	if (cContexts > IPHC_MAX_CONTEXTS)
+		cContexts = IPHC_MAX_CONTEXTS;
+
+	memset(pStates, 0, cContexts * sizeof(iphc_cstate_t));
+
+	// Link the contexts into a circular list, none is in the hash table until used
+
+	for (i = 0; i < cContexts; i++)
+	{
+		pStates[i].cs_cid  = (BYTE)i;
+		pStates[i].cs_next = &pStates[ i > 0 ? i-1 : cContexts - 1 ];
+		pStates[i].cs_prev = &pStates[ i < cContexts - 1 ? i+1 : 0 ];
+	}
+	comp->last_cs = &pStates[0];
+
+	comp->cContexts = cContexts;
+	comp->MaxPeriod = MaxPeriod ? MaxPeriod : IPHC_INFINITE_PERIOD;
+	comp->MaxTime   = MaxTime;
+	comp->MaxHeader = MaxHeader;
+}
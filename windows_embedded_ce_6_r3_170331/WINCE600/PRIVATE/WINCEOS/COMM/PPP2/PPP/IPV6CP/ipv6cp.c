@@ -58,9 +58,44 @@ ipv6cpUp(
 {
 	PIPV6Context	pContext = (PIPV6Context)context;
 	pppSession_t    *pSession = (pppSession_t *)(pContext->pSession);
+	DWORD           cContexts;
 
     DEBUGMSG( ZONE_IPV6CP, ( TEXT( "PPP: IPV6CP UP\n" )));
 
+	if (pContext->bPeerIPHC)
+	{
+		//
+		// Allocate new IPHC contexts if the number of them has changed.
+		//
+		cContexts = pContext->PeerIPHCNonTcpSpace + 1;
+		if (cContexts > IPHC_MAX_CONTEXTS)
+			cContexts = IPHC_MAX_CONTEXTS;
+
+		if (cContexts != pContext->cIPHCStates)
+		{
+			DEBUGMSG(ZONE_IPV6CP, (TEXT("PPP: Allocating %u IPHC contexts\n"), cContexts));
+			pppFree(pSession, pContext->pIPHCStates);
+			pContext->cIPHCStates = cContexts;
+			pContext->pIPHCStates = pppAlloc(pSession, cContexts * sizeof(iphc_cstate_t));
+			if (pContext->pIPHCStates == NULL)
+			{
+				// Send without header compression
+				pContext->bPeerIPHC = FALSE;
+				pContext->cIPHCStates = 0;
+			}
+		}
+
+		if (pContext->bPeerIPHC)
+		{
+			iphc_compress_init(&pContext->iphc,
+							   pContext->pIPHCStates,
+							   (USHORT)cContexts,
+							   pContext->PeerIPHCMaxPeriod,
+							   pContext->PeerIPHCMaxTime,
+							   pContext->PeerIPHCMaxHeader);
+		}
+	}
+
 	// Indicate connected to RAS (unless still waiting on encryption)
 	pppNcp_IndicateConnected(pSession->ncpCntxt);
 
@@ -79,6 +114,9 @@ ipv6cpDown(
 
     DEBUGMSG( ZONE_IPV6CP, ( TEXT( "PPP: IPV6CP DOWN\n" )));
 
+	DEBUGMSG(ZONE_STATS && pContext->bPeerIPHC, (L"PPP: IPHC TX %u packets, %u compressed, %u full, %u searches, %u misses\n",
+		pContext->iphc.packets, pContext->iphc.compressed, pContext->iphc.full, pContext->iphc.searches, pContext->iphc.misses));
+
 	PPPVEMIPV6InterfaceDown(pSession);
 
 	pContext->NextIFIDMethod = 0;
@@ -151,6 +189,10 @@ ipv6cpResetPeerOptionsToDefaultSettings(
 
 	// Set Peer IFID to 0 prior to the peer assigning it a value.
 	memset(pContext->PeerInterfaceIdentifier, 0, 8);
+
+	// No header compression unless the peer asks for it
+	pContext->bPeerIPHC = FALSE;
+	memset(pContext->PeerCompressionProtocol, 0, sizeof(pContext->PeerCompressionProtocol));
 }
 
 DWORD
@@ -388,6 +430,7 @@ pppIpv6cp_InstanceDelete(
 	if (context)
 	{
 		PppFsmDelete(pContext->pFsm);
+		pppFree( pContext->pSession, pContext->pIPHCStates);
 		pppFree( pContext->pSession, pContext);
 	}
 }
@@ -495,8 +538,8 @@ pppIpv6cpSendData(
 			break;
 		}
 
-		dwFlatLen = pWanPacket->CurrentLength;	// Save for later
-		pSession->Stats.BytesSent += pWanPacket->CurrentLength;
+		dwFlatLen = pWanPacket->CurrentLength + pppTxTailLength(pWanPacket);	// Save for later
+		pSession->Stats.BytesSent += dwFlatLen;
 		pSession->Stats.FramesSent++;
 
 		wProtocol = PPP_PROTOCOL_IPV6;
@@ -505,6 +548,16 @@ pppIpv6cpSendData(
 		if (dpCurSettings.ulZoneMask & 0x80000000)
 			DumpIPv6(TRUE, pWanPacket->CurrentBuffer, pWanPacket->CurrentLength);
 #endif
+		// IP Header Compression
+
+		if (pContext->bPeerIPHC)
+		{
+			//
+			// Peer is willing to accept IPHC compressed packets
+			//
+			wProtocol = iphc_compress(pWanPacket, &pContext->iphc);
+		}
+
 		// CCP Datagram Compression
 		//
 		// If CCP is enabled pass the packet to the CCP protocol for compression. 
@@ -44,6 +44,8 @@
 
 static const BYTE g_IFIDZero[IPV6_IFID_LENGTH] = {0};
 
+static const BYTE g_abIPHCProtocolID[2] = {0x00, 0x61};
+
 #define UNIVERSAL_LOCAL_BITNUM	1
 
 //
@@ -421,6 +423,88 @@ ipv6cpNakIFIDOptionCb(
 	return dwResult;
 }
 
+static void
+PutUSHORT(
+	OUT	PBYTE  pData,
+	IN	USHORT value)
+{
+	pData[0] = (BYTE)(value >> 8);
+	pData[1] = (BYTE)value;
+}
+
+static USHORT
+GetUSHORT(
+	IN	PBYTE  pData)
+{
+	return (pData[0] << 8) | pData[1];
+}
+
+DWORD
+ipv6cpRequestCompressionCb(
+	IN	OUT	PVOID context,
+	IN	OUT	POptionInfo pInfo,
+		OUT	PBYTE		pCode,
+	IN	OUT	PBYTE		*ppOptData,
+	IN	OUT	PDWORD		pcbOptData)
+//
+//	Called when we receive an IPV6CP configure request containing
+//	the IPv6-Compression-Protocol option.  The peer is telling us what
+//	header compression it wants us to use when sending packets to it.
+//
+{
+	PIPV6Context pContext = (PIPV6Context)context;
+	DWORD	     dwResult = NO_ERROR;
+	PBYTE		 pOptData = *ppOptData;
+	DWORD		 cbOptData= *pcbOptData;
+
+	//
+	// We only support IP Header Compression (RFC 2509) without suboptions,
+	// so if the peer is requesting anything else we NAK and suggest IPHC
+	// with the default parameters.
+	//
+	if ((pOptData == NULL)
+	||  (cbOptData != IPHC_OPTION_LENGTH)
+	||  (memcmp(pOptData, &g_abIPHCProtocolID[0], sizeof(g_abIPHCProtocolID)) != 0))
+	{
+		memcpy(&pContext->optDataIPHC[0], &g_abIPHCProtocolID[0], sizeof(g_abIPHCProtocolID));
+		PutUSHORT(&pContext->optDataIPHC[2],  IPHC_DEFAULT_TCP_SPACE);
+		PutUSHORT(&pContext->optDataIPHC[4],  IPHC_DEFAULT_NON_TCP_SPACE);
+		PutUSHORT(&pContext->optDataIPHC[6],  IPHC_DEFAULT_F_MAX_PERIOD);
+		PutUSHORT(&pContext->optDataIPHC[8],  IPHC_DEFAULT_F_MAX_TIME);
+		PutUSHORT(&pContext->optDataIPHC[10], IPHC_DEFAULT_MAX_HEADER);
+		*pCode = PPP_CONFIGURE_NAK;
+		*ppOptData = &pContext->optDataIPHC[0];
+		*pcbOptData = IPHC_OPTION_LENGTH;
+	}
+	else
+	{
+		*pCode = PPP_CONFIGURE_ACK;
+
+		// Save peer values. TCP_SPACE is not needed as we do not compress TCP.
+		pContext->bPeerIPHC = TRUE;
+		pContext->PeerIPHCNonTcpSpace = GetUSHORT(&pOptData[4]);
+		pContext->PeerIPHCMaxPeriod   = GetUSHORT(&pOptData[6]);
+		pContext->PeerIPHCMaxTime     = GetUSHORT(&pOptData[8]);
+		pContext->PeerIPHCMaxHeader   = GetUSHORT(&pOptData[10]);
+		memcpy(&pContext->PeerCompressionProtocol[0], pOptData, 2);
+	}
+
+	return dwResult;
+}
+
+OptionDescriptor ipv6cpCompressionOptionDescriptor =
+{
+	IPV6CP_OPT_COMPRESSION_PROTOCOL,	// type == IPv6-Compression-Protocol
+	OPTION_VARIABLE_LENGTH,
+	"IPv6-Compression",					// name
+	NULL,								// we do not request header compression of received packets
+	NULL,
+	NULL,
+	NULL,								// no special reject handling
+	ipv6cpRequestCompressionCb,
+	NULL								// use default debug hex output
+};
+
 OptionDescriptor ipv6cpIFIDOptionDescriptor =
 {
 	IPV6CP_OPT_INTERFACE_IDENTIFIER,	// type == Interface-Identifier
@@ -438,10 +522,22 @@ DWORD
 ipv6cpOptionInit(
 	PIPV6Context pContext)
 {
-	DWORD dwResult;
+	DWORD       dwResult;
+	RASPENTRY   *pRasEntry = &pContext->pSession->rasEntry;
+	OptionRequireLevel orlCompressionPeer;
+
+	//
+	// We compress the headers of packets we send if the peer asks for it. We
+	// never ask for compression ourselves, since that would require us to
+	// decompress IPHC TCP headers as well.
+	//
+	orlCompressionPeer = ORL_Unsupported;
+	if (pRasEntry->dwfOptions & RASEO_IpHeaderCompression)
+		orlCompressionPeer = ORL_Allowed;
 
 	dwResult = PppFsmOptionsAdd(pContext->pFsm,
 							&ipv6cpIFIDOptionDescriptor,ORL_Wanted, ORL_Wanted,
+							&ipv6cpCompressionOptionDescriptor, ORL_Unsupported, orlCompressionPeer,
 							NULL);
 
 	return dwResult;
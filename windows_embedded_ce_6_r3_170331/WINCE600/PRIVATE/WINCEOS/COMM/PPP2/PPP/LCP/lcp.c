@@ -563,7 +563,7 @@ lcpIdleDisconnectTimerStart(
 {
 	if (DurationMs && pContext->pFsm->state == PFS_Opened)
 	{
-		CTEStartTimer(&pContext->IdleDisconnectTimer, DurationMs, lcpIdleDisconnectTimerCb, (PVOID)pContext);
+		CTEStartTimer(&pContext->IdleDisconnectTimer, pppBatchTimerDelay(DurationMs), lcpIdleDisconnectTimerCb, (PVOID)pContext);
 	}
 }
 
@@ -116,7 +116,7 @@ ncpIdleDisconnectTimerStart(
 {
 	if (DurationMs && pContext->bLowerLayerUp)
 	{
-		CTEStartTimer(&pContext->IdleIpTimer, DurationMs, ncpIdleDisconnectTimerCb, (PVOID)pContext);
+		CTEStartTimer(&pContext->IdleIpTimer, pppBatchTimerDelay(DurationMs), ncpIdleDisconnectTimerCb, (PVOID)pContext);
 	}
 }
 
@@ -86,6 +86,154 @@ CopyNdisBufferChainToFlatBuffer(
 	return bSuccess;
 }
 
+DWORD
+NdisBufferChainLength(
+	IN     PNDIS_BUFFER		pNdisBuffer,
+	IN     DWORD            dwOffset)
+//
+//	Return the number of data bytes in an NDIS buffer chain past dwOffset.
+//
+{
+	DWORD	cbChain = 0;
+
+	for ( ; pNdisBuffer; NdisGetNextBuffer(pNdisBuffer, &pNdisBuffer))
+		cbChain += pNdisBuffer->ByteCount;
+
+	return cbChain > dwOffset ? cbChain - dwOffset : 0;
+}
+
+BOOLEAN
+NdisBufferChainNextSegment(
+	IN OUT PNDIS_BUFFER		*ppNdisBuffer,
+	IN OUT PDWORD           pdwOffset,
+	   OUT PBYTE            *ppData,
+	   OUT PDWORD           pcbData)
+//
+//	Iterate over the data in an NDIS buffer chain without copying it.
+//
+//	(*ppNdisBuffer, *pdwOffset) is the position in the chain. Return the
+//	contiguous data from there to the end of its buffer, and advance the
+//	position to the start of the next buffer.
+//
+//	Return FALSE if there is no more data in the chain.
+{
+	PNDIS_BUFFER	pNdisBuffer = *ppNdisBuffer;
+	DWORD			dwOffset = *pdwOffset;
+
+	while (pNdisBuffer)
+	{
+		if (dwOffset < pNdisBuffer->ByteCount)
+		{
+			*ppData  = (PBYTE)pNdisBuffer->StartVa + dwOffset;
+			*pcbData = pNdisBuffer->ByteCount - dwOffset;
+			NdisGetNextBuffer(pNdisBuffer, ppNdisBuffer);
+			*pdwOffset = 0;
+			return TRUE;
+		}
+
+		// This entire buffer is to be skipped
+		dwOffset -= pNdisBuffer->ByteCount;
+		NdisGetNextBuffer(pNdisBuffer, &pNdisBuffer);
+	}
+
+	*ppNdisBuffer = NULL;
+	*pdwOffset = 0;
+	return FALSE;
+}
+
+DWORD
+NdisBufferChainCopy(
+	IN OUT PNDIS_BUFFER		*ppNdisBuffer,
+	IN OUT PDWORD           pdwOffset,
+	IN     PBYTE            pFlatBuffer,
+	IN     DWORD            cbCopy)
+//
+//	Copy up to cbCopy bytes from the position (*ppNdisBuffer, *pdwOffset) in
+//	an NDIS buffer chain, and advance the position past them.
+//
+//	Return the number of bytes copied.
+{
+	PNDIS_BUFFER	pNdisBuffer = *ppNdisBuffer;
+	DWORD			dwOffset = *pdwOffset;
+	DWORD			cbCopied = 0;
+	DWORD			cbData;
+
+	while (pNdisBuffer && cbCopied < cbCopy)
+	{
+		if (dwOffset < pNdisBuffer->ByteCount)
+		{
+			cbData = pNdisBuffer->ByteCount - dwOffset;
+			if (cbData > cbCopy - cbCopied)
+				cbData = cbCopy - cbCopied;
+
+			memcpy (pFlatBuffer + cbCopied, (PBYTE)pNdisBuffer->StartVa + dwOffset, cbData);
+			cbCopied += cbData;
+			dwOffset += cbData;
+
+			if (dwOffset < pNdisBuffer->ByteCount)
+				break;
+		}
+		dwOffset -= pNdisBuffer->ByteCount;
+		NdisGetNextBuffer(pNdisBuffer, &pNdisBuffer);
+	}
+
+	*ppNdisBuffer = pNdisBuffer;
+	*pdwOffset = pNdisBuffer ? dwOffset : 0;
+	return cbCopied;
+}
+
+void
+pppTxSetTail(
+	IN     PNDIS_WAN_PACKET	pPacket,
+	IN     PNDIS_BUFFER		pNdisBuffer,
+	IN     DWORD            dwOffset)
+//
+//	Record that the packet data continues at (pNdisBuffer, dwOffset) in the
+//	sender's buffer chain, past the CurrentLength bytes in the WAN packet.
+//
+//	The caller must have checked that the whole packet fits in the WAN packet.
+//
+{
+	pPacket->ProtocolReserved3 = (PVOID)pNdisBuffer;
+	pPacket->ProtocolReserved4 = (PVOID)dwOffset;
+}
+
+DWORD
+pppTxTailLength(
+	IN     PNDIS_WAN_PACKET	pPacket)
+//
+//	Return the number of bytes of the packet that are not in the WAN packet yet.
+//
+{
+	return NdisBufferChainLength(PPP_TX_TAIL_BUFFER(pPacket), PPP_TX_TAIL_OFFSET(pPacket));
+}
+
+BOOLEAN
+pppTxFlattenTail(
+	IN     PNDIS_WAN_PACKET	pPacket)
+//
+//	Append the tail of the packet data, if any, to the data in the WAN packet.
+//
+//  Return FALSE if it does not fit.
+{
+	DWORD	cbTail;
+	BOOLEAN	bSuccess = TRUE;
+
+	if (PPP_TX_TAIL_BUFFER(pPacket))
+	{
+		cbTail = pPacket->EndBuffer - (pPacket->CurrentBuffer + pPacket->CurrentLength);
+		bSuccess = CopyNdisBufferChainToFlatBuffer(PPP_TX_TAIL_BUFFER(pPacket), PPP_TX_TAIL_OFFSET(pPacket),
+												   pPacket->CurrentBuffer + pPacket->CurrentLength, &cbTail);
+		ASSERT(bSuccess);
+		if (bSuccess)
+			pPacket->CurrentLength += cbTail;
+
+		pppTxSetTail(pPacket, NULL, 0);
+	}
+
+	return bSuccess;
+}
+
 DWORD
 pppSendData(
 	IN	void  *session,
@@ -153,6 +301,16 @@ pppMacSndData(
 	DEBUGMSG (ZONE_FUNCTION, (TEXT("PPP: +pppMacSndData (0x%X, 0x%X, 0x%X)\r\n"),
 							   pMac, wProtocol, pPacket));
 
+	//
+	//	The miniport needs the whole frame in the WAN packet, bring in any part
+	//	of it that is still in the sender's buffer chain.
+	//
+	if (!pppTxFlattenTail(pPacket))
+	{
+		NdisWanFreePacket (pMac, pPacket);
+		return NDIS_STATUS_INVALID_PACKET;
+	}
+
 	if (PPP_SLIP_PROTOCOL != wProtocol)
 	{
 		pData = pPacket->CurrentBuffer;
@@ -964,6 +964,350 @@ ArpProxyManagerStart()
 
 PPPServerConfiguration_t PPPServerConfig;
 CRITICAL_SECTION		 PPPServerCritSec;
+CRITICAL_SECTION		 PPPServerTableCritSec;
+
+////////////////////////////////////
+//	Static IP address pool
+////////////////////////////////////
+
+void
+PPPServerIPPoolUnlink(
+	IN	OUT	PPPServerIPPool_t	*pPool,
+	IN		DWORD				 i)
+//
+//	Remove free address index i from the free list and mark it in use.
+//
+{
+	DWORD	next = pPool->pNext[i],
+			prev = pPool->pPrev[i];
+
+	if (prev == IPPOOL_NIL)
+		pPool->dwHead = next;
+	else
+		pPool->pNext[prev] = next;
+
+	if (next == IPPOOL_NIL)
+		pPool->dwTail = prev;
+	else
+		pPool->pPrev[next] = prev;
+
+	pPool->pNext[i] = IPPOOL_IN_USE;
+	pPool->dwFree--;
+}
+
+DWORD
+PPPServerIPPoolAllocate(
+	IN	OUT	PPPServerIPPool_t	*pPool)
+//
+//	Allocate the least recently released address in the pool.
+//	Return 0 if all addresses in the pool are in use.
+//
+{
+	DWORD	i = pPool->dwHead;
+
+	if (i == IPPOOL_NIL)
+		return 0;
+
+	PPPServerIPPoolUnlink(pPool, i);
+
+	return pPool->dwStart + i;
+}
+
+void
+PPPServerIPPoolReserve(
+	IN	OUT	PPPServerIPPool_t	*pPool,
+	IN		DWORD				 IPAddr)
+//
+//	Mark the address in use if it is a free address of the pool.
+//
+{
+	DWORD	i = IPAddr - pPool->dwStart;
+
+	if (i < pPool->dwCount && pPool->pNext[i] != IPPOOL_IN_USE)
+		PPPServerIPPoolUnlink(pPool, i);
+}
+
+void
+PPPServerIPPoolRelease(
+	IN	OUT	PPPServerIPPool_t	*pPool,
+	IN		DWORD				 IPAddr)
+//
+//	Return the address to the tail of the free list if it is
+//	an allocated address of the pool.
+//
+{
+	DWORD	i = IPAddr - pPool->dwStart;
+
+	if (i < pPool->dwCount && pPool->pNext[i] == IPPOOL_IN_USE)
+	{
+		pPool->pNext[i] = IPPOOL_NIL;
+		pPool->pPrev[i] = pPool->dwTail;
+		if (pPool->dwTail == IPPOOL_NIL)
+			pPool->dwHead = i;
+		else
+			pPool->pNext[pPool->dwTail] = i;
+		pPool->dwTail = i;
+		pPool->dwFree++;
+	}
+}
+
+void
+PPPServerIPPoolInitialize(
+	IN	OUT	PPPServerIPPool_t	*pPool,
+	IN		DWORD				 dwStart,
+	IN		DWORD				 dwCount)
+//
+//	(Re)build the pool with all its addresses free.
+//
+//	If the pool is too large to index, it is left empty and static
+//	addresses are found by searching the address range instead.
+//
+{
+	DWORD	i;
+
+	pppFreeMemory(pPool->pNext, pPool->dwCount * 2 * sizeof(DWORD));
+
+	pPool->dwStart = dwStart;
+	pPool->dwCount = 0;
+	pPool->pNext = NULL;
+	pPool->pPrev = NULL;
+	pPool->dwHead = IPPOOL_NIL;
+	pPool->dwTail = IPPOOL_NIL;
+	pPool->dwFree = 0;
+
+	if (dwCount && dwCount <= IPPOOL_MAX_COUNT)
+	{
+		pPool->pNext = pppAllocateMemory(dwCount * 2 * sizeof(DWORD));
+		if (pPool->pNext)
+		{
+			pPool->pPrev = pPool->pNext + dwCount;
+			pPool->dwCount = dwCount;
+			for (i = 0; i < dwCount; i++)
+			{
+				pPool->pNext[i] = IPPOOL_IN_USE;
+				PPPServerIPPoolRelease(pPool, dwStart + i);
+			}
+		}
+	}
+}
+
+////////////////////////////////////
+//	Line lookup tables
+////////////////////////////////////
+
+DWORD
+PPPServerHashLineName(
+	IN	LPCTSTR	szDeviceName)
+{
+	DWORD	dwHash = 0;
+
+	while (*szDeviceName)
+		dwHash = dwHash * 31 + *szDeviceName++;
+
+	return dwHash & (PPPSRV_HASH_SIZE - 1);
+}
+
+BOOL
+PPPServerUsingIpAddr(
+	 DWORD ipAddr)
+//
+//  ipAddr should be in the format 0xAABBCCDD
+//
+{
+	PPPServerConfiguration_t	 *pConfig = &PPPServerConfig;
+	PPPServerIPAddrInfo			 *pInfo;
+
+	// Determine if the address is in use by an existing PPP Server line
+
+	EnterCriticalSection( &PPPServerTableCritSec );
+
+	for (pInfo = pConfig->IPAddrInfoByIPAddr[PPPSRV_HASH_IPADDR(ipAddr)];
+		 pInfo && pInfo->IPAddr != ipAddr;
+		 pInfo = pInfo->pNextByIPAddr)
+		;
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+
+	return pInfo != NULL;
+}
+
+void
+PPPServerLineSetIPAddr(
+	IN	OUT	PPPServerLineConfiguration_t *pLine,
+	IN		DWORD						  type,
+	IN		DWORD						  IPAddr)
+//
+//	Set the server or client IP address of the line, keeping the
+//	address lookup table and the static IP pool up to date.
+//
+{
+	PPPServerConfiguration_t	 *pConfig = &PPPServerConfig;
+	PPPServerIPAddrInfo			 *pInfo = &pLine->IPAddrInfo[type];
+	PPPServerIPAddrInfo			**ppInfo;
+	DWORD						  OldIPAddr;
+
+	EnterCriticalSection( &PPPServerTableCritSec );
+
+	OldIPAddr = pInfo->IPAddr;
+	if (OldIPAddr != IPAddr)
+	{
+		if (OldIPAddr)
+		{
+			for (ppInfo = &pConfig->IPAddrInfoByIPAddr[PPPSRV_HASH_IPADDR(OldIPAddr)];
+				 *ppInfo;
+				 ppInfo = &(*ppInfo)->pNextByIPAddr)
+			{
+				if (*ppInfo == pInfo)
+				{
+					*ppInfo = pInfo->pNextByIPAddr;
+					break;
+				}
+			}
+			pInfo->IPAddr = 0;
+
+			if (!PPPServerUsingIpAddr(OldIPAddr))
+				PPPServerIPPoolRelease(&pConfig->StaticIpPool, OldIPAddr);
+		}
+
+		pInfo->IPAddr = IPAddr;
+		pInfo->pNextByIPAddr = NULL;
+
+		if (IPAddr)
+		{
+			ppInfo = &pConfig->IPAddrInfoByIPAddr[PPPSRV_HASH_IPADDR(IPAddr)];
+			pInfo->pNextByIPAddr = *ppInfo;
+			*ppInfo = pInfo;
+
+			PPPServerIPPoolReserve(&pConfig->StaticIpPool, IPAddr);
+		}
+	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+}
+
+void
+PPPServerLineSetIndex(
+	IN	OUT	PPPServerLineConfiguration_t *pLine,
+	IN		DWORD						  type,
+	IN		DWORD						  Index)
+//
+//	Set the DHCP context index of the line's server or client IP info,
+//	keeping the index lookup table up to date.
+//
+{
+	PPPServerConfiguration_t	 *pConfig = &PPPServerConfig;
+	PPPServerIPAddrInfo			 *pInfo = &pLine->IPAddrInfo[type];
+	PPPServerIPAddrInfo			**ppInfo;
+
+	EnterCriticalSection( &PPPServerTableCritSec );
+
+	if (pInfo->Index)
+	{
+		for (ppInfo = &pConfig->IPAddrInfoByIndex[PPPSRV_HASH_INDEX(pInfo->Index)];
+			 *ppInfo;
+			 ppInfo = &(*ppInfo)->pNextByIndex)
+		{
+			if (*ppInfo == pInfo)
+			{
+				*ppInfo = pInfo->pNextByIndex;
+				break;
+			}
+		}
+	}
+
+	pInfo->Index = Index;
+	pInfo->pNextByIndex = NULL;
+
+	if (Index)
+	{
+		ppInfo = &pConfig->IPAddrInfoByIndex[PPPSRV_HASH_INDEX(Index)];
+		pInfo->pNextByIndex = *ppInfo;
+		*ppInfo = pInfo;
+	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+}
+
+void
+PPPServerLineClearIPAddrInfo(
+	IN	OUT	PPPServerLineConfiguration_t *pLine)
+//
+//	Forget the server and client IP addresses and DHCP indices of the line.
+//
+{
+	DWORD	type;
+
+	for (type = SERVER_INDEX; type <= CLIENT_INDEX; type++)
+	{
+		PPPServerLineSetIPAddr(pLine, type, 0);
+		PPPServerLineSetIndex(pLine, type, 0);
+	}
+}
+
+void
+PPPServerLineSetSession(
+	IN	OUT	PPPServerLineConfiguration_t *pLine,
+	IN		pppSession_t				 *pSession)
+//
+//	Attach a session to the line, or detach the current one if pSession
+//	is NULL, keeping the session lookup table up to date.
+//
+{
+	PPPServerConfiguration_t	  *pConfig = &PPPServerConfig;
+	PPPServerLineConfiguration_t **ppLine;
+
+	EnterCriticalSection( &PPPServerTableCritSec );
+
+	if (pLine->pSession)
+	{
+		for (ppLine = &pConfig->LineBySession[PPPSRV_HASH_SESSION(pLine->pSession)];
+			 *ppLine;
+			 ppLine = &(*ppLine)->pNextBySession)
+		{
+			if (*ppLine == pLine)
+			{
+				*ppLine = pLine->pNextBySession;
+				break;
+			}
+		}
+	}
+
+	pLine->pSession = pSession;
+	pLine->pNextBySession = NULL;
+
+	if (pSession)
+	{
+		ppLine = &pConfig->LineBySession[PPPSRV_HASH_SESSION(pSession)];
+		pLine->pNextBySession = *ppLine;
+		*ppLine = pLine;
+	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+}
+
+void
+PPPServerStaticIpPoolRebuild()
+//
+//	Rebuild the static IP pool for the current pool settings,
+//	reserving any addresses that lines are already using.
+//
+{
+	PPPServerConfiguration_t	 *pConfig = &PPPServerConfig;
+	PPPServerIPAddrInfo			 *pInfo;
+	DWORD						  i;
+
+	EnterCriticalSection( &PPPServerTableCritSec );
+
+	PPPServerIPPoolInitialize(&pConfig->StaticIpPool, pConfig->dwStaticIpAddrStart, pConfig->dwStaticIpAddrCount);
+
+	for (i = 0; i < PPPSRV_HASH_SIZE; i++)
+	{
+		for (pInfo = pConfig->IPAddrInfoByIPAddr[i]; pInfo; pInfo = pInfo->pNextByIPAddr)
+			PPPServerIPPoolReserve(&pConfig->StaticIpPool, pInfo->IPAddr);
+	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+}
 
 PPPServerLineConfiguration_t *
 PPPServerFindLineConfig(
@@ -976,17 +1320,13 @@ PPPServerFindLineConfig(
 {
 	PPPServerLineConfiguration_t *pLineConfig;
 
-	for (pLineConfig = (PPPServerLineConfiguration_t *)(pLineList->Flink);
-		 TRUE;
-		 pLineConfig = (PPPServerLineConfiguration_t *)pLineConfig->listEntry.Flink)
-	{
-		if (pLineConfig == (PPPServerLineConfiguration_t *)pLineList)
-		{
-			// Reached end of the list
-			pLineConfig = NULL;
-			break;
-		}
+	// All lines are on the one server list, which is indexed by name
+	ASSERT(pLineList == &PPPServerConfig.LineList);
 
+	for (pLineConfig = PPPServerConfig.LineByName[PPPServerHashLineName(pRasDevInfo->szDeviceName)];
+		 pLineConfig;
+		 pLineConfig = pLineConfig->pNextByName)
+	{
 		// Check for a matching name and type
 		if ((_tcscmp(pRasDevInfo->szDeviceName, pLineConfig->rasDevInfo.szDeviceName) == 0)
 		&&  (_tcscmp(pRasDevInfo->szDeviceType, pLineConfig->rasDevInfo.szDeviceType) == 0))
@@ -999,23 +1339,19 @@ PPPServerFindLineConfig(
 PPPServerLineConfiguration_t *
 PPPServerFindLineWithSession(
 	pppSession_t *pSession)
+//
+//	Caller must hold PPPServerTableCritSec.
+//
 {
 	PPPServerConfiguration_t *pConfig = &PPPServerConfig;
-	PPPServerLineConfiguration_t *pLine, *pMatchingLine;
+	PPPServerLineConfiguration_t *pLine;
 
-	pMatchingLine = NULL;
-	for (pLine  = (PPPServerLineConfiguration_t *)(pConfig->LineList.Flink);
-		 pLine != (PPPServerLineConfiguration_t *)(&pConfig->LineList);
-		 pLine  = (PPPServerLineConfiguration_t *)pLine->listEntry.Flink)
-	{
-		if (pLine->pSession == pSession)
-		{
-			pMatchingLine = pLine;
-			break;
-		}
-	}
+	for (pLine = pConfig->LineBySession[PPPSRV_HASH_SESSION(pSession)];
+		 pLine && pLine->pSession != pSession;
+		 pLine = pLine->pNextBySession)
+		;
 
-	return pMatchingLine;
+	return pLine;
 }
 
 PPPServerLineConfiguration_t *
@@ -1028,6 +1364,7 @@ PPPServerCreateLineConfig(
 //
 {
 	PPPServerLineConfiguration_t *pLineConfig;
+	PPPServerLineConfiguration_t **ppLineByName;
 
 	pLineConfig = pppAllocateMemory(sizeof(*pLineConfig));
 	if (!pLineConfig)
@@ -1045,6 +1382,9 @@ PPPServerCreateLineConfig(
 		pLineConfig->bmFlags = 0;
 		pLineConfig->DisconnectIdleSeconds = 0;
 
+		pLineConfig->IPAddrInfo[SERVER_INDEX].pLine = pLineConfig;
+		pLineConfig->IPAddrInfo[CLIENT_INDEX].pLine = pLineConfig;
+
 		pLineConfig->IPAddrInfo[SERVER_INDEX].hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 		pLineConfig->IPAddrInfo[CLIENT_INDEX].hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 
@@ -1057,7 +1397,15 @@ PPPServerCreateLineConfig(
 		}
 		else
 		{
+			EnterCriticalSection( &PPPServerTableCritSec );
+
 			InsertTailList(pLineList, &pLineConfig->listEntry);
+
+			ppLineByName = &PPPServerConfig.LineByName[PPPServerHashLineName(pLineConfig->rasDevInfo.szDeviceName)];
+			pLineConfig->pNextByName = *ppLineByName;
+			*ppLineByName = pLineConfig;
+
+			LeaveCriticalSection( &PPPServerTableCritSec );
 		}
 	}
 
@@ -1092,12 +1440,33 @@ PPPServerDestroyLineConfig(
 //	Remove a line config from the list and free it.
 //
 {
+	PPPServerLineConfiguration_t **ppLineByName;
+
 	DEBUGMSG( ZONE_FUNCTION, (TEXT("PPP: +PPPServerDestroyLineConfig %s\n"), pLineConfig->rasDevInfo.szDeviceName));
 
+	EnterCriticalSection( &PPPServerTableCritSec );
+
 	RemoveEntryList(&pLineConfig->listEntry);
 	pLineConfig->listEntry.Flink = NULL;
 	pLineConfig->listEntry.Blink = NULL;
 
+	for (ppLineByName = &PPPServerConfig.LineByName[PPPServerHashLineName(pLineConfig->rasDevInfo.szDeviceName)];
+		 *ppLineByName;
+		 ppLineByName = &(*ppLineByName)->pNextByName)
+	{
+		if (*ppLineByName == pLineConfig)
+		{
+			*ppLineByName = pLineConfig->pNextByName;
+			break;
+		}
+	}
+
+	// A line that failed to close may still be holding its addresses and session
+	PPPServerLineSetSession(pLineConfig, NULL);
+	PPPServerLineClearIPAddrInfo(pLineConfig);
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+
 	CloseHandle(pLineConfig->IPAddrInfo[SERVER_INDEX].hEvent);
 	CloseHandle(pLineConfig->IPAddrInfo[CLIENT_INDEX].hEvent);
 
@@ -1302,6 +1671,7 @@ PPPServerSetParameters(
 	PPPServerConfiguration_t	 *pConfig = &PPPServerConfig;
 	PPPServerLineConfiguration_t *pLine;
 	DWORD						  dwRetVal = SUCCESS;
+	BOOL						  bPoolChanged;
 
 	if ((pBufIn == NULL)
 	||  (dwLenIn < sizeof(RASCNTL_SERVERSTATUS)))
@@ -1312,6 +1682,9 @@ PPPServerSetParameters(
 	{
 		EnterCriticalSection( &PPPServerCritSec );
 
+		bPoolChanged = pConfig->dwStaticIpAddrStart != pBufIn->dwStaticIpAddrStart
+					|| pConfig->dwStaticIpAddrCount != pBufIn->dwStaticIpAddrCount;
+
 		pConfig->bmFlags = pBufIn->bmFlags;
 		pConfig->dwStaticIpAddrStart = pBufIn->dwStaticIpAddrStart;
 		pConfig->dwStaticIpAddrCount = pBufIn->dwStaticIpAddrCount;
@@ -1333,6 +1706,9 @@ PPPServerSetParameters(
 
 		PPPServerWriteRegistrySettings(pConfig);
 
+		if (bPoolChanged)
+			PPPServerStaticIpPoolRebuild();
+
 		//
 		//	Update any open lines for the new global flags settings.
 		//
@@ -1686,21 +2062,32 @@ PPPServerAddRouteToClient(
 //	the PPP server interface.
 //
 {
-	DWORD						  dwResult = ERROR_DEVICENAME_NOT_FOUND;
+	DWORD						  dwResult;
 	MIB_IPFORWARDROW			  route;
 	PPPServerLineConfiguration_t *pLine;
+	DWORD						  dwIfIndex;
 
-	pLine = PPPServerFindLineWithSession(pSession);
-	if (pLine)
+	dwResult = PPPServerGetAdapterIndex(pSession->AdapterName, &dwIfIndex);
+	if (dwResult == NO_ERROR)
 	{
-		dwResult = PPPServerGetAdapterIndex(pSession->AdapterName, &pLine->dwIfIndex);
-		if (dwResult == NO_ERROR)
+		EnterCriticalSection( &PPPServerTableCritSec );
+
+		pLine = PPPServerFindLineWithSession(pSession);
+		if (pLine)
 		{
+			pLine->dwIfIndex = dwIfIndex;
 			dwResult = PPPServerBuildRoute(pLine, &route);
-			if (dwResult == NO_ERROR)
-			{
-				dwResult = PPPServerCreateIpForwardEntry(&route);
-			}
+		}
+		else
+		{
+			dwResult = ERROR_DEVICENAME_NOT_FOUND;
+		}
+
+		LeaveCriticalSection( &PPPServerTableCritSec );
+
+		if (dwResult == NO_ERROR)
+		{
+			dwResult = PPPServerCreateIpForwardEntry(&route);
 		}
 	}
 }
@@ -1716,14 +2103,19 @@ PPPServerDeleteRouteToClient(
 	MIB_IPFORWARDROW			  route;
 	PPPServerLineConfiguration_t *pLine;
 
+	EnterCriticalSection( &PPPServerTableCritSec );
+
 	pLine = PPPServerFindLineWithSession(pSession);
 	if (pLine)
 	{
 		dwResult = PPPServerBuildRoute(pLine, &route);
-		if (dwResult == NO_ERROR)
-		{
-			dwResult = PPPServerDeleteIpForwardEntry(&route);
-		}
+	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+
+	if (dwResult == NO_ERROR)
+	{
+		dwResult = PPPServerDeleteIpForwardEntry(&route);
 	}
 }
 
@@ -1762,28 +2154,25 @@ PPPServerFindIPInfoByIndex(
 //
 {
 	PPPServerConfiguration_t	 *pConfig = &PPPServerConfig;
-	PPPServerLineConfiguration_t *pLine;
-	DWORD						  type;
+	PPPServerIPAddrInfo			 *pInfo;
 
 	*ppLine = NULL;
 
-	for (pLine  = (PPPServerLineConfiguration_t *)(pConfig->LineList.Flink);
-		 pLine != (PPPServerLineConfiguration_t *)(&pConfig->LineList);
-		 pLine  = (PPPServerLineConfiguration_t *)pLine->listEntry.Flink)
+	EnterCriticalSection( &PPPServerTableCritSec );
+
+	for (pInfo = pConfig->IPAddrInfoByIndex[PPPSRV_HASH_INDEX(Index)];
+		 pInfo;
+		 pInfo = pInfo->pNextByIndex)
 	{
-		for (type = SERVER_INDEX; type <= CLIENT_INDEX; type++)
+		if (Index == pInfo->Index)
 		{
-			if (Index == pLine->IPAddrInfo[type].Index)
-			{
-				*ppLine = pLine;
-				*pInfoType = type;
-				break;
-			}
-		}
-
-		if (*ppLine)
+			*ppLine = pInfo->pLine;
+			*pInfoType = (DWORD)(pInfo - &pInfo->pLine->IPAddrInfo[0]);
 			break;
+		}
 	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
 }
 
 VOID
@@ -1814,7 +2203,7 @@ PPPServerLineAssignUnusedIndices(
 		if (pLineUsingIndex == NULL)
 		{
 			// index is not in use, assign it
-			pLine->IPAddrInfo[type].Index = index;
+			PPPServerLineSetIndex(pLine, type, index);
 			type++;
 		}
 
@@ -2000,37 +2389,6 @@ PPPServerLineReleaseDHCPAddrs(
 	return dwResult;
 }
 
-BOOL
-PPPServerUsingIpAddr(
-	 DWORD ipAddr)
-//
-//  ipAddr should be in the format 0xAABBCCDD
-//
-{
-	PPPServerConfiguration_t	 *pConfig = &PPPServerConfig;
-	PPPServerLineConfiguration_t *pLine;
-	BOOL						  bInUse;
-
-	// Determine if the address is in use by an existing PPP Server line
-
-	bInUse = FALSE;
-
-	for (pLine  = (PPPServerLineConfiguration_t *)(pConfig->LineList.Flink);
-			pLine != (PPPServerLineConfiguration_t *)(&pConfig->LineList);
-			pLine  = (PPPServerLineConfiguration_t *)pLine->listEntry.Flink)
-	{
-		if (ipAddr == pLine->IPAddrInfo[SERVER_INDEX].IPAddr 
-		||  ipAddr == pLine->IPAddrInfo[CLIENT_INDEX].IPAddr)
-		{
-			// Address in use, try another.
-			bInUse = TRUE;
-			break;
-		}
-	}
-
-	return bInUse;
-}
-
 BOOL
 PPPServerIPAddrInUseOnNet(
 	DWORD	dwIpAddr)
@@ -2181,7 +2539,7 @@ PPPServerDhcpSetAddrCb(
 	{
 		OldIPAddr = pLine->IPAddrInfo[type].IPAddr;
 		OldMask = pLine->IPAddrInfo[type].IPMask;
-		pLine->IPAddrInfo[type].IPAddr = ntohl(Addr);
+		PPPServerLineSetIPAddr(pLine, type, ntohl(Addr));
 		pLine->IPAddrInfo[type].IPMask = ntohl(Mask);
 		pLine->IPAddrInfo[type].GWAddr = ntohl(GWAddr);
 
@@ -2333,7 +2691,7 @@ PPPServerLineGenerateAutoIpAddrs(
 			break;
 		}
 
-		pLine->IPAddrInfo[type].IPAddr = randomIpAddr;
+		PPPServerLineSetIPAddr(pLine, type, randomIpAddr);
 		pLine->IPAddrInfo[type].IPMask = pConfig->dwAutoIpSubnetMask;
 
 		// Configure IP to handle ARP requests for the address
@@ -2358,6 +2716,18 @@ PPPServerGetFreeStaticIpAddress()
 	DWORD						  ipAddr;
 	DWORD						  i;
 
+	if (pConfig->StaticIpPool.dwCount)
+	{
+		//
+		// The pool free list only holds addresses not in use by any line
+		//
+		EnterCriticalSection( &PPPServerTableCritSec );
+		ipAddr = PPPServerIPPoolAllocate(&pConfig->StaticIpPool);
+		LeaveCriticalSection( &PPPServerTableCritSec );
+
+		return ipAddr;
+	}
+
 	for (i = 0; TRUE; i++)
 	{
 		if (i == pConfig->dwStaticIpAddrCount)
@@ -2406,10 +2776,7 @@ PPPServerLineReleaseIPAddresses(
 	ArpProxyManagerIssueRequest(pLine->IPAddrInfo[SERVER_INDEX].IPAddr, FALSE);
 	ArpProxyManagerIssueRequest(pLine->IPAddrInfo[CLIENT_INDEX].IPAddr, FALSE);
 
-	pLine->IPAddrInfo[SERVER_INDEX].IPAddr = 0;
-	pLine->IPAddrInfo[SERVER_INDEX].Index = 0;
-	pLine->IPAddrInfo[CLIENT_INDEX].IPAddr = 0;
-	pLine->IPAddrInfo[CLIENT_INDEX].Index = 0;
+	PPPServerLineClearIPAddrInfo(pLine);
 
 	DEBUGMSG(ZONE_FUNCTION, (TEXT("PPP: -PPPServerLineReleaseIPAddresses\n")));
 }
@@ -2482,9 +2849,9 @@ PPPServerLineGetIPAddresses(
 		// Static IP address assignment
 
 		pLine->bUsingDhcpAddress = FALSE;
-		pLine->IPAddrInfo[SERVER_INDEX].IPAddr = PPPServerGetFreeStaticIpAddress();
+		PPPServerLineSetIPAddr(pLine, SERVER_INDEX, PPPServerGetFreeStaticIpAddress());
 		pLine->IPAddrInfo[SERVER_INDEX].IPMask = IPGetNetMask(pLine->IPAddrInfo[SERVER_INDEX].IPAddr);
-		pLine->IPAddrInfo[CLIENT_INDEX].IPAddr = PPPServerGetFreeStaticIpAddress();
+		PPPServerLineSetIPAddr(pLine, CLIENT_INDEX, PPPServerGetFreeStaticIpAddress());
 		pLine->IPAddrInfo[CLIENT_INDEX].IPMask = IPGetNetMask(pLine->IPAddrInfo[CLIENT_INDEX].IPAddr);
 
 		if (pLine->IPAddrInfo[SERVER_INDEX].IPAddr 
@@ -2507,10 +2874,7 @@ PPPServerLineGetIPAddresses(
 
 	if (dwResult != SUCCESS)
 	{
-		pLine->IPAddrInfo[SERVER_INDEX].IPAddr = 0;
-		pLine->IPAddrInfo[SERVER_INDEX].Index = 0;
-		pLine->IPAddrInfo[CLIENT_INDEX].IPAddr = 0;
-		pLine->IPAddrInfo[CLIENT_INDEX].Index = 0;
+		PPPServerLineClearIPAddrInfo(pLine);
 	}
 
 	DEBUGMSG(ZONE_FUNCTION, (TEXT("PPP: -PPPServerLineGetIPAddresses Result=%x\n"), dwResult));
@@ -2530,7 +2894,7 @@ PPPServerLineClose(
 	if (s_p)
 	{
 		AfdRasHangUp((HRASCONN)s_p);
-		pLine->pSession = NULL;
+		PPPServerLineSetSession(pLine, NULL);
 	}
 
 	//
@@ -2768,7 +3132,7 @@ PPPServerLineOpen(
 	//
 	// Attach the line to the new session
 	//
-	pLine->pSession = Start.session;
+	PPPServerLineSetSession(pLine, Start.session);
 
 	//
 	//	Since we just told the app about the session with the above assign,
@@ -3316,12 +3680,17 @@ PPPServerGetSessionIPAddress(
 	DWORD	dwIpAddr = 0;
 	PPPServerLineConfiguration_t *pLine;
 
+	EnterCriticalSection( &PPPServerTableCritSec );
+
 	pLine = PPPServerFindLineWithSession(pSession);
 	ASSERT(pLine);
 	if (pLine)
 	{
 		dwIpAddr = pLine->IPAddrInfo[dwType].IPAddr;
 	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+
 	return dwIpAddr;
 }
 
@@ -3363,6 +3732,8 @@ PPPServerGetSessionIPMask(
 	DWORD	                      dwIpMask = 0xFFFFFFFF;
 	PPPServerLineConfiguration_t *pLine;
 
+	EnterCriticalSection( &PPPServerTableCritSec );
+
 	pLine = PPPServerFindLineWithSession(pSession);
 	if (pLine
 	&& ((pConfig->bmFlags | pLine->bmFlags) & PPPSRV_FLAG_ADD_CLIENT_SUBNET))
@@ -3370,6 +3741,8 @@ PPPServerGetSessionIPMask(
 		dwIpMask = pLine->IPAddrInfo[SERVER_INDEX].IPMask;
 	}
 
+	LeaveCriticalSection( &PPPServerTableCritSec );
+
 	return dwIpMask;
 }
 
@@ -3470,6 +3843,9 @@ PPPServerGetSessionIPV6NetPrefix(
 	PPPServerLineConfiguration_t *pLine;
 
 	*pPrefixBitLength = 0;
+
+	EnterCriticalSection( &PPPServerTableCritSec );
+
 	pLine = PPPServerFindLineWithSession(pSession);
 	ASSERT(pLine);
 	if (pLine)
@@ -3484,6 +3860,8 @@ PPPServerGetSessionIPV6NetPrefix(
 		*pPrefixBitLength = pLine->IPV6NetPrefixBitLength;
 		memcpy(pPrefix, &pLine->IPV6NetPrefix[0], sizeof(pLine->IPV6NetPrefix));
 	}
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
 }
 
 BOOL
@@ -3498,13 +3876,17 @@ PPPServerGetSessionAuthenticationRequired(
 	DWORD							bmFlags;
 	BOOL							bAuthenticationRequired;
 
+	EnterCriticalSection( &PPPServerTableCritSec );
+
 	pLine = PPPServerFindLineWithSession(pSession);
 	ASSERT(pLine);
+	bmFlags = pLine ? pConfig->bmFlags | pLine->bmFlags : 0;
+
+	LeaveCriticalSection( &PPPServerTableCritSec );
+
 	if (!pLine)
 		return FALSE;
 
-	bmFlags = pConfig->bmFlags | pLine->bmFlags;
-
 	if (bmFlags & PPPSRV_FLAG_REQUIRE_DATA_ENCRYPTION)
 	{
 		// Need MSCHAP v1 or v2 to derived encryption session key
@@ -3759,6 +4141,7 @@ PPPServerInitialize()
 
 
 	InitializeCriticalSection( &PPPServerCritSec );
+	InitializeCriticalSection( &PPPServerTableCritSec );
 
 
 	// First initialize default settings
@@ -3808,6 +4191,8 @@ PPPServerInitialize()
 
 	PPPServerReadRegistrySettings(pConfig);
 
+	PPPServerStaticIpPoolRebuild();
+
 	//
 	// Spawn thread to perform initial line opening for enabled lines
 	//
@@ -0,0 +1,788 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+//
+// pollset.c
+//
+// poll set implementation of
+//  WSACreatePollSet
+//  WSAPollSetCtl
+//  WSAWaitPollSet
+//  WSAClosePollSet
+//
+// Poll sets are built on WSAEventSelect. Each registered socket has its own
+// event. The events are split in groups of up to MAXIMUM_WAIT_OBJECTS-1, each
+// watched by a thread which moves signalled sockets to the set's ready list.
+// WSAWaitPollSet then only calls WSAEnumNetworkEvents on ready sockets.
+//
+
+#include <winsock2p.h>
+#include <cxport.h>
+
+#define WSAPOLL_GROUP_SIZE      (MAXIMUM_WAIT_OBJECTS-1)    // one slot for the group signal
+#define WSAPOLL_HASH_SIZE       256
+#define WSAPOLL_HASH(s)         ((((DWORD)(s)) >> 2) % WSAPOLL_HASH_SIZE)
+#define WSAPOLL_DETACH_WAIT     2000    // ms, bounded since the loader lock is held
+
+typedef struct _WSAPOLL_SOCKET {
+    struct _WSAPOLL_SOCKET * wp_next;       // group list, or group retired list
+    struct _WSAPOLL_SOCKET * wp_nexthash;
+    struct _WSAPOLL_SOCKET * wp_nextready;
+    struct _WSAPOLL_GROUP *  wp_group;
+    SOCKET      wp_socket;
+    long        wp_levents;
+    DWORD       wp_context;
+    WSAEVENT    wp_hevent;
+    BOOL        wp_ready;       // on the ready list
+    BOOL        wp_retired;     // removed, freed by the group thread
+} WSAPOLL_SOCKET, * PWSAPOLL_SOCKET;
+
+typedef struct _WSAPOLL_GROUP {
+    struct _WSAPOLL_GROUP * wg_next;
+    struct _WSAPOLL_SET *   wg_set;
+    PWSAPOLL_SOCKET wg_list;
+    PWSAPOLL_SOCKET wg_retired;
+    int         wg_count;
+    HANDLE      wg_signal;      // rebuild the wait array, or exit
+    HANDLE      wg_thread;
+    BOOL        wg_exit;
+    BOOL        wg_gone;        // thread is done with the set
+} WSAPOLL_GROUP, * PWSAPOLL_GROUP;
+
+typedef struct _WSAPOLL_SET {
+    struct _WSAPOLL_SET * ws_next;
+    CRITICAL_SECTION ws_cs;
+    int         ws_refs;
+    BOOL        ws_closed;
+    HANDLE      ws_hready;      // ready list went non-empty, or set closed
+    PWSAPOLL_GROUP  ws_groups;
+    PWSAPOLL_SOCKET ws_readyhead;
+    PWSAPOLL_SOCKET ws_readytail;
+    PWSAPOLL_SOCKET ws_hash[WSAPOLL_HASH_SIZE];
+} WSAPOLL_SET, * PWSAPOLL_SET;
+
+CTELock g_PollSetListLock;
+PWSAPOLL_SET g_PollSetList;
+
+void MatchCurrentThreadPriority(HANDLE hThd);
+
+
+//
+// Look up a poll set by handle and take a reference on it
+//
+PWSAPOLL_SET
+WS2RefPollSet(
+    HANDLE hPollSet
+    )
+{
+    PWSAPOLL_SET pSet;
+
+    CTEGetLock(&g_PollSetListLock, 0);
+    for (pSet = g_PollSetList; pSet; pSet = pSet->ws_next) {
+        if ((HANDLE)pSet == hPollSet) {
+            EnterCriticalSection(&pSet->ws_cs);
+            pSet->ws_refs++;
+            LeaveCriticalSection(&pSet->ws_cs);
+            break;
+        }
+    }
+    CTEFreeLock(&g_PollSetListLock, 0);
+
+    return pSet;
+}   // WS2RefPollSet
+
+
+void
+WS2DerefPollSet(
+    PWSAPOLL_SET pSet
+    )
+{
+    int cRefs;
+
+    EnterCriticalSection(&pSet->ws_cs);
+    cRefs = --pSet->ws_refs;
+    LeaveCriticalSection(&pSet->ws_cs);
+
+    if (0 == cRefs) {
+        ASSERT(pSet->ws_closed);
+        ASSERT(NULL == pSet->ws_groups);
+        DeleteCriticalSection(&pSet->ws_cs);
+        CloseHandle(pSet->ws_hready);
+        LocalFree(pSet);
+    }
+}   // WS2DerefPollSet
+
+
+// Note: call with ws_cs taken
+PWSAPOLL_SOCKET
+WS2FindPollSocket(
+    PWSAPOLL_SET pSet,
+    SOCKET s
+    )
+{
+    PWSAPOLL_SOCKET pwp;
+
+    for (pwp = pSet->ws_hash[WSAPOLL_HASH(s)]; pwp; pwp = pwp->wp_nexthash) {
+        if (pwp->wp_socket == s) {
+            return pwp;
+        }
+    }
+    return NULL;
+}   // WS2FindPollSocket
+
+
+//
+// Queue a signalled socket for WSAWaitPollSet
+//
+// Note: call with ws_cs taken
+//
+void
+WS2ReadyPollSocket(
+    PWSAPOLL_SET pSet,
+    PWSAPOLL_SOCKET pwp
+    )
+{
+    if (pwp->wp_ready || pwp->wp_retired) {
+        return;
+    }
+
+    pwp->wp_ready = TRUE;
+    pwp->wp_nextready = NULL;
+    if (pSet->ws_readytail) {
+        pSet->ws_readytail->wp_nextready = pwp;
+    } else {
+        pSet->ws_readyhead = pwp;
+        SetEvent(pSet->ws_hready);
+    }
+    pSet->ws_readytail = pwp;
+}   // WS2ReadyPollSocket
+
+
+//
+// Unlink a socket from the set. Its event stays open until the group thread
+// is no longer waiting on it.
+//
+// Note: call with ws_cs taken
+//
+void
+WS2RetirePollSocket(
+    PWSAPOLL_SET pSet,
+    PWSAPOLL_SOCKET pwp
+    )
+{
+    PWSAPOLL_GROUP pGroup = pwp->wp_group;
+    PWSAPOLL_SOCKET * ppwp;
+
+    for (ppwp = &pSet->ws_hash[WSAPOLL_HASH(pwp->wp_socket)]; *ppwp; ppwp = &(*ppwp)->wp_nexthash) {
+        if (*ppwp == pwp) {
+            *ppwp = pwp->wp_nexthash;
+            break;
+        }
+    }
+
+    for (ppwp = &pGroup->wg_list; *ppwp; ppwp = &(*ppwp)->wp_next) {
+        if (*ppwp == pwp) {
+            *ppwp = pwp->wp_next;
+            break;
+        }
+    }
+
+    if (pwp->wp_ready) {
+        PWSAPOLL_SOCKET pPrev = NULL;
+
+        for (ppwp = &pSet->ws_readyhead; *ppwp; pPrev = *ppwp, ppwp = &(*ppwp)->wp_nextready) {
+            if (*ppwp == pwp) {
+                *ppwp = pwp->wp_nextready;
+                if (pSet->ws_readytail == pwp) {
+                    pSet->ws_readytail = pPrev;
+                }
+                break;
+            }
+        }
+        pwp->wp_ready = FALSE;
+    }
+
+    WSAEventSelect(pwp->wp_socket, pwp->wp_hevent, 0);    // Cancel notifications
+
+    pwp->wp_retired = TRUE;
+    pwp->wp_next = pGroup->wg_retired;
+    pGroup->wg_retired = pwp;
+    pGroup->wg_count--;
+
+    SetEvent(pGroup->wg_signal);
+}   // WS2RetirePollSocket
+
+
+DWORD
+WS2PollGroupThread(
+    LPVOID lpContext
+    )
+{
+    PWSAPOLL_GROUP pGroup = (PWSAPOLL_GROUP)lpContext;
+    PWSAPOLL_SET pSet = pGroup->wg_set;
+    PWSAPOLL_SOCKET pwp;
+    HANDLE rgHnd[MAXIMUM_WAIT_OBJECTS];
+    PWSAPOLL_SOCKET rgSock[MAXIMUM_WAIT_OBJECTS];
+    DWORD cHnd, ret;
+
+    EnterCriticalSection(&pSet->ws_cs);
+    while (! pGroup->wg_exit) {
+        //
+        // Nothing waits on the retired events any more
+        //
+        while (pwp = pGroup->wg_retired) {
+            pGroup->wg_retired = pwp->wp_next;
+            CloseHandle(pwp->wp_hevent);
+            LocalFree(pwp);
+        }
+
+        //
+        // Build array of event handles, signal first
+        //
+        rgHnd[0] = pGroup->wg_signal;
+        rgSock[0] = NULL;
+        cHnd = 1;
+        for (pwp = pGroup->wg_list; pwp; pwp = pwp->wp_next) {
+            ASSERT(cHnd < MAXIMUM_WAIT_OBJECTS);
+            rgSock[cHnd] = pwp;
+            rgHnd[cHnd++] = pwp->wp_hevent;
+        }
+        LeaveCriticalSection(&pSet->ws_cs);
+
+        for (;;) {
+            ret = WaitForMultipleObjects(cHnd, rgHnd, FALSE, INFINITE);
+
+            if ((WAIT_OBJECT_0 == ret) || (ret >= cHnd)) {
+                break;
+            }
+
+            // The entry cannot be freed before we rebuild, so it is safe to touch
+            EnterCriticalSection(&pSet->ws_cs);
+            WS2ReadyPollSocket(pSet, rgSock[ret]);
+            LeaveCriticalSection(&pSet->ws_cs);
+        }
+
+        if (ret >= cHnd) {
+            DEBUGMSG(ZONE_ERROR, (L"WS2PollGroupThread - WaitForMultipleObjects returned %d, error %d\n",
+                                  ret, GetLastError()));
+            Sleep(100);
+        }
+
+        EnterCriticalSection(&pSet->ws_cs);
+    }
+
+    while (pwp = pGroup->wg_retired) {
+        pGroup->wg_retired = pwp->wp_next;
+        CloseHandle(pwp->wp_hevent);
+        LocalFree(pwp);
+    }
+    pGroup->wg_gone = TRUE;
+    LeaveCriticalSection(&pSet->ws_cs);
+
+    return 0;
+}   // WS2PollGroupThread
+
+
+// Note: call with ws_cs taken
+PWSAPOLL_GROUP
+WS2CreatePollGroup(
+    PWSAPOLL_SET pSet
+    )
+{
+    PWSAPOLL_GROUP pGroup;
+
+    if (pGroup = LocalAlloc(LPTR, sizeof(WSAPOLL_GROUP))) {
+        pGroup->wg_set = pSet;
+        if (pGroup->wg_signal = CreateEvent(NULL, FALSE, FALSE, NULL)) {
+            pGroup->wg_thread = CreateThread(NULL, 0, WS2PollGroupThread, pGroup, 0, NULL);
+            if (pGroup->wg_thread) {
+                MatchCurrentThreadPriority(pGroup->wg_thread);
+                pGroup->wg_next = pSet->ws_groups;
+                pSet->ws_groups = pGroup;
+                return pGroup;
+            }
+            CloseHandle(pGroup->wg_signal);
+        }
+        LocalFree(pGroup);
+    }
+    return NULL;
+}   // WS2CreatePollGroup
+
+
+HANDLE
+WSAAPI
+WSACreatePollSet(
+    IN DWORD dwFlags
+    )
+{
+    PWSAPOLL_SET pSet;
+
+    if (dwFlags) {
+        SetLastError(WSAEINVAL);
+        return NULL;
+    }
+
+    if (pSet = LocalAlloc(LPTR, sizeof(WSAPOLL_SET))) {
+        if (pSet->ws_hready = CreateEvent(NULL, FALSE, FALSE, NULL)) {
+            InitializeCriticalSection(&pSet->ws_cs);
+            pSet->ws_refs = 1;      // released by WSAClosePollSet
+
+            CTEGetLock(&g_PollSetListLock, 0);
+            pSet->ws_next = g_PollSetList;
+            g_PollSetList = pSet;
+            CTEFreeLock(&g_PollSetListLock, 0);
+
+            return (HANDLE)pSet;
+        }
+        LocalFree(pSet);
+    }
+
+    SetLastError(WSAENOBUFS);
+    return NULL;
+}   // WSACreatePollSet
+
+
+//
+// Add, modify or remove the network events a socket is watched for
+//
+int
+WSAAPI
+WSAPollSetCtl(
+    IN HANDLE hPollSet,
+    IN int iOp,
+    IN SOCKET s,
+    IN long lNetworkEvents,
+    IN DWORD dwContext
+    )
+{
+    PWSAPOLL_SET pSet;
+    PWSAPOLL_SOCKET pwp;
+    PWSAPOLL_GROUP pGroup;
+    DWORD dwLastError = 0;
+
+    if (NULL == (pSet = WS2RefPollSet(hPollSet))) {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    EnterCriticalSection(&pSet->ws_cs);
+
+    if (pSet->ws_closed) {
+        dwLastError = WSAEINVAL;
+        goto wpc_exit;
+    }
+
+    pwp = WS2FindPollSocket(pSet, s);
+
+    switch (iOp) {
+    case WSAPOLLSET_ADD:
+        // closesocket removes the socket from all sets, so this is a live duplicate
+        if (pwp) {
+            dwLastError = WSAEINVAL;
+            break;
+        }
+
+        for (pGroup = pSet->ws_groups; pGroup; pGroup = pGroup->wg_next) {
+            if (pGroup->wg_count < WSAPOLL_GROUP_SIZE) {
+                break;
+            }
+        }
+
+        if ((NULL == pGroup) && (NULL == (pGroup = WS2CreatePollGroup(pSet)))) {
+            dwLastError = WSAENOBUFS;
+            break;
+        }
+
+        if (NULL == (pwp = LocalAlloc(LPTR, sizeof(WSAPOLL_SOCKET)))) {
+            dwLastError = WSAENOBUFS;
+            break;
+        }
+
+        if (NULL == (pwp->wp_hevent = CreateEvent(NULL, FALSE, FALSE, NULL))) {
+            LocalFree(pwp);
+            dwLastError = WSAENOBUFS;
+            break;
+        }
+
+        if (SOCKET_ERROR == WSAEventSelect(s, pwp->wp_hevent, lNetworkEvents)) {
+            dwLastError = GetLastError();
+            CloseHandle(pwp->wp_hevent);
+            LocalFree(pwp);
+            break;
+        }
+
+        pwp->wp_socket = s;
+        pwp->wp_levents = lNetworkEvents;
+        pwp->wp_context = dwContext;
+        pwp->wp_group = pGroup;
+
+        pwp->wp_nexthash = pSet->ws_hash[WSAPOLL_HASH(s)];
+        pSet->ws_hash[WSAPOLL_HASH(s)] = pwp;
+        pwp->wp_next = pGroup->wg_list;
+        pGroup->wg_list = pwp;
+        pGroup->wg_count++;
+
+        SetEvent(pGroup->wg_signal);
+        break;
+
+    case WSAPOLLSET_MOD:
+        if (NULL == pwp) {
+            dwLastError = WSAENOTSOCK;
+            break;
+        }
+
+        // Re-selecting records the events that are already pending
+        if (SOCKET_ERROR == WSAEventSelect(s, pwp->wp_hevent, lNetworkEvents)) {
+            dwLastError = GetLastError();
+            break;
+        }
+
+        pwp->wp_levents = lNetworkEvents;
+        pwp->wp_context = dwContext;
+        break;
+
+    case WSAPOLLSET_DEL:
+        if (NULL == pwp) {
+            dwLastError = WSAENOTSOCK;
+            break;
+        }
+
+        WS2RetirePollSocket(pSet, pwp);
+        break;
+
+    default:
+        dwLastError = WSAEINVAL;
+        break;
+    }
+
+wpc_exit:
+    LeaveCriticalSection(&pSet->ws_cs);
+    WS2DerefPollSet(pSet);
+
+    if (dwLastError) {
+        SetLastError(dwLastError);
+        return SOCKET_ERROR;
+    }
+    return 0;
+}   // WSAPollSetCtl
+
+
+//
+// Read the pending events of the sockets WSAWaitPollSet took off the ready
+// list. lpEvents holds each socket and the events it is watched for; the
+// entries with events to report are packed at the front.
+//
+// Note: call without ws_cs, the provider may block in WSAEnumNetworkEvents
+//
+int
+WS2ReadPollEvents(
+    PWSAPOLL_SET pSet,
+    LPWSAPOLLSET_EVENT lpEvents,
+    int cTaken
+    )
+{
+    PWSAPOLL_SOCKET pwp;
+    WSANETWORKEVENTS NetworkEvents;
+    SOCKET s;
+    DWORD dwContext;
+    long lEvents;
+    int i, cReady = 0;
+
+    for (i = 0; i < cTaken; i++) {
+        s = lpEvents[i].s;
+        dwContext = lpEvents[i].dwContext;
+        lEvents = lpEvents[i].NetworkEvents.lNetworkEvents;
+
+        if (SOCKET_ERROR == WSAEnumNetworkEvents(s, NULL, &NetworkEvents)) {
+            // Socket is gone, it cannot be signalled again
+            DEBUGMSG(ZONE_WARN, (L"WS2:WSAWaitPollSet: dropping socket %d, error %d\n",
+                                 s, GetLastError()));
+            EnterCriticalSection(&pSet->ws_cs);
+            if (pwp = WS2FindPollSocket(pSet, s)) {
+                WS2RetirePollSocket(pSet, pwp);
+            }
+            LeaveCriticalSection(&pSet->ws_cs);
+            continue;
+        }
+
+        NetworkEvents.lNetworkEvents &= lEvents;
+        if (NetworkEvents.lNetworkEvents) {
+            lpEvents[cReady].s = s;
+            lpEvents[cReady].dwContext = dwContext;
+            memcpy(&lpEvents[cReady].NetworkEvents, &NetworkEvents, sizeof(NetworkEvents));
+            cReady++;
+        }
+    }
+    return cReady;
+}   // WS2ReadPollEvents
+
+
+//
+// Wait for registered sockets to become ready. Returns the number of entries
+// filled in lpEvents, 0 on timeout.
+//
+int
+WSAAPI
+WSAWaitPollSet(
+    IN HANDLE hPollSet,
+    OUT LPWSAPOLLSET_EVENT lpEvents,
+    IN int cEvents,
+    IN DWORD dwTimeout
+    )
+{
+    PWSAPOLL_SET pSet;
+    PWSAPOLL_SOCKET pwp;
+    DWORD dwLastError = 0;
+    DWORD dwStart, dwElapsed, ret;
+    int cTaken, cReady = 0;
+
+    if ((NULL == lpEvents) || (cEvents <= 0)) {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    // Check the buffer before any event is consumed, reported events are not queued again
+    if (((DWORD)cEvents > MAXDWORD / sizeof(WSAPOLLSET_EVENT)) ||
+        IsBadWritePtr(lpEvents, cEvents * sizeof(WSAPOLLSET_EVENT))) {
+        SetLastError(WSAEFAULT);
+        return SOCKET_ERROR;
+    }
+
+    if (NULL == (pSet = WS2RefPollSet(hPollSet))) {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    dwStart = GetTickCount();
+
+    EnterCriticalSection(&pSet->ws_cs);
+    for (;;) {
+        if (pSet->ws_closed) {
+            SetEvent(pSet->ws_hready);      // wake the next waiter as well
+            dwLastError = WSAEINTR;
+            break;
+        }
+
+        cTaken = 0;
+        __try {
+            while ((cTaken < cEvents) && (pwp = pSet->ws_readyhead)) {
+                pSet->ws_readyhead = pwp->wp_nextready;
+                if (NULL == pSet->ws_readyhead) {
+                    pSet->ws_readytail = NULL;
+                }
+                pwp->wp_ready = FALSE;
+
+                lpEvents[cTaken].s = pwp->wp_socket;
+                lpEvents[cTaken].dwContext = pwp->wp_context;
+                lpEvents[cTaken].NetworkEvents.lNetworkEvents = pwp->wp_levents;
+                cTaken++;
+            }
+        }
+        __except(EXCEPTION_EXECUTE_HANDLER) {
+            dwLastError = WSAEFAULT;
+            break;
+        }
+
+        if (cTaken) {
+            // Let another waiter pick up what is left
+            if (pSet->ws_readyhead) {
+                SetEvent(pSet->ws_hready);
+            }
+            LeaveCriticalSection(&pSet->ws_cs);
+
+            __try {
+                cReady = WS2ReadPollEvents(pSet, lpEvents, cTaken);
+            }
+            __except(EXCEPTION_EXECUTE_HANDLER) {
+                dwLastError = WSAEFAULT;
+            }
+
+            EnterCriticalSection(&pSet->ws_cs);
+            if (cReady || dwLastError) {
+                break;
+            }
+        }
+
+        dwElapsed = GetTickCount() - dwStart;
+        if ((INFINITE != dwTimeout) && (dwElapsed >= dwTimeout)) {
+            break;
+        }
+
+        LeaveCriticalSection(&pSet->ws_cs);
+        ret = WaitForSingleObject(pSet->ws_hready,
+                                  (INFINITE == dwTimeout) ? INFINITE : dwTimeout - dwElapsed);
+        EnterCriticalSection(&pSet->ws_cs);
+
+        if ((WAIT_OBJECT_0 != ret) && (WAIT_TIMEOUT != ret)) {
+            dwLastError = WSASYSCALLFAILURE;
+            break;
+        }
+    }
+    LeaveCriticalSection(&pSet->ws_cs);
+
+    WS2DerefPollSet(pSet);
+
+    if (dwLastError) {
+        SetLastError(dwLastError);
+        return SOCKET_ERROR;
+    }
+    return cReady;
+}   // WSAWaitPollSet
+
+
+//
+// Retire all sockets of a set that is off g_PollSetList and stop its group
+// threads. Returns FALSE if a thread did not exit within dwTimeout, in which
+// case its group and the set are left allocated.
+//
+BOOL
+WS2ShutdownPollSet(
+    PWSAPOLL_SET pSet,
+    DWORD dwTimeout
+    )
+{
+    PWSAPOLL_GROUP pGroup, * ppGroup;
+    BOOL fGone, fDone = TRUE;
+    int i;
+
+    EnterCriticalSection(&pSet->ws_cs);
+    pSet->ws_closed = TRUE;
+    for (i = 0; i < WSAPOLL_HASH_SIZE; i++) {
+        while (pSet->ws_hash[i]) {
+            WS2RetirePollSocket(pSet, pSet->ws_hash[i]);
+        }
+    }
+    for (pGroup = pSet->ws_groups; pGroup; pGroup = pGroup->wg_next) {
+        pGroup->wg_exit = TRUE;
+        SetEvent(pGroup->wg_signal);
+    }
+    SetEvent(pSet->ws_hready);
+    LeaveCriticalSection(&pSet->ws_cs);
+
+    //
+    // Group threads take ws_cs on their way out, so wait for them unlocked
+    //
+    ppGroup = &pSet->ws_groups;
+    while (pGroup = *ppGroup) {
+        WaitForSingleObject(pGroup->wg_thread, dwTimeout);
+
+        EnterCriticalSection(&pSet->ws_cs);
+        fGone = pGroup->wg_gone;
+        LeaveCriticalSection(&pSet->ws_cs);
+
+        if (! fGone) {
+            DEBUGMSG(ZONE_WARN, (L"WS2:WS2ShutdownPollSet: group thread 0x%X did not exit\n",
+                                 pGroup->wg_thread));
+            fDone = FALSE;
+            ppGroup = &pGroup->wg_next;
+            continue;
+        }
+
+        *ppGroup = pGroup->wg_next;
+        CloseHandle(pGroup->wg_thread);
+        CloseHandle(pGroup->wg_signal);
+        LocalFree(pGroup);
+    }
+
+    return fDone;
+}   // WS2ShutdownPollSet
+
+
+//
+// Remove all sockets and release the set. Threads waiting in WSAWaitPollSet
+// return with WSAEINTR.
+//
+int
+WSAAPI
+WSAClosePollSet(
+    IN HANDLE hPollSet
+    )
+{
+    PWSAPOLL_SET pSet, * ppSet;
+
+    CTEGetLock(&g_PollSetListLock, 0);
+    for (ppSet = &g_PollSetList; pSet = *ppSet; ppSet = &pSet->ws_next) {
+        if ((HANDLE)pSet == hPollSet) {
+            *ppSet = pSet->ws_next;
+            break;
+        }
+    }
+    CTEFreeLock(&g_PollSetListLock, 0);
+
+    if (NULL == pSet) {
+        SetLastError(WSAEINVAL);
+        return SOCKET_ERROR;
+    }
+
+    WS2ShutdownPollSet(pSet, INFINITE);
+    WS2DerefPollSet(pSet);
+    return 0;
+}   // WSAClosePollSet
+
+
+//
+// Called by closesocket before the handle can be reused, so a set never holds
+// an entry for a socket that no longer exists.
+//
+void
+WS2PollSetSocketClosed(
+    SOCKET s
+    )
+{
+    PWSAPOLL_SET pSet;
+    PWSAPOLL_SOCKET pwp;
+
+    if (NULL == g_PollSetList) {
+        return;
+    }
+
+    CTEGetLock(&g_PollSetListLock, 0);
+    for (pSet = g_PollSetList; pSet; pSet = pSet->ws_next) {
+        EnterCriticalSection(&pSet->ws_cs);
+        if (pwp = WS2FindPollSocket(pSet, s)) {
+            WS2RetirePollSocket(pSet, pwp);
+        }
+        LeaveCriticalSection(&pSet->ws_cs);
+    }
+    CTEFreeLock(&g_PollSetListLock, 0);
+}   // WS2PollSetSocketClosed
+
+
+//
+// DLL_PROCESS_DETACH: close the sets the process left open. The group threads
+// cannot finish exiting while the loader lock is held, so the wait is bounded
+// and a set whose thread is still running is leaked rather than freed under it.
+//
+void
+WS2CleanupPollSets(
+    void
+    )
+{
+    PWSAPOLL_SET pSet;
+
+    for (;;) {
+        CTEGetLock(&g_PollSetListLock, 0);
+        if (pSet = g_PollSetList) {
+            g_PollSetList = pSet->ws_next;
+        }
+        CTEFreeLock(&g_PollSetListLock, 0);
+
+        if (NULL == pSet) {
+            break;
+        }
+
+        if (WS2ShutdownPollSet(pSet, WSAPOLL_DETACH_WAIT)) {
+            WS2DerefPollSet(pSet);
+        }
+    }
+}   // WS2CleanupPollSets
+
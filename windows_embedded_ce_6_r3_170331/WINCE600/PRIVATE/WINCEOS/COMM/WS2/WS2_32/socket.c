@@ -600,6 +600,8 @@ int WSAAPI closesocket(
 			ASSERT(SOCKET_ERROR == Status);
 			pSock->Flags &= ~WS_SOCK_FL_CLOSED;
 		} else {
+			// drop it from poll sets while the handle value is still ours
+			WS2PollSetSocketClosed(s);
 			cRefs = DerefSocket(pSock);
 			ASSERT(cRefs >= 0);
 		}
@@ -68,5 +68,6 @@ int DerefSocket(WsSocket *pSock);
 
 int CheckSockaddr(const struct sockaddr *pAddr, int cAddr);
 void CloseAllSockets();
+void WS2PollSetSocketClosed(SOCKET s);
 
 
@@ -37,6 +37,8 @@ extern void FreeNsProviders();
 extern BOOL g_bWSAAsyncCSInit;
 extern CRITICAL_SECTION g_WSAAsyncCS;
 extern WSAEVENT g_WSAAsyncSelectSignal;
+extern CTELock g_PollSetListLock;
+extern void WS2CleanupPollSets();
 
 //	Global variables
 
@@ -286,6 +288,7 @@ DllEntry (
         CTEInitLock(&s_NsProvListLock);
         CTEInitLock(&s_NsLookupsLock);
         CTEInitLock(&s_ProviderListLock);
+        CTEInitLock(&g_PollSetListLock);
         
         s_SockTlsSlot = TlsAlloc();
         
@@ -302,6 +305,7 @@ DllEntry (
     case DLL_PROCESS_DETACH:
     
         if (v_hDll) {
+            WS2CleanupPollSets();
             v_fProcessDetached = TRUE;
             CloseAllSockets();
             FreeLookups();
@@ -311,6 +315,7 @@ DllEntry (
             CTEDeleteLock(&s_NsProvListLock);
             CTEDeleteLock(&s_NsLookupsLock);
             CTEDeleteLock(&s_ProviderListLock);            
+            CTEDeleteLock(&g_PollSetListLock);
             TlsFree(s_SockTlsSlot);
             
             if (g_bWSAAsyncCSInit) {
@@ -113,6 +113,7 @@ typedef SOCKHAND LPSOCK_INFO;
 
 #include "pegcalls.h"
 #include "socket.h"
+#include "wspoll.h"
 
 #define WINSOCK_VERSION	MAKEWORD(2,2)
 
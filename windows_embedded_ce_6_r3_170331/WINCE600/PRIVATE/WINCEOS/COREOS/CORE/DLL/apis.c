@@ -362,6 +362,32 @@ BOOL CeSetPowerOnEvent (HANDLE hEvt)
     return SetEvent (hEvt);
 }
 
+//
+// Batched message queue calls - event handle methods, following ResumeMainThread
+//
+#define ID_MSGQ_READBATCH   ID_HCALL(10)
+#define ID_MSGQ_WRITEBATCH  ID_HCALL(11)
+
+#if defined (KCOREDLL)
+#define ReadMsgQueueBatchCall(hq, pb, cb, pcbRead, dwTimeout, pcMsgs)   \
+    _DIRECT_HANDLE_CALL(BOOL, HT_EVENT, ID_MSGQ_READBATCH, FALSE, (HANDLE, LPVOID, DWORD, LPDWORD, DWORD, LPDWORD), 1, (hq, pb, cb, pcbRead, dwTimeout, pcMsgs))
+#define WriteMsgQueueBatchCall(hq, pb, cb, dwTimeout, pcMsgs)           \
+    _DIRECT_HANDLE_CALL(BOOL, HT_EVENT, ID_MSGQ_WRITEBATCH, FALSE, (HANDLE, LPCVOID, DWORD, DWORD, LPDWORD), 1, (hq, pb, cb, dwTimeout, pcMsgs))
+#else
+#define ReadMsgQueueBatchCall   IMPLICIT_DECL(BOOL, HT_EVENT, ID_MSGQ_READBATCH, (HANDLE, LPVOID, DWORD, LPDWORD, DWORD, LPDWORD))
+#define WriteMsgQueueBatchCall  IMPLICIT_DECL(BOOL, HT_EVENT, ID_MSGQ_WRITEBATCH, (HANDLE, LPCVOID, DWORD, DWORD, LPDWORD))
+#endif
+
+BOOL xxx_ReadMsgQueueBatch (HANDLE hMsgQ, LPVOID lpBuffer, DWORD cbBufferSize, LPDWORD lpNumberOfBytesRead, DWORD dwTimeout, LPDWORD lpcMsgsRead)
+{
+    return ReadMsgQueueBatchCall (hMsgQ, lpBuffer, cbBufferSize, lpNumberOfBytesRead, dwTimeout, lpcMsgsRead);
+}
+
+BOOL xxx_WriteMsgQueueBatch (HANDLE hMsgQ, LPCVOID lpBuffer, DWORD cbBufferSize, DWORD dwTimeout, LPDWORD lpcMsgsWritten)
+{
+    return WriteMsgQueueBatchCall (hMsgQ, lpBuffer, cbBufferSize, dwTimeout, lpcMsgsWritten);
+}
+
 static CONST WCHAR szHex[] = L"0123456789ABCDEF";
 
 UINT GetTempFileNameW(LPCWSTR lpPathName, LPCWSTR lpPrefixString, UINT uUnique, LPWSTR lpTempFileName) {
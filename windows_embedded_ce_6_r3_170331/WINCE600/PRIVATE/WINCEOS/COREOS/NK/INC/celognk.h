@@ -207,6 +207,7 @@ void CELOG_SyncProcess(PPROCESS pProcess);
 void CELOG_SyncThread(PTHREAD pThread, PPROCESS pProcess);
 void CELOG_SyncModule(PMODULE pModule);
 BOOL CELOG_SyncModuleRefCount(PMODULELIST pml, PPROCESS pProcess, BOOL Reset);
+void CELOG_SyncKHeap(DWORD idx);
 
 
 
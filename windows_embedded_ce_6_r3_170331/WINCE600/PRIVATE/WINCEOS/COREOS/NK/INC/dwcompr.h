@@ -0,0 +1,68 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+#pragma once
+
+//
+// Compressed dump file format, written to reserved memory by DwDmpGen when 
+// WATSON_DUMP_FLAG_COMPRESSED is set, and expanded back into a standard dump
+// file on the host by DwDmpExp.exe.
+//
+// The file is a CEDUMP_COMPRESSED_HEADER followed by dwNumberOfBlocks blocks.
+// Each block is a CEDUMP_COMPRESSED_BLOCK followed by wPackedSize bytes of data,
+// and expands to wDataSize bytes of the dump file. Blocks are compressed 
+// independently, so a damaged block only loses its own data.
+//
+// Packed data is a sequence of LZ77 tokens:
+//
+//      BYTE    Token           - high nibble is the literal count, low nibble is the match length - 4
+//      BYTE    LiteralCount[]  - if literal count is 15, bytes added to it until a byte < 255
+//      BYTE    Literals[]
+//      WORD    MatchOffset     - distance back from the current position (little endian)
+//      BYTE    MatchLength[]   - if match length is 15, bytes added to it until a byte < 255
+//
+// A token whose literals run to the end of the packed data has no match, and is the last of the block.
+//
+
+#define CEDUMP_COMPRESSED_SIGNATURE     0x5A444D43  // "CMDZ"
+#define CEDUMP_COMPRESSED_BLOCK_SIZE    8192        // Size of dump data compressed in each block
+#define CEDUMP_COMPRESSED_HASH_SIZE     4096        // Number of WORD entries in the compression hash table
+
+typedef struct _CEDUMP_COMPRESSED_HEADER
+{
+    DWORD   dwSignature;            // CEDUMP_COMPRESSED_SIGNATURE
+    DWORD   dwSizeOfHeader;         // Size of this struct
+    DWORD   dwBlockSize;            // Expanded size of each block, the last one may be smaller
+    DWORD   dwNumberOfBlocks;       // Number of blocks following the header
+    DWORD   dwDumpFileSize;         // Size of the expanded dump file
+    DWORD   dwDumpFileCRC;          // Simple CRC (sum of all bytes) of the expanded dump file
+} CEDUMP_COMPRESSED_HEADER, *PCEDUMP_COMPRESSED_HEADER;
+
+typedef struct _CEDUMP_COMPRESSED_BLOCK
+{
+    WORD    wDataSize;              // Expanded size of the block
+    WORD    wPackedSize;            // Size of the packed data, equal to wDataSize if the block is stored uncompressed
+    DWORD   dwChecksum;             // Adler-32 of the expanded block
+} CEDUMP_COMPRESSED_BLOCK, *PCEDUMP_COMPRESSED_BLOCK;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+DWORD DwCompressBlock(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst, WORD *pwHashTable);
+DWORD DwDecompressBlock(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst);
+DWORD DwBlockChecksum(const BYTE *pbData, DWORD cbData);
+
+#ifdef __cplusplus
+}
+#endif
+
@@ -32,7 +32,14 @@ typedef struct _WATSON_DUMP_SETTINGS
     DWORD       dwDumpFileCRC;          // CRC of the dump file in the reserved memory
     WCHAR       wzExtraFilesDirectory[MAX_PATH]; // Path to directory where user app can place extra files
     WCHAR       wzExtraFilesPath[MAX_PATH];      // Path to extra files set by user app to upload with crash dump
+    DWORD       dwDumpFlags;            // WATSON_DUMP_FLAG_xxx, not present in settings written by older DwXfer.dll
 } WATSON_DUMP_SETTINGS, *PWATSON_DUMP_SETTINGS;
 
+// Size of the settings before dwDumpFlags was added, these settings are read with no flags set
+#define WATSON_DUMP_SETTINGS_V1_SIZE    FIELD_OFFSET(WATSON_DUMP_SETTINGS, dwDumpFlags)
+
+#define WATSON_DUMP_FLAG_COMPRESSED     0x00000001  // Write the dump compressed in blocks (see dwcompr.h), DwDmpExp.exe expands it
+#define WATSON_DUMP_FLAG_PRIORITY       0x00000002  // Fill the dump with stacks and the faulting process first, then trim the rest to fit
+
 #define WATSON_TRANSFER_BUFFER_SIZE 4096        // Size of Read/Write buffer for transfer of dump file to file system
 
@@ -64,6 +64,8 @@ struct _HDATA {
 };
 
 // handle entry (one per handle)
+// NOTE: for a free entry (phd == NULL), hndl.reuseCnt is kept to catch stale handles, and 
+//       hndl.idx is the index of the next free entry in the same table (HND_IDX_INVALID if none).
 typedef struct _HNDLENTRY {
     KHNDL           hndl;
     PHDATA          phd;
@@ -73,7 +75,7 @@ typedef struct _HNDLENTRY {
 // handle table
 struct _HNDLTABLE {
     DWORD           nFree;                                      // # of free entry
-    WORD            idxFree;                                    // next free entry
+    WORD            idxFree;                                    // head of the free entry list
     WORD            wReuseCntBase;                              // base of reuse count. to distinguish between processes for ease of debugging
     HNDLENTRY       hde[NUM_HNDL_1ST];                          // entry in both 1st/2nd level table
     union {
@@ -124,6 +124,15 @@ typedef struct heapptr_t {
     long cMax;      // maximum # of entries used
 } heapptr_t;
 
+// per-pool allocation statistics, kept separately as heapptr_t is returned to user mode as is
+typedef struct heapstat_t {
+    long cHit;      // # of allocations satisfied from the free list
+    long cMiss;     // # of allocations that had to carve a new block from a heap page
+} heapstat_t;
+
+extern heapptr_t heapptr[NUMARENAS];
+extern heapstat_t heapstat[NUMARENAS];
+
 //
 // function prototypes
 //
@@ -19,8 +19,19 @@
 #define _PG_POOL_H_
 
 
+// Shadow entry - remembers data that was recently paged into a pool, so that
+// the pool can tell when it has to page the same data in again (a refault).
 typedef struct {
-    // Parameters (constant)
+    DWORD  Key;                         // Identifies the data that was paged in
+    DWORD  PageInSeq;                   // Pool page-in sequence number at page-in time (0 = unused)
+} PagePoolShadow_t;
+
+#define PGPOOL_SHADOW_SHIFT        9
+#define PGPOOL_SHADOW_ENTRIES      (1 << PGPOOL_SHADOW_SHIFT)
+
+typedef struct {
+    // Parameters (constant, except for Target which adapts between BaseTarget
+    // and PoolTargetCap based on refaults)
     WORD   Target;                      // Target size, in pages (2^16 * 4096 = 256MB max)
     WORD   Maximum;                     // Maximum size, in pages
     WORD   ReleaseIncrement;            // Pages to release below target
@@ -30,7 +41,7 @@ typedef struct {
     
     PHDATA phdTrimThread;               // Pointer to trim thread HDATA (thread is locked)
     HANDLE hTrimEvent;
-    WORD   __unused;  // alignment/padding
+    WORD   BaseTarget;                  // Configured target size, in pages
 
     // Current state
     WORD   Flags;                       // PGPOOL_FLAG_*
@@ -57,7 +68,11 @@ typedef struct {
         } file;
     } EnumState;
 
-    CRITICAL_SECTION cs;    // Protects CurSize, Flags and EnumState
+    // Refault tracking, only used by pools with a trim thread
+    PagePoolShadow_t* pShadow;          // PGPOOL_SHADOW_ENTRIES entries, hashed by key
+    DWORD  PageInSeq;                   // # of pages paged into the pool
+
+    CRITICAL_SECTION cs;    // Protects CurSize, Target, Flags, EnumState and refault tracking
 
     // Debugging information
     DWORD TrimCount;        // # times the Target was exceeded and trim thread ran
@@ -65,6 +80,11 @@ typedef struct {
     DWORD CriticalCount;    // # times the thread went into critical mode
     DWORD CriticalTime;     // Amount of time (ms) trim thread has run at critical prio
     DWORD FailCount;        // # allocs that failed for lack of memory
+    DWORD RefaultCount;     // # page-ins of data that was recently paged in and evicted
+    DWORD WSRefaultCount;   // # refaults that a larger Target would have avoided
+    DWORD WSRefaultMark;    // WSRefaultCount at the end of the last trim
+    DWORD GrowCount;        // # times Target was raised because of refaults
+    DWORD ShrinkCount;      // # times Target was lowered back towards BaseTarget
 
 } PagePool_t;
 
@@ -84,6 +104,10 @@ typedef struct {
 #define PoolAboveCriticalThreshold(pPool)   ((pPool)->CurSize >= ((pPool)->Maximum - (pPool)->CriticalIncrement))
 #define PoolCriticalIsComplete(pPool)       ((pPool)->CurSize <= ((pPool)->Maximum - 2*(pPool)->CriticalIncrement))
 
+// Target can't grow into the critical range of the pool
+#define PoolTargetCap(pPool)                ((pPool)->Maximum - 2*(pPool)->CriticalIncrement)
+#define PoolAdaptIncrement(pPool)           ((pPool)->ReleaseIncrement ? (pPool)->ReleaseIncrement : 1)
+
 #define PagePoolCriticalFreePages           ((long) (PagePoolCriticalFreeMemory / VM_PAGE_SIZE))
 #define EnoughMemoryToLeaveCritical()       (PageFreeCount > PagePoolCriticalFreePages)
 
@@ -128,13 +152,15 @@ PagePoolGetNextFile (
 
 // GetPagingPage - Allocate a page from pool or from common RAM.
 // Caller is responsible for calling FreePagingPage.
+// ShadowKey identifies the data being paged in, for pool refault tracking.
 LPVOID
 GetPagingPage (
     PagePool_t* pPool,
     LPVOID*     ppReservation,
     DWORD       addr,
     BOOL        fUsePool,
-    DWORD       fProtect
+    DWORD       fProtect,
+    DWORD       ShadowKey
     );
 
 // FreePagingPage - Release a page from pool or from common RAM.
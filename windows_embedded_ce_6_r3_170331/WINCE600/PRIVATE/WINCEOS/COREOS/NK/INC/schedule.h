@@ -21,6 +21,11 @@
 
 #define PRIORITY_LEVELS_HASHSCALE (MAX_CE_PRIORITY_LEVELS/PRIORITY_LEVELS_HASHSIZE)
 
+// run queue bitmap: one bit per priority, grouped in DWORDs, plus one bit per group
+#define RUNQ_PRIO_GROUP_SHIFT   5
+#define RUNQ_PRIO_GROUP_MASK    ((1 << RUNQ_PRIO_GROUP_SHIFT) - 1)
+#define RUNQ_PRIO_GROUPS        (MAX_CE_PRIORITY_LEVELS >> RUNQ_PRIO_GROUP_SHIFT)
+
 //
 // MAX_TIMEOUT is 0x7FFF0000 to allow some 'reasonable' system tick value. 
 // The value needs to be <= (0x80000000 - system_tick), and we're
@@ -28,10 +33,16 @@
 //
 #define MAX_TIMEOUT     0x7FFF0000
 
+//
+// NOTE: pRunnable and pth must stay the first 2 fields, assembly code in the 
+//       scheduler references RunList.pth at offset 4.
+//
 typedef struct {
-    PTHREAD pRunnable;  /* List of runnable threads */
-    PTHREAD pth;        /* Currently running thread */
-    PTHREAD pHashThread[PRIORITY_LEVELS_HASHSIZE];
+    PTHREAD pRunnable;      /* Highest priority runnable thread (head of its priority queue) */
+    PTHREAD pth;            /* Currently running thread */
+    DWORD   dwGroupMap;     /* bit n set if dwPrioMap[n] != 0 */
+    DWORD   dwPrioMap[RUNQ_PRIO_GROUPS];            /* bit (prio & RUNQ_PRIO_GROUP_MASK) set if pRunQueue[prio] is not empty */
+    PTHREAD pRunQueue[MAX_CE_PRIORITY_LEVELS];      /* FIFO of runnable threads per priority, circular through pUpRun/pDownRun */
 } RunList_t;
 
 struct _PROXY {
@@ -164,6 +164,21 @@ BOOL MSGQRead (PEVENT lpe, LPVOID lpBuffer, DWORD cbSize,
 // MSGQWrite - write to a message queue
 BOOL MSGQWrite (PEVENT lpe, LPCVOID lpBuffer, DWORD cbDataSize, DWORD dwTimeout, DWORD dwFlags);
 
+// message header used by the batched read/write calls, the data follows padded to a DWORD boundary
+typedef struct _MSGQUEUEBATCHENTRY {
+    DWORD   cbData;                 // size of the message data
+    DWORD   dwFlags;                // message flags (MSGQUEUE_MSGALERT)
+} MSGQUEUEBATCHENTRY, *PMSGQUEUEBATCHENTRY;
+
+#define MSGQ_BATCH_ENTRY_SIZE(cbData)   (sizeof (MSGQUEUEBATCHENTRY) + (((cbData) + 3) & ~3))
+
+// MSGQReadBatch - read all queued messages that fit in the buffer from a message queue
+BOOL MSGQReadBatch (PEVENT lpe, LPVOID lpBuffer, DWORD cbSize, 
+                    LPDWORD lpNumberOfBytesRead, DWORD dwTimeout, LPDWORD lpcMsgs);
+
+// MSGQWriteBatch - write a sequence of messages to a message queue
+BOOL MSGQWriteBatch (PEVENT lpe, LPCVOID lpBuffer, DWORD cbSize, DWORD dwTimeout, LPDWORD lpcMsgs);
+
 // MSGQGetInfo - get information from a message queue
 BOOL MSGQGetInfo (PEVENT lpe, PMSGQUEUEINFO lpInfo);
 
@@ -56,8 +56,8 @@ struct _THREAD {
     FILETIME    ftCreate;       // 50: creation time - MUST BE 8-byt aligned
     FILETIME    ftExit;         // 58: exit time - MUST BE 8-BYTE aligned
     CPUCONTEXT  ctx;            /* 60: thread's cpu context information */
-    PTHREAD     pNextSleepRun;  /* ??: next sleeping thread, if sleeping, else next on runq if runnable */
-    PTHREAD     pPrevSleepRun;  /* ??: back pointer if sleeping or runnable */
+    PTHREAD     pNextSleepRun;  /* ??: next sleeping thread, if sleeping */
+    PTHREAD     pPrevSleepRun;  /* ??: back pointer if sleeping */
     CLEANEVENT *lpce;           /* ??: cleanevent for unqueueing blocking lists */
     DWORD       dwStartAddr;    /* ??: thread PC at creation, used to get thread name */
     PTHREAD     pUpRun;         /* ??: up run pointer (circulaar) */
@@ -65,7 +65,7 @@ __inline void UnlockHandleTable (PPROCESS pprc)
 }
 
 //
-// convert a handle to hdata, handle table is locked
+// convert a handle to hdata, handle table is locked or inside KCall
 //
 PHDATA h2pHDATA (HANDLE h, PHNDLTABLE phndtbl)
 {
@@ -109,6 +109,14 @@ PHNDLTABLE CreateHandleTable (DWORD nFree)
     PHNDLTABLE phndltbl = (PHNDLTABLE) GrabOnePage (PM_PT_ZEROED);
 
     if (phndltbl) {
+        DWORD idx;
+        
+        // chain all the entries into the free list (idxFree is 0 on a zeroed page)
+        for (idx = 1; idx < nFree; idx ++) {
+            phndltbl->hde[idx-1].hndl.idx = (WORD) idx;
+        }
+        phndltbl->hde[nFree-1].hndl.idx = HND_IDX_INVALID;
+        
         phndltbl->nFree = nFree;
         if (NUM_HNDL_1ST == nFree) {
             static LONG lCnt;
@@ -124,14 +132,18 @@ static void FreeHandleTable (PHNDLTABLE phtbl)
     FreePhysPage (GetPFN (phtbl));
 }
 
-static DWORD FindFreeHndl (PHNDLENTRY pEnt, DWORD idxStart, DWORD idxLimit)
+//
+// put a handle entry back to the free list of its table, handle table is locked
+//
+__inline void FreeHndlEntry (PHNDLTABLE phndtbl, DWORD idx)
 {
-    for ( ; idxStart < idxLimit; idxStart ++) {
-        if (!pEnt[idxStart].phd) {
-            break;
-        }
-    }
-    return idxStart;
+    PHNDLENTRY phde = &phndtbl->hde[idx];
+    
+    phde->phd = NULL;
+    phde->hndl.reuseCnt += 4;   // increment reuse count by 4 (lower 2 bits remains the same)
+    phde->hndl.idx = phndtbl->idxFree;
+    phndtbl->idxFree = (WORD) idx;
+    phndtbl->nFree ++;
 }
 
 static HANDLE HNDLAlloc (PHNDLTABLE phndtbl, PHDATA phd)
@@ -189,21 +201,16 @@ static HANDLE HNDLAlloc (PHNDLTABLE phndtbl, PHDATA phd)
         InterlockedIncrement (&phdAPISet->dwRefCnt);
     }
 
-    // search for the free entry
+    // take the first entry off the free list
     idx = phndtbl->idxFree;
-    do {
-        if (idx >= idxLimit) {
-            idx = 0;
-        }
-        phde = &phndtbl->hde[idx ++];
-
-    } while (phde->phd);
-
-    // note: at loop exit, idx is at one past the newly allocated entry
+    DEBUGCHK (idx < idxLimit);
+    phde = &phndtbl->hde[idx];
+    DEBUGCHK (!phde->phd);
+    phndtbl->idxFree = phde->hndl.idx;
 
     // setup the entry
     phde->phd = phd;
-    phde->hndl.idx = (WORD) (idx - 1 + idxBase);
+    phde->hndl.idx = (WORD) (idx + idxBase);
 
 //#ifdef DEBUG
 // Shouldn't affect perf too much adding a simple check. If we find this to cost
@@ -216,32 +223,49 @@ static HANDLE HNDLAlloc (PHNDLTABLE phndtbl, PHDATA phd)
 
     // update handle table bookkeeping values
     phndtbl->nFree --;
-    phndtbl->idxFree = (WORD) idx;  // free set to next one (idx is current + 1)
 
     return phde->hndl.hValue;
 }
 
 
 //
-// LockHandleData: Locking a handle prevent the HDATA from being destroyed
-// when a handle is locked, the HDATA of the handle cannot be destroyed.
-// NOTE: Locking a handle doesn't guarantee serialization
+// KC_LockHandleData: lookup and lock a handle without taking the handle table lock.
+// KCall is not preemptible, so the table cannot change while we look at it. Handle table
+// updates are ordered such that an entry with non-NULL phd always holds a handle count on
+// the HDATA, i.e. the HDATA we found is alive when we lock it. The handle tables are only
+// freed after pprc->phndtbl is cleared.
 //
-PHDATA LockHandleData (HANDLE h, PPROCESS pprc)
+// Why a KCall rather than a seqlock: the reader has to add a lock count to the HDATA it
+// found, and a writer can drop the last handle count and free the HDATA between the read
+// and the increment. A retry after the fact is too late, so the read and the increment
+// must not be preempted, which is what the KCall gives us. The non-preemptible window is
+// fixed: at most 2 table lookups, 1 compare and 1 interlocked increment. The csHndl it
+// replaces can be held by HNDLCloseOneHndlTbl for a scan of up to NUM_HNDL_2ND (511)
+// entries, or while HNDLAlloc grabs a page for a new table, and a lookup from any thread
+// waited for all of it. Uncontended the two cost about the same; the gain is the bound.
+//
+static PHDATA KC_LockHandleData (HANDLE h, PPROCESS pprc)
 {
     PHDATA phd = NULL;
-    PHNDLTABLE phndtbl = LockHandleTable (pprc);
+    PHNDLTABLE phndtbl = pprc->phndtbl;
 
-    if (phndtbl) {
-        if (phd = h2pHDATA (h, phndtbl)) {
-            DEBUGCHK ((int) phd->dwRefCnt > 0);
-            InterlockedIncrement (&phd->dwRefCnt);  // lock increment is 1, thus using InterlockedIncrement
-        }
-        UnlockHandleTable (pprc);
+    if (phndtbl && (phd = h2pHDATA (h, phndtbl))) {
+        DEBUGCHK ((int) phd->dwRefCnt > 0);
+        InterlockedIncrement (&phd->dwRefCnt);  // lock increment is 1, thus using InterlockedIncrement
     }
     return phd;
 }
 
+//
+// LockHandleData: Locking a handle prevent the HDATA from being destroyed
+// when a handle is locked, the HDATA of the handle cannot be destroyed.
+// NOTE: Locking a handle doesn't guarantee serialization
+//
+PHDATA LockHandleData (HANDLE h, PPROCESS pprc)
+{
+    return (PHDATA) KCall ((PKFN) KC_LockHandleData, h, pprc);
+}
+
 // locking via PHDATA directly
 void LockHDATA (PHDATA phd)
 {
@@ -648,9 +672,7 @@ PHDATA HNDLZapHandle (PPROCESS pprc, HANDLE h)
                         p1sttbl->idx2ndFree = (WORD) idx2ndTbl;
                     }
 
-                    phndtbl->nFree ++;
-                    phde->hndl.reuseCnt += 4; // increment reuse count by 4 (lower 2 bits remains the same)
-                    phde->phd = NULL;
+                    FreeHndlEntry (phndtbl, idx);
                 }
             }
 
@@ -697,12 +719,9 @@ static DWORD HNDLCloseOneHndlTbl (PHNDLTABLE phndtbl, PHDATA phds[], DWORD nMaxF
             // lock the handle
             InterlockedIncrement (&phds[nClosed]->dwRefCnt);
             nClosed ++;
-            InterlockedIncrement (&phndtbl->nFree);
-            phndtbl->hde[idx].phd = 0;
-            phndtbl->hde[idx].hndl.reuseCnt += 4;   // increment reuse count by 4 (lower 2 bits remains the same)
+            FreeHndlEntry (phndtbl, idx);
         }
     }
-    phndtbl->idxFree = 0;
     return nClosed;
 }
 
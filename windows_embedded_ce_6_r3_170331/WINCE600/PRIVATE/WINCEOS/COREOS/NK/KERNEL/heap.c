@@ -57,6 +57,8 @@ heapptr_t heapptr[NUMARENAS] = {
     HEAPENTRY(4),   HEAPENTRY(5),   HEAPENTRY(6),   HEAPENTRY(7)
 };
 
+heapstat_t heapstat[NUMARENAS];
+
 DWORD dwIndex; // ptr to arena to receive tail of heap page
 uint SmallestSize;
 
@@ -168,11 +170,14 @@ LPVOID AllocMem (ulong poolnum)
 
     //DEBUGMSG (ZONE_MEMORY, (L"+AllocMem %d\r\n", poolnum));
     hptr = &heapptr[poolnum];
-    if (!(pptr = InterlockedPopList(&hptr->fptr))) {
+    if (pptr = InterlockedPopList(&hptr->fptr)) {
+        InterlockedIncrement(&heapstat[poolnum].cHit);
+    } else {
         if (!(pptr = GetKHeap(hptr->size))) {
             return 0;
         }
         InterlockedIncrement(&hptr->cMax);
+        InterlockedIncrement(&heapstat[poolnum].cMiss);
     }
     InterlockedIncrement(&hptr->cUsed);
     //DEBUGMSG (ZONE_MEMORY, (L"-AllocMem %8.8x\r\n", pptr));
@@ -281,16 +286,16 @@ int ShowKernelHeapInfo(void)
            KInfoTable[KINX_SYSPAGES],KInfoTable[KINX_KERNRESERVE],
            KInfoTable[KINX_NUMPAGES]-KInfoTable[KINX_PAGEFREE]);
     
-    NKDbgPrintfW(L"Inx Size   Used    Max Extra  Entries Name\r\n");
+    NKDbgPrintfW(L"Inx Size   Used    Max Extra  Entries       Hit   Miss Name\r\n");
     for (loop = 0 ; loop < NUMARENAS ; ++loop, ++hptr) {
         cbUsed = hptr->size * hptr->cUsed;
         cbMax = hptr->size * hptr->cMax;
         cbExtra = cbMax - cbUsed;
         cbTotalUsed += cbUsed;
         cbTotalExtra += cbExtra;
-        NKDbgPrintfW (L"%2d: %4d %6ld %6ld %5ld %3d(%3d) %hs\r\n", loop, hptr->size,
+        NKDbgPrintfW (L"%2d: %4d %6ld %6ld %5ld %3d(%3d) %9ld %6ld %hs\r\n", loop, hptr->size,
                 cbUsed, cbMax, cbExtra, hptr->cUsed, hptr->cMax,
-                hptr->classname);
+                heapstat[loop].cHit, heapstat[loop].cMiss, hptr->classname);
     }
     NKDbgPrintfW (L"Total Used = %ld  Total Extra = %ld  Waste = %d\r\n",
             cbTotalUsed, cbTotalExtra, KInfoTable[KINX_HEAP_WASTE]);
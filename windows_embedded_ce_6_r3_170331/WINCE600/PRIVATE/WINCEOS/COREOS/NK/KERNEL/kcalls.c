@@ -56,76 +56,88 @@ __inline BOOL KC_IsThreadTerminated (PTHREAD pth)
         && !KC_IsThrdInPSL (pth);               // not in PSL
 }
 
+//------------------------------------------------------------------------------
+// run queue helpers
+//
+// The run queue is an array of per-priority FIFOs (circular through pUpRun/pDownRun)
+// plus a 2-level bitmap of the non-empty priorities. Enqueue and dequeue only touch
+// the FIFO of the thread's priority; the highest priority runnable thread is found
+// with GetHighPos (lowest set bit == highest priority) on the bitmap.
+//------------------------------------------------------------------------------
+__inline void RunqSetPrioBit (DWORD prio)
+{
+    RunList.dwPrioMap[prio >> RUNQ_PRIO_GROUP_SHIFT] |= (1 << (prio & RUNQ_PRIO_GROUP_MASK));
+    RunList.dwGroupMap |= (1 << (prio >> RUNQ_PRIO_GROUP_SHIFT));
+}
+
+__inline void RunqClearPrioBit (DWORD prio)
+{
+    if (!(RunList.dwPrioMap[prio >> RUNQ_PRIO_GROUP_SHIFT] &= ~(1 << (prio & RUNQ_PRIO_GROUP_MASK)))) {
+        RunList.dwGroupMap &= ~(1 << (prio >> RUNQ_PRIO_GROUP_SHIFT));
+    }
+}
+
+//------------------------------------------------------------------------------
+// find the highest priority runnable thread from the bitmap
+//------------------------------------------------------------------------------
+static PTHREAD RunqFindRunnable (void)
+{
+    DWORD grp;
+    
+    if (!RunList.dwGroupMap) {
+        return NULL;
+    }
+    grp = GetHighPos (RunList.dwGroupMap);
+    DEBUGCHK (RunList.dwPrioMap[grp]);
+    return RunList.pRunQueue[(grp << RUNQ_PRIO_GROUP_SHIFT) + GetHighPos (RunList.dwPrioMap[grp])];
+}
+
+//------------------------------------------------------------------------------
+// add a thread to the run queue of priority prio, either at the tail (FIFO order) 
+// or at the head (thread preempted with quantum left)
+//------------------------------------------------------------------------------
+static void RunqEnqueue (PTHREAD pth, DWORD prio, BOOL fHead)
+{
+    PTHREAD pHead;
+    
+    DEBUGCHK (prio < MAX_CE_PRIORITY_LEVELS);
+    pth->pNextSleepRun = pth->pPrevSleepRun = 0;
+    if (pHead = RunList.pRunQueue[prio]) {
+        // insert "before" the head, i.e. at the tail of the circular list
+        pth->pUpRun = pHead->pUpRun;
+        pth->pUpRun->pDownRun = pHead->pUpRun = pth;
+        pth->pDownRun = pHead;
+        if (fHead) {
+            RunList.pRunQueue[prio] = pth;
+        }
+    } else {
+        pth->pUpRun = pth->pDownRun = RunList.pRunQueue[prio] = pth;
+        RunqSetPrioBit (prio);
+    }
+
+    // update the highest priority runnable thread
+    if (!RunList.pRunnable || (prio <= GET_CPRIO (RunList.pRunnable))) {
+        RunList.pRunnable = RunList.pRunQueue[prio];
+    }
+}
+
 //------------------------------------------------------------------------------
 // make a thread runnable
 //------------------------------------------------------------------------------
 VOID MakeRun (PTHREAD pth) 
 {
-    DWORD prio, prio2;
-    PTHREAD pth2, pth3;
+    DWORD prio;
     if (!pth->bSuspendCnt) {
         SET_RUNSTATE(pth,RUNSTATE_RUNNABLE);
         CELOG_KCThreadRunnable(pth);
 
         prio = GET_CPRIO(pth);
-        prio2 = prio/PRIORITY_LEVELS_HASHSCALE;
-        if (!(pth2 = RunList.pRunnable) || (prio < GET_CPRIO(pth2))) {
-            // either there is no runnable or we're the highest priority thread
-            // make pth the head of runable and update the hash table
-            pth->pPrevSleepRun = 0;
-            if (pth->pNextSleepRun = pth2) {
-                pth2->pPrevSleepRun = pth;
-            }
-            pth->pUpRun = pth->pDownRun = RunList.pHashThread[prio2] = pth;
-            RunList.pRunnable = pth;
-
-            // see if we need to reschedule
-            if (!RunList.pth || (prio < GET_CPRIO(RunList.pth)))
-                SetReschedule();
-
-        } else {
-            // there are higher priority thread than pth, find the right
-            // place to enqueue it.
+        RunqEnqueue (pth, prio, FALSE);
 
-            if (!(pth2 = RunList.pHashThread[prio2])) {
-                // find the preceeding non-zero hash table entry
-                // bounded by PRIORITY_LEVELS_HASHSIZE
-                RunList.pHashThread[prio2] = pth;
-                while (!(pth2 = RunList.pHashThread[-- prio2]))
-                    ;
-
-            }
-            
-            if (prio < GET_CPRIO(pth2)) {
-                // insert into runlist and replace the hash table entry
-                DEBUGCHK (prio/PRIORITY_LEVELS_HASHSCALE == prio2);
-                pth->pPrevSleepRun = pth2->pPrevSleepRun;
-                pth->pNextSleepRun = pth2;
-                pth->pUpRun = pth->pDownRun = RunList.pHashThread[prio2] = pth->pPrevSleepRun->pNextSleepRun = pth2->pPrevSleepRun = pth;
-
-            } else {
-                
-                // find the appropriate place to insert pth
-                // bounded by MAX_PRIORITY_HASHSCALE
-                while ((pth3 = pth2->pNextSleepRun) && (prio >= GET_CPRIO(pth3)))
-                    pth2 = pth3;
-                DEBUGCHK (!pth3 || (prio < GET_CPRIO(pth3)));
-                DEBUGCHK (GET_CPRIO (pth2) <= prio);
-                if (prio == GET_CPRIO(pth2)) {
-                    pth->pUpRun = pth2->pUpRun;
-                    pth->pUpRun->pDownRun = pth2->pUpRun = pth;
-                    pth->pDownRun = pth2;
-                    pth->pPrevSleepRun = pth->pNextSleepRun = 0;
-                } else {
-                    // insert between pth2 and pth3
-                    if (pth->pNextSleepRun = pth3) {
-                        pth3->pPrevSleepRun = pth;
-                    }
-                    pth->pPrevSleepRun = pth2;
-                    pth2->pNextSleepRun = pth->pUpRun = pth->pDownRun = pth;
-                }
-            }
-        }
+        // see if we need to reschedule. pth is pRunnable only if it is the 
+        // highest priority runnable thread.
+        if ((RunList.pRunnable == pth) && (!RunList.pth || (prio < GET_CPRIO(RunList.pth))))
+            SetReschedule();
         
     } else {
         DEBUGCHK(!((pth->wInfo >> DEBUG_LOOPCNT_SHIFT) & 1));
@@ -221,8 +233,7 @@ static void FlatEnqueue (PTHREAD pth, PPROXY pProx)
 //------------------------------------------------------------------------------
 static void RunqDequeue (PTHREAD pth, DWORD cprio)
 {
-    PTHREAD pDown, pNext;
-    DWORD prio = cprio/PRIORITY_LEVELS_HASHSCALE;
+    PTHREAD pDown;
 
     DEBUGCHK (!GET_SLEEPING (pth));
     DEBUGCHK (!pth->pUpSleep);
@@ -277,24 +288,16 @@ static void RunqDequeue (PTHREAD pth, DWORD cprio)
                     pDown->pUpRun = pDown->pDownRun = pDown;
                 } else {
                     // fixup the links
-                    if (pDown->pUpRun = pth->pUpRun)
-                        pDown->pUpRun->pDownRun = pDown;
-                    if (pDown->pDownRun = pth->pDownRun)
-                        pDown->pDownRun->pUpRun = pDown;
+                    pDown->pUpRun = pth->pUpRun;
+                    pDown->pDownRun = pth->pDownRun;
+                    pDown->pUpRun->pDownRun = pDown->pDownRun->pUpRun = pDown;
                 }
-                // fix up next node
-                if (pDown->pNextSleepRun = pth->pNextSleepRun)
-                    pDown->pNextSleepRun->pPrevSleepRun = pDown;
-
-                // fix up prev node, update pRunnable if necessary
-                if (pDown->pPrevSleepRun = pth->pPrevSleepRun) {
-                    pDown->pPrevSleepRun->pNextSleepRun = pDown;
-                } else if (RunList.pRunnable == pth) {
-                    RunList.pRunnable = pDown;
+                // update queue head and pRunnable if necessary
+                if (RunList.pRunQueue[cprio] == pth) {
+                    RunList.pRunQueue[cprio] = pDown;
+                    if (RunList.pRunnable == pth)
+                        RunList.pRunnable = pDown;
                 }
-                // update hash table if necessary
-                if (RunList.pHashThread[prio] == pth)
-                    RunList.pHashThread[prio] = pDown;
                 SET_RUNSTATE (pDown, RUNSTATE_RUNNABLE);
                 return;
             }
@@ -307,36 +310,22 @@ static void RunqDequeue (PTHREAD pth, DWORD cprio)
     }
 
     // remove pth from the run queue
-    pDown = pth->pDownRun;
-    pNext = pth->pNextSleepRun;
-    if (RunList.pHashThread[prio] == pth) {
-        RunList.pHashThread[prio] = ((pDown != pth) ? pDown :
-            (pNext && (GET_CPRIO(pNext)/PRIORITY_LEVELS_HASHSCALE == (WORD)prio)) ? pNext : 0);
-    }
-    if (pDown == pth) {
-        if (!pth->pPrevSleepRun) {
-            DEBUGCHK(RunList.pRunnable == pth);
-            if (RunList.pRunnable = pNext)
-                pNext->pPrevSleepRun = 0;
-        } else {
-            if (pth->pPrevSleepRun->pNextSleepRun = pNext)
-                pNext->pPrevSleepRun = pth->pPrevSleepRun;
-        }
+    if ((pDown = pth->pDownRun) == pth) {
+        // only thread of this priority
+        DEBUGCHK (RunList.pRunQueue[cprio] == pth);
+        RunList.pRunQueue[cprio] = 0;
+        RunqClearPrioBit (cprio);
     } else {
         pDown->pUpRun = pth->pUpRun;
         pth->pUpRun->pDownRun = pDown;
-        if (pth->pPrevSleepRun) {
-            pth->pPrevSleepRun->pNextSleepRun = pDown;
-            pDown->pPrevSleepRun = pth->pPrevSleepRun;
-            goto FinishDequeue;
-        } else if (pth == RunList.pRunnable) {
-            RunList.pRunnable = pDown;
-            DEBUGCHK(!pDown->pPrevSleepRun);
-FinishDequeue:            
-            if (pNext) {
-                pNext->pPrevSleepRun = pDown;
-                pDown->pNextSleepRun = pNext;
-            }
+        if (RunList.pRunQueue[cprio] == pth)
+            RunList.pRunQueue[cprio] = pDown;
+    }
+
+    // update pRunnable if pth was the highest priority runnable thread
+    if (RunList.pRunnable == pth) {
+        if (!(RunList.pRunnable = RunList.pRunQueue[cprio])) {
+            RunList.pRunnable = RunqFindRunnable ();
         }
     }
 }
@@ -1199,7 +1188,7 @@ void KCNextThread (void)
 {
     DWORD prio, prio2, NewTime, NewReschedTime;
     BOOL bQuantExpired;
-    PTHREAD pth, pth2, pth3, pOwner;
+    PTHREAD pth, pth2, pOwner;
     PCRIT pCrit;
     LPCRITICAL_SECTION lpcs;
     KCALLPROFON(44);
@@ -1220,77 +1209,18 @@ void KCNextThread (void)
         if (pth2 = RunList.pRunnable) {
             if (((prio = GET_CPRIO (pth)) == (prio2 = GET_CPRIO (pth2))) && bQuantExpired) {
                 // Current thread quantum expired and next runnable thread have same priority, same run list.  
-                // Use runnable thread pointer (pth2, first on list) to place current thread (pth) 
-                // last on list.
-                pth->pUpRun = pth2->pUpRun;
-                pth->pUpRun->pDownRun = pth2->pUpRun = pth;
-                pth->pDownRun = pth2;
-                pth->pPrevSleepRun = pth->pNextSleepRun = 0;
+                // Place current thread (pth) last on list.
+                RunqEnqueue (pth, prio, FALSE);
 
                 SET_RUNSTATE(pth,RUNSTATE_RUNNABLE);
                 RunList.pth = 0;
 
             } else if (prio > prio2) {
-                // there is a runable thread of higher priority, enqueue the current thread
-                prio2 = prio/PRIORITY_LEVELS_HASHSCALE;
-                if (!(pth2 = RunList.pHashThread[prio2])) {
-                    // find the preceeding non-zero hash table entry
-                    // bounded by PRIORITY_LEVELS_HASHSIZE
-                    RunList.pHashThread[prio2] = pth;
-                    while (!(pth2 = RunList.pHashThread[-- prio2]))
-                        ;
-                }
-                
-                if (prio < GET_CPRIO(pth2)) {
-                    // insert into runlist and replace the hash table entry
-                    DEBUGCHK (prio/PRIORITY_LEVELS_HASHSCALE == prio2);
-                    pth->pPrevSleepRun = pth2->pPrevSleepRun;
-                    pth->pNextSleepRun = pth2;
-                    pth->pUpRun = pth->pDownRun = RunList.pHashThread[prio2] = pth->pPrevSleepRun->pNextSleepRun = pth2->pPrevSleepRun = pth;
-
-                } else {
-                    
-                    // find the appropriate place to insert current thread
-                    // bounded by MAX_PRIORITY_HASHSCALE
-                    while ((pth3 = pth2->pNextSleepRun) && (prio >= GET_CPRIO(pth3)))
-                        pth2 = pth3;
-                    DEBUGCHK (!pth3 || (prio < GET_CPRIO(pth3)));
-                    DEBUGCHK (GET_CPRIO (pth2) <= prio);
-                    DEBUGCHK (pth);
-
-                    if (prio == GET_CPRIO(pth2)) {
-                        // Run list for current thread priority exists, make current thread first if time
-                        // left in quantum or if quantum is 0 (run to completion).
-                        if (bQuantExpired) {
-                            pth->pPrevSleepRun = pth->pNextSleepRun = 0;
-                        } else {
-                            // become the head of the list
-                            if (pth->pNextSleepRun = pth3)
-                                pth3->pPrevSleepRun = pth;
-                            if (pth->pPrevSleepRun = pth2->pPrevSleepRun)
-                                pth2->pPrevSleepRun->pNextSleepRun = pth;
-                            pth2->pNextSleepRun = pth2->pPrevSleepRun = 0;
-                            // Update hash table entry if replacing first thread on list.
-                            if (pth2 == RunList.pHashThread[prio2]) {
-                                DEBUGCHK (prio/PRIORITY_LEVELS_HASHSCALE == prio2);
-                                RunList.pHashThread[prio2] = pth;
-                            }
-                        }
-
-                        // make pth "before" pth2
-                        pth->pUpRun = pth2->pUpRun;
-                        pth->pUpRun->pDownRun = pth2->pUpRun = pth;
-                        pth->pDownRun = pth2;
+                // there is a runable thread of higher priority, enqueue the current thread.
+                // Make current thread first of its priority if time left in quantum or 
+                // if quantum is 0 (run to completion).
+                RunqEnqueue (pth, prio, !bQuantExpired);
 
-                    } else {
-                        // insert between pth2 and pth3
-                        if (pth->pNextSleepRun = pth3) {
-                            pth3->pPrevSleepRun = pth;
-                        }
-                        pth->pPrevSleepRun = pth2;
-                        pth2->pNextSleepRun = pth->pUpRun = pth->pDownRun = pth;
-                    }
-                }
                 SET_RUNSTATE(pth,RUNSTATE_RUNNABLE);
                 RunList.pth = 0;
             }
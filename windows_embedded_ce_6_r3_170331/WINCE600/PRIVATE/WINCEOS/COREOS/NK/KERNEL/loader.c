@@ -2102,7 +2102,7 @@ int CopyFromKernel(PPROCESS pprcDst, o32_lite *optr, DWORD addr)
     
     // Get a page to write to
     pPagingMem = GetPagingPage (g_pLoaderPool, &pReservation, addr, FALSE,
-                                PAGE_EXECUTE_READWRITE);
+                                PAGE_EXECUTE_READWRITE, 0);
     if (pPagingMem) {
 
         // addr is committed in kernel; switch to kernel to do the memcpy
@@ -2181,8 +2181,9 @@ int PageInModule (PPROCESS pprcDst, PMODULE pMod, DWORD addr, BOOL fWrite)
 
         // Get a page to write to
         fUsePool = (!fWrite && PageAbleOptr (&pMod->oe, optr));
+        // Module pages are at the same address in all processes, use the address as shadow key
         pPagingMem = GetPagingPage (g_pLoaderPool, &pReservation, addr, fUsePool,
-                                    PAGE_EXECUTE_READWRITE);
+                                    PAGE_EXECUTE_READWRITE, addr);
         if (pPagingMem) {
             // call the paging function based on filetype
             retval = (FA_PREFIXUP & pMod->oe.filetype)
@@ -2260,7 +2261,7 @@ int PageInProcess (PPROCESS pProc, DWORD addr, BOOL fWrite)
     // Get a page to write to
     fUsePool = (!fWrite && PageAbleOptr (&pProc->oe, optr));
     pPagingMem = GetPagingPage (g_pLoaderPool, &pReservation, addr, fUsePool,
-                                PAGE_EXECUTE_READWRITE);
+                                PAGE_EXECUTE_READWRITE, addr ^ (DWORD) pProc);
     if (pPagingMem) {
 
         retval = (FA_PREFIXUP & pProc->oe.filetype)
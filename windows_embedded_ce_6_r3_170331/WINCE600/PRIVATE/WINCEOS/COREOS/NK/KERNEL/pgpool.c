@@ -51,7 +51,7 @@ const LPWSTR g_szPoolName[2] = {
 
 typedef void PAGEFN(BOOL fCritical);
 static BOOL PageOutForced;
-extern long PageOutNeeded;
+extern long PageOutNeeded, PageOutLevel;
 extern CRITICAL_SECTION PhysCS, PageOutCS;
 #ifdef DEBUG
 extern CRITICAL_SECTION MapCS;  // Used to check critical section usage
@@ -63,6 +63,7 @@ extern DWORD currmaxprio;
 #define PAGEOUT_FILE    (1 << 2)
 static void DoPageOut (DWORD PageOutType, BOOL fCritical);
 static void PGPOOLSetCritical (PagePool_t* pPool, DWORD ThreadPrio256);
+static void PGPOOLDecayTarget (PagePool_t* pPool);
 
 
 #ifdef DEBUG
@@ -348,14 +349,21 @@ PagePoolTrimThread (
         // Done looping, clear the trim flag
         DEBUGCHK (!PoolIsCritical (pPool));
         LeaveTrim (pPool);
+        PGPOOLDecayTarget (pPool);
         
         DEBUGMSG(ZONE_PAGING, (L"PGPOOL: %s TrimThread waiting, pool size %u target %u max %u\r\n",
                                PoolName(pPool), pPool->CurSize, pPool->Target, pPool->Maximum));
+        DEBUGMSG(ZONE_PAGING, (L"PGPOOL: %s refaults %u (working set %u), target grown %u shrunk %u\r\n",
+                               PoolName(pPool), pPool->RefaultCount, pPool->WSRefaultCount,
+                               pPool->GrowCount, pPool->ShrinkCount));
         
         LeaveCriticalSection (&pPool->cs);
     }
 
     HNDLCloseHandle (g_pprcNK, pPool->hTrimEvent);
+    if (pPool->pShadow) {
+        NKfree (pPool->pShadow);
+    }
     memset (pPool, 0, sizeof(PagePool_t));
     
     DEBUGMSG(ZONE_PAGING, (L"PGPOOL: %s TrimThread exit!\r\n", PoolName(pPool)));
@@ -417,13 +425,122 @@ PGPOOLNeedsTrim (
 }
 
 
+//------------------------------------------------------------------------------
+// Move the pool target, holding or releasing the pages that back the pool
+// below its target.  Returns FALSE if there is not enough memory to grow.
+//------------------------------------------------------------------------------
+static BOOL
+PGPOOLSetTarget (
+    PagePool_t* pPool,
+    WORD        NewTarget
+    )
+{
+    long HeldOld = pPool->Target - min (pPool->Target, pPool->CurSize);
+    long HeldNew = NewTarget - min (NewTarget, pPool->CurSize);
+
+    DEBUGCHK (OwnCS (&pPool->cs));
+
+    if (HeldNew > HeldOld) {
+        // Only grow when memory is plentiful, growing the pool must never push
+        // the system into page-out or OOM.
+        if ((PageFreeCount <= PageOutLevel + (HeldNew - HeldOld))
+            || !HoldPages (HeldNew - HeldOld, FALSE)) {
+            return FALSE;
+        }
+    } else if (HeldNew < HeldOld) {
+        InterlockedExchangeAdd (&PageFreeCount, HeldOld - HeldNew);
+    }
+#ifdef DEBUG
+    InterlockedExchangeAdd (&g_PoolHeldCount, HeldNew - HeldOld);
+#endif
+
+    DEBUGMSG(ZONE_PAGING, (L"PGPOOL: %s target %u -> %u, pool size %u\r\n",
+                           PoolName(pPool), pPool->Target, NewTarget, pPool->CurSize));
+    pPool->Target = NewTarget;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------
+// Refault tracking.  Every page-in records its key in the shadow table along
+// with the pool page-in sequence number.  Pool pages are only paged in while
+// the data is not resident, so finding the key again means the data was
+// evicted since.  The number of page-ins in between (the refault distance)
+// approximates the pool size that would have kept the data resident.  If
+// that is above the current target but within reach, grow the target.
+//------------------------------------------------------------------------------
+static void
+PGPOOLCheckRefault (
+    PagePool_t* pPool,
+    DWORD       Key
+    )
+{
+    PagePoolShadow_t* pShadow;
+    DWORD Distance;
+
+    DEBUGCHK (OwnCS (&pPool->cs));
+    DEBUGCHK (pPool->pShadow);
+
+    pShadow = &pPool->pShadow[(Key * 0x9E3779B1) >> (32 - PGPOOL_SHADOW_SHIFT)];
+    if (!++pPool->PageInSeq) {
+        pPool->PageInSeq = 1;   // 0 marks unused entries
+    }
+
+    if (pShadow->PageInSeq && (pShadow->Key == Key)) {
+        Distance = pPool->PageInSeq - pShadow->PageInSeq;
+        pPool->RefaultCount++;
+
+        if ((Distance > (DWORD) pPool->Target) && (Distance <= (DWORD) PoolTargetCap (pPool))) {
+            WORD NewTarget = (WORD) min (pPool->Target + PoolAdaptIncrement (pPool), PoolTargetCap (pPool));
+
+            pPool->WSRefaultCount++;
+            if ((NewTarget > pPool->Target) && PGPOOLSetTarget (pPool, NewTarget)) {
+                pPool->GrowCount++;
+            }
+        }
+    }
+
+    pShadow->Key = Key;
+    pShadow->PageInSeq = pPool->PageInSeq;
+}
+
+
+//------------------------------------------------------------------------------
+// Called by the trim thread at the end of a trim cycle.  Give back some of the
+// target growth if there were no working set refaults since the last trim, and
+// all of it if the system is low on memory.
+//------------------------------------------------------------------------------
+static void
+PGPOOLDecayTarget (
+    PagePool_t* pPool
+    )
+{
+    DEBUGCHK (OwnCS (&pPool->cs));
+
+    if ((pPool->Target > pPool->BaseTarget)
+        && (PageOutNeeded || (pPool->WSRefaultCount == pPool->WSRefaultMark))) {
+        WORD NewTarget = pPool->BaseTarget;
+
+        if (!PageOutNeeded
+            && (pPool->Target - pPool->BaseTarget > PoolAdaptIncrement (pPool))) {
+            NewTarget = (WORD) (pPool->Target - PoolAdaptIncrement (pPool));
+        }
+        VERIFY (PGPOOLSetTarget (pPool, NewTarget));  // shrinking can't fail
+        pPool->ShrinkCount++;
+    }
+
+    pPool->WSRefaultMark = pPool->WSRefaultCount;
+}
+
+
 //------------------------------------------------------------------------------
 // Returns NULL if memory is unavailable.  In that case the caller should loop
 // and try again, perhaps freeing up other data if possible.
 //------------------------------------------------------------------------------
 static LPVOID
 PGPOOLGetPage (
-    PagePool_t* pPool
+    PagePool_t* pPool,
+    DWORD       ShadowKey
     )
 {
     LPVOID pPage = NULL;
@@ -431,6 +548,12 @@ PGPOOLGetPage (
     if (pPool) {
         EnterCriticalSection (&pPool->cs);
 
+        // Track refaults before the target is checked, so that a grown target
+        // applies to this page already
+        if (pPool->pShadow) {
+            PGPOOLCheckRefault (pPool, ShadowKey);
+        }
+
         // Adjust the trim thread state if necessary
         if (pPool->phdTrimThread) {
             if (!PoolIsTrimming (pPool)) {
@@ -531,6 +654,8 @@ PGPOOLFreePage (
                         pPool->Maximum --;  // no trimmer thread, update max too
                     }
                     pPool->Target --;
+                    if (pPool->BaseTarget > pPool->Target)
+                        pPool->BaseTarget = pPool->Target;
                     if (pPool->ReleaseIncrement > pPool->Target)
                         pPool->ReleaseIncrement = pPool->Target;
                     if (pPool->CriticalIncrement > (pPool->Maximum - pPool->Target) / 2)
@@ -560,7 +685,8 @@ GetPagingPage (
     LPVOID*     ppReservation,
     DWORD       addr,
     BOOL        fUsePool,
-    DWORD       fProtect
+    DWORD       fProtect,
+    DWORD       ShadowKey
     )
 {
     LPVOID pReservation = NULL;
@@ -587,7 +713,7 @@ GetPagingPage (
 
     if (fUsePool && pPool) {
         // Commit using a page-pool page
-        LPVOID pTemp = PGPOOLGetPage (pPool);
+        LPVOID pTemp = PGPOOLGetPage (pPool, ShadowKey);
         if (pTemp) {
             // pTemp is a static-mapped address so the VirtualCopy will not
             // increment the physical page refcount, which is perfect.
@@ -657,6 +783,7 @@ InitPoolFromParameters(
     memset (pPool, 0, sizeof(PagePool_t));
 
     pPool->Target                 = (WORD) PAGECOUNT (pParams->Target);
+    pPool->BaseTarget             = pPool->Target;
     pPool->Maximum                = (WORD) PAGECOUNT (pParams->Maximum);
     pPool->ReleaseIncrement       = (WORD) PAGECOUNT (pParams->ReleaseIncrement);
     pPool->CriticalIncrement      = (WORD) PAGECOUNT (pParams->CriticalIncrement);
@@ -665,7 +792,7 @@ InitPoolFromParameters(
 
     // Sanity check the relationships between parameters
     if (pPool->Target > pPool->Maximum)
-        pPool->Target = pPool->Maximum;
+        pPool->Target = pPool->BaseTarget = pPool->Maximum;
     if (pPool->ReleaseIncrement > pPool->Target)
         pPool->ReleaseIncrement = pPool->Target;
     if (pPool->CriticalIncrement > (pPool->Maximum - pPool->Target) / 2)
@@ -704,6 +831,12 @@ InitPoolFromParameters(
             pPool->phdTrimThread = LockHandleData (hTrimThread, g_pprcNK);
             UnlockHandleData (pPool->phdTrimThread);
 
+            // Refault tracking is optional, the pool keeps a fixed target
+            // if the shadow table can't be allocated.
+            if (NULL != (pPool->pShadow = NKmalloc (PGPOOL_SHADOW_ENTRIES * sizeof (PagePoolShadow_t)))) {
+                memset (pPool->pShadow, 0, PGPOOL_SHADOW_ENTRIES * sizeof (PagePoolShadow_t));
+            }
+
         } else {
             DEBUGMSG (ZONE_PAGING, (TEXT("PGPOOL: no trim thread for %s pool\r\n"),
                                     PoolName(pPool)));
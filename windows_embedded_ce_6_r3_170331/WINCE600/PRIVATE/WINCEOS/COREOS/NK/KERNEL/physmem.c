@@ -35,6 +35,17 @@
 #define PAGEOUT_HIGH        ((132*1024)/VM_PAGE_SIZE)
 #define PAGE_OUT_TRIGGER    (( 24*1024)/VM_PAGE_SIZE)  // page out if below highwater and this much paged in recently
 
+#define ZEROED_PAGE_LOW     (( 64*1024)/VM_PAGE_SIZE)  // minimum low watermark of the zeroed pool
+#define ZEROED_PAGE_HIGH    ((256*1024)/VM_PAGE_SIZE)  // minimum high watermark of the zeroed pool
+#define ZEROED_PAGE_SHIFT   4                          // default high watermark is 1/16 of the pages in the system
+
+// Can be overwritten as FIXUPVARs in config.bib to set the zeroed pool watermarks (in pages), eg:
+//    kernel.dll:ZeroedPoolLowPages           00000000 00000040 FIXUPVAR
+//    kernel.dll:ZeroedPoolHighPages          00000000 00000200 FIXUPVAR
+// 0 means the watermark is derived from the number of pages in the system.
+const volatile DWORD ZeroedPoolLowPages     = 0;
+const volatile DWORD ZeroedPoolHighPages    = 0;
+
 HANDLE g_hOOMEvent;
 long g_cpLowThreshold       = STACK_RESERVE;
 long g_cpCriticalThreshold  = STACK_RESERVE;
@@ -45,6 +56,15 @@ long g_cpCriticalBlockSize  = VM_PAGE_SIZE;
 DLIST g_cleanPageList;
 DLIST g_dirtyPageList;
 
+// g_cCleanPages is the number of pre-zeroed pages in g_cleanPageList. The background page
+// cleaner refills the pool up to g_cpZeroedHigh, and is woken up by the allocation path
+// when the pool drops below g_cpZeroedLow. Since pages are only added to the clean list by
+// the page cleaner (and at init), the clean list never grows beyond g_cpZeroedHigh pages.
+// The watermarks are set in InitMemoryPool, scaled to the number of pages in the system.
+long g_cCleanPages;
+long g_cpZeroedLow          = ZEROED_PAGE_LOW;
+long g_cpZeroedHigh         = ZEROED_PAGE_HIGH;
+
 
 // the maximum (lowest) priority to keep a thread's stack from being scavanged
 // any thread of this priority or higher will never have its stack scvanaged.
@@ -191,9 +211,44 @@ static void  LinkCleanPage (PDLIST pMem, PFREEINFO pfi, DWORD dwPfn)
 {
     KCALLPROFON(32);
     LinkPage (&g_cleanPageList, pMem, pfi, dwPfn);
+    g_cCleanPages ++;
     KCALLPROFOFF(32);
 }
 
+//------------------------------------------------------------------------------
+// find out if a free page is on the clean list. A clean page reaches the clean
+// list head within g_cCleanPages steps, so the walk is bounded by the size of
+// the pre-zeroed pool and never scans the dirty list.
+//------------------------------------------------------------------------------
+static BOOL IsCleanPage (PDLIST pMem)
+{
+    long cSteps;
+
+    for (cSteps = g_cCleanPages; cSteps > 0; cSteps --) {
+        pMem = pMem->pFwd;
+        if (&g_cleanPageList == pMem) {
+            return TRUE;
+        }
+        if (&g_dirtyPageList == pMem) {
+            break;
+        }
+    }
+    return FALSE;
+}
+
+//------------------------------------------------------------------------------
+// wake up the background page cleaner if the pre-zeroed pool dropped below the
+// low watermark and there are dirty pages to clean.
+//------------------------------------------------------------------------------
+static void CheckZeroedPagePool (void)
+{
+    if (pEvtDirtyPage
+        && (g_cCleanPages < g_cpZeroedLow)
+        && !IsDListEmpty (&g_dirtyPageList)) {
+        EVNTModify (pEvtDirtyPage, EVENT_SET);
+    }
+}
+
 //
 // KC_GrabFirstPhysPage - grab a page, fHeld specifies if we already hold the page.
 //
@@ -219,11 +274,13 @@ PDLIST KC_GrabFirstPhysPage (DWORD dwRefCnt, DWORD dwPageType, BOOL fHeld)
             // try clean page list if there is no dirty pages        
             } else if (!IsDListEmpty (&g_cleanPageList)) {
                 pMem = g_cleanPageList.pFwd;
+                g_cCleanPages --;
             }
 
         // try clean page list first, if requesting clean page
         } else if (!IsDListEmpty (&g_cleanPageList)) {
             pMem = g_cleanPageList.pFwd;
+            g_cCleanPages --;
             fNeedClean = FALSE;     // indicate the page is already cleaned
 
         // if there is a dirty page, just use it
@@ -315,6 +372,7 @@ DWORD GetHeldPage (DWORD dwPageType)
         }
 #endif
         dwPfn = GetPFN (pMem);
+        CheckZeroedPagePool ();
     }
     DEBUGMSG(ZONE_PHYSMEM,(TEXT("GetHeldPage: Returning %8.8lx (%8.8lx)\r\n"), dwPfn, Pfn2Virt (dwPfn)));
     return dwPfn;
@@ -385,6 +443,9 @@ LPVOID GrabOnePage (DWORD dwPageType)
         
     } else if (HoldPages (1, FALSE)) {
         pMem = (PDLIST) KCall ((PKFN) KC_GrabFirstPhysPage, 1, dwPageType, TRUE);
+        if (pMem) {
+            CheckZeroedPagePool ();
+        }
     }    
 
     if (pMem) {
@@ -500,6 +561,8 @@ NKGetKPhys(
 
         LeaveCriticalSection (&PhysCS);
 
+        CheckZeroedPagePool ();
+
         if (bRet = !dwCount) {
             // got all the pages, zero them if necessary
             pPages = (PDLIST *)ptr;
@@ -573,6 +636,7 @@ void InitMemoryPool (void)
                 // adding to clean list, zero the page
                 if (&g_cleanPageList == pPageList) {
                     ZeroPage (pPage);
+                    g_cCleanPages ++;
                 }
 
                 // link the page to either clean or dirty list. Note that we're in system initialization phase,
@@ -587,6 +651,20 @@ void InitMemoryPool (void)
         }
     }
 
+    // scale the zeroed pool watermarks to the system, unless the OEM overrides them. The
+    // high watermark also bounds the IsCleanPage walk, so it's kept to a fraction of RAM.
+    g_cpZeroedHigh = ZeroedPoolHighPages
+                   ? (long) ZeroedPoolHighPages
+                   : max (ZEROED_PAGE_HIGH, KInfoTable[KINX_NUMPAGES] >> ZEROED_PAGE_SHIFT);
+    g_cpZeroedLow  = ZeroedPoolLowPages
+                   ? (long) ZeroedPoolLowPages
+                   : max (ZEROED_PAGE_LOW, g_cpZeroedHigh / 4);
+    if (g_cpZeroedLow >= g_cpZeroedHigh) {
+        g_cpZeroedLow = g_cpZeroedHigh / 4;
+    }
+    DEBUGMSG(ZONE_MEMORY,(TEXT("InitMemoryPool: zeroed pool watermarks low=%d high=%d\r\n"),
+            g_cpZeroedLow, g_cpZeroedHigh));
+
     // write-back cache for the pages we zero'd
     OEMCacheRangeFlush (NULL, 0, CACHE_SYNC_WRITEBACK);
     KInfoTable[KINX_MINPAGEFREE] = PageFreeCount;
@@ -623,6 +701,11 @@ PDLIST GetADirtyPage (PFREEINFO *ppfi, LPDWORD pdwPfn)
 // there are pages in the dirty page list, and we get into idle, we might as well clean the 
 // dirty pages such that future memory allocation is more likely to get a clean page.
 //
+// The pool of clean pages is kept between g_cpZeroedLow and g_cpZeroedHigh. We stop
+// cleaning once the pool reaches the high watermark, and the allocation path wakes us
+// up again when the pool drops below the low watermark. The high watermark scales with
+// the size of RAM (see InitMemoryPool).
+//
 void CleanPagesInTheBackground (void)
 {
 
@@ -639,7 +722,8 @@ void CleanPagesInTheBackground (void)
         DEBUGMSG (ZONE_PHYSMEM, (L"CleanPagesInTheBackground - pFwd = %8.8lx, pBack = %8.8lx\r\n",
                         g_dirtyPageList.pFwd, g_dirtyPageList.pBack));
 
-        while (pMem = (PDLIST) KCall ((PKFN) GetADirtyPage, &pfi, &dwPfn)) {
+        while ((g_cCleanPages < g_cpZeroedHigh)
+            && (pMem = (PDLIST) KCall ((PKFN) GetADirtyPage, &pfi, &dwPfn))) {
             DEBUGMSG (ZONE_PHYSMEM, (L"Cleaning page %8.8lx\r\n", pMem));
             // debug build softlog, useful to find cache issue
             SoftLog (0x88888888, (DWORD)pMem);
@@ -839,6 +923,9 @@ TakeSpecificPage(
         // debug build softlog, useful to find cache issue
         SoftLog (0x22222222, (DWORD)pMem);
         pfi->pUseMap[ix] = TRANSITION_PAGE;
+        if (IsCleanPage (pMem)) {
+            g_cCleanPages --;
+        }
         RemoveDList (pMem);
     }
     KCALLPROFOFF(40);
@@ -860,6 +947,7 @@ GiveSpecificPage(
         // debug build softlog, useful to find cache issue
         SoftLog (0x22222223, (DWORD)pMem);
         pfi->pUseMap[ix] = 0;
+        // always given back as dirty, g_cCleanPages is unchanged
         AddToDListHead (&g_dirtyPageList, pMem);
     }
     KCALLPROFOFF(40);
@@ -945,6 +1033,9 @@ GetContiguousPages(
         InterlockedExchangeAdd (&PageFreeCount, dwPages);
     }
 foundPages:
+    // TakeSpecificPage can take pages from the clean list, refill it if we drained it.
+    CheckZeroedPagePool ();
+
     if (INVALID_PHYSICAL_ADDRESS != paRet) {
         // the pages we got can come from both clean and dirty list, just do a
         // CACHE_SYNC_DISCARD here to make sure cache coherency.
@@ -56,6 +56,11 @@
     threads off of queues and put them on other queues.  NextThread finds the
     next thread to run, or returns 0 if there are no runnable threads.  We preempt
     with a fixed timeslice (probably 10ms).
+
+    The kernel runs on a single CPU and all run queue manipulation is done inside
+    KCalls, so there is exactly one run queue (RunList) and no lock around it.  The
+    per-priority queues are indexed by a bitmap of non-empty priorities, making both
+    queueing a thread and finding the highest priority runnable thread O(1).
 */
 
 CRITICAL_SECTION csDbg, NameCS, CompCS, ModListcs, MapCS, PagerCS;
@@ -120,6 +125,10 @@ ERRFALSE(offsetof(CRIT, pNextOwned) == offsetof(MUTEX, pNextOwned));
 ERRFALSE(offsetof(CRIT, pUpOwned) == offsetof(MUTEX, pUpOwned));
 ERRFALSE(offsetof(CRIT, pDownOwned) == offsetof(MUTEX, pDownOwned));
 
+ERRFALSE(offsetof(RunList_t, pRunnable) == 0);
+ERRFALSE(offsetof(RunList_t, pth) == 4);
+ERRFALSE((RUNQ_PRIO_GROUPS << RUNQ_PRIO_GROUP_SHIFT) == MAX_CE_PRIORITY_LEVELS);
+ERRFALSE(RUNQ_PRIO_GROUPS <= 32);
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -42,6 +42,8 @@ static const PFNVOID EvntMthds[] = {
     (PFNVOID)WDStop,
     (PFNVOID)WDRefresh,
     (PFNVOID)EVNTResumeMainThread,     // BC work around - allow ResumeThread called on process event
+    (PFNVOID)MSGQReadBatch,
+    (PFNVOID)MSGQWriteBatch,
 };
 
 static const ULONGLONG evntSigs [] = {
@@ -57,6 +59,8 @@ static const ULONGLONG evntSigs [] = {
     FNSIG1 (DW),                                // StopWatchDogTimer
     FNSIG1 (DW),                                // RefreshWatchDogTimer
     FNSIG2 (DW, O_PDW),                         // ResumeMainThread
+    FNSIG6 (DW, O_PTR, DW, O_PDW, DW, O_PDW),   // ReadMsgQueueBatch
+    FNSIG5 (DW, I_PTR, DW, DW, O_PDW),          // WriteMsgQueueBatch
 };
 
 ERRFALSE ((sizeof(EvntMthds) / sizeof(EvntMthds[0])) == (sizeof(evntSigs) / sizeof(evntSigs[0])));
@@ -58,6 +58,16 @@ typedef union {  // Union so that the buffer is the max of all these and aligned
     };
 } ModuleInfoBuffer;
 
+#define MAX_KHEAP_MSGLEN 96
+
+typedef struct {
+    union {
+        CEL_DEBUG_MSG cl;
+        BYTE _b;  // Work around compiler warning on zero-length array
+    };
+    WCHAR _sz[MAX_KHEAP_MSGLEN];  // Accessed through cl.szMessage
+} KHeapInfoBuffer;
+
 
 static void CELOG_KCLogProcessInfo(PPROCESS pProcess, LPCWSTR lpProcName,
                                    ProcessInfoBuffer* pProcessBuf);
@@ -1297,10 +1307,33 @@ union {  // Union so that the buffer is the max of all these and aligned properl
     ProcessInfoBuffer ProcessBuf;
     ThreadInfoBuffer  ThreadBuf;
     ModuleInfoBuffer  ModuleBuf;
+    KHeapInfoBuffer   KHeapBuf;
     CEL_SYSTEM_INVERT PriorityInvertBuf;
 } g_CeLogSyncBuffer;
 
 
+//------------------------------------------------------------------------------
+// Format into a sync buffer, NKwvsprintfW only takes a va_list
+//------------------------------------------------------------------------------
+static DWORD
+CELOG_SyncPrintf(
+    LPWSTR  pszBuf,
+    int     cchBuf,
+    LPCWSTR pszFmt,
+    ...
+    )
+{
+    va_list args;
+
+    va_start(args, pszFmt);
+    NKwvsprintfW(pszBuf, pszFmt, args, cchBuf);
+    va_end(args);
+
+    return NKwcslen(pszBuf);
+}
+
+
+
 //------------------------------------------------------------------------------
 // Helper func to generate CeLog process events, minimizing stack usage.
 //------------------------------------------------------------------------------
@@ -1394,3 +1427,34 @@ CELOG_SyncModuleRefCount(
 
     return TRUE;
 }
+
+
+//------------------------------------------------------------------------------
+// Helper func to log the usage and hit/miss statistics of a kernel heap pool.
+// There is no dedicated event for the kernel heap, the statistics are logged
+// as a debug message in the heap zone.
+//------------------------------------------------------------------------------
+void
+CELOG_SyncKHeap(      // Done inside a KCall
+    DWORD idx
+    )
+{
+    KHeapInfoBuffer* pKHeapBuf = &g_CeLogSyncBuffer.KHeapBuf;
+    heapptr_t*       hptr = &heapptr[idx];
+    WORD             wLen;
+
+    DEBUGCHK (InSysCall());  // Must be in a KCall
+    DEBUGCHK (idx < NUMARENAS);
+
+    pKHeapBuf->cl.pid = g_pprcNK->dwId;
+    pKHeapBuf->cl.tid = pCurThread->dwId;
+
+    wLen = (WORD) (CELOG_SyncPrintf(pKHeapBuf->cl.szMessage, MAX_KHEAP_MSGLEN,
+                                    L"KHeap %u (%u): used=%u max=%u hit=%u miss=%u",
+                                    idx, hptr->size, hptr->cUsed, hptr->cMax,
+                                    heapstat[idx].cHit, heapstat[idx].cMiss) + 1);
+
+    g_pfnCeLogData(TRUE, CELID_DEBUG_MSG, (PVOID) &pKHeapBuf->cl,
+                   (WORD)(sizeof(CEL_DEBUG_MSG) + (wLen * sizeof(WCHAR))),
+                   0, CELZONE_HEAP, 0, FALSE);
+}
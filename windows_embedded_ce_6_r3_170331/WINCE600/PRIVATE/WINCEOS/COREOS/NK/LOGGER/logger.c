@@ -955,6 +955,14 @@ KCallCeLogReSync()
             } while (pmlCur && (pmlFirst != ((PMODULELIST) pmlCur->link.pFwd)));
         }
 
+        // Log the kernel heap pool statistics
+        if (IsCeLogEnabled(CELOGSTATUS_ENABLED_ANY, CELZONE_HEAP)) {
+            DWORD idx;
+            for (idx = 0; idx < NUMARENAS; idx++) {
+                CELOG_SyncKHeap(idx);
+            }
+        }
+
         // Send a sync end marker
         g_pfnCeLogData(FALSE, CELID_SYNC_END, NULL, 0, 0, CELZONE_ALWAYSON,
                        0, FALSE);
@@ -1769,7 +1769,8 @@ DWORD PageFromMapper (PPROCESS pprc, DWORD dwAddr, BOOL fWrite)
 
             // Get a page to write to
             pPagingPage = GetPagingPage (g_pFilePool, &pReservation, dwAddr,
-                                         fUsePool, PAGE_READWRITE);
+                                         fUsePool, PAGE_READWRITE,
+                                         (DWORD) pfsmap ^ (DWORD) (liFileOffset.QuadPart >> VM_PAGE_SHIFT));
             if (pPagingPage) {
                 // Read the file data into the page, and store it in the page tree
                 dwRet = MAPPageInPage (pfsmap, &liFileOffset, pPagingPage);
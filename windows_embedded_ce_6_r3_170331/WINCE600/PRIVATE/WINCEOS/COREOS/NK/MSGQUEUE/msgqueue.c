@@ -102,6 +102,21 @@ static BOOL ResetQEvent (PHDATA phdQ)
     return phdQ? EVNTModify ((PEVENT) phdQ->pvObj, EVENT_RESET) : FALSE;
 }
 
+//
+// IsRoomAvailable - can a writer get a node without waiting, queue is locked
+//
+// NOTE: The reader/writer events are manual reset events, which are set when the queue is 
+//       not empty/full, and reset (under the queue lock) only when the queue is empty/full. 
+//       Thus we only need to signal them when the queue changes from empty to not-empty, or
+//       from full to not-full, saving an event operation on every read/write.
+//
+static BOOL IsRoomAvailable (PMSGQUEUE lpQ)
+{
+    DEBUGCHK (OwnCS (&lpQ->csLock));
+    return lpQ->pFreeList
+        || ((lpQ->dwFlags & MSGQUEUE_NOPRECOMMIT) && (lpQ->dwCurNumMsg < lpQ->dwMaxNumMsg));
+}
+
 static DWORD WaitQEvent (PHDATA phdQ, DWORD dwTimeout)
 {
     DEBUGCHK (phdQ);
@@ -579,7 +594,77 @@ static DWORD WaitForQueueEvent (PHDATA phdQ, PMSGQUEUE lpQ, DWORD dwTimeout, DWO
 // for perf improvemnt
 #define COPY_THRESHOLD  128
 
-BOOL  MSGQRead (
+//
+// ReleaseNode - release a node that has been read and is no longer in the queue, queue is locked
+//
+static void ReleaseNode (PMSGQUEUE lpQ, PMSGNODE lpN)
+{
+    if (lpQ->pAlert == lpN) {
+
+        lpQ->pAlert = NULL;
+
+    // final queue data management (node release, max # of messages, etc)
+    } else if ((lpQ->dwFlags & MSGQUEUE_NOPRECOMMIT)
+        && (lpQ->pFreeList || (lpN->dwDataSize != lpQ->cbMaxMessage))) {
+
+        // not pre-commit, and can't cache the node -- free it
+        MsgQfree (lpN);
+
+    } else {
+
+        // max specified, or cached node
+        lpN->pNext = lpQ->pFreeList;
+        lpQ->pFreeList = lpN;
+    }
+}
+
+//
+// TakeFreeNode - get a node to write a message to, queue is locked. Returns NULL with 
+//                *pdwErr == 0 if the queue is full.
+//
+static PMSGNODE TakeFreeNode (PMSGQUEUE lpQ, DWORD cbDataSize, DWORD dwFlags, LPDWORD pdwErr)
+{
+    PMSGNODE lpN = NULL;
+
+    *pdwErr = 0;
+
+    // check msg size limitation
+    if (cbDataSize > lpQ->cbMaxMessage) {
+        *pdwErr = ERROR_INSUFFICIENT_BUFFER;
+
+    } else if (!GetHandleCountFromHDATA (lpQ->phdWriter)) {
+        // all handle to the write-end closed while we're writing.
+        *pdwErr = ERROR_INVALID_HANDLE;
+
+    // queue broken?
+    } else if (!(lpQ->dwFlags & MSGQUEUE_ALLOW_BROKEN) && !GetHandleCountFromHDATA (lpQ->phdReader)) {
+        *pdwErr = ERROR_PIPE_NOT_CONNECTED;
+
+    // alert message?
+    } else if ((dwFlags & MSGQUEUE_MSGALERT) && !lpQ->pAlert) {
+        // alert buffer is right after the queue
+        lpQ->pAlert = lpN = (PMSGNODE)(lpQ + 1);
+
+    // anything in the free list?
+    } else if (lpN = lpQ->pFreeList) {
+        lpQ->pFreeList = lpN->pNext;
+
+    // allocate memory if not pre-commit
+    } else if ((lpQ->dwFlags & MSGQUEUE_NOPRECOMMIT)
+        && (lpQ->dwCurNumMsg < lpQ->dwMaxNumMsg)) {
+
+        if (!(lpN = (PMSGNODE) MsgQmalloc (cbDataSize + sizeof(MSGNODE)))) {
+            *pdwErr = ERROR_OUTOFMEMORY;
+        }
+    }
+
+    return lpN;
+}
+
+//
+// ReadOneMessage - read a message, return error code
+//
+static DWORD ReadOneMessage (
     PEVENT  lpe,                    // Event object of the message queue
     LPVOID  lpBuffer,               // OUT only
     DWORD   cbSize,
@@ -604,6 +689,7 @@ BOOL  MSGQRead (
 
         DWORD    dwWakeupTime = (INFINITE == dwTimeout)? INFINITE : (OEMGetTickCount () + dwTimeout);
         PMSGNODE lpN;
+        PHDATA   phdWriter = NULL;
 
         LockQueue (lpQ);
         do {
@@ -639,6 +725,7 @@ BOOL  MSGQRead (
             } else {
 
                 BOOL   fUnlocked = FALSE;
+                BOOL   fSignalWriter = !IsRoomAvailable (lpQ);  // was the queue full?
                 // data available, check size. Succeed even if passed in buffer is < message size (MSDN).
                 if (cbSize < lpN->dwDataSize) {
                     dwErr = ERROR_INSUFFICIENT_BUFFER;
@@ -687,27 +774,21 @@ BOOL  MSGQRead (
                     LockQueue (lpQ);
                 }
 
-                if (lpQ->pAlert == lpN) {
-
-                    lpQ->pAlert = NULL;
-
-                // final queue data management (node release, max # of messages, etc)
-                } else if ((lpQ->dwFlags & MSGQUEUE_NOPRECOMMIT)
-                    && (lpQ->pFreeList || (lpN->dwDataSize != lpQ->cbMaxMessage))) {
-
-                    // not pre-commit, and can't cache the node -- free it
-                    MsgQfree (lpN);
+                // the queue can become full while it's unlocked
+                if (!IsRoomAvailable (lpQ)) {
+                    fSignalWriter = TRUE;
+                }
 
-                } else {
+                ReleaseNode (lpQ, lpN);
 
-                    // max specified, or cached node
-                    lpN->pNext = lpQ->pFreeList;
-                    lpQ->pFreeList = lpN;
+                // signal room available for write if the queue was full. Same as the writer
+                // signaling the reader, don't signal while holding the lock, lock the HDATA of
+                // writer event here and signal it once we release the lock.
+                if (fSignalWriter && lpQ->phdWriter) {
+                    phdWriter = lpQ->phdWriter;
+                    LockHDATA (phdWriter);
                 }
 
-                // signal room available for write
-                SetQEvent (lpQ->phdWriter);
-
                 // Need to reset event if queue is empty. Otherwise, codes using 
                 // "WaitForSingleObject/WaitForMultipleObjects" on queue handle will get
                 // signaled, while there is no data in the queue.
@@ -720,76 +801,205 @@ BOOL  MSGQRead (
         }
 
         UnlockQueue (lpQ);
+
+        if (phdWriter) {
+            SetQEvent (phdWriter);
+            UnlockHandleData (phdWriter);
+        }
     }
 
+    return dwErr;
+}
+
+BOOL  MSGQRead (
+    PEVENT  lpe,                    // Event object of the message queue
+    LPVOID  lpBuffer,               // OUT only
+    DWORD   cbSize,
+    LPDWORD lpNumberOfBytesRead,    // OUT only
+    DWORD   dwTimeout,
+    LPDWORD pdwFlags,               // OUT only
+    PHANDLE phTok                   // OUT only, to receive sender's token
+    )
+{
+    DWORD dwErr = ReadOneMessage (lpe, lpBuffer, cbSize, lpNumberOfBytesRead, dwTimeout, pdwFlags, phTok);
+
     SetLastError (dwErr);
     return (!dwErr || (ERROR_INSUFFICIENT_BUFFER == dwErr));
 }
 
-BOOL MSGQWrite (
+//
+// MSGQReadBatch - read as many messages as fit in the buffer. Only the first message is 
+//                 waited for. Each message is stored as a MSGQUEUEBATCHENTRY followed by 
+//                 its data, padded to a DWORD boundary. The whole batch is read under a 
+//                 single acquisition of the queue lock, and the writer is signaled once.
+//                 If the first message doesn't fit, *lpNumberOfBytesRead is set to the 
+//                 buffer size it needs.
+//
+BOOL MSGQReadBatch (
     PEVENT  lpe,                    // Event object of the message queue
-    LPCVOID lpBuffer,               // IN only
-    DWORD   cbDataSize,
+    LPVOID  lpBuffer,               // OUT only
+    DWORD   cbSize,
+    LPDWORD lpNumberOfBytesRead,    // OUT only
     DWORD   dwTimeout,
-    DWORD   dwFlags
+    LPDWORD lpcMsgs                 // OUT only, # of messages read
     )
 {
     DWORD       dwErr = ERROR_INVALID_HANDLE;
+    DWORD       cbRead = 0;
+    DWORD       cMsgs = 0;
     PMSGQUEUE   lpQ;
 
     // validate parameters
-    if (!lpBuffer || !cbDataSize) { // invalid queue
+    if (   !lpBuffer
+        || ((int) cbSize <= 0)
+        || !lpNumberOfBytesRead
+        || !lpcMsgs) {
         dwErr = ERROR_INVALID_PARAMETER;
 
-    // valid writer end of the queue?
-    } else if (ISWRITER(lpe) && (lpQ = lpe->pMsgQ)) {
+    // make sure thisis the reader end of the queue
+    } else if (!ISWRITER (lpe) && (lpQ = lpe->pMsgQ)) {
 
-        PMSGNODE   lpN = NULL;
-        DWORD      dwWakeupTime = (INFINITE == dwTimeout)? INFINITE : (OEMGetTickCount () + dwTimeout);
-        PHDATA     phdReader = NULL;
+        DWORD    dwWakeupTime = (INFINITE == dwTimeout)? INFINITE : (OEMGetTickCount () + dwTimeout);
+        PMSGNODE lpN;
+        PHDATA   phdWriter = NULL;
 
         LockQueue (lpQ);
-
         do {
+        
+            if (!GetHandleCountFromHDATA (lpQ->phdReader)) {
+                // all handle to the read-end closed while we're reading.
+                dwErr = ERROR_INVALID_HANDLE;
+                break;
+            }
             
-            // check msg size limitation
-            if (cbDataSize > lpQ->cbMaxMessage) {
-                dwErr = ERROR_INSUFFICIENT_BUFFER;
+            // queue broken?            
+            if (!(lpQ->dwFlags & MSGQUEUE_ALLOW_BROKEN) && !GetHandleCountFromHDATA (lpQ->phdWriter)) {
+                dwErr = ERROR_PIPE_NOT_CONNECTED;
                 break;
             }
-
-            if (!GetHandleCountFromHDATA (lpQ->phdWriter)) {
-                // all handle to the write-end closed while we're writing.
-                dwErr = ERROR_INVALID_HANDLE;
+            
+            // any data available?
+            if (!IS_QUEUE_EMPTY (lpQ)) {
+                dwErr = 0;
                 break;
             }
+        } while (!(dwErr = WaitForQueueEvent (lpQ->phdReader, lpQ, dwTimeout, dwWakeupTime)));
 
-            // queue broken?
-            if (!(lpQ->dwFlags & MSGQUEUE_ALLOW_BROKEN) && !GetHandleCountFromHDATA (lpQ->phdReader)) {
-                dwErr = ERROR_PIPE_NOT_CONNECTED;
-                break;
+        if (!dwErr) {
+
+            BOOL fSignalWriter = !IsRoomAvailable (lpQ);    // was the queue full?
+
+            // the batch ends at the first message that doesn't fit or when the queue is empty
+            while (lpN = (lpQ->pAlert? lpQ->pAlert : lpQ->pHead)) {
+
+                LPBYTE              pbEntry = (LPBYTE) lpBuffer + cbRead;
+                DWORD               cbNeeded = sizeof (MSGQUEUEBATCHENTRY) + lpN->dwDataSize;
+                MSGQUEUEBATCHENTRY  entry;
+
+                if (cbSize - cbRead < cbNeeded) {
+                    if (!cMsgs) {
+                        // tell the caller how big a buffer it needs, the message stays queued
+                        dwErr = ERROR_INSUFFICIENT_BUFFER;
+                        cbRead = cbNeeded;
+                    }
+                    break;
+                }
+
+                entry.cbData  = lpN->dwDataSize;
+                entry.dwFlags = lpN->dwFlags;
+
+                __try {
+                    memcpy (pbEntry, &entry, sizeof (entry));
+                    memcpy (pbEntry + sizeof (entry), (lpN+1), entry.cbData);
+                } __except (EXCEPTION_EXECUTE_HANDLER) {
+                    // the message is lost, same as a copy error in MSGQRead
+                    DEBUGMSG(1 ,(TEXT("ReadMsgQueueBatch: copy data error\r\n")));
+                    dwErr = ERROR_INVALID_PARAMETER;
+                }
+
+                // unlock the sender's token, the batch doesn't return it
+                UnlockHandleData (lpN->phdTok);
+                lpN->phdTok = NULL;
+
+                if (lpQ->pAlert != lpN) {
+                    DEBUGCHK (lpN == lpQ->pHead);
+                    Dequeue (lpQ);
+                    lpQ->dwCurNumMsg --;
+                }
+                ReleaseNode (lpQ, lpN);
+
+                if (dwErr) {
+                    break;
+                }
+
+                cMsgs ++;
+                cbRead += MSGQ_BATCH_ENTRY_SIZE (entry.cbData);
+                if (cbRead >= cbSize) {
+                    break;
+                }
             }
 
-            // alert message?
-            if ((dwFlags & MSGQUEUE_MSGALERT) && !lpQ->pAlert) {
-                // alert buffer is right after the queue
-                lpQ->pAlert = lpN = (PMSGNODE)(lpQ + 1);
-                break;
+            if (cMsgs && (cbRead > cbSize)) {
+                // no padding after the last message
+                cbRead = cbSize;
             }
 
-            // anything in the free list?
-            if (lpN = lpQ->pFreeList) {
-                lpQ->pFreeList = lpN->pNext;
-                break;
+            // signal room available for write once for the whole batch if the queue was full,
+            // after we release the lock (see MSGQRead).
+            if (fSignalWriter && IsRoomAvailable (lpQ) && lpQ->phdWriter) {
+                phdWriter = lpQ->phdWriter;
+                LockHDATA (phdWriter);
             }
 
-            // allocate memory if not pre-commit
-            if ((lpQ->dwFlags & MSGQUEUE_NOPRECOMMIT)
-                && (lpQ->dwCurNumMsg < lpQ->dwMaxNumMsg)) {
+            if (IS_QUEUE_EMPTY (lpQ)) {
+                ResetQEvent (lpQ->phdReader);
+            }
+        }
 
-                if (!(lpN = (PMSGNODE) MsgQmalloc (cbDataSize + sizeof(MSGNODE)))) {
-                    dwErr = ERROR_OUTOFMEMORY;
-                }
+        UnlockQueue (lpQ);
+
+        if (phdWriter) {
+            SetQEvent (phdWriter);
+            UnlockHandleData (phdWriter);
+        }
+
+        *lpNumberOfBytesRead = cbRead;
+        *lpcMsgs = cMsgs;
+    }
+
+    SetLastError (dwErr);
+    return !dwErr;
+}
+
+//
+// WriteOneMessage - write a message, return error code
+//
+static DWORD WriteOneMessage (
+    PEVENT  lpe,                    // Event object of the message queue
+    LPCVOID lpBuffer,               // IN only
+    DWORD   cbDataSize,
+    DWORD   dwTimeout,
+    DWORD   dwFlags
+    )
+{
+    DWORD       dwErr = ERROR_INVALID_HANDLE;
+    PMSGQUEUE   lpQ;
+
+    // validate parameters
+    if (!lpBuffer || !cbDataSize) { // invalid queue
+        dwErr = ERROR_INVALID_PARAMETER;
+
+    // valid writer end of the queue?
+    } else if (ISWRITER(lpe) && (lpQ = lpe->pMsgQ)) {
+
+        PMSGNODE   lpN = NULL;
+        DWORD      dwWakeupTime = (INFINITE == dwTimeout)? INFINITE : (OEMGetTickCount () + dwTimeout);
+        PHDATA     phdReader = NULL;
+
+        LockQueue (lpQ);
+
+        do {
+            if ((lpN = TakeFreeNode (lpQ, cbDataSize, dwFlags, &dwErr)) || dwErr) {
                 break;
             }
             // when we gets here, queue is full.
@@ -832,6 +1042,10 @@ BOOL MSGQWrite (
             
             if (!dwErr) {
 
+                // only need to signal the reader if the queue was empty (an alert message 
+                // is always signaled)
+                BOOL fSignalReader = (lpQ->pAlert == lpN) || IS_QUEUE_EMPTY (lpQ);
+
                 if (lpQ->pAlert != lpN) {
                     Enqueue (lpQ, lpN);
 
@@ -846,7 +1060,7 @@ BOOL MSGQWrite (
                 // cause extra context switches if writer is lower in priority.
                 // So, we lock the HDATA of reader event here and will signal it
                 // once we release the lock.
-                if (lpQ->phdReader) {
+                if (fSignalReader && lpQ->phdReader) {
                     phdReader = lpQ->phdReader;
                     LockHDATA (phdReader);
                 }
@@ -895,11 +1109,151 @@ BOOL MSGQWrite (
         }
     }
 
+    return dwErr;
+}
+
+BOOL MSGQWrite (
+    PEVENT  lpe,                    // Event object of the message queue
+    LPCVOID lpBuffer,               // IN only
+    DWORD   cbDataSize,
+    DWORD   dwTimeout,
+    DWORD   dwFlags
+    )
+{
+    DWORD dwErr = WriteOneMessage (lpe, lpBuffer, cbDataSize, dwTimeout, dwFlags);
+
     SetLastError (dwErr);
     return NOERROR == dwErr;
 
 }
 
+//
+// MSGQWriteBatch - write a sequence of messages, laid out as for MSGQReadBatch. Only the 
+//                  first message waits for room in the queue; the batch stops when the 
+//                  queue is full. The whole batch is written under a single acquisition 
+//                  of the queue lock, and the reader is signaled once.
+//
+BOOL MSGQWriteBatch (
+    PEVENT  lpe,                    // Event object of the message queue
+    LPCVOID lpBuffer,               // IN only
+    DWORD   cbSize,
+    DWORD   dwTimeout,
+    LPDWORD lpcMsgs                 // OUT only, # of messages written
+    )
+{
+    DWORD       dwErr = ERROR_INVALID_HANDLE;
+    DWORD       cbWritten = 0;
+    DWORD       cMsgs = 0;
+    PMSGQUEUE   lpQ;
+
+    // validate parameters
+    if (!lpBuffer || !cbSize || !lpcMsgs) {
+        dwErr = ERROR_INVALID_PARAMETER;
+
+    // valid writer end of the queue?
+    } else if (ISWRITER(lpe) && (lpQ = lpe->pMsgQ)) {
+
+        DWORD       dwWakeupTime = (INFINITE == dwTimeout)? INFINITE : (OEMGetTickCount () + dwTimeout);
+        PHDATA      phdReader = NULL;
+        BOOL        fSignalReader = FALSE;
+        PMSGNODE    lpN;
+
+        LockQueue (lpQ);
+
+        while (cbWritten < cbSize) {
+            const BYTE          *pbEntry = (const BYTE *) lpBuffer + cbWritten;
+            MSGQUEUEBATCHENTRY  entry;
+
+            if ((cbSize - cbWritten < sizeof (entry))
+                || !CeSafeCopyMemory (&entry, pbEntry, sizeof (entry))
+                || !entry.cbData
+                || (entry.cbData > cbSize - cbWritten - sizeof (entry))) {
+                dwErr = ERROR_INVALID_PARAMETER;
+                break;
+            }
+
+            // only the first message waits for room
+            do {
+                if ((lpN = TakeFreeNode (lpQ, entry.cbData, entry.dwFlags, &dwErr)) || dwErr) {
+                    break;
+                }
+                // when we gets here, queue is full.
+            } while (!cMsgs && !(dwErr = WaitForQueueEvent (lpQ->phdWriter, lpQ, dwTimeout, dwWakeupTime)));
+
+            if (!lpN) {
+                // error, or queue is full after the first message and the caller retries with the rest
+                break;
+            }
+
+            __try {
+                memcpy (lpN+1, pbEntry + sizeof (entry), entry.cbData);
+            }  __except (EXCEPTION_EXECUTE_HANDLER) {
+                DEBUGMSG(1, (TEXT("WriteMsgQueueBatch: copy data error\r\n")));
+                dwErr = ERROR_INVALID_PARAMETER;
+            }
+
+            if (dwErr) {
+                // give the node back
+                if (lpQ->pAlert == lpN) {
+                    lpQ->pAlert = NULL;
+                } else if (lpQ->dwFlags & MSGQUEUE_NOPRECOMMIT) {
+                    MsgQfree (lpN);
+                } else {
+                    lpN->pNext = lpQ->pFreeList;
+                    lpQ->pFreeList = lpN;
+                }
+                break;
+            }
+
+            lpN->dwDataSize = entry.cbData;
+            lpN->dwFlags = entry.dwFlags;
+            lpN->phdTok  = LockThrdToken (pCurThread);
+
+            // only need to signal the reader if the queue was empty (an alert message 
+            // is always signaled)
+            if ((lpQ->pAlert == lpN) || IS_QUEUE_EMPTY (lpQ)) {
+                fSignalReader = TRUE;
+            }
+
+            if (lpQ->pAlert != lpN) {
+                lpQ->dwCurNumMsg ++;
+                Enqueue (lpQ, lpN);
+
+                // update high water mark if necessary
+                if (lpQ->dwMaxQueueMessages < lpQ->dwCurNumMsg) {
+                    lpQ->dwMaxQueueMessages = lpQ->dwCurNumMsg;
+                }
+            }
+
+            cMsgs ++;
+            cbWritten += MSGQ_BATCH_ENTRY_SIZE (entry.cbData);
+        }
+
+        if (cMsgs) {
+            // signal the reader once for the whole batch, after we release the lock (see MSGQWrite)
+            if (fSignalReader && lpQ->phdReader) {
+                phdReader = lpQ->phdReader;
+                LockHDATA (phdReader);
+            }
+
+            if (lpQ->dwCurNumMsg == lpQ->dwMaxNumMsg) {
+                ResetQEvent (lpQ->phdWriter);
+            }
+        }
+
+        UnlockQueue (lpQ);
+
+        if (phdReader) {
+            SetQEvent (phdReader);
+            UnlockHandleData (phdReader);
+        }
+
+        *lpcMsgs = cMsgs;
+    }
+
+    SetLastError (dwErr);
+    return !dwErr;
+}
 
 
 BOOL MSGQGetInfo (
@@ -40,6 +40,20 @@ BOOL MSGQWrite (PEVENT lpe, LPCVOID lpBuffer, DWORD cbDataSize, DWORD dwTimeout,
     return FALSE;
 }
 
+// MSGQReadBatch - read all queued messages that fit in the buffer from a message queue
+BOOL MSGQReadBatch (PEVENT lpe, LPVOID lpBuffer, DWORD cbSize, LPDWORD lpNumberOfBytesRead, DWORD dwTimeout, LPDWORD lpcMsgs)
+{
+    SetLastError (ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
+// MSGQWriteBatch - write a sequence of messages to a message queue
+BOOL MSGQWriteBatch (PEVENT lpe, LPCVOID lpBuffer, DWORD cbSize, DWORD dwTimeout, LPDWORD lpcMsgs)
+{
+    SetLastError (ERROR_NOT_SUPPORTED);
+    return FALSE;
+}
+
 // MSGQGetInfo - get information from a message queue
 BOOL MSGQGetInfo (PEVENT lpe, PMSGQUEUEINFO lpInfo)
 {
@@ -0,0 +1,216 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+
+/*----------------------------------------------------------------------------
+    DwDmpExp
+
+    Expands a compressed dump file (WATSON_DUMP_FLAG_COMPRESSED, see 
+    dwcompr.h) back into the standard dump file written by DwDmpGen.
+----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dwcompr.h"
+
+BYTE g_bBlock[CEDUMP_COMPRESSED_BLOCK_SIZE];
+
+static void Usage()
+{
+    printf("Usage: dwdmpexp <compressed dump file> <output dump file>\r\n");
+}
+
+// Read the whole input file, return NULL on failure
+static BYTE *ReadInputFile(const char *szFileName, DWORD *pcbFile)
+{
+    FILE *pFile;
+    BYTE *pbFile = NULL;
+    long cbFile;
+
+    pFile = fopen(szFileName, "rb");
+    if (!pFile)
+    {
+        printf("Error: Can't open %s\r\n", szFileName);
+        return NULL;
+    }
+
+    if ((0 != fseek(pFile, 0, SEEK_END)) || ((cbFile = ftell(pFile)) < 0) || (0 != fseek(pFile, 0, SEEK_SET)))
+    {
+        printf("Error: Can't get the size of %s\r\n", szFileName);
+        goto Exit;
+    }
+
+    pbFile = (BYTE *) malloc(cbFile ? cbFile : 1);
+    if (!pbFile)
+    {
+        printf("Error: Out of memory reading %s (%ld bytes)\r\n", szFileName, cbFile);
+        goto Exit;
+    }
+
+    if (fread(pbFile, 1, cbFile, pFile) != (size_t) cbFile)
+    {
+        printf("Error: Can't read %s\r\n", szFileName);
+        free(pbFile);
+        pbFile = NULL;
+        goto Exit;
+    }
+
+    *pcbFile = (DWORD) cbFile;
+
+Exit:
+
+    fclose(pFile);
+    return pbFile;
+}
+
+// Expand the blocks of the compressed dump into pOutFile, return FALSE on failure
+static BOOL ExpandDumpFile(const BYTE *pbFile, DWORD cbFile, FILE *pOutFile)
+{
+    PCEDUMP_COMPRESSED_HEADER pceDmpHeader = (PCEDUMP_COMPRESSED_HEADER) pbFile;
+    CEDUMP_COMPRESSED_BLOCK ceDmpBlock;
+    DWORD dwFileOffset;
+    DWORD dwBlock;
+    DWORD dwDataSize;
+    DWORD dwDumpFileSize = 0;
+    DWORD dwDumpFileCRC = 0;
+    DWORD dwCRCLoop;
+
+    if ((cbFile < sizeof(CEDUMP_COMPRESSED_HEADER)) ||
+        (CEDUMP_COMPRESSED_SIGNATURE != pceDmpHeader->dwSignature) ||
+        (sizeof(CEDUMP_COMPRESSED_HEADER) != pceDmpHeader->dwSizeOfHeader) ||
+        (CEDUMP_COMPRESSED_BLOCK_SIZE != pceDmpHeader->dwBlockSize))
+    {
+        printf("Error: Not a compressed dump file\r\n");
+        return FALSE;
+    }
+
+    dwFileOffset = sizeof(CEDUMP_COMPRESSED_HEADER);
+
+    for (dwBlock = 0; dwBlock < pceDmpHeader->dwNumberOfBlocks; ++dwBlock)
+    {
+        if ((cbFile - dwFileOffset) < sizeof(CEDUMP_COMPRESSED_BLOCK))
+        {
+            printf("Error: Block %u is missing, file is truncated at offset %u\r\n", dwBlock, dwFileOffset);
+            return FALSE;
+        }
+
+        // The block headers are not aligned
+        memcpy(&ceDmpBlock, pbFile + dwFileOffset, sizeof(CEDUMP_COMPRESSED_BLOCK));
+        dwFileOffset += sizeof(CEDUMP_COMPRESSED_BLOCK);
+
+        if ((ceDmpBlock.wDataSize > CEDUMP_COMPRESSED_BLOCK_SIZE) ||
+            (ceDmpBlock.wPackedSize > ceDmpBlock.wDataSize) ||
+            ((cbFile - dwFileOffset) < ceDmpBlock.wPackedSize))
+        {
+            printf("Error: Block %u at offset %u is corrupt, Data Size=%u, Packed Size=%u\r\n", 
+                   dwBlock, dwFileOffset - sizeof(CEDUMP_COMPRESSED_BLOCK), ceDmpBlock.wDataSize, ceDmpBlock.wPackedSize);
+            return FALSE;
+        }
+
+        if (ceDmpBlock.wPackedSize == ceDmpBlock.wDataSize)
+        {
+            // Stored uncompressed
+            memcpy(g_bBlock, pbFile + dwFileOffset, ceDmpBlock.wDataSize);
+            dwDataSize = ceDmpBlock.wDataSize;
+        }
+        else
+        {
+            dwDataSize = DwDecompressBlock(pbFile + dwFileOffset, ceDmpBlock.wPackedSize, g_bBlock, sizeof(g_bBlock));
+        }
+
+        if (dwDataSize != ceDmpBlock.wDataSize)
+        {
+            printf("Error: Block %u at offset %u does not expand to %u bytes\r\n", dwBlock, dwFileOffset, ceDmpBlock.wDataSize);
+            return FALSE;
+        }
+
+        if (DwBlockChecksum(g_bBlock, dwDataSize) != ceDmpBlock.dwChecksum)
+        {
+            printf("Error: Block %u at offset %u failed checksum, Expected=0x%08X, Actual=0x%08X\r\n", 
+                   dwBlock, dwFileOffset, ceDmpBlock.dwChecksum, DwBlockChecksum(g_bBlock, dwDataSize));
+            return FALSE;
+        }
+
+        if (fwrite(g_bBlock, 1, dwDataSize, pOutFile) != dwDataSize)
+        {
+            printf("Error: Can't write the output file\r\n");
+            return FALSE;
+        }
+
+        for (dwCRCLoop = 0; dwCRCLoop < dwDataSize; ++dwCRCLoop)
+        {
+            // Add up all the bytes in the dump file (Simple CRC)
+            dwDumpFileCRC += g_bBlock[dwCRCLoop];
+        }
+
+        dwDumpFileSize += dwDataSize;
+        dwFileOffset += ceDmpBlock.wPackedSize;
+    }
+
+    if ((dwDumpFileSize != pceDmpHeader->dwDumpFileSize) || (dwDumpFileCRC != pceDmpHeader->dwDumpFileCRC))
+    {
+        printf("Error: Dump file size or CRC failure, Expected Size=%u, Actual Size=%u, Expected CRC=0x%08X, Actual CRC=0x%08X\r\n",
+               pceDmpHeader->dwDumpFileSize, dwDumpFileSize, pceDmpHeader->dwDumpFileCRC, dwDumpFileCRC);
+        return FALSE;
+    }
+
+    printf("Expanded %u blocks, %u bytes to %u bytes\r\n", pceDmpHeader->dwNumberOfBlocks, dwFileOffset, dwDumpFileSize);
+    return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    BYTE *pbFile;
+    DWORD cbFile = 0;
+    FILE *pOutFile;
+    BOOL fOk;
+
+    if (argc != 3)
+    {
+        Usage();
+        return 1;
+    }
+
+    pbFile = ReadInputFile(argv[1], &cbFile);
+    if (!pbFile)
+    {
+        return 1;
+    }
+
+    pOutFile = fopen(argv[2], "wb");
+    if (!pOutFile)
+    {
+        printf("Error: Can't create %s\r\n", argv[2]);
+        free(pbFile);
+        return 1;
+    }
+
+    fOk = ExpandDumpFile(pbFile, cbFile, pOutFile);
+
+    if (0 != fclose(pOutFile))
+    {
+        printf("Error: Can't write %s\r\n", argv[2]);
+        fOk = FALSE;
+    }
+    free(pbFile);
+
+    if (!fOk)
+    {
+        // Don't leave a partial dump file behind
+        remove(argv[2]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,301 @@
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//
+// Use of this source code is subject to the terms of the Microsoft shared
+// source or premium shared source license agreement under which you licensed
+// this source code. If you did not accept the terms of the license agreement,
+// you are not authorized to use this source code. For the terms of the license,
+// please see the license agreement between you and Microsoft or, if applicable,
+// see the SOURCE.RTF on your install media or the root of your tools installation.
+// THE SOURCE CODE IS PROVIDED "AS IS", WITH NO WARRANTIES.
+//
+
+/*----------------------------------------------------------------------------
+    Block codec for compressed dump files (see dwcompr.h for the format).
+
+    This file is built into the target (DwDmpGen) and the host (DwDmpExp),
+    so it must not use anything beyond plain memory access.
+----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "dwcompr.h"
+
+enum
+{
+    MIN_MATCH       = 4,                // Shortest match encoded
+    MAX_OFFSET      = 0xFFFF,           // Largest match offset encoded
+    HASH_SHIFT      = 32 - 12,          // CEDUMP_COMPRESSED_HASH_SIZE is 1 << 12
+    LENGTH_MASK     = 0x0F,             // Length field of a token, 15 means more length bytes follow
+    SKIP_SHIFT      = 6,                // Step through incompressible data faster after each 64 literals
+    ADLER_BASE      = 65521,            // Largest prime below 65536
+    ADLER_RUN       = 5552,             // Bytes that can be summed before the Adler-32 sums overflow
+};
+
+// The dump data is not aligned, so read it a byte at a time
+static inline DWORD ReadDword(const BYTE *pb)
+{
+    return (DWORD)pb[0] | ((DWORD)pb[1] << 8) | ((DWORD)pb[2] << 16) | ((DWORD)pb[3] << 24);
+}
+
+static inline DWORD HashDword(DWORD dw)
+{
+    return (dw * 2654435761U) >> HASH_SHIFT;
+}
+
+// Write the extra bytes for a length of 15 or more, return NULL if there is no room
+static BYTE *WriteLength(BYTE *pbOut, BYTE *pbOutEnd, DWORD dwLength)
+{
+    for (dwLength -= LENGTH_MASK; dwLength >= 255; dwLength -= 255)
+    {
+        if (pbOut >= pbOutEnd)
+        {
+            return NULL;
+        }
+        *pbOut++ = 255;
+    }
+    if (pbOut >= pbOutEnd)
+    {
+        return NULL;
+    }
+    *pbOut++ = (BYTE)dwLength;
+    return pbOut;
+}
+
+// Read the extra bytes for a length of 15 or more, return FALSE if the data ends first
+static BOOL ReadLength(const BYTE **ppbIn, const BYTE *pbInEnd, DWORD *pdwLength)
+{
+    BYTE bLength;
+    
+    if (LENGTH_MASK == *pdwLength)
+    {
+        do
+        {
+            if (*ppbIn >= pbInEnd)
+            {
+                return FALSE;
+            }
+            bLength = *(*ppbIn)++;
+            *pdwLength += bLength;
+        }
+        while (255 == bLength);
+    }
+    return TRUE;
+}
+
+// Write out a token with its literals and (if dwMatchLength is not 0) its match, return NULL if there is no room
+static BYTE *WriteSequence(BYTE *pbOut, BYTE *pbOutEnd, const BYTE *pbLiterals, DWORD cbLiterals, DWORD dwOffset, DWORD dwMatchLength)
+{
+    BYTE *pbToken = pbOut;
+    BYTE  bToken;
+    
+    if (pbOut >= pbOutEnd)
+    {
+        return NULL;
+    }
+    ++ pbOut;
+
+    bToken = (BYTE)(min(cbLiterals, (DWORD) LENGTH_MASK) << 4);
+    if ((cbLiterals >= LENGTH_MASK) && !(pbOut = WriteLength(pbOut, pbOutEnd, cbLiterals)))
+    {
+        return NULL;
+    }
+    if ((DWORD)(pbOutEnd - pbOut) < cbLiterals)
+    {
+        return NULL;
+    }
+    memcpy(pbOut, pbLiterals, cbLiterals);
+    pbOut += cbLiterals;
+
+    if (dwMatchLength)
+    {
+        dwMatchLength -= MIN_MATCH;
+        bToken |= (BYTE) min(dwMatchLength, (DWORD) LENGTH_MASK);
+        if ((pbOutEnd - pbOut) < 2)
+        {
+            return NULL;
+        }
+        *pbOut++ = (BYTE) dwOffset;
+        *pbOut++ = (BYTE)(dwOffset >> 8);
+        if ((dwMatchLength >= LENGTH_MASK) && !(pbOut = WriteLength(pbOut, pbOutEnd, dwMatchLength)))
+        {
+            return NULL;
+        }
+    }
+
+    *pbToken = bToken;
+    return pbOut;
+}
+
+/*----------------------------------------------------------------------------
+    DwCompressBlock
+
+    Compress cbSrc bytes (at most 64K) into pbDst. pwHashTable is a scratch
+    table of CEDUMP_COMPRESSED_HASH_SIZE entries.
+
+    Return Values:
+        Size of the packed data, or 0 if it doesn't fit in cbDst bytes.
+----------------------------------------------------------------------------*/
+DWORD DwCompressBlock(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst, WORD *pwHashTable)
+{
+    const BYTE *pbEnd = pbSrc + cbSrc;
+    const BYTE *pbAnchor = pbSrc;   // Start of the literals not written out yet
+    const BYTE *pbCur = pbSrc;
+    const BYTE *pbRef;
+    const BYTE *pbMatchEnd;
+    BYTE *pbOut = pbDst;
+    BYTE *pbOutEnd = pbDst + cbDst;
+    DWORD dwHash;
+    DWORD dwStep;
+
+    if (cbSrc > 0xFFFF)
+    {
+        // Positions in the hash table are WORDs
+        return 0;
+    }
+
+    memset(pwHashTable, 0, CEDUMP_COMPRESSED_HASH_SIZE * sizeof(WORD));
+
+    while ((DWORD)(pbEnd - pbCur) >= MIN_MATCH)
+    {
+        dwHash = HashDword(ReadDword(pbCur));
+        pbRef = pbSrc + pwHashTable[dwHash];
+        pwHashTable[dwHash] = (WORD)(pbCur - pbSrc);
+
+        if ((pbRef >= pbCur) || ((pbCur - pbRef) > MAX_OFFSET) || (ReadDword(pbRef) != ReadDword(pbCur)))
+        {
+            // No match, the step grows with the number of literals to get through incompressible data quickly
+            dwStep = 1 + (DWORD)((pbCur - pbAnchor) >> SKIP_SHIFT);
+            if ((DWORD)(pbEnd - pbCur) < dwStep + MIN_MATCH)
+            {
+                break;
+            }
+            pbCur += dwStep;
+            continue;
+        }
+
+        // Extend the match as far as it goes
+        pbMatchEnd = pbCur + MIN_MATCH;
+        while ((pbMatchEnd < pbEnd) && (*pbMatchEnd == pbRef[pbMatchEnd - pbCur]))
+        {
+            ++ pbMatchEnd;
+        }
+
+        pbOut = WriteSequence(pbOut, pbOutEnd, pbAnchor, (DWORD)(pbCur - pbAnchor), (DWORD)(pbCur - pbRef), (DWORD)(pbMatchEnd - pbCur));
+        if (!pbOut)
+        {
+            return 0;
+        }
+
+        pbCur = pbAnchor = pbMatchEnd;
+    }
+
+    // Last literals
+    if (pbAnchor < pbEnd)
+    {
+        pbOut = WriteSequence(pbOut, pbOutEnd, pbAnchor, (DWORD)(pbEnd - pbAnchor), 0, 0);
+        if (!pbOut)
+        {
+            return 0;
+        }
+    }
+
+    return (DWORD)(pbOut - pbDst);
+}
+
+/*----------------------------------------------------------------------------
+    DwDecompressBlock
+
+    Expand cbSrc bytes of packed data into pbDst.
+
+    Return Values:
+        Size of the expanded data, or (-1) if the packed data is corrupt or 
+        expands to more than cbDst bytes.
+----------------------------------------------------------------------------*/
+DWORD DwDecompressBlock(const BYTE *pbSrc, DWORD cbSrc, BYTE *pbDst, DWORD cbDst)
+{
+    const BYTE *pbIn = pbSrc;
+    const BYTE *pbInEnd = pbSrc + cbSrc;
+    const BYTE *pbRef;
+    BYTE *pbOut = pbDst;
+    BYTE *pbOutEnd = pbDst + cbDst;
+    DWORD dwToken;
+    DWORD dwLength;
+    DWORD dwOffset;
+
+    while (pbIn < pbInEnd)
+    {
+        dwToken = *pbIn++;
+
+        // Literals
+        dwLength = dwToken >> 4;
+        if (!ReadLength(&pbIn, pbInEnd, &dwLength) ||
+            ((DWORD)(pbInEnd - pbIn) < dwLength) ||
+            ((DWORD)(pbOutEnd - pbOut) < dwLength))
+        {
+            return (DWORD)(-1);
+        }
+        memcpy(pbOut, pbIn, dwLength);
+        pbOut += dwLength;
+        pbIn += dwLength;
+
+        if (pbIn == pbInEnd)
+        {
+            // Last token has no match
+            break;
+        }
+
+        // Match
+        if ((pbInEnd - pbIn) < 2)
+        {
+            return (DWORD)(-1);
+        }
+        dwOffset = (DWORD)pbIn[0] | ((DWORD)pbIn[1] << 8);
+        pbIn += 2;
+
+        dwLength = dwToken & LENGTH_MASK;
+        if (!ReadLength(&pbIn, pbInEnd, &dwLength) ||
+            !dwOffset ||
+            (dwOffset > (DWORD)(pbOut - pbDst)) ||
+            ((DWORD)(pbOutEnd - pbOut) < dwLength + MIN_MATCH))
+        {
+            return (DWORD)(-1);
+        }
+
+        // Copy forward a byte at a time, the match may overlap the bytes it produces
+        pbRef = pbOut - dwOffset;
+        for (dwLength += MIN_MATCH; dwLength; --dwLength)
+        {
+            *pbOut++ = *pbRef++;
+        }
+    }
+
+    return (DWORD)(pbOut - pbDst);
+}
+
+/*----------------------------------------------------------------------------
+    DwBlockChecksum
+
+    Adler-32 of a block of dump data.
+----------------------------------------------------------------------------*/
+DWORD DwBlockChecksum(const BYTE *pbData, DWORD cbData)
+{
+    DWORD dwA = 1;
+    DWORD dwB = 0;
+    DWORD cbRun;
+
+    while (cbData)
+    {
+        cbRun = min(cbData, (DWORD) ADLER_RUN);
+        cbData -= cbRun;
+        while (cbRun--)
+        {
+            dwA += *pbData++;
+            dwB += dwA;
+        }
+        dwA %= ADLER_BASE;
+        dwB %= ADLER_BASE;
+    }
+
+    return (dwB << 16) | dwA;
+}
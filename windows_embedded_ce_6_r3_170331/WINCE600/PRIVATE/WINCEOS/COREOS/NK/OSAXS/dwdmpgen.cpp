@@ -27,12 +27,15 @@
 #include "DwPublic.h"
 #include "DwPrivate.h"
 #include "DwDmpGen.h"
+#include "DwCompr.h"
 
 enum
 {
     STACK_FRAMES_BUFFERED = 20,
     MAX_STREAMS           = (ceStreamLastStream - ceStreamNull),
     MAX_THREAD_ENTRIES    = FLEX_PTMI_BUFFER_SIZE / sizeof (WORD),
+    WRITE_CHUNK_SIZE      = 256,    // Bytes copied and written out per chunk by WatsonWriteData
+    COMPRESSED_RATIO_MAX  = 4,      // Compression ratio first assumed when sizing a compressed dump
 };
 
 enum
@@ -81,6 +84,7 @@ CEDUMP_BUCKET_PARAMETERS        g_ceDmpBucketParameters;
 WATSON_DUMP_SETTINGS g_watsonDumpSettings = {0};
 
 BYTE         g_bBuffer[FLEX_PTMI_BUFFER_SIZE];
+BYTE         g_bWriteChunk[WRITE_CHUNK_SIZE];
 MEMORY_BLOCK g_memoryVirtualBlocks[MAX_MEMORY_VIRTUAL_BLOCKS];
 DWORD        g_dwMemoryVirtualBlocksTotal = 0;
 DWORD        g_dwMemoryVirtualSizeTotal = 0;
@@ -106,6 +110,23 @@ DWORD g_dwLastError;
 DWORD g_dwDumpFileSize = 0;
 CEDUMP_TYPE g_ceDumpType = ceDumpTypeUndefined;
 
+// Compressed dump (WATSON_DUMP_FLAG_COMPRESSED), the dump is written through g_bCompressBlock while g_fDumpCompressing is set
+BOOL  g_fDumpCompressed = FALSE;
+BOOL  g_fDumpCompressing = FALSE;
+BOOL  g_fDumpCompressOverflow = FALSE;
+BYTE  g_bCompressBlock[CEDUMP_COMPRESSED_BLOCK_SIZE];
+BYTE  g_bCompressPacked[sizeof(CEDUMP_COMPRESSED_BLOCK) + CEDUMP_COMPRESSED_BLOCK_SIZE];
+WORD  g_wCompressHashTable[CEDUMP_COMPRESSED_HASH_SIZE];
+DWORD g_dwCompressBlockOffset;
+DWORD g_dwCompressedBlocks;
+DWORD g_dwCompressedOffset;
+DWORD g_dwCompressedCRC;
+DWORD g_dwCompressedMaxSize;
+
+// Priority dump (WATSON_DUMP_FLAG_PRIORITY), virtual memory blocks are trimmed to fit g_dwMemoryVirtualBudget
+BOOL  g_fDumpPriority = FALSE;
+DWORD g_dwMemoryVirtualBudget = (-1);
+
 OSAXS_KDBG_RESPONSE_FUNC g_pKdpSendOsAxsResponse = NULL;
 BYTE *g_pKdpBuffer = NULL;
 DWORD g_dwKdpBufferSize = 0;
@@ -312,23 +333,196 @@ Exit:
     return hRes;
 }
 
+/*----------------------------------------------------------------------------
+    CompressWriteReserved
+
+    Writes compressed dump data to reserved memory, failing with 
+    E_OUTOFMEMORY once the compressed dump grows past g_dwCompressedMaxSize.
+----------------------------------------------------------------------------*/
+static HRESULT CompressWriteReserved(DWORD dwOffset, const BYTE *pbData, DWORD dwDataSize)
+{
+    HRESULT hRes = E_FAIL;
+    DWORD dwCRCLoop;
+
+    if (((dwOffset + dwDataSize) > g_dwCompressedMaxSize) || // Check for buffer overflow
+        (dwOffset > (dwOffset + dwDataSize)))                // Check for integer overflow
+    {
+        DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!CompressWriteReserved: Compressed dump does not fit, Max Size=0x%08X, dwOffset=0x%08X, dwDataSize=0x%08X\r\n", g_dwCompressedMaxSize, dwOffset, dwDataSize));
+        g_fDumpCompressOverflow = TRUE;
+        hRes = E_OUTOFMEMORY;
+        goto Exit;
+    }
+
+    if (pfnNKKernelLibIoControl((HANDLE) KMOD_CORE, IOCTL_KLIB_WRITEWATSON, (PVOID) pbData, dwDataSize, NULL, dwOffset, NULL) != dwDataSize)
+    {
+        DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!CompressWriteReserved: KernelLibIoControl failed, dwOffset=0x%08X, dwDataSize=0x%08X\r\n", dwOffset, dwDataSize));
+        hRes = E_FAIL;
+        goto Exit;
+    }
+
+    for (dwCRCLoop = 0; dwCRCLoop < dwDataSize; ++dwCRCLoop)
+    {
+        // Add up all the bytes in reserved memory (Simple CRC), DwXfer.dll checks the compressed dump with this
+        g_dwCompressedCRC += pbData[dwCRCLoop];
+    }
+
+    hRes = S_OK;
+
+Exit:
+
+    return hRes;
+}
+
+/*----------------------------------------------------------------------------
+    CompressFlushBlock
+
+    Compresses the data collected in g_bCompressBlock and writes it out
+    after the previous block, stored as is if it doesn't get any smaller.
+----------------------------------------------------------------------------*/
+static HRESULT CompressFlushBlock()
+{
+    HRESULT hRes = S_OK;
+    PCEDUMP_COMPRESSED_BLOCK pceDmpBlock = (PCEDUMP_COMPRESSED_BLOCK) g_bCompressPacked;
+    BYTE *pbPacked = g_bCompressPacked + sizeof(CEDUMP_COMPRESSED_BLOCK);
+    DWORD dwPackedSize;
+
+    if (!g_dwCompressBlockOffset)
+    {
+        goto Exit;
+    }
+
+    dwPackedSize = DwCompressBlock(g_bCompressBlock, g_dwCompressBlockOffset, pbPacked, g_dwCompressBlockOffset - 1, g_wCompressHashTable);
+    if (!dwPackedSize)
+    {
+        memcpy(pbPacked, g_bCompressBlock, g_dwCompressBlockOffset);
+        dwPackedSize = g_dwCompressBlockOffset;
+    }
+
+    pceDmpBlock->wDataSize = (WORD) g_dwCompressBlockOffset;
+    pceDmpBlock->wPackedSize = (WORD) dwPackedSize;
+    pceDmpBlock->dwChecksum = DwBlockChecksum(g_bCompressBlock, g_dwCompressBlockOffset);
+
+    hRes = CompressWriteReserved(g_dwCompressedOffset, g_bCompressPacked, sizeof(CEDUMP_COMPRESSED_BLOCK) + dwPackedSize);
+    if (FAILED(hRes))
+    {
+        goto Exit;
+    }
+
+    g_dwCompressedOffset += sizeof(CEDUMP_COMPRESSED_BLOCK) + dwPackedSize;
+    ++ g_dwCompressedBlocks;
+    g_dwCompressBlockOffset = 0;
+
+Exit:
+
+    return hRes;
+}
+
+/*----------------------------------------------------------------------------
+    CompressWrite
+
+    Adds dump data to the compressed dump, a block at a time.
+----------------------------------------------------------------------------*/
+static HRESULT CompressWrite(const BYTE *pbData, DWORD dwDataSize)
+{
+    HRESULT hRes = S_OK;
+    DWORD dwCopySize;
+
+    while (dwDataSize)
+    {
+        dwCopySize = min (dwDataSize, (DWORD) CEDUMP_COMPRESSED_BLOCK_SIZE - g_dwCompressBlockOffset);
+        memcpy(g_bCompressBlock + g_dwCompressBlockOffset, pbData, dwCopySize);
+        g_dwCompressBlockOffset += dwCopySize;
+        pbData += dwCopySize;
+        dwDataSize -= dwCopySize;
+
+        if (CEDUMP_COMPRESSED_BLOCK_SIZE == g_dwCompressBlockOffset)
+        {
+            hRes = CompressFlushBlock();
+            if (FAILED(hRes))
+            {
+                break;
+            }
+        }
+    }
+
+    return hRes;
+}
+
+/*----------------------------------------------------------------------------
+    CompressStart
+
+    Starts a compressed dump no larger than dwMaxDumpFileSize, the blocks
+    follow the CEDUMP_COMPRESSED_HEADER written by CompressEnd.
+----------------------------------------------------------------------------*/
+static void CompressStart(DWORD dwMaxDumpFileSize)
+{
+    g_fDumpCompressing = TRUE;
+    g_fDumpCompressOverflow = FALSE;
+    g_dwCompressBlockOffset = 0;
+    g_dwCompressedBlocks = 0;
+    g_dwCompressedOffset = sizeof(CEDUMP_COMPRESSED_HEADER);
+    g_dwCompressedCRC = 0;
+    g_dwCompressedMaxSize = dwMaxDumpFileSize;
+}
+
+/*----------------------------------------------------------------------------
+    CompressEnd
+
+    Writes out the last block and the CEDUMP_COMPRESSED_HEADER, recording 
+    the size and CRC of the dump file written through WatsonWriteData.
+----------------------------------------------------------------------------*/
+static HRESULT CompressEnd()
+{
+    HRESULT hRes;
+    CEDUMP_COMPRESSED_HEADER ceDmpCompressedHeader;
+
+    g_fDumpCompressing = FALSE;
+
+    hRes = CompressFlushBlock();
+    if (FAILED(hRes))
+    {
+        goto Exit;
+    }
+
+    ceDmpCompressedHeader.dwSignature = CEDUMP_COMPRESSED_SIGNATURE;
+    ceDmpCompressedHeader.dwSizeOfHeader = sizeof(CEDUMP_COMPRESSED_HEADER);
+    ceDmpCompressedHeader.dwBlockSize = CEDUMP_COMPRESSED_BLOCK_SIZE;
+    ceDmpCompressedHeader.dwNumberOfBlocks = g_dwCompressedBlocks;
+    ceDmpCompressedHeader.dwDumpFileSize = g_dwWrittenOffset;
+    ceDmpCompressedHeader.dwDumpFileCRC = g_dwWrittenCRC;
+
+    hRes = CompressWriteReserved(0, (BYTE *) &ceDmpCompressedHeader, sizeof(CEDUMP_COMPRESSED_HEADER));
+
+Exit:
+
+    DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  DwDmpGen!CompressEnd: Dump Size=%u, Compressed Size=%u, Blocks=%u, hRes=0x%08X\r\n", 
+                                  g_dwWrittenOffset, g_dwCompressedOffset, g_dwCompressedBlocks, hRes));
+    return hRes;
+}
+
 /*----------------------------------------------------------------------------
     WatsonWriteData
 
     Writes the data to the output stream, either reserved memory or KDBG.
+    The data is copied out in chunks that do not cross a page boundary, and
+    each chunk is written to reserved memory with a single KernelLibIoControl,
+    or added to the compressed dump while g_fDumpCompressing is set.
 ----------------------------------------------------------------------------*/
 static HRESULT WatsonWriteData(DWORD dwOffset, PVOID pDataBuffer, DWORD dwDataSize, BOOL fCalculateCRC)
 {
     HRESULT hRes = E_FAIL;
     DWORD dwWriteLoop;
-    BYTE  bDataOut;
+    DWORD dwChunkSize;
+    DWORD dwChunkLoop;
+    BOOL  fChunkFault;
     BOOL  fExceptionEncountered = FALSE;
     DWORD dwWriteLoopError;
     DWORD dwExceptionCount = 0;
     PVOID pAddr;
     
-    if (((dwOffset + dwDataSize) > g_dwReservedMemorySize) || // Check for buffer overflow
-        (dwOffset > (dwOffset + dwDataSize)))                 // Check for integer overflow
+    // A compressed dump checks the size of the compressed data as it is written out
+    if ((!g_fDumpCompressing && ((dwOffset + dwDataSize) > g_dwReservedMemorySize)) || // Check for buffer overflow
+        (dwOffset > (dwOffset + dwDataSize)))                                          // Check for integer overflow
     {
         DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WatsonWriteData: Trying to write beyond size of reserved memory, Reserved Size=0x%08X, dwOffset=0x%08X, dwDataSize=0x%08X\r\n", g_dwReservedMemorySize, dwOffset, dwDataSize));
         hRes = E_OUTOFMEMORY;
@@ -349,54 +543,83 @@ static HRESULT WatsonWriteData(DWORD dwOffset, PVOID pDataBuffer, DWORD dwDataSi
     }
     
 
-    for (dwWriteLoop = 0; dwWriteLoop < dwDataSize; ++dwWriteLoop)
+    for (dwWriteLoop = 0; dwWriteLoop < dwDataSize; dwWriteLoop += dwChunkSize)
     {
         pAddr = (PVOID)((BYTE *)pDataBuffer + dwWriteLoop);
 
+        // Chunks never cross a page boundary, so a page that can't be read only affects its own chunk
+        dwChunkSize = min (dwDataSize - dwWriteLoop, (DWORD) WRITE_CHUNK_SIZE);
+        dwChunkSize = min (dwChunkSize, VM_PAGE_SIZE - ((DWORD)pAddr & (VM_PAGE_SIZE-1)));
+
 #ifdef DEBUG        
         // At this point we should only have valid addresses that are currently paged in
-        if ((0 == dwWriteLoop) || ((DWORD)pAddr & (VM_PAGE_SIZE-1)))
-        {
-            // Validate the page is paged in each time we move to a new page
-            KD_ASSERT(NULL != MapToDebuggeeCtxKernEquivIfAcc (NULL, pAddr, TRUE /* Probe Only */));
-        }
+        KD_ASSERT(NULL != MapToDebuggeeCtxKernEquivIfAcc (NULL, pAddr, TRUE /* Probe Only */));
 #endif // DEBUG
         
         // Just in case we may be reading from invalid memory, catch possible exceptions
 
         // Prevent hitting exceptions in the debugger
         DisableFaults ();
+        fChunkFault = FALSE;
         __try
         {
-            bDataOut = *((BYTE *)pAddr);
+            memcpy (g_bWriteChunk, pAddr, dwChunkSize);
         }
         __except (EXCEPTION_EXECUTE_HANDLER)
         {
-            if (FALSE == fExceptionEncountered)
+            fChunkFault = TRUE;
+        }
+
+        if (fChunkFault)
+        {
+            // Copy the chunk again a byte at a time, writing zero for the bytes that can't be read
+            for (dwChunkLoop = 0; dwChunkLoop < dwChunkSize; ++dwChunkLoop)
             {
-                dwWriteLoopError = dwWriteLoop;
-                fExceptionEncountered = TRUE;
+                __try
+                {
+                    g_bWriteChunk[dwChunkLoop] = *((BYTE *)pAddr + dwChunkLoop);
+                }
+                __except (EXCEPTION_EXECUTE_HANDLER)
+                {
+                    if (FALSE == fExceptionEncountered)
+                    {
+                        dwWriteLoopError = dwWriteLoop + dwChunkLoop;
+                        fExceptionEncountered = TRUE;
+                    }
+                    g_bWriteChunk[dwChunkLoop] = 0;
+                    ++ dwExceptionCount;
+                }
             }
-            bDataOut = 0;
-            ++ dwExceptionCount;
         }
         // Enable hitting exceptions in the debugger
         EnableFaults ();
 
         if (g_pKdpSendOsAxsResponse)
         {
-            hRes = WatsonWriteKDBG(bDataOut, FALSE);
+            for (dwChunkLoop = 0; dwChunkLoop < dwChunkSize; ++dwChunkLoop)
+            {
+                hRes = WatsonWriteKDBG(g_bWriteChunk[dwChunkLoop], FALSE);
+                if (FAILED(hRes))
+                {
+                    DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WatsonWriteData: WatsonWriteKDBG failed, hRes=0x%08X, pDataBuffer=0x%08X, dwOffset=0x%08X, dwWriteLoop=0x%08X\r\n", hRes, pDataBuffer, dwOffset, dwWriteLoop + dwChunkLoop));
+                    hRes = E_FAIL;
+                    goto Exit;
+                }
+            }
+        }
+        else if (g_fDumpCompressing)
+        {
+            hRes = CompressWrite(g_bWriteChunk, dwChunkSize);
             if (FAILED(hRes))
             {
-                DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WatsonWriteData: WatsonWriteKDBG failed, hRes=0x%08X, pDataBuffer=0x%08X, dwOffset=0x%08X, dwWriteLoop=0x%08X\r\n", hRes, pDataBuffer, dwOffset, dwWriteLoop));
-                hRes = E_FAIL;
+                DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WatsonWriteData: CompressWrite failed, hRes=0x%08X, pDataBuffer=0x%08X, dwOffset=0x%08X, dwWriteLoop=0x%08X\r\n", hRes, pDataBuffer, dwOffset, dwWriteLoop));
                 goto Exit;
             }
         }
         else
         {
-            // Write out byte of memory to reserved memory location
-            if (pfnNKKernelLibIoControl((HANDLE) KMOD_CORE, IOCTL_KLIB_WRITEWATSON, &bDataOut, 1, NULL, (dwOffset+dwWriteLoop), NULL) != 1)
+            // Write out the chunk to reserved memory location
+            if (pfnNKKernelLibIoControl((HANDLE) KMOD_CORE, IOCTL_KLIB_WRITEWATSON, g_bWriteChunk, dwChunkSize, NULL, (dwOffset+dwWriteLoop), NULL) != dwChunkSize)
             {
                 DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WatsonWriteData: KernelLibIoControl failed, pDataBuffer=0x%08X, dwOffset=0x%08X, dwWriteLoop=0x%08X\r\n", pDataBuffer, dwOffset, dwWriteLoop));
                 hRes = E_FAIL; 
@@ -406,8 +629,11 @@ static HRESULT WatsonWriteData(DWORD dwOffset, PVOID pDataBuffer, DWORD dwDataSi
 
         if (fCalculateCRC)
         {
-            // Add up all the bytes written so far (Simple CRC)
-            g_dwWrittenCRC += bDataOut;
+            for (dwChunkLoop = 0; dwChunkLoop < dwChunkSize; ++dwChunkLoop)
+            {
+                // Add up all the bytes written so far (Simple CRC)
+                g_dwWrittenCRC += g_bWriteChunk[dwChunkLoop];
+            }
         }
     }
     
@@ -1174,7 +1400,7 @@ static void DWMemoryBlockOverlap (MEMORY_BLOCK *MemoryBlocks, DWORD NewBlock, DW
                 MemoryEnd = max (MemoryEnd, BlockEnd);
     
                 // Remove the added size + current size from total
-                TotalMemorySize -= (MemorySize + BlockStart);
+                TotalMemorySize -= (MemorySize + BlockSize);
                 
                 // Calculate the new combined size
                 MemorySize = MemoryEnd - MemoryStart;
@@ -1260,6 +1486,26 @@ static HRESULT MemoryBlocksAdd(PROCESS *VMProcess, DWORD dwMemoryStartAdd, DWORD
         goto Exit;
     }
 
+    if (fVirtual && ((-1) != g_dwMemoryVirtualBudget))
+    {
+        // Filling the dump by priority, trim the block to the space left for virtual memory (allowing for its descriptor)
+        DWORD dwMemoryUsed = g_dwMemoryVirtualSizeTotal + ((g_dwMemoryVirtualBlocksTotal + 1) * sizeof(CEDUMP_MEMORY_DESCRIPTOR));
+        DWORD dwMemoryLeft = (g_dwMemoryVirtualBudget > dwMemoryUsed) ? (g_dwMemoryVirtualBudget - dwMemoryUsed) : 0;
+
+        if (dwMemorySizeAdd > dwMemoryLeft)
+        {
+            DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!MemoryBlocksAdd: Dump full, trimming block at 0x%08X from %u to %u bytes\r\n", dwMemoryStartAdd, dwMemorySizeAdd, dwMemoryLeft));
+            dwMemorySizeAdd = dwMemoryLeft;
+        }
+
+        if (0 == dwMemorySizeAdd)
+        {
+            // Lower priority memory is left out, not an error
+            hRes = S_OK;
+            goto Exit;
+        }
+    }
+
     if (TRUE == fVirtual)
     {
         dwMemoryBlocksMax = MAX_MEMORY_VIRTUAL_BLOCKS;
@@ -1335,7 +1581,7 @@ static HRESULT MemoryBlocksAdd(PROCESS *VMProcess, DWORD dwMemoryStartAdd, DWORD
         KD_ASSERT(dwFirstEmpty == dwMemoryBlocksMax);
         
         DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!MemoryBlocksAdd: No free memory block found (Total blocks=%u)\r\n", dwFirstEmpty));
-        hRes = E_FAIL;
+        hRes = (fVirtual && ((-1) != g_dwMemoryVirtualBudget)) ? S_OK : E_FAIL; // Filling by priority leaves the rest out
         goto Exit;
     }
 
@@ -3330,6 +3576,192 @@ Exit:
     return hRes;
 }
 
+/*----------------------------------------------------------------------------
+    MemoryAddThreadStack
+
+    Add the non-secure and secure stacks of the faulting thread, limited to
+    what fits in dwMaxFileSize after the dump written up to dwFileOffset.
+----------------------------------------------------------------------------*/
+static HRESULT MemoryAddThreadStack(DWORD dwFileOffset, DWORD dwMaxFileSize, BOOL fWrite)
+{
+    HRESULT hRes = E_FAIL;
+    DWORD dwMemoryStart;
+    DWORD dwMemorySize;
+    DWORD dwStackBase, dwStackSize, dwStackBound, dwStackTop;
+    DWORD dwFileOffsetEstimate;
+    DWORD dwFileSpaceLeft; 
+
+    DEBUGGERMSG(OXZONE_DWDMPGEN,(L"++DwDmpGen!MemoryAddThreadStack: Enter\r\n"));
+
+    // Calculate offset to include Memory List header and Memory descriptors 
+    dwFileOffsetEstimate = dwFileOffset + 
+                           (sizeof(CEDUMP_MEMORY_LIST) * 2) + // Virtual + Physical list
+                           (sizeof(CEDUMP_MEMORY_DESCRIPTOR) * (g_dwMemoryVirtualBlocksTotal+1)); // +1 for non-secure stack memory descriptor
+                           
+    // Calculate offset to include total memory added so far                       
+    dwFileOffsetEstimate += g_dwMemoryVirtualSizeTotal;
+    
+    // Calculate file space left for adding non-secure stack memory 
+    dwFileSpaceLeft = (dwMaxFileSize > dwFileOffsetEstimate) ? dwMaxFileSize - dwFileOffsetEstimate : 0;
+
+    // Memory for non-secure stack (may be a fiber)
+    if (g_pDmpThread->pprcVM != 0)
+    {
+        if (dwFileSpaceLeft != 0)
+        {
+            // If the thread does not have a VM, then it is a NK.EXE/kernel only thread and will not
+            // have a non-secure stack / tlsNonSecure.
+         
+            if (OsAxsReadMemory(&dwStackBase, g_pDmpThread->pprcVM,
+                                &g_pDmpThread->tlsNonSecure[PRETLS_STACKBASE], sizeof(dwStackBase)) == sizeof(dwStackBase) &&
+                OsAxsReadMemory(&dwStackBound, g_pDmpThread->pprcVM,
+                                &g_pDmpThread->tlsNonSecure[PRETLS_STACKBOUND], sizeof(dwStackBound)) == sizeof(dwStackBound))
+            {
+                BOOL WriteNonSecureStack = TRUE;
+
+                if (dwStackBase == g_pDmpThread->dwOrigBase)
+                {
+                    // Normal thread
+                    dwStackSize = g_pDmpThread->dwOrigStkSize;
+                }
+                else
+                {
+                    // Fiber thread
+                    if (OsAxsReadMemory(&dwStackSize, g_pDmpThread->pprcVM,
+                            &g_pDmpThread->tlsNonSecure[PRETLS_STACKSIZE], sizeof(dwStackSize)) != sizeof(dwStackSize))
+                    {
+                        DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  Thread %08X failed to read tlsNonSecure(%08X) in VM(%08X) for fiber\r\n", g_pDmpThread,
+                                    g_pDmpThread->tlsNonSecure, g_pDmpThread->pprcVM));
+                        WriteNonSecureStack = FALSE;
+                    }
+                    else
+                    {
+                        KD_ASSERT(dwStackSize == g_pDmpThread->pprcOwner->e32.e32_stackmax);
+                    }
+                }
+
+                if (WriteNonSecureStack)
+                {
+                    dwStackTop = (dwStackBase + dwStackSize);
+
+                    // Save the stack between the Bound and Top
+                    dwMemoryStart = dwStackBound;
+                    dwMemorySize = dwStackTop - dwStackBound;
+
+                    // Limit memory size to amount of file space left
+                    if (dwMemorySize > dwFileSpaceLeft)
+                    {
+                        DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!MemoryAddThreadStack: Limiting Non-secure Stack memory to fit in dump file -> Old Size=0x%08X, New Size=0x%08X\r\n", dwMemorySize, dwFileSpaceLeft));
+                        dwMemorySize = dwFileSpaceLeft;
+                    }
+
+                    DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  DwDmpGen!MemoryAddThreadStack: Add Non-secure Stack memory\r\n"));
+
+                    hRes = MemoryBlocksAdd(g_pDmpThread->pprcVM, dwMemoryStart, dwMemorySize, VIRTUAL_MEMORY, fWrite);
+                    if (FAILED(hRes))
+                    {
+                        DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!MemoryAddThreadStack: MemoryBlocksAdd failed adding non-secure Stack memory, hRes=0x%08X\r\n", hRes));
+                        goto Exit;
+                    }
+                }
+            }
+            else
+            {
+                DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  Thread %08X failed to read tlsNonSecure(%08X) in VM(%08X)\r\n", g_pDmpThread,
+                            g_pDmpThread->tlsNonSecure, g_pDmpThread->pprcVM));
+            }
+        }
+        else
+        {
+            DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  No space left for Non-secure Stack memory, skip\r\n"));
+        }
+    }
+    else
+    {
+        DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  Thread %08X does not have a VM\r\n", g_pDmpThread));
+    }
+
+    if (g_pDmpThread->tlsNonSecure != g_pDmpThread->tlsSecure)
+    {
+        // Calculate new File space left to limit size of secure stack
+        // We don't simply add the previous memory block size, since it may have been
+        // combined with another, so we work it out again from the begining
+        
+        // Calculate offset to include Memory List header and Memory descriptors 
+        dwFileOffsetEstimate = dwFileOffset + 
+                               (sizeof(CEDUMP_MEMORY_LIST) * 2) + // Virtual + Physical list
+                               (sizeof(CEDUMP_MEMORY_DESCRIPTOR) * (g_dwMemoryVirtualBlocksTotal+1)); // +1 for secure stack memory descriptor
+                               
+        // Calculate offset to include total memory added so far (This will now include the non-secure stack)                       
+        dwFileOffsetEstimate += g_dwMemoryVirtualSizeTotal;
+        
+        // Calculate file space left for adding secure stack memory 
+        dwFileSpaceLeft = (dwMaxFileSize > dwFileOffsetEstimate) ? dwMaxFileSize - dwFileOffsetEstimate : 0;
+
+        if (dwFileSpaceLeft != 0)
+        {
+            // Write the decriptor for secure stack (may be a fiber?)
+            dwStackBase = g_pDmpThread->tlsSecure[PRETLS_STACKBASE];
+            dwStackBound = g_pDmpThread->tlsSecure[PRETLS_STACKBOUND]; // Memory is commited to this point
+
+            // Secure stack size is always fixed
+            dwStackSize = KRN_STACK_SIZE;
+            
+            dwStackTop = (dwStackBase + dwStackSize);
+
+            // Save the stack between the Bound and Top
+            if (dwStackBound)
+            {
+                dwMemoryStart = dwStackBound;
+                dwMemorySize = dwStackTop - dwStackBound;
+            }
+            else
+            {
+                dwMemoryStart = dwStackBase;
+                dwMemorySize  = dwStackSize;
+            }
+
+            // Limit memory size to amount of file space left
+            if (dwMemorySize > dwFileSpaceLeft)
+            {
+                DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!MemoryAddThreadStack: Limiting Secure Stack memory to fit in dump file -> Old Size=0x%08X, New Size=0x%08X\r\n", dwMemorySize, dwFileSpaceLeft));
+                dwMemorySize = dwFileSpaceLeft;
+            }
+
+            DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  DwDmpGen!MemoryAddThreadStack: Add Secure Stack memory\r\n"));
+
+            PPROCESS SecureStackVM;
+            if (dwMemoryStart < VM_KMODE_BASE)
+            {
+                DEBUGGERMSG (OXZONE_ALERT, (L"  DwDmpGen!MemoryAddThreadStack: Secure Stack for thread in user mode?\r\n"));
+                SecureStackVM = g_pDmpThread->pprcVM;
+            }
+            else
+            {
+                SecureStackVM = g_pprcNK;
+            }
+            
+            hRes = MemoryBlocksAdd (SecureStackVM, dwMemoryStart, dwMemorySize, VIRTUAL_MEMORY, fWrite);
+            if (FAILED(hRes))
+            {
+                DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!MemoryAddThreadStack: MemoryBlocksAdd failed adding secure Stack memory, hRes=0x%08X\r\n", hRes));
+                goto Exit;
+            }
+        }
+        else
+        {
+            DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  No space left for Secure Stack memory, skip\r\n"));
+        }
+    }
+
+    hRes = S_OK;
+
+Exit:
+
+    DEBUGGERMSG(OXZONE_DWDMPGEN,(L"--DwDmpGen!MemoryAddThreadStack: Leave, hRes=0x%08X\r\n", hRes));
+    return hRes;
+}
+
 /*----------------------------------------------------------------------------
     WriteCeStreamMemoryVirtualList
 
@@ -3346,11 +3778,8 @@ static HRESULT WriteCeStreamMemoryVirtualList(CEDUMP_TYPE ceDumpType, MINIDUMP_D
     BOOL fCurrentProcessHeap = FALSE;
     BOOL fAllVirtualMemory = FALSE;
     BOOL fKData = FALSE;
-    DWORD dwStackBase, dwStackSize, dwStackBound, dwStackTop;
     DWORD dwMemoryIPBefore;
     DWORD dwMemoryIPAfter;
-    DWORD dwFileOffsetEstimate;
-    DWORD dwFileSpaceLeft; 
     DWORD dwMaxFileSize = (-1);
 
     DEBUGGERMSG(OXZONE_DWDMPGEN,(L"++DwDmpGen!WriteCeStreamMemoryVirtualList: Enter\r\n"));
@@ -3411,7 +3840,27 @@ static HRESULT WriteCeStreamMemoryVirtualList(CEDUMP_TYPE ceDumpType, MINIDUMP_D
 
     if (!fWrite)
     {
-        if (fCurrentProcessHeap)
+        if (g_fDumpPriority)
+        {
+            // Fill the dump by priority: the faulting thread's stacks first, then the faulting process, then 
+            // everything else. MemoryBlocksAdd trims what doesn't fit in the space left for virtual memory,
+            // so OptimizeDumpFileContents does not have to drop whole parts of the dump.
+            dwMaxFileSize = dwMaxDumpFileSize;
+            g_dwMemoryVirtualBudget = (*pdwFileOffset) + ((sizeof(CEDUMP_MEMORY_LIST) + CEDUMP_ALIGNMENT) * 2); // Virtual + Physical list
+            g_dwMemoryVirtualBudget = (dwMaxFileSize > g_dwMemoryVirtualBudget) ? (dwMaxFileSize - g_dwMemoryVirtualBudget) : 0;
+
+            if (fCurrentThreadStackMemory)
+            {
+                hRes = MemoryAddThreadStack(*pdwFileOffset, dwMaxFileSize, fWrite);
+                if (FAILED(hRes))
+                {
+                    DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteCeStreamMemoryVirtualList: MemoryAddThreadStack failed adding Stack memory, hRes=0x%08X\r\n", hRes));
+                    goto Exit;
+                }
+            }
+        }
+
+        if (fCurrentProcessHeap && !g_fDumpPriority)
         {
             hRes = MemoryAddProcessHeap(g_pDmpProc, fWrite);
             if (FAILED(hRes))
@@ -3459,172 +3908,28 @@ static HRESULT WriteCeStreamMemoryVirtualList(CEDUMP_TYPE ceDumpType, MINIDUMP_D
         // **********************************************************************
         // *** The stack memory must be the last virtual memory added, since  ***
         // *** it may be sized down to fit in the Context dump size limit.    ***
-        // *** The only exception is fAllVirtualMemory, since it is only      ***
-        // *** for complete dumps.                                            ***
+        // *** The only exceptions are fAllVirtualMemory, since it is only    ***
+        // *** for complete dumps, and g_fDumpPriority, which added the stack ***
+        // *** first and trims everything after it.                           ***
         // **********************************************************************
 
-        if (fCurrentThreadStackMemory)
+        if (fCurrentThreadStackMemory && !g_fDumpPriority)
         {
-            
-            // Calculate offset to include Memory List header and Memory descriptors 
-            dwFileOffsetEstimate = (*pdwFileOffset) + 
-                                   (sizeof(CEDUMP_MEMORY_LIST) * 2) + // Virtual + Physical list
-                                   (sizeof(CEDUMP_MEMORY_DESCRIPTOR) * (g_dwMemoryVirtualBlocksTotal+1)); // +1 for non-secure stack memory descriptor
-                                   
-            // Calculate offset to include total memory added so far                       
-            dwFileOffsetEstimate += g_dwMemoryVirtualSizeTotal;
-            
-            // Calculate file space left for adding non-secure stack memory 
-            dwFileSpaceLeft = (dwMaxFileSize > dwFileOffsetEstimate) ? dwMaxFileSize - dwFileOffsetEstimate : 0;
-
-            // Memory for non-secure stack (may be a fiber)
-            if (g_pDmpThread->pprcVM != 0)
-            {
-                if (dwFileSpaceLeft != 0)
-                {
-                    // If the thread does not have a VM, then it is a NK.EXE/kernel only thread and will not
-                    // have a non-secure stack / tlsNonSecure.
-                 
-                    if (OsAxsReadMemory(&dwStackBase, g_pDmpThread->pprcVM,
-                                        &g_pDmpThread->tlsNonSecure[PRETLS_STACKBASE], sizeof(dwStackBase)) == sizeof(dwStackBase) &&
-                        OsAxsReadMemory(&dwStackBound, g_pDmpThread->pprcVM,
-                                        &g_pDmpThread->tlsNonSecure[PRETLS_STACKBOUND], sizeof(dwStackBound)) == sizeof(dwStackBound))
-                    {
-                        BOOL WriteNonSecureStack = TRUE;
-
-                        if (dwStackBase == g_pDmpThread->dwOrigBase)
-                        {
-                            // Normal thread
-                            dwStackSize = g_pDmpThread->dwOrigStkSize;
-                        }
-                        else
-                        {
-                            // Fiber thread
-                            if (OsAxsReadMemory(&dwStackSize, g_pDmpThread->pprcVM,
-                                    &g_pDmpThread->tlsNonSecure[PRETLS_STACKSIZE], sizeof(dwStackSize)) != sizeof(dwStackSize))
-                            {
-                                DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  Thread %08X failed to read tlsNonSecure(%08X) in VM(%08X) for fiber\r\n", g_pDmpThread,
-                                            g_pDmpThread->tlsNonSecure, g_pDmpThread->pprcVM));
-                                WriteNonSecureStack = FALSE;
-                            }
-                            else
-                            {
-                                KD_ASSERT(dwStackSize == g_pDmpThread->pprcOwner->e32.e32_stackmax);
-                            }
-                        }
-
-                        if (WriteNonSecureStack)
-                        {
-                            dwStackTop = (dwStackBase + dwStackSize);
-
-                            // Save the stack between the Bound and Top
-                            dwMemoryStart = dwStackBound;
-                            dwMemorySize = dwStackTop - dwStackBound;
-
-                            // Limit memory size to amount of file space left
-                            if (dwMemorySize > dwFileSpaceLeft)
-                            {
-                                DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WriteCeStreamMemoryVirtualList: Limiting Non-secure Stack memory to fit in dump file -> Old Size=0x%08X, New Size=0x%08X\r\n", dwMemorySize, dwFileSpaceLeft));
-                                dwMemorySize = dwFileSpaceLeft;
-                            }
-
-                            DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  DwDmpGen!WriteCeStreamMemoryVirtualList: Add Non-secure Stack memory\r\n"));
-
-                            hRes = MemoryBlocksAdd(g_pDmpThread->pprcVM, dwMemoryStart, dwMemorySize, VIRTUAL_MEMORY, fWrite);
-                            if (FAILED(hRes))
-                            {
-                                DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WriteCeStreamMemoryVirtualList: MemoryBlocksAdd failed adding non-secure Stack memory, hRes=0x%08X\r\n", hRes));
-                                goto Exit;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  Thread %08X failed to read tlsNonSecure(%08X) in VM(%08X)\r\n", g_pDmpThread,
-                                    g_pDmpThread->tlsNonSecure, g_pDmpThread->pprcVM));
-                    }
-                }
-                else
-                {
-                    DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  No space left for Non-secure Stack memory, skip\r\n"));
-                }
-            }
-            else
+            hRes = MemoryAddThreadStack(*pdwFileOffset, dwMaxFileSize, fWrite);
+            if (FAILED(hRes))
             {
-                DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  Thread %08X does not have a VM\r\n", g_pDmpThread));
+                DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteCeStreamMemoryVirtualList: MemoryAddThreadStack failed adding Stack memory, hRes=0x%08X\r\n", hRes));
+                goto Exit;
             }
+        }
 
-            if (g_pDmpThread->tlsNonSecure != g_pDmpThread->tlsSecure)
+        if (fCurrentProcessHeap && g_fDumpPriority)
+        {
+            hRes = MemoryAddProcessHeap(g_pDmpProc, fWrite);
+            if (FAILED(hRes))
             {
-                // Calculate new File space left to limit size of secure stack
-                // We don't simply add the previous memory block size, since it may have been
-                // combined with another, so we work it out again from the begining
-                
-                // Calculate offset to include Memory List header and Memory descriptors 
-                dwFileOffsetEstimate = (*pdwFileOffset) + 
-                                       (sizeof(CEDUMP_MEMORY_LIST) * 2) + // Virtual + Physical list
-                                       (sizeof(CEDUMP_MEMORY_DESCRIPTOR) * (g_dwMemoryVirtualBlocksTotal+1)); // +1 for secure stack memory descriptor
-                                       
-                // Calculate offset to include total memory added so far (This will now include the non-secure stack)                       
-                dwFileOffsetEstimate += g_dwMemoryVirtualSizeTotal;
-                
-                // Calculate file space left for adding secure stack memory 
-                dwFileSpaceLeft = (dwMaxFileSize > dwFileOffsetEstimate) ? dwMaxFileSize - dwFileOffsetEstimate : 0;
-
-                if (dwFileSpaceLeft != 0)
-                {
-                    // Write the decriptor for secure stack (may be a fiber?)
-                    dwStackBase = g_pDmpThread->tlsSecure[PRETLS_STACKBASE];
-                    dwStackBound = g_pDmpThread->tlsSecure[PRETLS_STACKBOUND]; // Memory is commited to this point
-
-                    // Secure stack size is always fixed
-                    dwStackSize = KRN_STACK_SIZE;
-                    
-                    dwStackTop = (dwStackBase + dwStackSize);
-
-                    // Save the stack between the Bound and Top
-                    if (dwStackBound)
-                    {
-                        dwMemoryStart = dwStackBound;
-                        dwMemorySize = dwStackTop - dwStackBound;
-                    }
-                    else
-                    {
-                        dwMemoryStart = dwStackBase;
-                        dwMemorySize  = dwStackSize;
-                    }
-
-                    // Limit memory size to amount of file space left
-                    if (dwMemorySize > dwFileSpaceLeft)
-                    {
-                        DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WriteCeStreamMemoryVirtualList: Limiting Secure Stack memory to fit in dump file -> Old Size=0x%08X, New Size=0x%08X\r\n", dwMemorySize, dwFileSpaceLeft));
-                        dwMemorySize = dwFileSpaceLeft;
-                    }
-
-                    DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  DwDmpGen!WriteCeStreamMemoryVirtualList: Add Secure Stack memory\r\n"));
-
-                    PPROCESS SecureStackVM;
-                    if (dwMemoryStart < VM_KMODE_BASE)
-                    {
-                        DEBUGGERMSG (OXZONE_ALERT, (L"  DwDmpGen!WriteCeStreamMemoryVirtualList: Secure Stack for thread in user mode?\r\n"));
-                        SecureStackVM = g_pDmpThread->pprcVM;
-                    }
-                    else
-                    {
-                        SecureStackVM = g_pprcNK;
-                    }
-                    
-                    hRes = MemoryBlocksAdd (SecureStackVM, dwMemoryStart, dwMemorySize, VIRTUAL_MEMORY, fWrite);
-                    if (FAILED(hRes))
-                    {
-                        DEBUGGERMSG(OXZONE_ALERT, (L"  DwDmpGen!WriteCeStreamMemoryVirtualList: MemoryBlocksAdd failed adding secure Stack memory, hRes=0x%08X\r\n", hRes));
-                        goto Exit;
-                    }
-                }
-                else
-                {
-                    DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  No space left for Secure Stack memory, skip\r\n"));
-                }
+                DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteCeStreamMemoryVirtualList: MemoryAddProcessHeap failed adding Process Heap memory, hRes=0x%08X\r\n", hRes));
+                goto Exit;
             }
         }
         
@@ -3650,6 +3955,8 @@ static HRESULT WriteCeStreamMemoryVirtualList(CEDUMP_TYPE ceDumpType, MINIDUMP_D
 
 Exit:
 
+    g_dwMemoryVirtualBudget = (-1);
+
     DEBUGGERMSG(OXZONE_DWDMPGEN,(L"--DwDmpGen!WriteCeStreamMemoryVirtualList: Leave, hRes=0x%08X\r\n", hRes));
     return hRes;
 }
@@ -4298,41 +4605,100 @@ Exit:
     return hRes;
 }
 
+/*----------------------------------------------------------------------------
+    CompressedContentsSize
+
+    Size of dump file contents to aim for when the compressed dump must fit
+    in dwMaxDumpFileSize. With dwCompressRatio of 1 the contents always fit,
+    since a block that doesn't compress is stored as is.
+----------------------------------------------------------------------------*/
+static DWORD CompressedContentsSize(DWORD dwMaxDumpFileSize, DWORD dwCompressRatio)
+{
+    DWORD dwOverhead;
+
+    if (dwCompressRatio > 1)
+    {
+        return (dwMaxDumpFileSize > (DWORD)(-1) / dwCompressRatio) ? (DWORD)(-1) : (dwMaxDumpFileSize * dwCompressRatio);
+    }
+
+    dwOverhead = sizeof(CEDUMP_COMPRESSED_HEADER) + (((dwMaxDumpFileSize / CEDUMP_COMPRESSED_BLOCK_SIZE) + 1) * sizeof(CEDUMP_COMPRESSED_BLOCK));
+    return (dwMaxDumpFileSize > dwOverhead) ? (dwMaxDumpFileSize - dwOverhead) : 0;
+}
+
 /*----------------------------------------------------------------------------
     WriteDumpFile
 
     Write out the entire dump file.
+
+    A compressed dump is first sized assuming COMPRESSED_RATIO_MAX, and
+    written again with half the ratio each time it doesn't fit.
 ----------------------------------------------------------------------------*/
 static HRESULT WriteDumpFile(CEDUMP_TYPE ceDumpType, DWORD dwMaxDumpFileSize, BOOL fOnTheFly)
 {
     HRESULT hRes = E_FAIL;
     DWORD dwFileOffset = 0;
+    CEDUMP_TYPE ceDumpTypeRequested = ceDumpType;
+    DWORD dwCompressRatio = g_fDumpCompressed ? COMPRESSED_RATIO_MAX : 1;
+    DWORD dwMaxContentsSize;
 
     DEBUGGERMSG(OXZONE_DWDMPGEN,(L"++DwDmpGen!WriteDumpFile: Enter\r\n"));
 
-    // Optimize dump file contents, this may change the type
-    hRes = OptimizeDumpFileContents(&ceDumpType, dwMaxDumpFileSize);
-    if (FAILED(hRes))
-    {
-        DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteDumpFile: OptimizeDumpFileContents failed, hRes=0x%08X\r\n", hRes));
-    }
-    else
+    do
     {
-        // Write dump file contents (Call write routine with fWrite=TRUE)
-        dwFileOffset = 0;
-        hRes = WriteDumpFileContents(ceDumpType, &dwFileOffset, TRUE /* fWrite */, dwMaxDumpFileSize);
+        ceDumpType = ceDumpTypeRequested;
+        dwMaxContentsSize = dwMaxDumpFileSize;
+
+        if (g_fDumpCompressed)
+        {
+            dwMaxContentsSize = CompressedContentsSize(dwMaxDumpFileSize, dwCompressRatio);
+            DEBUGGERMSG(OXZONE_DWDMPGEN,(L"  DwDmpGen!WriteDumpFile: Compressed dump, Ratio=%u, Max Contents Size=%u\r\n", dwCompressRatio, dwMaxContentsSize));
+            CompressStart(dwMaxDumpFileSize);
+        }
+        dwCompressRatio /= 2;
+
+        // Optimize dump file contents, this may change the type
+        hRes = OptimizeDumpFileContents(&ceDumpType, dwMaxContentsSize);
         if (FAILED(hRes))
         {
-            DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteDumpFile: WriteDumpFileContents failed, hRes=0x%08X\r\n", hRes));
+            DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteDumpFile: OptimizeDumpFileContents failed, hRes=0x%08X\r\n", hRes));
+        }
+        else
+        {
+            // Write dump file contents (Call write routine with fWrite=TRUE)
+            dwFileOffset = 0;
+            hRes = WriteDumpFileContents(ceDumpType, &dwFileOffset, TRUE /* fWrite */, dwMaxContentsSize);
+            if (FAILED(hRes))
+            {
+                DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteDumpFile: WriteDumpFileContents failed, hRes=0x%08X\r\n", hRes));
+            }
+            else if (g_fDumpCompressed)
+            {
+                hRes = CompressEnd();
+            }
         }
     }
+    while (FAILED(hRes) && g_fDumpCompressOverflow && dwCompressRatio);
     
     if (FAILED(hRes))
     {
         DBGRETAILMSG(1,(L"  DwDmpGen!WriteDumpFile: Watson fault - trying tiny dump instead\r\n"));
-        WriteTinyDumpFileContents();
+        if (g_fDumpCompressed)
+        {
+            CompressStart(dwMaxDumpFileSize);
+            if (SUCCEEDED(WriteTinyDumpFileContents()))
+            {
+                CompressEnd();
+            }
+        }
+        else
+        {
+            WriteTinyDumpFileContents();
+        }
     }
 
+    // Stop compressing, whatever state the last attempt left it in
+    g_fDumpCompressing = FALSE;
+
     if (fOnTheFly)
     {
         // Flush any remaining data to host
@@ -4366,6 +4732,7 @@ static HRESULT ReadSettings(CEDUMP_TYPE *pceDumpType, DWORD *pdwMaxDumpFileSize)
     HRESULT hRes = E_FAIL;
     DWORD dwMaxDumpFileSize;
     DWORD dwSettingsOffset;
+    DWORD dwSettingsSize;
     DWORD dwSettingsCRC;
 
     DEBUGGERMSG(OXZONE_DWDMPGEN,(L"++DwDmpGen!ReadSettings: Enter\r\n"));
@@ -4404,19 +4771,34 @@ static HRESULT ReadSettings(CEDUMP_TYPE *pceDumpType, DWORD *pdwMaxDumpFileSize)
     // The Watson dump settings are at the end of the reserved memory
     dwSettingsOffset = g_dwReservedMemorySize - WATSON_REGISTRY_SETTINGS_SIZE;
 
+    // Settings written by an older DwXfer.dll stop before dwDumpFlags, read those with no flags set
+    hRes = WatsonReadData(dwSettingsOffset, &dwSettingsSize, sizeof(DWORD), FALSE /* Don't calculate CRC */);
+    if (FAILED(hRes))
+    {
+        DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!ReadSettings: WatsonReadData failed reading dump settings size, hRes=0x%08X\r\n", hRes));
+        goto Exit;
+    }
+
+    if (WATSON_DUMP_SETTINGS_V1_SIZE != dwSettingsSize)
+    {
+        dwSettingsSize = sizeof(WATSON_DUMP_SETTINGS);
+    }
+
+    memset(&g_watsonDumpSettings, 0, sizeof(WATSON_DUMP_SETTINGS));
+
     // Reset the read offset and CRC
     g_dwReadOffset = dwSettingsOffset;
     g_dwReadCRC = 0;
 
     // Read in the dump settings
-    hRes = WatsonReadData(dwSettingsOffset, &g_watsonDumpSettings, sizeof(WATSON_DUMP_SETTINGS), TRUE /* Calculate CRC */);
+    hRes = WatsonReadData(dwSettingsOffset, &g_watsonDumpSettings, dwSettingsSize, TRUE /* Calculate CRC */);
     if (FAILED(hRes))
     {
         DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!ReadSettings: WatsonReadData failed reading dump settings, hRes=0x%08X\r\n", hRes));
         goto Exit;
     }
 
-    dwSettingsOffset += sizeof (WATSON_DUMP_SETTINGS);
+    dwSettingsOffset += dwSettingsSize;
     
     // Read in the CRC to make sure the settings are valid
     hRes = WatsonReadData(dwSettingsOffset, &dwSettingsCRC, sizeof(DWORD), FALSE /* Don't calculate CRC */);
@@ -4427,10 +4809,10 @@ static HRESULT ReadSettings(CEDUMP_TYPE *pceDumpType, DWORD *pdwMaxDumpFileSize)
     }
 
     // Check if Header is correct size and CRC is valid
-    if ((dwSettingsCRC != g_dwReadCRC) || (g_watsonDumpSettings.dwSizeOfHeader != sizeof(WATSON_DUMP_SETTINGS)))
+    if ((dwSettingsCRC != g_dwReadCRC) || (g_watsonDumpSettings.dwSizeOfHeader != dwSettingsSize))
     {
         DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  DwDmpGen!ReadSettings: Dump Settings CRC or size failure!, Expected CRC=0x%08X, Actual CRC=0x%08X, Expected Size=%u, Actual Size=%u\r\n", 
-                                     dwSettingsCRC, g_dwReadCRC, sizeof(WATSON_DUMP_SETTINGS), g_watsonDumpSettings.dwSizeOfHeader));
+                                     dwSettingsCRC, g_dwReadCRC, dwSettingsSize, g_watsonDumpSettings.dwSizeOfHeader));
         g_dwLastError = ERROR_CRC;
         hRes = E_FAIL;
         goto Exit;
@@ -4438,8 +4820,8 @@ static HRESULT ReadSettings(CEDUMP_TYPE *pceDumpType, DWORD *pdwMaxDumpFileSize)
 
     DEBUGGERMSG(OXZONE_DWDMPGEN,(L"  DwDmpGen!ReadSettings: Dump Settings validated, CRC=0x%08X, Header Size=%u, Max Dump Size=%u\r\n", 
                                 dwSettingsCRC, g_watsonDumpSettings.dwSizeOfHeader, g_watsonDumpSettings.dwMaxDumpFileSize));
-    DEBUGGERMSG(OXZONE_DWDMPGEN,(L"  DwDmpGen!ReadSettings: Dump Settings validated, Dump CRC=0x%08X, Dump Size=%u\r\n", 
-                                g_watsonDumpSettings.dwDumpFileCRC, g_watsonDumpSettings.dwDumpWritten));
+    DEBUGGERMSG(OXZONE_DWDMPGEN,(L"  DwDmpGen!ReadSettings: Dump Settings validated, Dump CRC=0x%08X, Dump Size=%u, Dump Flags=0x%08X\r\n", 
+                                g_watsonDumpSettings.dwDumpFileCRC, g_watsonDumpSettings.dwDumpWritten, g_watsonDumpSettings.dwDumpFlags));
 
     if (!g_watsonDumpSettings.fDumpEnabled)
     {
@@ -4505,6 +4887,7 @@ static HRESULT WriteSettings()
 {
     HRESULT hRes = E_FAIL;
     DWORD dwSettingsOffset;
+    DWORD dwSettingsSize;
 
     DEBUGGERMSG(OXZONE_DWDMPGEN,(L"++DwDmpGen!WriteSettings: Enter\r\n"));
 
@@ -4525,19 +4908,22 @@ static HRESULT WriteSettings()
     // The Watson dump settings are at the end of the reserved memory
     dwSettingsOffset = g_dwReservedMemorySize - WATSON_REGISTRY_SETTINGS_SIZE;
 
+    // Write the settings back in the layout DwXfer.dll used, settings without dwDumpFlags stay that way
+    dwSettingsSize = (WATSON_DUMP_SETTINGS_V1_SIZE == g_watsonDumpSettings.dwSizeOfHeader) ? WATSON_DUMP_SETTINGS_V1_SIZE : sizeof(WATSON_DUMP_SETTINGS);
+
     // Reset the write offset and CRC
     g_dwWrittenOffset = dwSettingsOffset;
     g_dwWrittenCRC = 0;
 
     // Write the dump settings
-    hRes = WatsonWriteData(dwSettingsOffset, &g_watsonDumpSettings, sizeof(WATSON_DUMP_SETTINGS), TRUE /* Calculate CRC */);
+    hRes = WatsonWriteData(dwSettingsOffset, &g_watsonDumpSettings, dwSettingsSize, TRUE /* Calculate CRC */);
     if (FAILED(hRes))
     {
         DEBUGGERMSG(OXZONE_ALERT,(L"  DwDmpGen!WriteSettings: WatsonWriteData failed writing dump settings, hRes=0x%08X\r\n", hRes));
         goto Exit;
     }
 
-    dwSettingsOffset += sizeof (WATSON_DUMP_SETTINGS);
+    dwSettingsOffset += dwSettingsSize;
     
     // Write the CRC to make sure the settings are valid
     hRes = WatsonWriteData(dwSettingsOffset, &g_dwWrittenCRC, sizeof(DWORD), FALSE /* Don't calculate CRC */);
@@ -4574,6 +4960,10 @@ static HRESULT Initialize(CEDUMP_TYPE *pceDumpType, DWORD *pdwMaxDumpFileSize, B
     g_pDmpThread = pCurThread;
     g_pDmpProc = g_pKData->pCurPrc;
 
+    // Only a dump written to reserved memory can be compressed or filled by priority
+    g_fDumpCompressed = FALSE;
+    g_fDumpPriority = FALSE;
+
     if (fOnTheFly)
     {
         // This indicates the max we can write out, in this case the max size to send back to host
@@ -4587,6 +4977,9 @@ static HRESULT Initialize(CEDUMP_TYPE *pceDumpType, DWORD *pdwMaxDumpFileSize, B
             DEBUGGERMSG(OXZONE_DWDMPGEN, (L"  DwDmpGen!Initialize: ReadSettings failed, hRes=0x%08X\r\n", hRes));
             goto Exit;
         }
+
+        g_fDumpCompressed = (g_watsonDumpSettings.dwDumpFlags & WATSON_DUMP_FLAG_COMPRESSED) ? TRUE : FALSE;
+        g_fDumpPriority = (g_watsonDumpSettings.dwDumpFlags & WATSON_DUMP_FLAG_PRIORITY) ? TRUE : FALSE;
     }
     
     hRes = S_OK;
@@ -4650,8 +5043,17 @@ static HRESULT Shutdown(BOOL fOnTheFly)
     }
     else
     {
-        g_watsonDumpSettings.dwDumpWritten = g_dwWrittenOffset;
-        g_watsonDumpSettings.dwDumpFileCRC = g_dwWrittenCRC;
+        if (g_fDumpCompressed)
+        {
+            // DwXfer.dll copies out and checks what is in reserved memory, the expanded size and CRC are in the compressed header
+            g_watsonDumpSettings.dwDumpWritten = g_dwCompressedOffset;
+            g_watsonDumpSettings.dwDumpFileCRC = g_dwCompressedCRC;
+        }
+        else
+        {
+            g_watsonDumpSettings.dwDumpWritten = g_dwWrittenOffset;
+            g_watsonDumpSettings.dwDumpFileCRC = g_dwWrittenCRC;
+        }
 
         hRes = WriteSettings();
         if (FAILED(hRes))